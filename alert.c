@@ -1,112 +1,194 @@
 #include "structures.h"
 
-void push_alert(SharedState *state, AlertItem item)
+/*
+ * Analyzer shards hand alerts to the alert thread through a lock-free MPSC
+ * ring (ring.c). When the ring is full, push_alert applies the configured
+ * backpressure: wait for room, spill to a temporary file, or drop and count.
+ * Once anything has been spilled, later alerts follow it into the file until
+ * the alert thread has read it back, so each shard's alerts stay in order.
+ *
+ * The alert thread prints every alert and hands it to the alert log writer
+ * (sink.c), which batches file writes.
+ */
+
+void init_alerts(SharedState *state)
+{
+    mpsc_init(&state->alert_ring, sizeof(AlertItem), ALERT_QUEUE_CAP);
+    pthread_mutex_init(&state->spill_lock, NULL);
+    atomic_init(&state->alerts_spilled, 0);
+    atomic_init(&state->alerts_dropped, 0);
+    sink_open(&state->alert_sink, &state->cfg);
+    state->alert_sink.commit_hist = &state->alert_metrics.commit_ns;
+}
+
+void free_alerts(SharedState *state)
 {
-    pthread_mutex_lock(&state->lock);
+    mpsc_destroy(&state->alert_ring);
+    pthread_mutex_destroy(&state->spill_lock);
+    if (state->alert_spill)
+        fclose(state->alert_spill);
+    state->alert_spill = NULL;
+    sink_close(&state->alert_sink);
+}
 
-    if (state->aq_count < ALERT_QUEUE_CAP)
+/* Append to the spill file; returns 0 if it cannot be written */
+static int spill_alert(SharedState *state, const AlertItem *item)
+{
+    if (!state->alert_spill)
     {
-        state->alert_queue[state->aq_tail] = item;
-        state->aq_tail = (state->aq_tail + 1) % ALERT_QUEUE_CAP;
-        state->aq_count++;
-        pthread_cond_signal(&state->cond_alert);
+        state->alert_spill = tmpfile();
+        if (!state->alert_spill)
+        {
+            perror("tmpfile alert spill");
+            return 0;
+        }
     }
-    else
+
+    fseek(state->alert_spill, 0, SEEK_END);
+    if (fwrite(item, sizeof(*item), 1, state->alert_spill) != 1)
+        return 0;
+    state->spill_pending++;
+    atomic_fetch_add(&state->alerts_spilled, 1);
+    return 1;
+}
+
+/* Called by every analyzer shard */
+void push_alert(SharedState *state, AlertItem item)
+{
+    switch (state->cfg.alert_backpressure)
     {
-        fprintf(stderr, "[WARN] Alert queue full, dropping alert\n");
+    case BACKPRESSURE_SPILL:
+        pthread_mutex_lock(&state->spill_lock);
+        if (state->spill_pending > 0 || !mpsc_try_push(&state->alert_ring, &item))
+        {
+            if (!spill_alert(state, &item))
+                atomic_fetch_add(&state->alerts_dropped, 1);
+        }
+        pthread_mutex_unlock(&state->spill_lock);
+        break;
+    case BACKPRESSURE_DROP:
+        if (!mpsc_try_push(&state->alert_ring, &item))
+            atomic_fetch_add(&state->alerts_dropped, 1);
+        break;
+    default:
+        mpsc_push(&state->alert_ring, &item);
+        break;
     }
+}
 
-    pthread_mutex_unlock(&state->lock);
+/* Called once, by the last shard to stop: the stop marker is never dropped
+ * or spilled, so it arrives after every alert already in the ring */
+void finish_alerts(SharedState *state)
+{
+    AlertItem stop = {.severity = ALERT_STOP};
+    mpsc_push(&state->alert_ring, &stop);
 }
 
 static void print_colored_alert(const AlertItem *a)
 {
+    if (log_level < LOG_LEVEL_INFO)
+        return;
+
     /* Color codes for terminal */
     const char *colors[] = {"\033[0m", "\033[33m", "\033[31m", "\033[1;31m"};
     const char *reset = "\033[0m";
 
-    printf("\n%s", colors[a->severity]);
-    printf("╔════════════════════════════════════════════╗\n");
-    printf("║                 ALERT                      ║\n");
-    printf("╠════════════════════════════════════════════╣\n");
+    char user_line[64] = "";
     if (a->user_id != -1)
     {
-        printf("║ User:     %-30d ║\n", a->user_id);
+        snprintf(user_line, sizeof(user_line), "║ User:     %-30d ║\n", a->user_id);
     }
-    printf("║ IP:       %-30s ║\n", a->ip_address);
-    printf("║ Score:    %-30d ║\n", a->score);
-    printf("║ Severity: %-30s ║\n", severity_str(a->severity));
-    printf("╚════════════════════════════════════════════╝%s\n\n", reset);
+
+    /* One record, so the box is never split by other output */
+    log_info("\n%s"
+             "╔════════════════════════════════════════════╗\n"
+             "║                 ALERT                      ║\n"
+             "╠════════════════════════════════════════════╣\n"
+             "%s"
+             "║ IP:       %-30s ║\n"
+             "║ Score:    %-30d ║\n"
+             "║ Severity: %-30s ║\n"
+             "╚════════════════════════════════════════════╝%s\n\n",
+             colors[a->severity], user_line, a->ip_address, a->score,
+             severity_str(a->severity), reset);
 }
 
-static void write_alert_to_file(const AlertItem *a)
+static void emit_alert(SharedState *state, const AlertItem *a)
 {
-    FILE *fp = fopen("alert_log.txt", "a");
-    if (!fp)
-    {
-        perror("fopen alert_log.txt");
-        return;
-    }
+    /* Console box (log level info and up) */
+    print_colored_alert(a);
 
-    time_t t = a->timestamp;
-    struct tm *tm_info = localtime(&t);
-    char timebuf[26];
-    strftime(timebuf, 26, "%Y-%m-%d %H:%M:%S", tm_info);
+    /* Log file (buffered; severities below cfg.alert_min_severity skipped) */
+    sink_write(&state->alert_sink, a);
 
-    fprintf(fp, "[%s] ", timebuf);
-    if (a->user_id != -1)
+    if (a->tick_ns)
+        hist_record(&state->alert_metrics.latency_ns, now_ns() - a->tick_ns);
+    counter_add(&state->alert_metrics.emitted, 1);
+}
+
+/* Take the spill file over and read it back; shards that spill meanwhile
+ * start a new one. Returns the number of alerts read. */
+static long drain_spill(SharedState *state)
+{
+    pthread_mutex_lock(&state->spill_lock);
+    FILE *fp = state->alert_spill;
+    long drained = state->spill_pending;
+    state->alert_spill = NULL;
+    state->spill_pending = 0;
+    pthread_mutex_unlock(&state->spill_lock);
+
+    if (!fp)
+        return 0;
+
+    AlertItem buf[64];
+    size_t n;
+    rewind(fp);
+    while ((n = fread(buf, sizeof(AlertItem), 64, fp)) > 0)
     {
-        fprintf(fp, "User: %d | ", a->user_id);
+        for (size_t i = 0; i < n; i++)
+            emit_alert(state, &buf[i]);
     }
-    fprintf(fp, "IP: %s | Score: %d | Severity: %s\n",
-            a->ip_address, a->score, severity_str(a->severity));
-
     fclose(fp);
+    return drained;
 }
 
+#define ALERT_BATCH 64
+
 void *alert_thread(void *arg)
 {
     SharedState *state = (SharedState *)arg;
+    AlertItem batch[ALERT_BATCH];
+    int stopped = 0;
 
-    while (1)
+    while (!stopped)
     {
-        pthread_mutex_lock(&state->lock);
-
-        /* Wait for alerts or shutdown */
-        while (state->aq_count == 0 && !state->analyzer_done)
-        {
-            pthread_cond_wait(&state->cond_alert, &state->lock);
-        }
-
-        /* Process all queued alerts */
-        while (state->aq_count > 0)
+        /* Spilled alerts were pushed after everything in the ring, and
+         * nothing new enters the ring while the file is non-empty, so the
+         * file is read back only once the ring has run dry. Only then is
+         * it safe to sleep. */
+        size_t n = mpsc_try_pop_batch(&state->alert_ring, batch, ALERT_BATCH);
+        if (n == 0)
         {
-            AlertItem a = state->alert_queue[state->aq_head];
-            state->aq_head = (state->aq_head + 1) % ALERT_QUEUE_CAP;
-            state->aq_count--;
-
-            pthread_mutex_unlock(&state->lock);
-
-            /* Print to console (always) */
-            print_colored_alert(&a);
-
-            /* Write critical alerts to file */
-            if (a.severity >= 3)
-            {
-                write_alert_to_file(&a);
-            }
-
-            pthread_mutex_lock(&state->lock);
+            if (drain_spill(state) > 0)
+                continue;
+            /* Nothing left to group with: write out what is buffered
+             * rather than hold it while asleep */
+            sink_commit(&state->alert_sink);
+            n = mpsc_pop_batch(&state->alert_ring, batch, ALERT_BATCH);
         }
 
-        if (state->analyzer_done && state->aq_count == 0)
+        for (size_t i = 0; i < n; i++)
         {
-            pthread_mutex_unlock(&state->lock);
-            break;
+            if (batch[i].severity == ALERT_STOP)
+                stopped = 1;
+            else
+                emit_alert(state, &batch[i]);
         }
-
-        pthread_mutex_unlock(&state->lock);
+        sink_commit_due(&state->alert_sink);
     }
 
+    /* Whatever was spilled behind the stop marker */
+    drain_spill(state);
+    sink_commit(&state->alert_sink);
     return NULL;
 }
\ No newline at end of file
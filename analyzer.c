@@ -5,196 +5,254 @@ int compute_score(EntityStats *e);
 int compute_ip_score(IPStats *ip);
 
 /* Evaluate user for alerts */
-static void evaluate_user(SharedState *state, EntityStats *user)
+static void evaluate_user(Shard *shard, EntityStats *user)
 {
     if (!user)
         return;
 
+    refresh_distinct_counts(shard, user);
     int score = compute_score(user);
     user->current_score = score;
+    heap_update(&shard->user_heap, &user->heap_pos, (uint32_t)user->user_id, score);
 
-    /* Always print user stats */
-    printf("[USER %d] score=%d, failed=%d, resources=%d, ips=%d, last_alert=%d\n",
-           user->user_id, score, user->failed_attempts,
-           user->resource_count, user->ip_count, user->last_alert_score);
+    log_debug("[USER %d] score=%d, failed=%d, resources=%d, ips=%d, last_alert=%d\n",
+              user->user_id, score, user->failed_attempts,
+              user->resource_count, user->ip_count, user->last_alert_score);
 
     /* Check if thresholds are exceeded */
     int threshold_met = 0;
     if (user->failed_attempts >= THRESH_FAILED_IP)
     {
-        printf("  └─ FAILED threshold met: %d >= %d\n", user->failed_attempts, THRESH_FAILED_IP);
+        log_debug("  └─ FAILED threshold met: %d >= %d\n", user->failed_attempts, THRESH_FAILED_IP);
         threshold_met = 1;
     }
     if (user->resource_count >= THRESH_RESOURCES)
     {
-        printf("  └─ RESOURCE threshold met: %d >= %d\n", user->resource_count, THRESH_RESOURCES);
+        log_debug("  └─ RESOURCE threshold met: %d >= %d\n", user->resource_count, THRESH_RESOURCES);
         threshold_met = 1;
     }
     if (user->ip_count >= THRESH_IPS)
     {
-        printf("  └─ IP threshold met: %d >= %d\n", user->ip_count, THRESH_IPS);
+        log_debug("  └─ IP threshold met: %d >= %d\n", user->ip_count, THRESH_IPS);
         threshold_met = 1;
     }
 
     if (threshold_met)
     {
         int severity = severity_from_score(score);
-        printf("  └─ Threshold met! severity=%d, score=%d, last_alert=%d\n",
-               severity, score, user->last_alert_score);
+        log_debug("  └─ Threshold met! severity=%d, score=%d, last_alert=%d\n",
+                  severity, score, user->last_alert_score);
 
         /* Alert if severity is at least SUSPICIOUS and score changed */
         if (severity >= 1 && score != user->last_alert_score)
         {
-            printf("  └─ 🔔 TRIGGERING ALERT for user %d!\n", user->user_id);
+            log_debug("  └─ 🔔 TRIGGERING ALERT for user %d!\n", user->user_id);
 
             AlertItem item = {
                 .user_id = user->user_id,
                 .score = score,
                 .severity = severity,
-                .timestamp = time(NULL)};
+                .timestamp = shard->watermark,
+                .tick_ns = shard->metrics.tick_ns};
 
-            if (user->ip_count > 0 && user->ip_refs != NULL)
-            {
-                strncpy(item.ip_address, user->ip_refs[0].ip, 39);
-            }
-            else
-            {
-                strncpy(item.ip_address, "0.0.0.0", 39);
-            }
-            item.ip_address[39] = '\0';
+            snprintf(item.ip_address, sizeof(item.ip_address), "%s",
+                     intern_str(user->last_ip_id));
 
-            push_alert(state, item);
+            push_alert(shard->state, item);
             user->last_alert_score = score;
-            user->last_alert_time = time(NULL);
-            state->total_alerts_generated++;
+            user->last_alert_time = shard->watermark;
+            shard->alerts_generated++;
+            counter_add(&shard->metrics.alerts, 1);
         }
         else if (severity >= 1 && score == user->last_alert_score)
         {
-            printf("  └─ ⏸️  Alert suppressed (same score as last alert)\n");
+            log_debug("  └─ ⏸️  Alert suppressed (same score as last alert)\n");
         }
         else if (severity < 1)
         {
-            printf("  └─ ⏸️  Severity too low: %d (need >=1)\n", severity);
+            log_debug("  └─ ⏸️  Severity too low: %d (need >=1)\n", severity);
         }
     }
 }
 
 /* Evaluate IP for alerts */
-void evaluate_ip(SharedState *state, IPStats *ip)
+void evaluate_ip(Shard *shard, IPStats *ip)
 {
     if (!ip)
         return;
 
+    int score = compute_ip_score(ip);
+    ip->current_score = score;
+    heap_update(&shard->ip_heap, &ip->heap_pos, ip->ip_id, score);
+
     if (ip->failed_attempts >= THRESH_FAILED_IP)
     {
-        int score = compute_ip_score(ip);
         int severity = severity_from_score(score);
 
-        printf("[IP %s] failed=%d, score=%d, severity=%d, last_alert=%d\n",
-               ip->ip_address, ip->failed_attempts, score, severity, ip->last_alert_score);
+        log_debug("[IP %s] failed=%d, score=%d, severity=%d, last_alert=%d\n",
+                  intern_str(ip->ip_id), ip->failed_attempts, score, severity, ip->last_alert_score);
 
         if (severity >= 1 && score != ip->last_alert_score)
         {
-            printf("  └─ 🔔 TRIGGERING IP ALERT for %s!\n", ip->ip_address);
+            log_debug("  └─ 🔔 TRIGGERING IP ALERT for %s!\n", intern_str(ip->ip_id));
 
             AlertItem item = {
                 .user_id = -1,
                 .score = score,
                 .severity = severity,
-                .timestamp = time(NULL)};
-            strncpy(item.ip_address, ip->ip_address, 39);
-            item.ip_address[39] = '\0';
+                .timestamp = shard->watermark,
+                .tick_ns = shard->metrics.tick_ns};
+            snprintf(item.ip_address, sizeof(item.ip_address), "%s", intern_str(ip->ip_id));
 
-            push_alert(state, item);
+            push_alert(shard->state, item);
             ip->last_alert_score = score;
-            ip->last_alert_time = time(NULL);
-            state->total_alerts_generated++;
+            ip->last_alert_time = shard->watermark;
+            shard->alerts_generated++;
+            counter_add(&shard->metrics.alerts, 1);
         }
     }
 }
 
-/* Analyzer thread */
-void *analyzer_thread(void *arg)
+/* Rescore the users and IPs whose stats changed since the last tick. An
+ * untouched entity would score exactly as before and so could not alert;
+ * the one exception is an HLL estimate, which drops when a sketch slice
+ * leaves the window, so in approximate mode every user is swept once each
+ * time that happens. Returns the number of entities scored. */
+static int run_evaluation(Shard *shard)
 {
-    SharedState *state = (SharedState *)arg;
-    time_t last_full_eval = 0;
+    log_debug("\n[DEBUG] 🔍 Shard %d running evaluation at %ld\n",
+              shard->id, (long)shard->watermark);
 
-    while (1)
+    int full_sweep = 0;
+    if (shard->state->cfg.approx_error > 0.0)
     {
-        pthread_mutex_lock(&state->lock);
+        int64_t epoch = hll_oldest_slice(shard->watermark);
+        full_sweep = epoch != shard->sketch_epoch;
+        shard->sketch_epoch = epoch;
+    }
 
-        /* Wait for new logs or shutdown */
-        while (state->head == NULL && !state->ingestion_done)
+    /* Evaluate changed users (or all of them) */
+    int user_count = 0;
+    EntityStats *user;
+    if (full_sweep)
+    {
+        size_t cursor = 0;
+        while ((user = (EntityStats *)map_next(&shard->user_map, &cursor)) != NULL)
         {
-            pthread_cond_wait(&state->cond_new_log, &state->lock);
+            user->dirty = 0;
+            evaluate_user(shard, user);
+            user_count++;
         }
-
-        if (state->ingestion_done && state->head == NULL)
+    }
+    else
+    {
+        for (user = shard->dirty_users; user; user = user->dirty_next)
         {
-            state->analyzer_done = 1;
-            pthread_cond_signal(&state->cond_alert);
-            pthread_mutex_unlock(&state->lock);
-            break;
+            user->dirty = 0;
+            evaluate_user(shard, user);
+            user_count++;
         }
+    }
+    shard->dirty_users = NULL;
 
-        /* Get current time */
-        time_t now = time(NULL);
+    if (user_count > 0)
+    {
+        log_debug("[DEBUG] 📊 Evaluated %d users\n", user_count);
+    }
 
-        /* Expire old logs */
-        expire_old_logs(state, now);
+    /* Evaluate changed IPs */
+    int ip_count = 0;
+    for (IPStats *ip = shard->dirty_ips; ip; ip = ip->dirty_next)
+    {
+        ip->dirty = 0;
+        evaluate_ip(shard, ip);
+        ip_count++;
+    }
+    shard->dirty_ips = NULL;
 
-        /* Evaluate every 2 seconds */
-        if (now - last_full_eval >= 2)
-        {
-            printf("\n[DEBUG] 🔍 Running evaluation at %ld\n", now);
+    if (ip_count > 0)
+    {
+        log_debug("[DEBUG] 📊 Evaluated %d IPs\n", ip_count);
+    }
+    log_debug("[DEBUG] ✅ Evaluation complete\n\n");
+    return user_count + ip_count;
+}
 
-            /* Evaluate all users */
-            int user_count = 0;
-            for (int i = 0; i < HASH_SIZE; i++)
-            {
-                EntityStats *user = state->user_map[i];
-                while (user)
-                {
-                    evaluate_user(state, user);
-                    user = user->next;
-                    user_count++;
-                }
-            }
+/* Bring the shard up to the global watermark carried by a control entry */
+static void catch_up(Shard *shard, time_t watermark)
+{
+    advance_watermark(shard, watermark);
+    expire_old_logs(shard, shard->watermark);
+}
 
-            if (user_count > 0)
-            {
-                printf("[DEBUG] 📊 Evaluated %d users\n", user_count);
-            }
+/* Analyzer worker, one per shard: folds the entries routed to it into the
+ * shard's window in arrival order and evaluates whenever ingestion
+ * broadcasts a tick (every EVAL_INTERVAL seconds of event time), so a
+ * replay gives the same detections no matter how fast it runs or how many
+ * shards share the work. */
+void *analyzer_thread(void *arg)
+{
+    Shard *shard = (Shard *)arg;
+    SharedState *state = shard->state;
+    int stopped = 0;
 
-            /* Evaluate all IPs */
-            pthread_mutex_lock(&state->ip_lock);
-            int ip_count = 0;
-            for (int i = 0; i < HASH_SIZE; i++)
+    while (!stopped)
+    {
+        size_t n = shard_take(shard);
+        size_t run = 0; /* Start of the current run of events */
+
+        for (size_t i = 0; i <= n && !stopped; i++)
+        {
+            /* Fold each run of events between control entries into the
+             * window in one go */
+            uint8_t route = i < n ? shard->batch[i].route : 0;
+            int control = (route & (ROUTE_TICK | ROUTE_STOP | ROUTE_CHECKPOINT)) != 0;
+            if (i == n || control)
             {
-                IPStats *ip = state->ip_map[i];
-                while (ip)
+                if (i > run)
                 {
-                    evaluate_ip(state, ip);
-                    ip = ip->next;
-                    ip_count++;
+                    uint64_t t0 = now_ns();
+                    window_push_batch(&shard->window, &shard->batch[run], i - run);
+                    apply_pending_logs(shard);
+                    hist_record(&shard->metrics.fold_ns, now_ns() - t0);
+                    counter_add(&shard->metrics.events_applied, i - run);
                 }
+                run = i + 1;
             }
-            pthread_mutex_unlock(&state->ip_lock);
+            if (!control)
+                continue;
 
-            if (ip_count > 0)
+            /* A tick evaluates at the new watermark; the stop does the same
+             * one last time over whatever is still inside the window */
+            if (route & (ROUTE_TICK | ROUTE_STOP))
             {
-                printf("[DEBUG] 📊 Evaluated %d IPs\n", ip_count);
+                uint64_t t0 = now_ns();
+                shard->metrics.tick_ns = shard->batch[i].sent_ns;
+                catch_up(shard, shard->batch[i].timestamp);
+                int scored = run_evaluation(shard);
+                topk_publish(shard);
+                hist_record(&shard->metrics.eval_ns, now_ns() - t0);
+                counter_add(&shard->metrics.evaluations, 1);
+                counter_add(&shard->metrics.entities_scored, (uint64_t)scored);
             }
-            printf("[DEBUG] ✅ Evaluation complete\n\n");
 
-            last_full_eval = now;
+            /* A checkpoint marker leaves the clock alone, so taking one does
+             * not change what the next tick sees */
+            if (route & ROUTE_CHECKPOINT)
+                checkpoint_shard(shard);
+            stopped = (route & ROUTE_STOP) != 0;
         }
+        atomic_store_explicit(&shard->metrics.window_entries, window_count(&shard->window),
+                              memory_order_relaxed);
+    }
 
-        pthread_mutex_unlock(&state->lock);
-
-        /* Don't spin too fast */
-        usleep(500000); /* 500ms */
+    /* The last shard to finish lets the alert thread drain and exit */
+    atomic_fetch_add(&state->total_alerts_generated, shard->alerts_generated);
+    if (atomic_fetch_sub(&state->shards_running, 1) == 1)
+    {
+        state->analyzer_done = 1;
+        finish_alerts(state);
     }
 
     return NULL;
-}
\ No newline at end of file
+}
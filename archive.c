@@ -0,0 +1,510 @@
+#include "structures.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * Binary columnar log archives.
+ *
+ * Replaying text logs means tokenizing and interning every field of every
+ * line again. An archive stores the same events already split into columns,
+ * in time-partitioned blocks, so ingestion decodes them with a few varint
+ * reads per event and interns each distinct IP and resource once per block.
+ *
+ * File: a 16-byte header ("CSARCH01", version, reserved), then blocks. A
+ * block holds the events of one ARCHIVE_BLOCK_SECONDS slice of event time,
+ * up to ARCHIVE_BLOCK_EVENTS of them, in input order. Its header carries
+ * the event count, the min/max timestamp and the payload size, so a reader
+ * can step over a block it does not want without touching its payload.
+ * The payload is:
+ *
+ *   dictionary     per string: varint length, bytes
+ *   timestamps     zigzag varint delta from the previous event
+ *                  (the first from base_time)
+ *   user ids       zigzag varint
+ *   IPs            varint index into the dictionary
+ *   resources      varint index into the dictionary
+ *   event/status   one byte each: event_type | status_code << 4
+ *
+ * IPs and resources share the dictionary, in order of first use (an
+ * event's IP before its resource). Decoding only looks it up; a string
+ * the table lacks is interned when its first kept event is published, as
+ * for text, so replaying the archive gives the same ids as the text.
+ * Blocks are independent, so the parse workers decode them in parallel the
+ * same way they parse chunks of a text file, and a block boundary is an
+ * exact resume point for checkpoints.
+ */
+
+#define ARCHIVE_MAGIC "CSARCH01"
+#define ARCHIVE_VERSION 1
+#define BLOCK_MAGIC "CSBK"
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t reserved;
+} ArchiveHeader;
+
+typedef struct
+{
+    char magic[4];
+    uint32_t count;
+    int64_t min_time;
+    int64_t max_time;
+    int64_t base_time;
+    uint32_t payload_bytes;
+    uint32_t dict_count; /* Strings in the dictionary */
+} BlockHeader;
+
+/* ─── Varints ─── */
+
+static uint8_t *put_varint(uint8_t *p, uint64_t v)
+{
+    while (v >= 0x80)
+    {
+        *p++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+static uint64_t zigzag(int64_t v)
+{
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static int64_t unzigzag(uint64_t v)
+{
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+/* Read one varint; -1 if it runs past end */
+static int get_varint(const uint8_t **pp, const uint8_t *end, uint64_t *out)
+{
+    const uint8_t *p = *pp;
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7)
+    {
+        if (p >= end)
+            return -1;
+        uint8_t b = *p++;
+        v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80))
+        {
+            *out = v;
+            *pp = p;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* ─── Reading ─── */
+
+int archive_is(const char *data, size_t size)
+{
+    return size >= sizeof(ArchiveHeader) && memcmp(data, ARCHIVE_MAGIC, 8) == 0;
+}
+
+size_t archive_first_block(void)
+{
+    return sizeof(ArchiveHeader);
+}
+
+/* Validate the block header at `pos` and describe the block */
+ParseResult archive_block_at(const char *data, size_t size, size_t pos, ArchiveBlock *blk)
+{
+    BlockHeader h;
+    if (size - pos < sizeof(h))
+        return PARSE_ERR_BAD_BLOCK;
+    memcpy(&h, data + pos, sizeof(h));
+    if (memcmp(h.magic, BLOCK_MAGIC, 4) != 0 || h.payload_bytes > size - pos - sizeof(h) ||
+        h.count > ARCHIVE_BLOCK_EVENTS || h.min_time > h.max_time)
+        return PARSE_ERR_BAD_BLOCK;
+
+    blk->count = h.count;
+    blk->min_time = (time_t)h.min_time;
+    blk->max_time = (time_t)h.max_time;
+    blk->start = pos;
+    blk->end = pos + sizeof(h) + h.payload_bytes;
+    return PARSE_OK;
+}
+
+/* Intern the dictionary, or defer it (see parse_log_line()); ids[i] is the
+ * id of its i-th string */
+static int read_dict(const uint8_t **pp, const uint8_t *end, uint32_t n, uint32_t *ids,
+                     InternDeferred *defer)
+{
+    for (uint32_t i = 0; i < n; i++)
+    {
+        uint64_t len;
+        if (get_varint(pp, end, &len) != 0 || len == 0 || len > MAX_FIELD_LEN ||
+            len > (uint64_t)(end - *pp))
+            return -1;
+        ids[i] = defer ? intern_defer(defer, (const char *)*pp, (size_t)len)
+                       : intern_bytes((const char *)*pp, (size_t)len);
+        *pp += len;
+    }
+    return 0;
+}
+
+/* Decode a block into out[0..blk->count). Thread-safe: only interns, or
+ * with `defer` set only looks up. */
+ParseResult archive_decode_block(const char *data, const ArchiveBlock *blk, LogEntry *out,
+                                 InternDeferred *defer)
+{
+    BlockHeader h;
+    memcpy(&h, data + blk->start, sizeof(h));
+    const uint8_t *p = (const uint8_t *)data + blk->start + sizeof(h);
+    const uint8_t *end = (const uint8_t *)data + blk->end;
+
+    /* Each dictionary entry takes at least two bytes */
+    if (h.dict_count > (size_t)(end - p) / 2)
+        return PARSE_ERR_BAD_BLOCK;
+    uint32_t *ids = (uint32_t *)malloc(sizeof(uint32_t) * ((size_t)h.dict_count + 1));
+    if (!ids)
+    {
+        perror("malloc archive dictionary");
+        exit(1);
+    }
+
+    ParseResult r = PARSE_ERR_BAD_BLOCK;
+    if (read_dict(&p, end, h.dict_count, ids, defer) != 0)
+        goto out;
+
+    uint64_t v;
+    int64_t ts = h.base_time;
+    for (uint32_t i = 0; i < h.count; i++)
+    {
+        if (get_varint(&p, end, &v) != 0)
+            goto out;
+        ts += unzigzag(v);
+        out[i].timestamp = (time_t)ts;
+    }
+    for (uint32_t i = 0; i < h.count; i++)
+    {
+        if (get_varint(&p, end, &v) != 0)
+            goto out;
+        out[i].user_id = (int)unzigzag(v);
+    }
+    for (uint32_t i = 0; i < h.count; i++)
+    {
+        if (get_varint(&p, end, &v) != 0 || v >= h.dict_count)
+            goto out;
+        out[i].ip_id = ids[v];
+    }
+    for (uint32_t i = 0; i < h.count; i++)
+    {
+        if (get_varint(&p, end, &v) != 0 || v >= h.dict_count)
+            goto out;
+        out[i].resource_id = ids[v];
+    }
+    if ((size_t)(end - p) != h.count)
+        goto out;
+    for (uint32_t i = 0; i < h.count; i++)
+    {
+        out[i].event_type = p[i] & 0x0f;
+        out[i].status_code = p[i] >> 4;
+        out[i].route = 0;
+    }
+    r = PARSE_OK;
+
+out:
+    free(ids);
+    return r;
+}
+
+/* ─── Writing ─── */
+
+typedef struct
+{
+    FILE *f;
+    LogEntry *events;
+    uint32_t count;
+    time_t slice; /* ARCHIVE_BLOCK_SECONDS slice the block started in */
+
+    /* Block dictionary: intern id -> index + 1 (0 = not in the block),
+     * reset through the id list after each block */
+    uint32_t *index;
+    uint32_t *ids;
+    uint32_t dict_count;
+    uint32_t index_cap;
+
+    uint8_t *buf;
+    size_t buf_cap;
+
+    unsigned long blocks;
+    unsigned long long events_total;
+    unsigned long long bytes;
+} ArchiveWriter;
+
+static void writer_fit_index(ArchiveWriter *w, uint32_t id)
+{
+    if (id < w->index_cap)
+        return;
+    uint32_t cap = w->index_cap ? w->index_cap : 4096;
+    while (cap <= id)
+        cap *= 2;
+    w->index = (uint32_t *)realloc(w->index, sizeof(uint32_t) * cap);
+    if (!w->index)
+    {
+        perror("realloc archive index");
+        exit(1);
+    }
+    memset(w->index + w->index_cap, 0, sizeof(uint32_t) * (cap - w->index_cap));
+    w->index_cap = cap;
+}
+
+/* Add an id to the block dictionary; returns the bytes it adds to the block */
+static size_t dict_add(ArchiveWriter *w, uint32_t id)
+{
+    if (w->index[id] != 0)
+        return 0;
+    w->ids[w->dict_count] = id;
+    w->index[id] = ++w->dict_count;
+    return strlen(intern_str(id)) + 2; /* MAX_FIELD_LEN fits a 2-byte varint */
+}
+
+static uint8_t *put_dict(uint8_t *p, const uint32_t *ids, uint32_t n)
+{
+    for (uint32_t i = 0; i < n; i++)
+    {
+        const char *s = intern_str(ids[i]);
+        size_t len = strlen(s);
+        p = put_varint(p, len);
+        memcpy(p, s, len);
+        p += len;
+    }
+    return p;
+}
+
+static int writer_flush(ArchiveWriter *w)
+{
+    if (w->count == 0)
+        return 0;
+
+    BlockHeader h = {0};
+    memcpy(h.magic, BLOCK_MAGIC, 4);
+    h.count = w->count;
+    h.base_time = w->events[0].timestamp;
+    h.min_time = h.max_time = h.base_time;
+
+    /* Dictionaries first: every value is then a small index */
+    size_t dict_bytes = 0;
+    for (uint32_t i = 0; i < w->count; i++)
+    {
+        const LogEntry *e = &w->events[i];
+        writer_fit_index(w, e->ip_id > e->resource_id ? e->ip_id : e->resource_id);
+        dict_bytes += dict_add(w, e->ip_id);
+        dict_bytes += dict_add(w, e->resource_id);
+        if (e->timestamp < h.min_time)
+            h.min_time = e->timestamp;
+        if (e->timestamp > h.max_time)
+            h.max_time = e->timestamp;
+    }
+    h.dict_count = w->dict_count;
+
+    /* Worst case: four 10-byte varints and the type byte per event */
+    size_t need = dict_bytes + (size_t)w->count * 41;
+    if (need > w->buf_cap)
+    {
+        w->buf = (uint8_t *)realloc(w->buf, need);
+        if (!w->buf)
+        {
+            perror("realloc archive block");
+            exit(1);
+        }
+        w->buf_cap = need;
+    }
+
+    uint8_t *p = put_dict(w->buf, w->ids, w->dict_count);
+    int64_t prev = h.base_time;
+    for (uint32_t i = 0; i < w->count; i++)
+    {
+        p = put_varint(p, zigzag((int64_t)w->events[i].timestamp - prev));
+        prev = w->events[i].timestamp;
+    }
+    for (uint32_t i = 0; i < w->count; i++)
+        p = put_varint(p, zigzag(w->events[i].user_id));
+    for (uint32_t i = 0; i < w->count; i++)
+        p = put_varint(p, w->index[w->events[i].ip_id] - 1);
+    for (uint32_t i = 0; i < w->count; i++)
+        p = put_varint(p, w->index[w->events[i].resource_id] - 1);
+    for (uint32_t i = 0; i < w->count; i++)
+        *p++ = (uint8_t)(w->events[i].event_type | w->events[i].status_code << 4);
+    h.payload_bytes = (uint32_t)(p - w->buf);
+
+    for (uint32_t i = 0; i < w->dict_count; i++)
+        w->index[w->ids[i]] = 0;
+    w->dict_count = 0;
+
+    w->blocks++;
+    w->events_total += w->count;
+    w->bytes += sizeof(h) + h.payload_bytes;
+    w->count = 0;
+    return fwrite(&h, sizeof(h), 1, w->f) == 1 &&
+                   fwrite(w->buf, 1, h.payload_bytes, w->f) == h.payload_bytes
+               ? 0
+               : -1;
+}
+
+/* Append one event, closing the block when it is full or when event time
+ * moves on to the next slice */
+static int writer_add(ArchiveWriter *w, const LogEntry *e)
+{
+    time_t slice = e->timestamp / ARCHIVE_BLOCK_SECONDS;
+    if (w->count == ARCHIVE_BLOCK_EVENTS || (w->count > 0 && slice > w->slice))
+    {
+        if (writer_flush(w) != 0)
+            return -1;
+    }
+    if (w->count == 0)
+        w->slice = slice;
+    w->events[w->count++] = *e;
+    return 0;
+}
+
+/* Parse the lines of text[..end) into the archive */
+static int convert_text(ArchiveWriter *w, const EngineConfig *cfg, const char *p,
+                        const char *end, int *errors, unsigned long long *out_of_range)
+{
+    int rc = 0;
+    while (p < end && rc == 0)
+    {
+        const char *nl = memchr(p, '\n', (size_t)(end - p));
+        const char *line_end = nl ? nl + 1 : end;
+        LogEntry e;
+        if (!is_ignorable_line(p, (size_t)(line_end - p)))
+        {
+            ParseResult r = parse_log_line(p, (size_t)(line_end - p), &e, NULL);
+            if (r != PARSE_OK)
+                errors[r]++;
+            else if (!in_time_range(cfg, e.timestamp))
+                (*out_of_range)++;
+            else
+                rc = writer_add(w, &e);
+        }
+        p = line_end;
+    }
+    return rc;
+}
+
+/* Convert the configured text inputs (plain or gzip) into one archive at
+ * cfg->archive_path. Events outside --from/--until are left out. Returns 0 on success. */
+int archive_convert(const EngineConfig *cfg)
+{
+    ArchiveWriter w = {0};
+    w.f = fopen(cfg->archive_path, "wb");
+    if (!w.f)
+    {
+        fprintf(stderr, "Cannot create %s: %s\n", cfg->archive_path, strerror(errno));
+        return -1;
+    }
+    w.events = (LogEntry *)malloc(sizeof(LogEntry) * ARCHIVE_BLOCK_EVENTS);
+    w.ids = (uint32_t *)malloc(sizeof(uint32_t) * 2 * ARCHIVE_BLOCK_EVENTS);
+    if (!w.events || !w.ids)
+    {
+        perror("malloc archive writer");
+        exit(1);
+    }
+
+    ArchiveHeader ah = {0};
+    memcpy(ah.magic, ARCHIVE_MAGIC, 8);
+    ah.version = ARCHIVE_VERSION;
+    int rc = fwrite(&ah, sizeof(ah), 1, w.f) == 1 ? 0 : -1;
+    w.bytes = sizeof(ah);
+
+    unsigned long long text_bytes = 0, out_of_range = 0;
+    int errors[PARSE_RESULT_COUNT] = {0};
+    for (int i = 0; i < input_total(cfg) && rc == 0; i++)
+    {
+        const char *path = input_path_at(cfg, i);
+        int fd = open(path, O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+        {
+            fprintf(stderr, "Cannot read %s\n", path);
+            if (fd >= 0)
+                close(fd);
+            rc = 1;
+            break;
+        }
+        if (st.st_size == 0)
+        {
+            close(fd);
+            continue;
+        }
+        const char *data = (const char *)mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED)
+        {
+            fprintf(stderr, "Cannot mmap %s: %s\n", path, strerror(errno));
+            rc = 1;
+            break;
+        }
+        if (archive_is(data, (size_t)st.st_size))
+        {
+            fprintf(stderr, "%s is already an archive\n", path);
+            munmap((void *)data, (size_t)st.st_size);
+            rc = 1;
+            break;
+        }
+        madvise((void *)data, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+        if (gzip_is(data, (size_t)st.st_size))
+        {
+            GzipReader *gz = gzip_open(data, (size_t)st.st_size, 0, 2);
+            GzipPiece piece;
+            while (rc == 0 && gzip_next(gz, &piece))
+            {
+                rc = convert_text(&w, cfg, piece.data, piece.data + piece.len, errors,
+                                  &out_of_range);
+                gzip_release(gz);
+            }
+            text_bytes += gzip_inflated(gz);
+            const char *err = gzip_error(gz);
+            if (err)
+            {
+                fprintf(stderr, "Cannot decompress %s: %s\n", path, err);
+                rc = 1;
+            }
+            gzip_close(gz);
+        }
+        else
+        {
+            rc = convert_text(&w, cfg, data, data + st.st_size, errors, &out_of_range);
+            text_bytes += (unsigned long long)st.st_size;
+        }
+        munmap((void *)data, (size_t)st.st_size);
+    }
+
+    /* rc: 0 = fine, 1 = an input could not be read (reported), -1 = write error */
+    if (rc == 0)
+        rc = writer_flush(&w);
+    if (fclose(w.f) != 0 && rc == 0)
+        rc = -1;
+    if (rc < 0)
+        fprintf(stderr, "Writing %s failed: %s\n", cfg->archive_path, strerror(errno));
+    if (rc != 0)
+        unlink(cfg->archive_path); /* No half-written archive */
+    else
+        printf("Archived %llu events into %s: %lu blocks, %.1f MB (%.0f%% of %.1f MB of text)\n",
+               w.events_total, cfg->archive_path, w.blocks, w.bytes / 1e6,
+               text_bytes ? 100.0 * (double)w.bytes / (double)text_bytes : 0.0, text_bytes / 1e6);
+    if (out_of_range > 0)
+        printf("  Left out %llu events outside the time range\n", out_of_range);
+    for (int r = 1; r < PARSE_RESULT_COUNT; r++)
+    {
+        if (errors[r] > 0)
+            printf("  Skipped %d malformed lines: %s\n", errors[r], parse_result_str((ParseResult)r));
+    }
+
+    free(w.events);
+    free(w.ids);
+    free(w.index);
+    free(w.buf);
+    return rc == 0 ? 0 : -1;
+}
@@ -0,0 +1,1901 @@
+#include "structures.h"
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <zlib.h>
+
+/*
+ * CodeShield microbenchmarks. Built from every engine source except main.c:
+ *   gcc -O2 -o bench bench.c alert.c analyzer.c archive.c checkpoint.c gzip.c hashmap.c hll.c ingestion.c intern.c listen.c log.c merge.c metrics.c pool.c refset.c ring.c scorer.c shard.c sink.c topk.c window.c -lpthread -lm -lz
+ *
+ *   ./bench parse [lines]   hand-written parser vs the original sscanf parser
+ *   ./bench window [events] ring-buffer window vs the old doubly linked list
+ *   ./bench crawler [ops]   per-user distinct sets vs the old linear arrays
+ *   ./bench maps [max]      entity map lookups from 1k up to max entities (10M)
+ *   ./bench shards [events] full analyzer replay on 1, 2, 4 and 8 shards
+ *   ./bench idle [max]      evaluation cost per tick with 10k up to max idle users (1M)
+ *   ./bench handoff [items] stage handoff: condvar queue vs SPSC/MPSC rings
+ *   ./bench batch [events]  analyzer replay with ingestion batch sizes 1 to 4096
+ *   ./bench sink [alerts]   alert log: fopen/fclose per alert vs the buffered sink
+ *   ./bench log [users]     debug logging of one sweep: off, inline printf, async
+ *   ./bench suite [events]  end-to-end runs of ./codeshield on ./generate_logs workloads
+ *   ./bench archive [events] text parsing vs binary archive decoding, and range skips
+ *   ./bench checkpoint [events] checkpoint cost in a run, and restart vs log replay
+ *   ./bench gzip [events]   ./codeshield on a .gz log vs the same log as plain text
+ *   ./bench merge [events]  one log vs the same events split into host files under --merge
+ *   ./bench listen [events] events pushed to ./codeshield --listen over TCP, syslog and UDP
+ *
+ * Every result is printed as one "name key=value ..." line so runs of two
+ * builds can be diffed directly.
+ */
+
+static volatile long sink; /* Keeps the optimizer from dropping the work */
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static unsigned int rng_state = 2463534242u;
+
+static unsigned int rng(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+/* Lines in the same shape generate_logs.c writes */
+static char *generate_lines(int count, size_t *out_len)
+{
+    static const char *events[] = {"LOGIN", "FILE_ACCESS", "API_CALL", "TRANSACTION"};
+    size_t cap = (size_t)count * 80 + 1;
+    char *buf = (char *)malloc(cap);
+    if (!buf)
+    {
+        perror("malloc bench lines");
+        exit(1);
+    }
+
+    size_t len = 0;
+    long t = 1708069200;
+    for (int i = 0; i < count; i++)
+    {
+        /* Users mostly stay on their home IP, like real traffic */
+        unsigned int user = rng() % 5000;
+        unsigned int host = (rng() % 10 == 0) ? rng() % 65536 : user;
+        len += (size_t)snprintf(buf + len, cap - len, "%ld, %u, 10.0.%u.%u, %s, res_%u, %s\n",
+                                t, user, host >> 8, host & 255,
+                                events[rng() % 4], rng() % 1000,
+                                (rng() % 20 == 0) ? "FAILED" : "SUCCESS");
+        t += rng() % 3;
+    }
+    *out_len = len;
+    return buf;
+}
+
+/* ─── Original parser (calloc + sscanf + memmove trim), kept for comparison ─── */
+typedef struct
+{
+    time_t timestamp;
+    int user_id;
+    char ip_address[40];
+    char event_type[16];
+    char resource_id[32];
+    char status_code[16];
+} LegacyLogEntry;
+
+static LegacyLogEntry *legacy_parse_log_line(const char *line)
+{
+    LegacyLogEntry *entry = (LegacyLogEntry *)calloc(1, sizeof(LegacyLogEntry));
+    if (!entry)
+    {
+        perror("calloc LogEntry");
+        exit(1);
+    }
+
+    long ts;
+    int n = sscanf(line, " %ld , %d , %39[^,] , %15[^,] , %31[^,] , %15[^\n]",
+                   &ts, &entry->user_id, entry->ip_address,
+                   entry->event_type, entry->resource_id, entry->status_code);
+    if (n < 6)
+    {
+        free(entry);
+        return NULL;
+    }
+    entry->timestamp = (time_t)ts;
+
+    char *fields[] = {entry->ip_address, entry->event_type,
+                      entry->resource_id, entry->status_code};
+    for (int i = 0; i < 4; i++)
+    {
+        char *p = fields[i];
+        while (*p == ' ')
+        {
+            memmove(p, p + 1, strlen(p));
+        }
+        size_t len = strlen(p);
+        while (len > 0 && (p[len - 1] == ' ' || p[len - 1] == '\n' || p[len - 1] == '\r'))
+            p[--len] = '\0';
+    }
+
+    return entry;
+}
+
+static void bench_parse(int count)
+{
+    size_t total;
+    char *buf = generate_lines(count, &total);
+    char line[256];
+
+    /* Original: fgets-style copy, then parse into a fresh calloc'd entry */
+    double t0 = now_sec();
+    int ok = 0;
+    for (const char *p = buf; p < buf + total;)
+    {
+        const char *nl = memchr(p, '\n', (size_t)(buf + total - p));
+        size_t len = (size_t)(nl - p) + 1;
+        memcpy(line, p, len);
+        line[len] = '\0';
+        LegacyLogEntry *e = legacy_parse_log_line(line);
+        if (e)
+        {
+            sink += e->user_id;
+            ok++;
+            free(e);
+        }
+        p = nl + 1;
+    }
+    double legacy = now_sec() - t0;
+    printf("parse/sscanf    lines=%d ok=%d ns_per_line=%.1f mlines_per_s=%.2f\n",
+           count, ok, legacy * 1e9 / count, count / legacy / 1e6);
+
+    /* New: parse in place into one reused entry, interning as it goes */
+    LogEntry entry;
+    t0 = now_sec();
+    ok = 0;
+    for (const char *p = buf; p < buf + total;)
+    {
+        const char *nl = memchr(p, '\n', (size_t)(buf + total - p));
+        size_t len = (size_t)(nl - p) + 1;
+        if (parse_log_line(p, len, &entry, NULL) == PARSE_OK)
+        {
+            sink += entry.user_id;
+            ok++;
+        }
+        p = nl + 1;
+    }
+    double fast = now_sec() - t0;
+    printf("parse/tokenizer lines=%d ok=%d ns_per_line=%.1f mlines_per_s=%.2f speedup=%.2fx\n",
+           count, ok, fast * 1e9 / count, count / fast / 1e6, legacy / fast);
+
+    free(buf);
+}
+
+/* Parse generated lines into a flat array of entries */
+static LogEntry *generate_entries(int count)
+{
+    size_t total;
+    char *buf = generate_lines(count, &total);
+    LogEntry *entries = (LogEntry *)malloc(sizeof(LogEntry) * count);
+    if (!entries)
+    {
+        perror("malloc bench entries");
+        exit(1);
+    }
+
+    int n = 0;
+    for (const char *p = buf; p < buf + total && n < count;)
+    {
+        const char *nl = memchr(p, '\n', (size_t)(buf + total - p));
+        if (parse_log_line(p, (size_t)(nl - p) + 1, &entries[n], NULL) == PARSE_OK)
+            n++;
+        p = nl + 1;
+    }
+    free(buf);
+    return entries;
+}
+
+/* ─── Window storage: the old pooled doubly linked list vs the ring ─── */
+typedef struct ListNode
+{
+    LogEntry entry;
+    struct ListNode *prev;
+    struct ListNode *next;
+} ListNode;
+
+static void bench_window(int count)
+{
+    LogEntry *entries = generate_entries(count);
+
+    /* List: insert at head, expire from tail, nodes from a pool */
+    ObjectPool pool;
+    pool_init(&pool, "list", sizeof(ListNode), 4096);
+    ListNode *head = NULL, *tail = NULL;
+
+    double t0 = now_sec();
+    for (int i = 0; i < count; i++)
+    {
+        ListNode *n = (ListNode *)pool_alloc(&pool);
+        n->entry = entries[i];
+        n->prev = NULL;
+        n->next = head;
+        if (head)
+            head->prev = n;
+        head = n;
+        if (!tail)
+            tail = n;
+    }
+    double list_insert = now_sec() - t0;
+
+    t0 = now_sec();
+    while (tail)
+    {
+        ListNode *old = tail;
+        sink += old->entry.user_id;
+        tail = old->prev;
+        if (tail)
+            tail->next = NULL;
+        else
+            head = NULL;
+        pool_free(&pool, old);
+    }
+    double list_expire = now_sec() - t0;
+    size_t list_bytes = pool.obj_size;
+    pool_destroy(&pool);
+
+    printf("window/list  events=%d bytes_per_event=%zu insert_mev_per_s=%.2f expire_mev_per_s=%.2f\n",
+           count, list_bytes, count / list_insert / 1e6, count / list_expire / 1e6);
+
+    /* Ring: append at end, expire by advancing begin */
+    LogWindow w;
+    window_init(&w, 4096);
+
+    t0 = now_sec();
+    for (int i = 0; i < count; i++)
+    {
+        *window_push(&w) = entries[i];
+    }
+    double ring_insert = now_sec() - t0;
+
+    t0 = now_sec();
+    while (w.begin != w.end)
+    {
+        sink += window_at(&w, w.begin)->user_id;
+        w.begin++;
+    }
+    double ring_expire = now_sec() - t0;
+    double ring_bytes = (double)(w.cap * sizeof(LogEntry)) / count;
+    window_free(&w);
+
+    printf("window/ring  events=%d bytes_per_event=%.1f insert_mev_per_s=%.2f expire_mev_per_s=%.2f\n",
+           count, ring_bytes, count / ring_insert / 1e6, count / ring_expire / 1e6);
+
+    free(entries);
+}
+
+/* ─── Distinct-resource tracking under a crawler ───
+ * One user walks `distinct` different resources over and over; the window
+ * holds exactly one full sweep, so every event adds one reference and
+ * expires another, and the set stays `distinct` members large. */
+
+typedef struct
+{
+    SetRef *items;
+    int count;
+    int cap;
+} LinearSet;
+
+/* The original add_log_to_stats bookkeeping: scan, append, memmove on remove */
+static void linear_add(LinearSet *s, uint32_t id)
+{
+    for (int i = 0; i < s->count; i++)
+    {
+        if (s->items[i].id == id)
+        {
+            s->items[i].ref_count++;
+            return;
+        }
+    }
+    if (s->count >= s->cap)
+    {
+        s->cap = s->cap ? s->cap * 2 : 8;
+        s->items = (SetRef *)realloc(s->items, sizeof(SetRef) * s->cap);
+    }
+    s->items[s->count].id = id;
+    s->items[s->count].ref_count = 1;
+    s->count++;
+}
+
+static void linear_remove(LinearSet *s, uint32_t id)
+{
+    for (int i = 0; i < s->count; i++)
+    {
+        if (s->items[i].id == id)
+        {
+            if (--s->items[i].ref_count == 0)
+            {
+                memmove(&s->items[i], &s->items[i + 1],
+                        (s->count - i - 1) * sizeof(SetRef));
+                s->count--;
+            }
+            return;
+        }
+    }
+}
+
+static void bench_crawler(long ops)
+{
+    const int sizes[] = {10, 100, 1000, 10000};
+
+    for (int k = 0; k < 4; k++)
+    {
+        int distinct = sizes[k];
+        /* Interned ids are dense, but spread them like a busy table would */
+        uint32_t *ids = (uint32_t *)malloc(sizeof(uint32_t) * distinct);
+        for (int i = 0; i < distinct; i++)
+            ids[i] = (uint32_t)i * 7919u + 13u;
+
+        LinearSet lin = {0};
+        double t0 = now_sec();
+        for (long i = 0; i < ops; i++)
+        {
+            linear_add(&lin, ids[i % distinct]);
+            if (i >= distinct)
+                linear_remove(&lin, ids[(i - distinct) % distinct]);
+        }
+        double t_lin = now_sec() - t0;
+        sink += lin.count;
+        free(lin.items);
+
+        RefSet set = {0};
+        t0 = now_sec();
+        for (long i = 0; i < ops; i++)
+        {
+            refset_add(&set, ids[i % distinct]);
+            if (i >= distinct)
+                refset_remove(&set, ids[(i - distinct) % distinct]);
+        }
+        double t_set = now_sec() - t0;
+        sink += set.count;
+        refset_free(&set);
+
+        printf("crawler/distinct=%-5d ops=%ld linear_ns_per_op=%.1f refset_ns_per_op=%.1f speedup=%.1fx\n",
+               distinct, ops, t_lin * 1e9 / ops, t_set * 1e9 / ops, t_lin / t_set);
+        free(ids);
+    }
+}
+
+/* ─── Entity maps: the old fixed 2048-bucket chains vs the resizable map ───
+ * Each round inserts n users, then looks up n random present ids and n
+ * absent ones. The chained table's lookup cost grows with n / 2048; the
+ * Robin Hood map should stay flat. The slowest batch of 1024 inserts shows
+ * that incremental rehash keeps resizes from stalling the caller. */
+
+#define LEGACY_BUCKETS 2048
+
+typedef struct ChainNode
+{
+    uint32_t key;
+    struct ChainNode *next;
+} ChainNode;
+
+static unsigned int bench_hash(uint32_t key)
+{
+    return hash_user((int)key);
+}
+
+static void bench_maps(long max)
+{
+    for (long n = 1000; n <= max; n *= 10)
+    {
+        uint32_t *keys = (uint32_t *)malloc(sizeof(uint32_t) * n);
+        if (!keys)
+        {
+            perror("malloc bench keys");
+            exit(1);
+        }
+        for (long i = 0; i < n; i++)
+            keys[i] = (uint32_t)i * 2u + 1u; /* Odd ids present, even ones absent */
+
+        /* Chained table, skipped where it would take minutes */
+        double chain_hit = 0.0, chain_miss = 0.0;
+        if (n <= 1000000)
+        {
+            ChainNode **buckets = (ChainNode **)calloc(LEGACY_BUCKETS, sizeof(ChainNode *));
+            ChainNode *nodes = (ChainNode *)malloc(sizeof(ChainNode) * n);
+            for (long i = 0; i < n; i++)
+            {
+                unsigned int b = bench_hash(keys[i]) % LEGACY_BUCKETS;
+                nodes[i].key = keys[i];
+                nodes[i].next = buckets[b];
+                buckets[b] = &nodes[i];
+            }
+
+            double t0 = now_sec();
+            for (long i = 0; i < n; i++)
+            {
+                uint32_t k = keys[rng() % n];
+                for (ChainNode *c = buckets[bench_hash(k) % LEGACY_BUCKETS]; c; c = c->next)
+                {
+                    if (c->key == k)
+                    {
+                        sink++;
+                        break;
+                    }
+                }
+            }
+            chain_hit = (now_sec() - t0) * 1e9 / n;
+
+            t0 = now_sec();
+            for (long i = 0; i < n; i++)
+            {
+                uint32_t k = keys[rng() % n] + 1u;
+                for (ChainNode *c = buckets[bench_hash(k) % LEGACY_BUCKETS]; c; c = c->next)
+                {
+                    if (c->key == k)
+                        sink++;
+                }
+            }
+            chain_miss = (now_sec() - t0) * 1e9 / n;
+            free(nodes);
+            free(buckets);
+        }
+
+        EntityMap m;
+        map_init(&m, bench_hash);
+        double worst_batch = 0.0;
+        double t0 = now_sec();
+        for (long i = 0; i < n; i += 1024)
+        {
+            double b0 = now_sec();
+            for (long j = i; j < i + 1024 && j < n; j++)
+                map_put(&m, keys[j], &keys[j]);
+            double dt = now_sec() - b0;
+            if (dt > worst_batch)
+                worst_batch = dt;
+        }
+        double put = (now_sec() - t0) * 1e9 / n;
+
+        t0 = now_sec();
+        for (long i = 0; i < n; i++)
+        {
+            if (map_get(&m, keys[rng() % n]))
+                sink++;
+        }
+        double hit = (now_sec() - t0) * 1e9 / n;
+
+        t0 = now_sec();
+        for (long i = 0; i < n; i++)
+        {
+            if (map_get(&m, keys[rng() % n] + 1u))
+                sink++;
+        }
+        double miss = (now_sec() - t0) * 1e9 / n;
+
+        if (chain_hit > 0.0)
+            printf("maps/entities=%-8ld chain_hit_ns=%.1f chain_miss_ns=%.1f ", n, chain_hit, chain_miss);
+        else
+            printf("maps/entities=%-8ld chain_hit_ns=- chain_miss_ns=- ", n);
+        printf("map_put_ns=%.1f map_hit_ns=%.1f map_miss_ns=%.1f worst_1k_puts_us=%.1f resizes=%ld\n",
+               put, hit, miss, worst_batch * 1e6, m.resizes);
+
+        map_destroy(&m);
+        free(keys);
+    }
+}
+
+/* ─── Sharded analyzer: end-to-end replay throughput ───
+ * Routes pre-parsed events through the real pipeline (admission, shard
+ * inboxes, per-shard windows, evaluation ticks, alert thread) and times it
+ * from the first event to the last shard stopping. Event time advances one
+ * second per 10k events, so the window holds ~3M events at steady state;
+ * users keep to a handful of resources and their home IP, so alerts stay
+ * rare and the run measures the pipeline rather than the alert sink.
+ * The analyzer's console output is sent to /dev/null for the run. */
+
+/* An engine run: bench_engine_run starts the analyzer shards and the alert
+ * thread with stdout sent to /dev/null, bench_engine_stop broadcasts the
+ * final stop and waits for the pipeline to drain. A stopped state can be
+ * run again; its windows and entities carry over. */
+static int saved_stdout = -1;
+static pthread_t bench_alert;
+
+static SharedState *bench_engine_new(int shards, int batch_size)
+{
+    SharedState *state = (SharedState *)calloc(1, sizeof(SharedState));
+    if (!state)
+    {
+        perror("calloc SharedState");
+        exit(1);
+    }
+    state->cfg.allowed_lateness = DEFAULT_LATENESS;
+    state->cfg.hll_precision = HLL_MIN_PRECISION;
+    state->cfg.shard_count = shards;
+    state->cfg.batch_size = batch_size;
+    state->cfg.flush_ms = DEFAULT_FLUSH_MS;
+    state->cfg.alert_path = "/dev/null";
+    state->cfg.alert_min_severity = 3;
+    state->cfg.alert_commit_ms = DEFAULT_ALERT_COMMIT_MS;
+    state->cfg.top_k = DEFAULT_TOP_K;
+    state->cfg.checkpoint_secs = DEFAULT_CHECKPOINT_SECS;
+    init_shards(state);
+    init_alerts(state);
+    return state;
+}
+
+static void bench_engine_run(SharedState *state)
+{
+    fflush(stdout);
+    saved_stdout = dup(STDOUT_FILENO);
+    if (!freopen("/dev/null", "w", stdout))
+    {
+        perror("freopen /dev/null");
+        exit(1);
+    }
+
+    atomic_store(&state->shards_running, state->cfg.shard_count);
+    state->analyzer_done = 0;
+    pthread_create(&bench_alert, NULL, alert_thread, state);
+    for (int i = 0; i < state->cfg.shard_count; i++)
+        pthread_create(&state->shards[i].thread, NULL, analyzer_thread, &state->shards[i]);
+}
+
+/* Stop the shards; returns once every analyzer has exited */
+static void bench_engine_join_shards(SharedState *state)
+{
+    shard_broadcast(state, ROUTE_STOP, state->watermark);
+    shard_flush_all(state);
+    for (int i = 0; i < state->cfg.shard_count; i++)
+        pthread_join(state->shards[i].thread, NULL);
+}
+
+static void bench_engine_stop(SharedState *state)
+{
+    bench_engine_join_shards(state);
+    pthread_join(bench_alert, NULL);
+    log_stop(); /* Before stdout is pointed back at the terminal */
+
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+    clearerr(stdout);
+}
+
+static void bench_engine_free(SharedState *state)
+{
+    free_all_resources(state);
+    free_alerts(state);
+    free(state);
+}
+
+#define SHARD_BENCH_USERS 50000
+#define SHARD_BENCH_RATE 10000 /* Events per second of event time */
+
+/* Synthetic stream shared by the shard and batch benches: users keep to a
+ * home IP and a few resources, with the odd roaming login and failure */
+static LogEntry *make_shard_entries(int count)
+{
+    LogEntry *entries = (LogEntry *)malloc(sizeof(LogEntry) * count);
+    if (!entries)
+    {
+        perror("malloc bench entries");
+        exit(1);
+    }
+    char buf[32];
+    uint32_t *ips = (uint32_t *)malloc(sizeof(uint32_t) * 65536);
+    if (!ips)
+    {
+        perror("malloc bench ips");
+        exit(1);
+    }
+    for (int i = 0; i < 65536; i++)
+    {
+        int len = snprintf(buf, sizeof(buf), "10.1.%d.%d", i >> 8, i & 255);
+        ips[i] = intern_bytes(buf, (size_t)len);
+    }
+    for (int i = 0; i < count; i++)
+    {
+        unsigned int user = rng() % SHARD_BENCH_USERS;
+        entries[i].timestamp = 1708069200 + i / SHARD_BENCH_RATE;
+        entries[i].user_id = (int)user;
+        entries[i].ip_id = (rng() % 200 == 0) ? ips[rng() % 65536] : ips[user % 65536];
+        entries[i].resource_id = 1 + (user * 7 + rng() % 4) % 100000; /* A few each */
+        entries[i].event_type = (uint8_t)(EVENT_LOGIN + rng() % 4);
+        entries[i].status_code = (rng() % 200 == 0) ? STATUS_FAILED : STATUS_SUCCESS;
+        entries[i].route = 0;
+    }
+    free(ips);
+    return entries;
+}
+
+static void bench_shards(int count)
+{
+    LogEntry *entries = make_shard_entries(count);
+
+    double base = 0.0;
+    for (int shards = 1; shards <= 8; shards *= 2)
+    {
+        SharedState *state = bench_engine_new(shards, DEFAULT_BATCH_SIZE);
+        bench_engine_run(state);
+
+        double t0 = now_sec();
+        for (int i = 0; i < count; i++)
+            route_log_entry(state, &entries[i]);
+        bench_engine_stop(state);
+        double dt = now_sec() - t0;
+
+        if (shards == 1)
+            base = dt;
+        printf("shards/n=%d events=%d mev_per_s=%.2f alerts=%d speedup=%.2fx\n",
+               shards, count, count / dt / 1e6, atomic_load(&state->total_alerts_generated), base / dt);
+        bench_engine_free(state);
+    }
+    free(entries);
+}
+
+/* Ingestion -> shard handoff granularity: the same replay on 4 shards with
+ * the staging batch going from one entry per ring push up to a full inbox
+ * batch */
+static void bench_batch(int count)
+{
+    static const int sizes[] = {1, 16, 64, 256, 1024, 4096};
+    LogEntry *entries = make_shard_entries(count);
+
+    for (size_t k = 0; k < sizeof(sizes) / sizeof(sizes[0]); k++)
+    {
+        SharedState *state = bench_engine_new(4, sizes[k]);
+        bench_engine_run(state);
+
+        double t0 = now_sec();
+        for (int i = 0; i < count; i++)
+            route_log_entry(state, &entries[i]);
+        bench_engine_stop(state);
+        double dt = now_sec() - t0;
+
+        printf("batch/size=%d events=%d mev_per_s=%.2f alerts=%d\n",
+               sizes[k], count, count / dt / 1e6, atomic_load(&state->total_alerts_generated));
+        bench_engine_free(state);
+    }
+    free(entries);
+}
+
+/* ─── Evaluation cost vs idle population ───
+ * `idle` users log one event each and then stay quiet inside the window
+ * while IDLE_BENCH_ACTIVE other users keep logging for IDLE_BENCH_SECONDS
+ * of event time. Only changed entities are rescored, so the cost per
+ * evaluation tick should not grow with the idle population. */
+
+#define IDLE_BENCH_ACTIVE 1000
+#define IDLE_BENCH_SECONDS 100
+
+static void bench_idle(long max)
+{
+    for (long idle = 10000; idle <= max; idle *= 10)
+    {
+        SharedState *state = bench_engine_new(1, DEFAULT_BATCH_SIZE);
+        bench_engine_run(state);
+        LogEntry e = {.timestamp = 1708069200, .ip_id = 1, .resource_id = 1,
+                      .event_type = EVENT_API_CALL, .status_code = STATUS_SUCCESS};
+
+        for (long u = 0; u < idle; u++)
+        {
+            e.user_id = (int)u;
+            route_log_entry(state, &e);
+        }
+
+        /* Fold the population in (and score it once) before timing */
+        bench_engine_stop(state);
+        bench_engine_run(state);
+
+        long events = 0;
+        double t0 = now_sec();
+        for (int sec = 1; sec <= IDLE_BENCH_SECONDS; sec++)
+        {
+            e.timestamp++;
+            for (int i = 0; i < IDLE_BENCH_ACTIVE; i++)
+            {
+                e.user_id = (int)(idle + rng() % IDLE_BENCH_ACTIVE);
+                route_log_entry(state, &e);
+                events++;
+            }
+        }
+        bench_engine_stop(state);
+        double dt = now_sec() - t0;
+
+        int ticks = IDLE_BENCH_SECONDS / EVAL_INTERVAL + 1;
+        printf("idle/users=%-8ld active=%d events=%ld ticks=%d us_per_tick=%.1f tracked=%zu\n",
+               idle, IDLE_BENCH_ACTIVE, events, ticks, dt * 1e6 / ticks,
+               map_count(&state->shards[0].user_map));
+        bench_engine_free(state);
+    }
+}
+
+/* ─── Stage handoff: mutex + condvar queue vs lock-free rings ───
+ * One consumer, 1 or 4 producers, 24-byte items stamped with their send
+ * time. The condvar queue is the old design: lock, append, signal per item;
+ * the consumer takes items out one lock round-trip at a time. The rings
+ * push lock-free and the consumer takes batches. Latency is send -> receive
+ * as seen by the consumer. */
+
+#define HANDOFF_CAP 1024
+#define HANDOFF_BATCH 256
+
+typedef struct
+{
+    uint64_t sent_ns;
+    char pad[16];
+} HandoffItem;
+
+typedef struct
+{
+    HandoffItem items[HANDOFF_CAP];
+    int head, tail, count;
+    pthread_mutex_t mu;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+} CondQueue;
+
+typedef struct
+{
+    int kind; /* 0 = condvar, 1 = SPSC ring, 2 = MPSC ring */
+    CondQueue cq;
+    SpscRing spsc;
+    MpscRing mpsc;
+    long per_producer;
+} HandoffBench;
+
+static void *handoff_producer(void *arg)
+{
+    HandoffBench *hb = (HandoffBench *)arg;
+    HandoffItem item = {0};
+    for (long i = 0; i < hb->per_producer; i++)
+    {
+        item.sent_ns = now_ns();
+        if (hb->kind == 0)
+        {
+            CondQueue *q = &hb->cq;
+            pthread_mutex_lock(&q->mu);
+            while (q->count == HANDOFF_CAP)
+                pthread_cond_wait(&q->not_full, &q->mu);
+            q->items[q->tail] = item;
+            q->tail = (q->tail + 1) % HANDOFF_CAP;
+            q->count++;
+            pthread_cond_signal(&q->not_empty);
+            pthread_mutex_unlock(&q->mu);
+        }
+        else if (hb->kind == 1)
+        {
+            spsc_push(&hb->spsc, &item);
+        }
+        else
+        {
+            mpsc_push(&hb->mpsc, &item);
+        }
+    }
+    return NULL;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void run_handoff(const char *name, int kind, int producers, long count)
+{
+    HandoffBench hb = {.kind = kind, .per_producer = count / producers};
+    long total = hb.per_producer * producers;
+    pthread_mutex_init(&hb.cq.mu, NULL);
+    pthread_cond_init(&hb.cq.not_empty, NULL);
+    pthread_cond_init(&hb.cq.not_full, NULL);
+    spsc_init(&hb.spsc, sizeof(HandoffItem), HANDOFF_CAP);
+    mpsc_init(&hb.mpsc, sizeof(HandoffItem), HANDOFF_CAP);
+
+    uint64_t *lat = (uint64_t *)malloc(sizeof(uint64_t) * total);
+    if (!lat)
+    {
+        perror("malloc bench latencies");
+        exit(1);
+    }
+
+    pthread_t threads[4];
+    double t0 = now_sec();
+    for (int i = 0; i < producers; i++)
+        pthread_create(&threads[i], NULL, handoff_producer, &hb);
+
+    HandoffItem batch[HANDOFF_BATCH];
+    long got = 0;
+    while (got < total)
+    {
+        size_t n;
+        if (kind == 0)
+        {
+            CondQueue *q = &hb.cq;
+            pthread_mutex_lock(&q->mu);
+            while (q->count == 0)
+                pthread_cond_wait(&q->not_empty, &q->mu);
+            batch[0] = q->items[q->head];
+            q->head = (q->head + 1) % HANDOFF_CAP;
+            q->count--;
+            pthread_cond_signal(&q->not_full);
+            pthread_mutex_unlock(&q->mu);
+            n = 1;
+        }
+        else if (kind == 1)
+        {
+            n = spsc_pop_batch(&hb.spsc, batch, HANDOFF_BATCH);
+        }
+        else
+        {
+            n = mpsc_pop_batch(&hb.mpsc, batch, HANDOFF_BATCH);
+        }
+
+        uint64_t now = now_ns();
+        for (size_t i = 0; i < n; i++)
+            lat[got++] = now - batch[i].sent_ns;
+    }
+    double dt = now_sec() - t0;
+    for (int i = 0; i < producers; i++)
+        pthread_join(threads[i], NULL);
+
+    qsort(lat, (size_t)total, sizeof(uint64_t), cmp_u64);
+    printf("handoff/%-7s producers=%d items=%ld mitems_per_s=%.2f p50_ns=%llu p99_ns=%llu p999_ns=%llu\n",
+           name, producers, total, total / dt / 1e6,
+           (unsigned long long)lat[total / 2], (unsigned long long)lat[total * 99 / 100],
+           (unsigned long long)lat[total * 999 / 1000]);
+
+    free(lat);
+    spsc_destroy(&hb.spsc);
+    mpsc_destroy(&hb.mpsc);
+    pthread_mutex_destroy(&hb.cq.mu);
+    pthread_cond_destroy(&hb.cq.not_empty);
+    pthread_cond_destroy(&hb.cq.not_full);
+}
+
+static void bench_handoff(long count)
+{
+    run_handoff("condvar", 0, 1, count);
+    run_handoff("spsc", 1, 1, count);
+    run_handoff("mpsc", 2, 1, count);
+    run_handoff("condvar", 0, 4, count);
+    run_handoff("mpsc", 2, 4, count);
+}
+
+/* ─── Console logging: debug output off, printed inline, or async ───
+ * One evaluation sweep over `users` freshly touched users, each of which
+ * logs a debug line when enabled. "sync" is what every printf used to
+ * cost; "async" leaves the writing to the log thread, so the analyzer
+ * finishes first (sweep_ms) and the log drains behind it (total_ms). */
+static void run_log(const char *name, LogLevel level, int async, long users)
+{
+    SharedState *state = bench_engine_new(1, DEFAULT_BATCH_SIZE);
+    bench_engine_run(state);
+    log_level = level;
+    if (async)
+        log_start(level);
+
+    LogEntry e = {.timestamp = 1708069200, .ip_id = 1, .resource_id = 1,
+                  .event_type = EVENT_API_CALL, .status_code = STATUS_SUCCESS};
+    double t0 = now_sec();
+    for (long u = 0; u < users; u++)
+    {
+        e.user_id = (int)u;
+        route_log_entry(state, &e);
+    }
+    bench_engine_join_shards(state);
+    double sweep = now_sec() - t0;
+    pthread_join(bench_alert, NULL);
+    log_stop();
+    double total = now_sec() - t0;
+
+    log_level = LOG_LEVEL_INFO;
+    fflush(stdout);
+    dup2(saved_stdout, STDOUT_FILENO);
+    close(saved_stdout);
+    clearerr(stdout);
+
+    if (name)
+        printf("log/%-6s users=%ld sweep_ms=%.1f total_ms=%.1f ns_per_user=%.1f\n",
+               name, users, sweep * 1e3, total * 1e3, sweep * 1e9 / users);
+    bench_engine_free(state);
+}
+
+static void bench_log(long users)
+{
+    run_log(NULL, LOG_LEVEL_OFF, 0, users); /* Warm-up: page in the pools and maps */
+    run_log("off", LOG_LEVEL_OFF, 0, users);
+    run_log("sync", LOG_LEVEL_DEBUG, 0, users);
+    run_log("async", LOG_LEVEL_DEBUG, 1, users);
+}
+
+/* ─── Alert log: open/append/close per alert vs the buffered sink ─── */
+#define SINK_BENCH_PATH "/tmp/codeshield-bench-alerts.log"
+
+/* The old write_alert_to_file, verbatim apart from the path */
+static void legacy_write_alert(const AlertItem *a)
+{
+    FILE *fp = fopen(SINK_BENCH_PATH, "a");
+    if (!fp)
+    {
+        perror("fopen bench alert log");
+        return;
+    }
+
+    time_t t = a->timestamp;
+    struct tm *tm_info = localtime(&t);
+    char timebuf[26];
+    strftime(timebuf, 26, "%Y-%m-%d %H:%M:%S", tm_info);
+
+    fprintf(fp, "[%s] ", timebuf);
+    if (a->user_id != -1)
+    {
+        fprintf(fp, "User: %d | ", a->user_id);
+    }
+    fprintf(fp, "IP: %s | Score: %d | Severity: %s\n",
+            a->ip_address, a->score, severity_str(a->severity));
+
+    fclose(fp);
+}
+
+static void run_sink(const char *name, const AlertItem *alerts, int count,
+                     AlertFormat format, AlertFsync fsync_policy, double legacy)
+{
+    EngineConfig cfg = {0};
+    cfg.alert_path = SINK_BENCH_PATH;
+    cfg.alert_format = format;
+    cfg.alert_fsync = fsync_policy;
+    cfg.alert_commit_ms = DEFAULT_ALERT_COMMIT_MS;
+
+    AlertSink s;
+    double t0 = now_sec();
+    sink_open(&s, &cfg);
+    for (int i = 0; i < count; i++)
+        sink_write(&s, &alerts[i]);
+    sink_close(&s);
+    double dt = now_sec() - t0;
+
+    printf("sink/%-12s alerts=%d ns_per_alert=%.1f writes=%ld speedup=%.2fx\n",
+           name, count, dt * 1e9 / count, s.commits, legacy / dt);
+}
+
+static void bench_sink(int count)
+{
+    AlertItem *alerts = (AlertItem *)malloc(sizeof(AlertItem) * count);
+    if (!alerts)
+    {
+        perror("malloc bench alerts");
+        exit(1);
+    }
+    for (int i = 0; i < count; i++)
+    {
+        alerts[i].user_id = (i % 5 == 0) ? -1 : (int)(rng() % 100000);
+        snprintf(alerts[i].ip_address, sizeof(alerts[i].ip_address), "10.%u.%u.%u",
+                 rng() % 256, rng() % 256, rng() % 256);
+        alerts[i].score = 31 + (int)(rng() % 40);
+        alerts[i].severity = 3;
+        alerts[i].timestamp = 1708069200 + i / 50; /* Storm: 50 alerts per second */
+    }
+
+    unlink(SINK_BENCH_PATH);
+    double t0 = now_sec();
+    for (int i = 0; i < count; i++)
+        legacy_write_alert(&alerts[i]);
+    double legacy = now_sec() - t0;
+    printf("sink/%-12s alerts=%d ns_per_alert=%.1f writes=%d\n",
+           "fopen-each", count, legacy * 1e9 / count, count);
+
+    run_sink("text", alerts, count, ALERT_FORMAT_TEXT, ALERT_FSYNC_NONE, legacy);
+    run_sink("json", alerts, count, ALERT_FORMAT_JSON, ALERT_FSYNC_NONE, legacy);
+    run_sink("text+fsync", alerts, count, ALERT_FORMAT_TEXT, ALERT_FSYNC_COMMIT, legacy);
+
+    unlink(SINK_BENCH_PATH);
+    free(alerts);
+}
+
+/* ─── End-to-end suite: ./codeshield on generated workloads ─── */
+
+#define SUITE_LOG_PATH "/tmp/codeshield-suite.log"
+#define SUITE_PROM_PATH "/tmp/codeshield-suite.prom"
+
+typedef struct
+{
+    const char *name;
+    const char *args; /* Extra generate_logs options */
+} SuiteWorkload;
+
+static const SuiteWorkload suite_workloads[] = {
+    {"uniform", "-u 100000"},
+    {"zipf", "-u 100000 -z 1.1"},
+    {"attack-heavy", "-u 100000 -a 0.02"},
+    {"out-of-order", "-u 100000 -O 0.1"},
+    {"high-card", "-u 10000000 -i 16000000 -r 10000000"},
+};
+
+typedef struct
+{
+    double events;
+    double alerts;
+    double p50, p99, p999; /* Alert latency, seconds */
+} SuiteResult;
+
+/* Pick the few series the suite reports out of the final metrics export */
+static int read_suite_metrics(SuiteResult *r)
+{
+    FILE *fp = fopen(SUITE_PROM_PATH, "r");
+    if (!fp)
+        return -1;
+
+    char line[512];
+    double v;
+    memset(r, 0, sizeof(*r));
+    while (fgets(line, sizeof(line), fp))
+    {
+        if (sscanf(line, "codeshield_events_ingested_total %lf", &v) == 1)
+            r->events = v;
+        else if (sscanf(line, "codeshield_alerts_emitted_total %lf", &v) == 1)
+            r->alerts = v;
+        else if (sscanf(line, "codeshield_alert_latency_seconds{quantile=\"0.5\"} %lf", &v) == 1)
+            r->p50 = v;
+        else if (sscanf(line, "codeshield_alert_latency_seconds{quantile=\"0.99\"} %lf", &v) == 1)
+            r->p99 = v;
+        else if (sscanf(line, "codeshield_alert_latency_seconds{quantile=\"0.999\"} %lf", &v) == 1)
+            r->p999 = v;
+    }
+    fclose(fp);
+    return 0;
+}
+
+/* Run the engine on `input` as its own process so peak RSS is the engine's
+ * alone; `extra` is a NULL-terminated list of options to add, or NULL */
+static int run_engine_on(const char *input, const char *const *extra, double *wall,
+                         long *rss_kb)
+{
+    const char *argv[32] = {"codeshield", "-v", "off", "-o", "/dev/null",
+                            "--metrics-file", SUITE_PROM_PATH};
+    int argc = 7;
+    for (int i = 0; extra && extra[i] && argc < 30; i++)
+        argv[argc++] = extra[i];
+    argv[argc++] = input;
+    argv[argc] = NULL;
+
+    double t0 = now_sec();
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        perror("fork");
+        return -1;
+    }
+    if (pid == 0)
+    {
+        if (!freopen("/dev/null", "w", stdout))
+            _exit(127);
+        execv("./codeshield", (char *const *)argv);
+        perror("exec ./codeshield");
+        _exit(127);
+    }
+
+    int status;
+    struct rusage ru;
+    if (wait4(pid, &status, 0, &ru) < 0)
+    {
+        perror("wait4");
+        return -1;
+    }
+    *wall = now_sec() - t0;
+    *rss_kb = ru.ru_maxrss;
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+static int run_engine(const char *const *extra, double *wall, long *rss_kb)
+{
+    return run_engine_on(SUITE_LOG_PATH, extra, wall, rss_kb);
+}
+
+static void bench_suite(long events)
+{
+    for (size_t w = 0; w < sizeof(suite_workloads) / sizeof(suite_workloads[0]); w++)
+    {
+        const SuiteWorkload *wl = &suite_workloads[w];
+        char cmd[512];
+        snprintf(cmd, sizeof(cmd), "./generate_logs -n %ld %s -S 1 -o %s 2>/dev/null",
+                 events, wl->args, SUITE_LOG_PATH);
+        if (system(cmd) != 0)
+        {
+            fprintf(stderr, "suite/%s: ./generate_logs failed (is it built?)\n", wl->name);
+            exit(1);
+        }
+
+        double wall;
+        long rss_kb;
+        SuiteResult r;
+        unlink(SUITE_PROM_PATH);
+        if (run_engine(NULL, &wall, &rss_kb) != 0 || read_suite_metrics(&r) != 0)
+        {
+            fprintf(stderr, "suite/%s: ./codeshield failed (is it built?)\n", wl->name);
+            exit(1);
+        }
+
+        printf("suite/%-12s events=%.0f mev_per_s=%.3f p50_ms=%.2f p99_ms=%.2f p999_ms=%.2f "
+               "rss_mb=%.1f alerts=%.0f\n",
+               wl->name, r.events, r.events / wall / 1e6, r.p50 * 1e3, r.p99 * 1e3,
+               r.p999 * 1e3, rss_kb / 1024.0, r.alerts);
+        fflush(stdout);
+    }
+    unlink(SUITE_LOG_PATH);
+    unlink(SUITE_PROM_PATH);
+}
+
+/* ─── Binary archive vs text ───
+ * The same generated lines as a text file and as an archive, both read
+ * from memory on one thread: tokenizing every line against decoding every
+ * block, and then only the blocks overlapping a tenth of the time span.
+ * The conversion has interned every string already, so neither side pays
+ * for first-time interning. */
+
+#define ARCHIVE_BENCH_TEXT "/tmp/codeshield-bench.log"
+#define ARCHIVE_BENCH_PATH "/tmp/codeshield-bench.csa"
+
+static const char *map_file(const char *path, size_t *size)
+{
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        perror(path);
+        exit(1);
+    }
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        perror("mmap");
+        exit(1);
+    }
+    *size = (size_t)st.st_size;
+    return (const char *)map;
+}
+
+/* Decode every block overlapping [from, until] (0 = unbounded); returns
+ * the events decoded */
+static long decode_archive(const char *data, size_t size, time_t from, time_t until,
+                           LogEntry *out, long *blocks_read)
+{
+    long events = 0;
+    *blocks_read = 0;
+    ArchiveBlock blk;
+    for (size_t pos = archive_first_block(); pos < size; pos = blk.end)
+    {
+        if (archive_block_at(data, size, pos, &blk) != PARSE_OK)
+        {
+            fprintf(stderr, "archive: corrupt block at %zu\n", pos);
+            exit(1);
+        }
+        if ((from && blk.max_time < from) || (until && blk.min_time > until))
+            continue;
+        if (archive_decode_block(data, &blk, out, NULL) != PARSE_OK)
+        {
+            fprintf(stderr, "archive: block at %zu does not decode\n", pos);
+            exit(1);
+        }
+        sink += out[blk.count - 1].user_id;
+        events += blk.count;
+        (*blocks_read)++;
+    }
+    return events;
+}
+
+static void bench_archive(int count)
+{
+    size_t text_len;
+    char *buf = generate_lines(count, &text_len);
+    FILE *f = fopen(ARCHIVE_BENCH_TEXT, "w");
+    if (!f || fwrite(buf, 1, text_len, f) != text_len || fclose(f) != 0)
+    {
+        perror(ARCHIVE_BENCH_TEXT);
+        exit(1);
+    }
+    free(buf);
+
+    char *inputs[] = {ARCHIVE_BENCH_TEXT};
+    EngineConfig cfg = {0};
+    cfg.input_paths = inputs;
+    cfg.input_count = 1;
+    cfg.archive_path = ARCHIVE_BENCH_PATH;
+    fflush(stdout);
+    int saved = dup(STDOUT_FILENO);
+    if (!freopen("/dev/null", "w", stdout) || archive_convert(&cfg) != 0)
+        exit(1);
+    fflush(stdout);
+    dup2(saved, STDOUT_FILENO);
+    close(saved);
+    clearerr(stdout);
+
+    size_t text_size, arch_size;
+    const char *text = map_file(ARCHIVE_BENCH_TEXT, &text_size);
+    const char *arch = map_file(ARCHIVE_BENCH_PATH, &arch_size);
+    LogEntry *out = (LogEntry *)malloc(sizeof(LogEntry) * ARCHIVE_BLOCK_EVENTS);
+    if (!out)
+    {
+        perror("malloc bench entries");
+        exit(1);
+    }
+
+    double t0 = now_sec();
+    int ok = 0;
+    time_t first = 0, last = 0;
+    for (const char *p = text; p < text + text_size;)
+    {
+        const char *nl = memchr(p, '\n', (size_t)(text + text_size - p));
+        if (parse_log_line(p, (size_t)(nl - p) + 1, &out[0], NULL) == PARSE_OK)
+        {
+            if (ok++ == 0)
+                first = out[0].timestamp;
+            last = out[0].timestamp;
+            sink += out[0].user_id;
+        }
+        p = nl + 1;
+    }
+    double parse = now_sec() - t0;
+    printf("archive/text   events=%d mb=%.1f ns_per_event=%.1f mev_per_s=%.2f\n",
+           ok, text_size / 1e6, parse * 1e9 / ok, ok / parse / 1e6);
+
+    long blocks, all_blocks;
+    t0 = now_sec();
+    long events = decode_archive(arch, arch_size, 0, 0, out, &all_blocks);
+    double decode = now_sec() - t0;
+    printf("archive/binary events=%ld mb=%.1f ns_per_event=%.1f mev_per_s=%.2f "
+           "size=%.0f%% speedup=%.2fx\n",
+           events, arch_size / 1e6, decode * 1e9 / events, events / decode / 1e6,
+           100.0 * arch_size / text_size, parse / decode);
+
+    time_t span = last - first, from = first + span * 45 / 100, until = first + span * 55 / 100;
+    t0 = now_sec();
+    events = decode_archive(arch, arch_size, from, until, out, &blocks);
+    double ranged = now_sec() - t0;
+    printf("archive/range  span=10%% blocks_read=%ld/%ld events=%ld ms=%.2f speedup=%.1fx\n",
+           blocks, all_blocks, events, ranged * 1e3, decode / ranged);
+
+    munmap((void *)text, text_size);
+    munmap((void *)arch, arch_size);
+    free(out);
+    unlink(ARCHIVE_BENCH_TEXT);
+    unlink(ARCHIVE_BENCH_PATH);
+}
+
+/* ─── Checkpoint and restore ───
+ * One attack-heavy workload, run end to end three ways: without
+ * checkpoints, with a checkpoint every second, and restarted from the final
+ * checkpoint of that run. The restart has no input left to read, so its
+ * wall time is what a restart costs; the cold run is what rebuilding the
+ * same state by replaying the log costs. */
+
+#define CHECKPOINT_BENCH_PATH "/tmp/codeshield-bench.ckpt"
+
+typedef struct
+{
+    double written, bytes;
+    double pause_p50, pause_p99; /* Seconds, per shard */
+    double write_p50, write_p99; /* Seconds, marker to rename */
+} CheckpointResult;
+
+static int read_checkpoint_metrics(CheckpointResult *r)
+{
+    FILE *fp = fopen(SUITE_PROM_PATH, "r");
+    if (!fp)
+        return -1;
+
+    char line[512];
+    double v;
+    memset(r, 0, sizeof(*r));
+    while (fgets(line, sizeof(line), fp))
+    {
+        if (sscanf(line, "codeshield_checkpoints_written_total %lf", &v) == 1)
+            r->written = v;
+        else if (sscanf(line, "codeshield_checkpoint_bytes %lf", &v) == 1)
+            r->bytes = v;
+        else if (sscanf(line, "codeshield_checkpoint_pause_seconds{quantile=\"0.5\"} %lf", &v) == 1)
+            r->pause_p50 = v;
+        else if (sscanf(line, "codeshield_checkpoint_pause_seconds{quantile=\"0.99\"} %lf", &v) == 1)
+            r->pause_p99 = v;
+        else if (sscanf(line, "codeshield_checkpoint_seconds{quantile=\"0.5\"} %lf", &v) == 1)
+            r->write_p50 = v;
+        else if (sscanf(line, "codeshield_checkpoint_seconds{quantile=\"0.99\"} %lf", &v) == 1)
+            r->write_p99 = v;
+    }
+    fclose(fp);
+    return 0;
+}
+
+static void bench_checkpoint(long events)
+{
+    char cmd[512];
+    snprintf(cmd, sizeof(cmd), "./generate_logs -n %ld -u 100000 -a 0.02 -S 1 -o %s 2>/dev/null",
+             events, SUITE_LOG_PATH);
+    if (system(cmd) != 0)
+    {
+        fprintf(stderr, "checkpoint: ./generate_logs failed (is it built?)\n");
+        exit(1);
+    }
+
+    static const char *const periodic[] = {"--checkpoint", CHECKPOINT_BENCH_PATH,
+                                           "--checkpoint-secs", "1", NULL};
+    static const char *const restart[] = {"--checkpoint", CHECKPOINT_BENCH_PATH, NULL};
+    double cold, with, warm;
+    long rss_kb;
+    SuiteResult base;
+    CheckpointResult r;
+    unlink(CHECKPOINT_BENCH_PATH);
+    if (run_engine(NULL, &cold, &rss_kb) != 0 || read_suite_metrics(&base) != 0 ||
+        run_engine(periodic, &with, &rss_kb) != 0 || read_checkpoint_metrics(&r) != 0 ||
+        run_engine(restart, &warm, &rss_kb) != 0)
+    {
+        fprintf(stderr, "checkpoint: ./codeshield failed (is it built?)\n");
+        exit(1);
+    }
+
+    printf("checkpoint/run events=%.0f mev_per_s=%.3f with_checkpoints=%.3f written=%.0f\n",
+           base.events, base.events / cold / 1e6, base.events / with / 1e6, r.written);
+    printf("checkpoint/cut pause_p50_ms=%.3f pause_p99_ms=%.3f write_p50_ms=%.2f "
+           "write_p99_ms=%.2f size_mb=%.1f\n",
+           r.pause_p50 * 1e3, r.pause_p99 * 1e3, r.write_p50 * 1e3, r.write_p99 * 1e3,
+           r.bytes / (1024.0 * 1024.0));
+    printf("checkpoint/restart replay_s=%.3f restore_s=%.3f speedup=%.1fx\n",
+           cold, warm, cold / warm);
+
+    unlink(CHECKPOINT_BENCH_PATH);
+    unlink(SUITE_LOG_PATH);
+    unlink(SUITE_PROM_PATH);
+}
+
+/* ─── Compressed input ───
+ * One generated log replayed end to end as plain text and as gzip, and the
+ * old way: gunzip to disk, then replay the text. The gzip run inflates on
+ * its own thread while the workers parse, so it should keep up with the
+ * text run as long as inflating is faster than parsing. */
+
+#define GZIP_BENCH_PATH "/tmp/codeshield-bench.log.gz"
+
+static int read_gzip_metrics(double *inflate_s, double *inflated)
+{
+    FILE *fp = fopen(SUITE_PROM_PATH, "r");
+    if (!fp)
+        return -1;
+
+    char line[512];
+    double v;
+    *inflate_s = *inflated = 0;
+    while (fgets(line, sizeof(line), fp))
+    {
+        if (sscanf(line, "codeshield_inflate_seconds_sum %lf", &v) == 1)
+            *inflate_s = v;
+        else if (sscanf(line, "codeshield_bytes_inflated_total %lf", &v) == 1)
+            *inflated = v;
+    }
+    fclose(fp);
+    return 0;
+}
+
+/* Copy `from` into `to` through zlib, gzip-compressing or inflating it */
+static double gzip_copy(const char *from, const char *to, int compress)
+{
+    double t0 = now_sec();
+    static char buf[1 << 16];
+    int n;
+    if (compress)
+    {
+        FILE *in = fopen(from, "rb");
+        gzFile out = gzopen(to, "wb6");
+        if (!in || !out)
+        {
+            perror("gzip bench");
+            exit(1);
+        }
+        while ((n = (int)fread(buf, 1, sizeof(buf), in)) > 0)
+            gzwrite(out, buf, (unsigned)n);
+        fclose(in);
+        gzclose(out);
+    }
+    else
+    {
+        gzFile in = gzopen(from, "rb");
+        FILE *out = fopen(to, "wb");
+        if (!in || !out)
+        {
+            perror("gunzip bench");
+            exit(1);
+        }
+        while ((n = gzread(in, buf, sizeof(buf))) > 0)
+            fwrite(buf, 1, (size_t)n, out);
+        gzclose(in);
+        if (fsync(fileno(out)) != 0 || fclose(out) != 0)
+        {
+            perror("gunzip bench");
+            exit(1);
+        }
+    }
+    return now_sec() - t0;
+}
+
+static void bench_gzip(long events)
+{
+    char cmd[512];
+    snprintf(cmd, sizeof(cmd), "./generate_logs -n %ld -u 100000 -S 1 -o %s 2>/dev/null",
+             events, SUITE_LOG_PATH);
+    if (system(cmd) != 0)
+    {
+        fprintf(stderr, "gzip: ./generate_logs failed (is it built?)\n");
+        exit(1);
+    }
+    gzip_copy(SUITE_LOG_PATH, GZIP_BENCH_PATH, 1);
+    struct stat text_st, gz_st;
+    stat(SUITE_LOG_PATH, &text_st);
+    stat(GZIP_BENCH_PATH, &gz_st);
+
+    double text, gz, unpacked, inflate_s, inflated;
+    long rss_kb;
+    SuiteResult base;
+    if (run_engine(NULL, &text, &rss_kb) != 0 || read_suite_metrics(&base) != 0)
+    {
+        fprintf(stderr, "gzip: ./codeshield failed (is it built?)\n");
+        exit(1);
+    }
+
+    /* The engine reads SUITE_LOG_PATH: gunzip over it for the old way, then
+     * put the compressed file in its place */
+    double gunzip = gzip_copy(GZIP_BENCH_PATH, SUITE_LOG_PATH, 0);
+    if (run_engine(NULL, &unpacked, &rss_kb) != 0 ||
+        rename(GZIP_BENCH_PATH, SUITE_LOG_PATH) != 0 ||
+        run_engine(NULL, &gz, &rss_kb) != 0 || read_gzip_metrics(&inflate_s, &inflated) != 0)
+    {
+        fprintf(stderr, "gzip: ./codeshield failed\n");
+        exit(1);
+    }
+
+    printf("gzip/text     events=%.0f mb=%.1f s=%.3f mev_per_s=%.3f\n",
+           base.events, text_st.st_size / 1e6, text, base.events / text / 1e6);
+    printf("gzip/gz       mb=%.1f ratio=%.1fx s=%.3f mev_per_s=%.3f vs_text=%.2fx "
+           "inflate_mb_per_s=%.0f\n",
+           gz_st.st_size / 1e6, (double)text_st.st_size / gz_st.st_size, gz,
+           base.events / gz / 1e6, text / gz, inflate_s > 0 ? inflated / inflate_s / 1e6 : 0.0);
+    printf("gzip/unpacked gunzip_s=%.3f replay_s=%.3f total_s=%.3f vs_gz=%.2fx\n",
+           gunzip, unpacked, gunzip + unpacked, (gunzip + unpacked) / gz);
+
+    unlink(SUITE_LOG_PATH);
+    unlink(SUITE_PROM_PATH);
+}
+
+/* ─── Multi-source merge ───
+ * One generated log split by user into MERGE_BENCH_SOURCES per-host files,
+ * then replayed end to end twice: the original single file (one reader,
+ * parse workers) against the host files under --merge (a reader per file,
+ * merged by event time). Both feed the shards the same events in time
+ * order; stall is the time the merge spent waiting on its readers. */
+
+#define MERGE_BENCH_DIR "/tmp/codeshield-bench-hosts"
+#define MERGE_BENCH_SOURCES 8
+
+static void split_by_user(const char *from, int parts)
+{
+    FILE *in = fopen(from, "r");
+    FILE *out[MERGE_BENCH_SOURCES];
+    if (!in || mkdir(MERGE_BENCH_DIR, 0755) != 0)
+    {
+        perror("merge bench");
+        exit(1);
+    }
+    char path[256], line[1024];
+    for (int i = 0; i < parts; i++)
+    {
+        snprintf(path, sizeof(path), "%s/host%02d.log", MERGE_BENCH_DIR, i);
+        if (!(out[i] = fopen(path, "w")))
+        {
+            perror("merge bench");
+            exit(1);
+        }
+    }
+    while (fgets(line, sizeof(line), in))
+    {
+        const char *comma = strchr(line, ',');
+        if (line[0] == '#' || !comma)
+            continue;
+        fputs(line, out[strtol(comma + 1, NULL, 10) % parts]);
+    }
+    fclose(in);
+    for (int i = 0; i < parts; i++)
+        fclose(out[i]);
+}
+
+static void remove_split(int parts)
+{
+    char path[256];
+    for (int i = 0; i < parts; i++)
+    {
+        snprintf(path, sizeof(path), "%s/host%02d.log", MERGE_BENCH_DIR, i);
+        unlink(path);
+    }
+    rmdir(MERGE_BENCH_DIR);
+}
+
+static double read_merge_stall(void)
+{
+    FILE *fp = fopen(SUITE_PROM_PATH, "r");
+    if (!fp)
+        return 0;
+    static const char series[] = "codeshield_source_stall_seconds_total{";
+    char line[512];
+    double v, total = 0;
+    while (fgets(line, sizeof(line), fp))
+    {
+        const char *p = strstr(line, "} ");
+        if (strncmp(line, series, sizeof(series) - 1) == 0 && p && sscanf(p + 2, "%lf", &v) == 1)
+            total += v;
+    }
+    fclose(fp);
+    return total;
+}
+
+static void bench_merge(long events)
+{
+    char cmd[512];
+    snprintf(cmd, sizeof(cmd), "./generate_logs -n %ld -u 100000 -S 1 -o %s 2>/dev/null",
+             events, SUITE_LOG_PATH);
+    if (system(cmd) != 0)
+    {
+        fprintf(stderr, "merge: ./generate_logs failed (is it built?)\n");
+        exit(1);
+    }
+    remove_split(MERGE_BENCH_SOURCES);
+    split_by_user(SUITE_LOG_PATH, MERGE_BENCH_SOURCES);
+
+    static const char *const merged[] = {"--merge", NULL};
+    double single, merge;
+    long rss_single, rss_merge;
+    SuiteResult a, b;
+    if (run_engine(NULL, &single, &rss_single) != 0 || read_suite_metrics(&a) != 0 ||
+        run_engine_on(MERGE_BENCH_DIR, merged, &merge, &rss_merge) != 0 ||
+        read_suite_metrics(&b) != 0)
+    {
+        fprintf(stderr, "merge: ./codeshield failed (is it built?)\n");
+        exit(1);
+    }
+
+    printf("merge/single  events=%.0f s=%.3f mev_per_s=%.3f rss_mb=%.1f alerts=%.0f\n",
+           a.events, single, a.events / single / 1e6, rss_single / 1024.0, a.alerts);
+    printf("merge/merged  sources=%d events=%.0f s=%.3f mev_per_s=%.3f vs_single=%.2fx "
+           "stall_s=%.3f rss_mb=%.1f alerts=%.0f\n",
+           MERGE_BENCH_SOURCES, b.events, merge, b.events / merge / 1e6, single / merge,
+           read_merge_stall(), rss_merge / 1024.0, b.alerts);
+
+    remove_split(MERGE_BENCH_SOURCES);
+    unlink(SUITE_LOG_PATH);
+    unlink(SUITE_PROM_PATH);
+}
+
+/* ─── Network listener ───
+ * The engine is started with --listen on a loopback TCP and UDP port and
+ * fed one generated log, split by user into host files as for the merge
+ * bench: each host is one client. Over TCP every client is a connection
+ * sending plain lines, then the same lines as octet-counted RFC5424 syslog;
+ * over UDP each line is one datagram, paced to a fixed offered rate since
+ * an unpaced sender only measures how fast the kernel drops. The rate is
+ * messages the listener received per second, read back from the metrics
+ * export. */
+
+#define LISTEN_BENCH_PORT 47514
+#define LISTEN_BENCH_CHUNK 65536
+#define LISTEN_BENCH_UDP_RATE 200000 /* Datagrams/s offered, over all clients */
+
+typedef struct
+{
+    int kind; /* 0 plain lines over TCP, 1 syslog over TCP, 2 lines over UDP */
+    char *data;
+    size_t len;
+    long lines;
+} ListenClient;
+
+/* The host file as it goes on the wire: plain lines as they are, syslog
+ * as "<len> <frame>" with an RFC5424 header in front of each line */
+static void load_client(ListenClient *c, const char *path, int kind, int host)
+{
+    size_t size;
+    const char *map = map_file(path, &size);
+    c->kind = kind;
+    c->lines = 0;
+    for (size_t i = 0; i < size; i++)
+        c->lines += map[i] == '\n';
+    size_t cap = kind == 1 ? size + (size_t)c->lines * 96 : size;
+    c->data = malloc(cap + 1);
+    if (!c->data)
+    {
+        perror("malloc");
+        exit(1);
+    }
+    if (kind != 1)
+    {
+        memcpy(c->data, map, size);
+        c->len = size;
+    }
+    else
+    {
+        char frame[1200];
+        c->len = 0;
+        for (const char *p = map, *end = map + size; p < end;)
+        {
+            const char *nl = memchr(p, '\n', (size_t)(end - p));
+            size_t n = (size_t)((nl ? nl : end) - p);
+            int hdr = snprintf(frame, sizeof(frame),
+                               "<134>1 2024-02-16T07:00:00Z host%02d codeshield - - - ", host);
+            if (n > sizeof(frame) - (size_t)hdr)
+                n = sizeof(frame) - (size_t)hdr;
+            memcpy(frame + hdr, p, n);
+            c->len += (size_t)sprintf(c->data + c->len, "%zu ", (size_t)hdr + n);
+            memcpy(c->data + c->len, frame, (size_t)hdr + n);
+            c->len += (size_t)hdr + n;
+            p = nl ? nl + 1 : end;
+        }
+    }
+    munmap((void *)map, size);
+}
+
+static void *listen_client(void *arg)
+{
+    ListenClient *c = arg;
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(LISTEN_BENCH_PORT)};
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int fd = socket(AF_INET, c->kind == 2 ? SOCK_DGRAM : SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        perror("listen bench: connect");
+        exit(1);
+    }
+    if (c->kind == 2)
+    {
+        double t0 = now_sec(), rate = LISTEN_BENCH_UDP_RATE / (double)MERGE_BENCH_SOURCES;
+        long sent = 0;
+        for (char *p = c->data, *end = c->data + c->len; p < end; sent++)
+        {
+            char *nl = memchr(p, '\n', (size_t)(end - p));
+            size_t n = (size_t)((nl ? nl : end) - p);
+            while (send(fd, p, n, 0) < 0)
+                sched_yield(); /* ENOBUFS or ECONNREFUSED: let the engine drain */
+            p = nl ? nl + 1 : end;
+            double ahead = sent / rate - (now_sec() - t0);
+            if ((sent & 63) == 0 && ahead > 0)
+                usleep((useconds_t)(ahead * 1e6));
+        }
+    }
+    else
+    {
+        for (size_t off = 0; off < c->len;)
+        {
+            size_t n = c->len - off < LISTEN_BENCH_CHUNK ? c->len - off : LISTEN_BENCH_CHUNK;
+            ssize_t w = send(fd, c->data + off, n, MSG_NOSIGNAL);
+            if (w <= 0)
+            {
+                perror("listen bench: send");
+                exit(1);
+            }
+            off += (size_t)w;
+        }
+    }
+    close(fd);
+    return NULL;
+}
+
+/* One series from the latest metrics export, -1 while there is none */
+static double read_listen_metric(const char *series)
+{
+    FILE *fp = fopen(SUITE_PROM_PATH, "r");
+    if (!fp)
+        return -1;
+    char line[512];
+    size_t n = strlen(series);
+    double v = -1;
+    while (fgets(line, sizeof(line), fp))
+        if (strncmp(line, series, n) == 0 && line[n] == ' ')
+            v = strtod(line + n + 1, NULL);
+    fclose(fp);
+    return v;
+}
+
+static pid_t start_listener(void)
+{
+    char tcp[32], udp[32];
+    snprintf(tcp, sizeof(tcp), "tcp:%d", LISTEN_BENCH_PORT);
+    snprintf(udp, sizeof(udp), "udp:%d", LISTEN_BENCH_PORT);
+    const char *argv[] = {"codeshield", "-v", "off", "-o", "/dev/null",
+                          "--metrics-file", SUITE_PROM_PATH, "--metrics-interval", "20",
+                          "--listen", tcp, "--listen", udp, NULL};
+    unlink(SUITE_PROM_PATH);
+    fflush(stdout); /* Or the child flushes the lines printed so far too */
+    pid_t pid = fork();
+    if (pid < 0)
+    {
+        perror("fork");
+        exit(1);
+    }
+    if (pid == 0)
+    {
+        if (!freopen("/dev/null", "w", stdout))
+            _exit(127);
+        execv("./codeshield", (char *const *)argv);
+        perror("exec ./codeshield");
+        _exit(127);
+    }
+    /* The first export is written once the sockets are bound */
+    for (int i = 0; i < 500 && read_listen_metric("codeshield_listen_messages_total") < 0; i++)
+        usleep(10000);
+    return pid;
+}
+
+static void run_listen(const char *name, int kind)
+{
+    ListenClient clients[MERGE_BENCH_SOURCES];
+    pthread_t threads[MERGE_BENCH_SOURCES];
+    char path[256];
+    long sent = 0;
+    for (int i = 0; i < MERGE_BENCH_SOURCES; i++)
+    {
+        snprintf(path, sizeof(path), "%s/host%02d.log", MERGE_BENCH_DIR, i);
+        load_client(&clients[i], path, kind, i);
+        sent += clients[i].lines;
+    }
+
+    pid_t pid = start_listener();
+    double t0 = now_sec();
+    for (int i = 0; i < MERGE_BENCH_SOURCES; i++)
+        pthread_create(&threads[i], NULL, listen_client, &clients[i]);
+    for (int i = 0; i < MERGE_BENCH_SOURCES; i++)
+        pthread_join(threads[i], NULL);
+    double sent_s = now_sec() - t0;
+
+    /* Received is final once it reaches what was sent, or, with UDP losses,
+     * once it has not moved for a second */
+    double got = 0, last = -1, settled = now_sec();
+    while (got < sent && now_sec() - settled < 1.0)
+    {
+        usleep(5000);
+        got = read_listen_metric("codeshield_listen_messages_total");
+        if (got != last)
+        {
+            last = got;
+            settled = now_sec();
+        }
+    }
+    double s = (got < sent ? settled : now_sec()) - t0;
+    double bytes = read_listen_metric("codeshield_listen_bytes_total");
+
+    kill(pid, SIGTERM);
+    int status;
+    waitpid(pid, &status, 0);
+    double ingested = read_listen_metric("codeshield_events_ingested_total");
+
+    printf("listen/%-7s clients=%d sent=%ld received=%.0f loss=%.2f%% s=%.3f "
+           "send_s=%.3f kev_per_s=%.1f mb_per_s=%.1f ingested=%.0f\n",
+           name, MERGE_BENCH_SOURCES, sent, got, 100.0 * (sent - got) / (sent ? sent : 1), s,
+           sent_s, got / s / 1e3, bytes / s / 1e6, ingested);
+    for (int i = 0; i < MERGE_BENCH_SOURCES; i++)
+        free(clients[i].data);
+}
+
+static void bench_listen(long events)
+{
+    char cmd[512];
+    snprintf(cmd, sizeof(cmd), "./generate_logs -n %ld -u 100000 -S 1 -o %s 2>/dev/null",
+             events, SUITE_LOG_PATH);
+    if (system(cmd) != 0)
+    {
+        fprintf(stderr, "listen: ./generate_logs failed (is it built?)\n");
+        exit(1);
+    }
+    remove_split(MERGE_BENCH_SOURCES);
+    split_by_user(SUITE_LOG_PATH, MERGE_BENCH_SOURCES);
+
+    run_listen("tcp", 0);
+    run_listen("syslog", 1);
+    run_listen("udp", 2);
+
+    remove_split(MERGE_BENCH_SOURCES);
+    unlink(SUITE_LOG_PATH);
+    unlink(SUITE_PROM_PATH);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s parse|window|crawler|maps|shards|idle|handoff|batch|sink|log|suite|archive|checkpoint|gzip|merge|listen [count]\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    long n = argc > 2 ? atol(argv[2]) : 0;
+    intern_init();
+
+    if (strcmp(argv[1], "parse") == 0)
+    {
+        bench_parse(n > 0 ? (int)n : 1000000);
+    }
+    else if (strcmp(argv[1], "window") == 0)
+    {
+        bench_window(n > 0 ? (int)n : 4000000);
+    }
+    else if (strcmp(argv[1], "crawler") == 0)
+    {
+        bench_crawler(n > 0 ? n : 200000);
+    }
+    else if (strcmp(argv[1], "maps") == 0)
+    {
+        bench_maps(n > 0 ? n : 10000000);
+    }
+    else if (strcmp(argv[1], "shards") == 0)
+    {
+        bench_shards(n > 0 ? (int)n : 4000000);
+    }
+    else if (strcmp(argv[1], "idle") == 0)
+    {
+        bench_idle(n > 0 ? n : 1000000);
+    }
+    else if (strcmp(argv[1], "handoff") == 0)
+    {
+        bench_handoff(n > 0 ? n : 2000000);
+    }
+    else if (strcmp(argv[1], "batch") == 0)
+    {
+        bench_batch(n > 0 ? (int)n : 4000000);
+    }
+    else if (strcmp(argv[1], "sink") == 0)
+    {
+        bench_sink(n > 0 ? (int)n : 200000);
+    }
+    else if (strcmp(argv[1], "log") == 0)
+    {
+        bench_log(n > 0 ? n : 1000000);
+    }
+    else if (strcmp(argv[1], "suite") == 0)
+    {
+        bench_suite(n > 0 ? n : 2000000);
+    }
+    else if (strcmp(argv[1], "archive") == 0)
+    {
+        bench_archive(n > 0 ? (int)n : 2000000);
+    }
+    else if (strcmp(argv[1], "checkpoint") == 0)
+    {
+        bench_checkpoint(n > 0 ? n : 2000000);
+    }
+    else if (strcmp(argv[1], "gzip") == 0)
+    {
+        bench_gzip(n > 0 ? n : 2000000);
+    }
+    else if (strcmp(argv[1], "merge") == 0)
+    {
+        bench_merge(n > 0 ? n : 2000000);
+    }
+    else if (strcmp(argv[1], "listen") == 0)
+    {
+        bench_listen(n > 0 ? n : 1000000);
+    }
+    else
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    intern_destroy();
+    return 0;
+}
@@ -0,0 +1,635 @@
+#include "structures.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * Checkpoints of the analyzer state, for fast restarts.
+ *
+ * A checkpoint is a consistent cut taken in-band, like an evaluation tick.
+ * At a parse-chunk boundary (so the input offset is exact) ingestion records
+ * where it stands (input file, its inode and byte offset, its watermark and
+ * next tick)
+ * and broadcasts a ROUTE_CHECKPOINT entry. Each shard handles it after every
+ * entry before it and none after it. It copies its window and the alert
+ * dedup state of every entity that has alerted into a CheckpointSection,
+ * then carries on. The copy is a memcpy of the window ring plus one walk of
+ * the maps. The last shard to hand in its section wakes the writer thread.
+ * The writer assembles the file, fsyncs it and renames it over the previous
+ * checkpoint, so a crash at any point leaves the last complete one. Only one
+ * checkpoint is in flight at a time; ingestion skips a due checkpoint rather
+ * than wait for the previous one.
+ *
+ * The file is laid out for mmap: a fixed header, the input path, one header
+ * per shard, then each shard's window entries and dedup records as raw
+ * arrays, then the intern table as of the cut. Interned ids are per process
+ * and more than the window depends on them (IP shard placement, top-K
+ * ties), so restore re-interns the whole table in id order into the
+ * fresh process and gets the same ids back. Should an id still come out
+ * different, entries are rewritten as they are copied out of the mapping.
+ * The table is every string seen so far, so it sets a floor on the file
+ * size for high-cardinality input.
+ *
+ * Entity stats are not stored. They are rebuilt by folding the window back
+ * in, which also re-creates the sets or sketches of the current
+ * distinct-counting mode. The restored entities are then dirty, so the next
+ * tick rescores them. Scores come out as before, user alerts name the same
+ * IP (that of the user's newest event) and the restored last_alert_score
+ * suppresses a repeat alert.
+ *
+ * Alerts raised before the cut but still queued for the alert thread are not
+ * part of it; a crash in that gap loses them rather than repeating them.
+ */
+
+#define CHECKPOINT_MAGIC "CSCKPT01"
+#define CHECKPOINT_VERSION 2
+
+typedef struct
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t entry_size; /* sizeof(LogEntry) of the writer */
+    uint32_t shard_count;
+    uint32_t input_index;
+    uint64_t input_offset;
+    uint64_t input_ino;
+    int64_t watermark;
+    int64_t next_eval_time;
+    int64_t admit_max_time;
+    int64_t created; /* Wall-clock time of the cut */
+    uint32_t intern_count;
+    uint32_t string_count;
+    uint64_t strings_off;
+    uint64_t path_off;
+    uint32_t path_len;
+    uint32_t reserved;
+} FileHeader;
+
+typedef struct
+{
+    int64_t watermark;
+    int64_t sketch_epoch;
+    uint64_t entry_count;
+    uint64_t entries_off;
+    uint64_t user_count;
+    uint64_t users_off;
+    uint64_t ip_count;
+    uint64_t ips_off;
+} ShardHeader;
+
+static uint64_t align8(uint64_t v)
+{
+    return (v + 7) & ~(uint64_t)7;
+}
+
+/* ─── Shard side ─── */
+
+static DedupRecord *collect_dedup(EntityMap *map, int users, size_t *count)
+{
+    size_t cap = 64, n = 0;
+    DedupRecord *out = (DedupRecord *)malloc(sizeof(DedupRecord) * cap);
+    if (!out)
+    {
+        perror("malloc checkpoint records");
+        exit(1);
+    }
+
+    size_t cursor = 0;
+    void *v;
+    while ((v = map_next(map, &cursor)) != NULL)
+    {
+        DedupRecord r;
+        if (users)
+        {
+            EntityStats *e = (EntityStats *)v;
+            r = (DedupRecord){(uint32_t)e->user_id, e->last_alert_score, e->last_alert_time};
+        }
+        else
+        {
+            IPStats *ip = (IPStats *)v;
+            r = (DedupRecord){ip->ip_id, ip->last_alert_score, ip->last_alert_time};
+        }
+        if (r.last_alert_score == 0 && r.last_alert_time == 0)
+            continue; /* Never alerted: nothing to suppress */
+
+        if (n == cap)
+        {
+            cap *= 2;
+            out = (DedupRecord *)realloc(out, sizeof(DedupRecord) * cap);
+            if (!out)
+            {
+                perror("realloc checkpoint records");
+                exit(1);
+            }
+        }
+        out[n++] = r;
+    }
+    *count = n;
+    return out;
+}
+
+/* Copy this shard's state into its section of the checkpoint in flight */
+void checkpoint_shard(Shard *shard)
+{
+    Checkpointer *ck = &shard->state->checkpoint;
+    CheckpointSection *sec = &ck->sections[shard->id];
+    uint64_t t0 = now_ns();
+
+    LogWindow *w = &shard->window;
+    sec->watermark = shard->watermark;
+    sec->sketch_epoch = shard->sketch_epoch;
+    sec->entry_count = w->end - w->begin;
+    sec->entries = (LogEntry *)malloc(sizeof(LogEntry) * (sec->entry_count ? sec->entry_count : 1));
+    if (!sec->entries)
+    {
+        perror("malloc checkpoint window");
+        exit(1);
+    }
+
+    /* The live part of the ring is at most two runs */
+    size_t at = w->begin & (w->cap - 1);
+    size_t first = sec->entry_count < w->cap - at ? sec->entry_count : w->cap - at;
+    memcpy(sec->entries, &w->slots[at], first * sizeof(LogEntry));
+    memcpy(sec->entries + first, w->slots, (sec->entry_count - first) * sizeof(LogEntry));
+
+    sec->users = collect_dedup(&shard->user_map, 1, &sec->user_count);
+    sec->ips = collect_dedup(&shard->ip_map, 0, &sec->ip_count);
+    hist_record(&shard->metrics.pause_ns, now_ns() - t0);
+
+    if (atomic_fetch_sub(&ck->pending, 1) == 1)
+    {
+        pthread_mutex_lock(&ck->mu);
+        pthread_cond_broadcast(&ck->cond);
+        pthread_mutex_unlock(&ck->mu);
+    }
+}
+
+/* ─── Ingestion side ─── */
+
+/* A checkpoint is due once checkpoint_secs have passed since the last one
+ * went out, if that one is written by now */
+int checkpoint_due(SharedState *state)
+{
+    Checkpointer *ck = &state->checkpoint;
+    if (!ck->running || atomic_load(&ck->in_flight))
+        return 0;
+    return now_ns() - ck->started_ns >= (uint64_t)state->cfg.checkpoint_secs * 1000000000ull;
+}
+
+/* Record ingestion's side of the cut and send the marker; `route` adds
+ * ROUTE_STOP for the final checkpoint at the end of input */
+void checkpoint_begin(SharedState *state, int input_index, uint64_t offset, uint64_t input_ino,
+                      uint8_t route)
+{
+    Checkpointer *ck = &state->checkpoint;
+    ck->input_index = input_index;
+    ck->input_offset = offset;
+    ck->input_ino = input_ino;
+    ck->watermark = state->watermark;
+    ck->next_eval_time = state->next_eval_time;
+    ck->admit_max_time = state->admit_max_time;
+    ck->intern_count = intern_count();
+    ck->started_ns = now_ns();
+    atomic_store(&ck->pending, state->cfg.shard_count);
+    atomic_store(&ck->in_flight, 1);
+
+    shard_broadcast(state, ROUTE_CHECKPOINT | route, state->watermark);
+    shard_flush_all(state);
+}
+
+/* Wait for the checkpoint in flight, if any, to be written */
+void checkpoint_wait(SharedState *state)
+{
+    Checkpointer *ck = &state->checkpoint;
+    if (!ck->running)
+        return;
+    pthread_mutex_lock(&ck->mu);
+    while (atomic_load(&ck->in_flight))
+        pthread_cond_wait(&ck->cond, &ck->mu);
+    pthread_mutex_unlock(&ck->mu);
+}
+
+/* ─── Writer ─── */
+
+static int write_all(FILE *f, const void *p, size_t len)
+{
+    return len == 0 || fwrite(p, 1, len, f) == len ? 0 : -1;
+}
+
+static int write_pad(FILE *f, uint64_t *off)
+{
+    static const char zeros[8] = {0};
+    uint64_t to = align8(*off);
+    int rc = write_all(f, zeros, (size_t)(to - *off));
+    *off = to;
+    return rc;
+}
+
+static int write_checkpoint(SharedState *state, FILE *f)
+{
+    Checkpointer *ck = &state->checkpoint;
+    int shards = state->cfg.shard_count;
+    const char *path = input_path_at(&state->cfg, ck->input_index);
+
+    ShardHeader *sh = (ShardHeader *)calloc((size_t)shards, sizeof(ShardHeader));
+    if (!sh)
+    {
+        perror("calloc checkpoint");
+        exit(1);
+    }
+
+    FileHeader h = {0};
+    memcpy(h.magic, CHECKPOINT_MAGIC, sizeof(h.magic));
+    h.version = CHECKPOINT_VERSION;
+    h.entry_size = sizeof(LogEntry);
+    h.shard_count = (uint32_t)shards;
+    h.input_index = (uint32_t)ck->input_index;
+    h.input_offset = ck->input_offset;
+    h.input_ino = ck->input_ino;
+    h.watermark = ck->watermark;
+    h.next_eval_time = ck->next_eval_time;
+    h.admit_max_time = ck->admit_max_time;
+    h.created = (int64_t)time(NULL);
+    h.intern_count = ck->intern_count;
+    h.string_count = ck->intern_count;
+    h.path_off = sizeof(FileHeader);
+    h.path_len = (uint32_t)strlen(path);
+
+    /* Lay out the shard arrays after the path and the shard headers */
+    uint64_t off = align8(h.path_off + h.path_len) + sizeof(ShardHeader) * (uint64_t)shards;
+    for (int s = 0; s < shards; s++)
+    {
+        const CheckpointSection *sec = &ck->sections[s];
+        sh[s].watermark = sec->watermark;
+        sh[s].sketch_epoch = sec->sketch_epoch;
+        sh[s].entry_count = sec->entry_count;
+        sh[s].entries_off = off;
+        off += sizeof(LogEntry) * sec->entry_count;
+        sh[s].user_count = sec->user_count;
+        sh[s].users_off = off;
+        off += sizeof(DedupRecord) * sec->user_count;
+        sh[s].ip_count = sec->ip_count;
+        sh[s].ips_off = off;
+        off += sizeof(DedupRecord) * sec->ip_count;
+    }
+    h.strings_off = off;
+
+    int rc = write_all(f, &h, sizeof(h));
+    uint64_t pos = sizeof(h);
+    rc |= write_all(f, path, h.path_len);
+    pos += h.path_len;
+    rc |= write_pad(f, &pos);
+    rc |= write_all(f, sh, sizeof(ShardHeader) * (size_t)shards);
+    for (int s = 0; s < shards; s++)
+    {
+        const CheckpointSection *sec = &ck->sections[s];
+        rc |= write_all(f, sec->entries, sizeof(LogEntry) * sec->entry_count);
+        rc |= write_all(f, sec->users, sizeof(DedupRecord) * sec->user_count);
+        rc |= write_all(f, sec->ips, sizeof(DedupRecord) * sec->ip_count);
+    }
+
+    /* String table: (id, length, bytes) for every id of the cut, in order */
+    for (uint32_t id = 0; id < ck->intern_count && rc == 0; id++)
+    {
+        const char *str;
+        while ((str = intern_peek(id)) == NULL)
+            sched_yield(); /* A parser took the id and is about to publish it */
+        uint32_t rec[2] = {id, (uint32_t)strlen(str)};
+        rc |= write_all(f, rec, sizeof(rec));
+        rc |= write_all(f, str, rec[1]);
+    }
+
+    free(sh);
+    return rc;
+}
+
+static void commit_checkpoint(SharedState *state)
+{
+    Checkpointer *ck = &state->checkpoint;
+    const char *path = state->cfg.checkpoint_path;
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+
+    FILE *f = fopen(tmp, "w");
+    int rc = -1;
+    if (f)
+    {
+        setvbuf(f, NULL, _IOFBF, 1 << 20);
+        rc = write_checkpoint(state, f);
+        if (fflush(f) != 0 || fsync(fileno(f)) != 0)
+            rc = -1;
+        atomic_store(&ck->last_bytes, (unsigned long long)ftell(f));
+        if (fclose(f) != 0)
+            rc = -1;
+    }
+    if (rc == 0 && rename(tmp, path) != 0)
+        rc = -1;
+
+    if (rc == 0)
+    {
+        atomic_fetch_add(&ck->written, 1);
+        hist_record(&ck->total_ns, now_ns() - ck->started_ns);
+    }
+    else
+    {
+        if (atomic_fetch_add(&ck->failed, 1) == 0)
+            fprintf(stderr, "Cannot write checkpoint %s: %s\n", path, strerror(errno));
+        unlink(tmp);
+    }
+
+    for (int s = 0; s < state->cfg.shard_count; s++)
+    {
+        CheckpointSection *sec = &ck->sections[s];
+        free(sec->entries);
+        free(sec->users);
+        free(sec->ips);
+        memset(sec, 0, sizeof(*sec));
+    }
+}
+
+static void *checkpoint_thread(void *arg)
+{
+    SharedState *state = (SharedState *)arg;
+    Checkpointer *ck = &state->checkpoint;
+
+    pthread_mutex_lock(&ck->mu);
+    while (1)
+    {
+        int ready = atomic_load(&ck->in_flight) && atomic_load(&ck->pending) == 0;
+        if (ready)
+        {
+            pthread_mutex_unlock(&ck->mu);
+            commit_checkpoint(state);
+            pthread_mutex_lock(&ck->mu);
+            atomic_store(&ck->in_flight, 0);
+            pthread_cond_broadcast(&ck->cond);
+            continue;
+        }
+        if (ck->stop)
+            break;
+        pthread_cond_wait(&ck->cond, &ck->mu);
+    }
+    pthread_mutex_unlock(&ck->mu);
+    return NULL;
+}
+
+/* Start the writer if checkpoints are on; the first checkpoint is due
+ * checkpoint_secs from now */
+void checkpoint_start(SharedState *state)
+{
+    Checkpointer *ck = &state->checkpoint;
+    ck->running = 0;
+    if (!state->cfg.checkpoint_path)
+        return;
+
+    ck->sections = (CheckpointSection *)calloc((size_t)state->cfg.shard_count,
+                                               sizeof(CheckpointSection));
+    if (!ck->sections)
+    {
+        perror("calloc checkpoint sections");
+        exit(1);
+    }
+    pthread_mutex_init(&ck->mu, NULL);
+    pthread_cond_init(&ck->cond, NULL);
+    atomic_init(&ck->pending, 0);
+    atomic_init(&ck->in_flight, 0);
+    ck->stop = 0;
+    ck->started_ns = now_ns();
+
+    if (pthread_create(&ck->thread, NULL, checkpoint_thread, state) != 0)
+    {
+        perror("pthread_create checkpoint");
+        exit(1);
+    }
+    ck->running = 1;
+}
+
+/* Finish the checkpoint in flight and stop the writer; call after the
+ * shards have exited */
+void checkpoint_stop(SharedState *state)
+{
+    Checkpointer *ck = &state->checkpoint;
+    if (!ck->running)
+        return;
+
+    pthread_mutex_lock(&ck->mu);
+    ck->stop = 1;
+    pthread_cond_broadcast(&ck->cond);
+    pthread_mutex_unlock(&ck->mu);
+    pthread_join(ck->thread, NULL);
+
+    pthread_mutex_destroy(&ck->mu);
+    pthread_cond_destroy(&ck->cond);
+    free(ck->sections);
+    ck->sections = NULL;
+    ck->running = 0;
+}
+
+/* ─── Restore ─── */
+
+static int restore_fail(const char *path, const char *why)
+{
+    fprintf(stderr, "Not restoring checkpoint %s: %s\n", path, why);
+    return -1;
+}
+
+/* Re-intern the cut's strings; remap[old id] = id in this process */
+static uint32_t *load_strings(const char *base, size_t size, const FileHeader *h)
+{
+    uint32_t *remap = (uint32_t *)calloc(h->intern_count ? h->intern_count : 1, sizeof(uint32_t));
+    if (!remap)
+    {
+        perror("calloc checkpoint remap");
+        exit(1);
+    }
+
+    uint64_t off = h->strings_off;
+    for (uint32_t i = 0; i < h->string_count; i++)
+    {
+        uint32_t rec[2];
+        if (off + sizeof(rec) > size)
+            goto bad;
+        memcpy(rec, base + off, sizeof(rec));
+        off += sizeof(rec);
+        if (rec[0] >= h->intern_count || off + rec[1] > size)
+            goto bad;
+        remap[rec[0]] = intern_bytes(base + off, rec[1]);
+        off += rec[1];
+    }
+    return remap;
+
+bad:
+    free(remap);
+    return NULL;
+}
+
+static int shard_header_ok(const ShardHeader *sh, size_t size)
+{
+    return sh->entries_off + sizeof(LogEntry) * sh->entry_count <= size &&
+           sh->users_off + sizeof(DedupRecord) * sh->user_count <= size &&
+           sh->ips_off + sizeof(DedupRecord) * sh->ip_count <= size;
+}
+
+static void restore_shard(Shard *shard, const char *base, const ShardHeader *sh,
+                          const uint32_t *remap, uint32_t intern_count)
+{
+    /* Copy the window out of the mapping with this process's ids, then fold
+     * it back in as if it had just arrived */
+    LogEntry *entries = (LogEntry *)malloc(sizeof(LogEntry) * (sh->entry_count ? sh->entry_count : 1));
+    if (!entries)
+    {
+        perror("malloc restore window");
+        exit(1);
+    }
+    memcpy(entries, base + sh->entries_off, sizeof(LogEntry) * sh->entry_count);
+    for (size_t i = 0; i < sh->entry_count; i++)
+    {
+        LogEntry *e = &entries[i];
+        e->ip_id = e->ip_id < intern_count ? remap[e->ip_id] : RESOURCE_NONE;
+        e->resource_id = e->resource_id < intern_count ? remap[e->resource_id] : RESOURCE_NONE;
+    }
+    window_push_batch(&shard->window, entries, sh->entry_count);
+    apply_pending_logs(shard);
+    free(entries);
+
+    advance_watermark(shard, (time_t)sh->watermark);
+    shard->sketch_epoch = sh->sketch_epoch;
+
+    const DedupRecord *users = (const DedupRecord *)(base + sh->users_off);
+    for (size_t i = 0; i < sh->user_count; i++)
+    {
+        DedupRecord r;
+        memcpy(&r, &users[i], sizeof(r));
+        /* An entity kept idle for its alert state has no entries to fold
+         * back in: create it, and it is kept or dropped as it would be */
+        EntityStats *e = get_or_create_user(shard, (int)r.id);
+        e->last_alert_score = r.last_alert_score;
+        e->last_alert_time = (time_t)r.last_alert_time;
+        remove_user_if_empty(shard, (int)r.id);
+    }
+
+    const DedupRecord *ips = (const DedupRecord *)(base + sh->ips_off);
+    for (size_t i = 0; i < sh->ip_count; i++)
+    {
+        DedupRecord r;
+        memcpy(&r, &ips[i], sizeof(r));
+        if (r.id >= intern_count)
+            continue;
+        IPStats *ip = get_or_create_ip(shard, remap[r.id]);
+        ip->last_alert_score = r.last_alert_score;
+        ip->last_alert_time = (time_t)r.last_alert_time;
+        remove_ip_if_empty(shard, remap[r.id]);
+    }
+}
+
+/* Load cfg.checkpoint_path into freshly initialised shards, before any
+ * thread starts. Returns 1 if a checkpoint was restored, 0 if there was none
+ * and -1 if one was there but could not be used (the run starts fresh). */
+int checkpoint_restore(SharedState *state)
+{
+    const char *path = state->cfg.checkpoint_path;
+    if (!path)
+        return 0;
+
+    uint64_t t0 = now_ns();
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        if (errno == ENOENT)
+            return 0;
+        return restore_fail(path, strerror(errno));
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(FileHeader))
+    {
+        close(fd);
+        return restore_fail(path, "truncated");
+    }
+    size_t size = (size_t)st.st_size;
+    const char *base = (const char *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return restore_fail(path, strerror(errno));
+
+    FileHeader h;
+    memcpy(&h, base, sizeof(h));
+    const ShardHeader *sh = (const ShardHeader *)(base + align8(h.path_off + h.path_len));
+    int rc = -1;
+    char why[512];
+
+    if (memcmp(h.magic, CHECKPOINT_MAGIC, sizeof(h.magic)) != 0 ||
+        h.version != CHECKPOINT_VERSION || h.entry_size != sizeof(LogEntry))
+    {
+        snprintf(why, sizeof(why), "not a checkpoint of this version");
+        goto out;
+    }
+    if ((int)h.shard_count != state->cfg.shard_count)
+    {
+        snprintf(why, sizeof(why), "taken with %u shards, run with -s %u to use it",
+                 h.shard_count, h.shard_count);
+        goto out;
+    }
+    if (h.path_off + h.path_len > size ||
+        (const char *)(sh + h.shard_count) > base + size || h.strings_off > size)
+    {
+        snprintf(why, sizeof(why), "truncated");
+        goto out;
+    }
+    for (uint32_t s = 0; s < h.shard_count; s++)
+    {
+        if (!shard_header_ok(&sh[s], size))
+        {
+            snprintf(why, sizeof(why), "truncated");
+            goto out;
+        }
+    }
+
+    /* Resume only into the same input it was reading */
+    const char *input = (int)h.input_index < input_total(&state->cfg)
+                            ? input_path_at(&state->cfg, (int)h.input_index)
+                            : NULL;
+    if (!input || strlen(input) != h.path_len ||
+        memcmp(input, base + h.path_off, h.path_len) != 0)
+    {
+        snprintf(why, sizeof(why), "it was reading %.*s as input %u",
+                 (int)(h.path_len < 256 ? h.path_len : 256), base + h.path_off, h.input_index + 1);
+        goto out;
+    }
+
+    uint32_t *remap = load_strings(base, size, &h);
+    if (!remap)
+    {
+        snprintf(why, sizeof(why), "corrupt string table");
+        goto out;
+    }
+
+    size_t entries = 0, records = 0;
+    for (uint32_t s = 0; s < h.shard_count; s++)
+    {
+        restore_shard(&state->shards[s], base, &sh[s], remap, h.intern_count);
+        entries += sh[s].entry_count;
+        records += sh[s].user_count + sh[s].ip_count;
+    }
+    free(remap);
+
+    state->watermark = (time_t)h.watermark;
+    state->next_eval_time = (time_t)h.next_eval_time;
+    state->admit_max_time = (time_t)h.admit_max_time;
+    state->resume_index = (int)h.input_index;
+    state->resume_offset = h.input_offset;
+    state->resume_ino = h.input_ino;
+    rc = 1;
+
+    log_info("Restored checkpoint %s: %zu window entries, %zu alert states in %.1f ms; "
+             "resuming %s at byte %llu\n",
+             path, entries, records, (double)(now_ns() - t0) / 1e6, input,
+             (unsigned long long)h.input_offset);
+
+out:
+    munmap((void *)base, size);
+    if (rc < 0)
+        return restore_fail(path, why);
+    return rc;
+}
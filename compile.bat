@@ -2,12 +2,27 @@
 echo Compiling CodeShield...
 gcc -c alert.c -o alert.o
 gcc -c analyzer.c -o analyzer.o
+gcc -c archive.c -o archive.o
+gcc -c checkpoint.c -o checkpoint.o
+gcc -c gzip.c -o gzip.o
 gcc -c hashmap.c -o hashmap.o
+gcc -c hll.c -o hll.o
 gcc -c ingestion.c -o ingestion.o
+gcc -c intern.c -o intern.o
+gcc -c listen.c -o listen.o
+gcc -c log.c -o log.o
 gcc -c main.c -o main.o
+gcc -c merge.c -o merge.o
+gcc -c metrics.c -o metrics.o
+gcc -c pool.c -o pool.o
+gcc -c refset.c -o refset.o
+gcc -c ring.c -o ring.o
 gcc -c scorer.c -o scorer.o
+gcc -c shard.c -o shard.o
+gcc -c sink.c -o sink.o
+gcc -c topk.c -o topk.o
 gcc -c window.c -o window.o
-gcc -o codeshield.exe alert.o analyzer.o hashmap.o ingestion.o main.o scorer.o window.o -lpthread
+gcc -o codeshield.exe alert.o analyzer.o archive.o checkpoint.o gzip.o hashmap.o hll.o ingestion.o intern.o listen.o log.o main.o merge.o metrics.o pool.o refset.o ring.o scorer.o shard.o sink.o topk.o window.o -lpthread -lm -lz
 
 if %errorlevel% equ 0 (
     echo.
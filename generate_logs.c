@@ -1,17 +1,33 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
 #include <time.h>
+#include <getopt.h>
 
 /*
- * Generates sample_logs.txt with 1200+ log entries including:
+ * Test log generator.
+ *
+ * Without arguments it writes sample_logs.txt: 1200+ entries including
  *  - Normal users doing normal things
  *  - Brute force attacker (many failed logins from one IP)
  *  - Resource crawler (accessing tons of unique resources)
  *  - IP hopper (same user, many different IPs)
  *  - Combined attacker (all patterns at once)
+ *
+ * With options it becomes a workload generator that streams any number of
+ * events (to stdout by default, so it can feed a pipe), e.g.
+ *   ./generate_logs -n 100000000 -u 1000000 -z 1.1 -a 0.001 -O 0.05 > big.log
+ * Users are picked with a Zipf skew (rank 1 busiest), each mostly from a
+ * home IP and a few resources; a fraction of events belongs to attack
+ * campaigns of the four kinds above, mixed by weight; a fraction arrives
+ * up to --max-lag seconds out of order. The same seed gives the same file.
  */
 
-int main(void)
+/* ─── Classic sample ─── */
+
+static int write_sample(void)
 {
     FILE *fp = fopen("sample_logs.txt", "w");
     if (!fp)
@@ -105,4 +121,450 @@ int main(void)
     printf("Time span: %ld seconds (~%.1f minutes)\n",
            (long)(t - base), (double)(t - base) / 60.0);
     return 0;
-}
\ No newline at end of file
+}
+
+/* ─── Workload generator ─── */
+
+typedef struct
+{
+    long long events;
+    long users;
+    long ips;
+    long resources;
+    double zipf;         /* 0 = uniform */
+    double attack_rate;  /* Fraction of events from attack campaigns */
+    double mix[4];       /* Weights: brute, crawl, hop, combo */
+    double out_of_order; /* Fraction of events that arrive late */
+    int max_lag;         /* Seconds a late event trails the clock, at most */
+    long rate;           /* Events per second of log time */
+    uint64_t seed;
+    const char *output;  /* "-" = stdout */
+} Workload;
+
+static uint64_t rng_state;
+
+/* xorshift64*: fast, and plenty for synthetic traffic */
+static uint64_t rng_next(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 2685821657736338717ull;
+}
+
+static double rng_unit(void)
+{
+    return (double)(rng_next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static long rng_below(long n)
+{
+    return (long)(rng_next() % (uint64_t)n);
+}
+
+/* Zipf over 1..n by rejection-inversion (Hörmann & Derflinger), O(1) per
+ * sample with no table, so it works for hundreds of millions of ranks */
+typedef struct
+{
+    double s;
+    long n;
+    double h_x1, h_n, cut;
+} Zipf;
+
+static double zipf_helper1(double x)
+{
+    return fabs(x) > 1e-8 ? log1p(x) / x : 1.0 - x * (0.5 - x * (1.0 / 3.0 - 0.25 * x));
+}
+
+static double zipf_helper2(double x)
+{
+    return fabs(x) > 1e-8 ? expm1(x) / x : 1.0 + x * 0.5 * (1.0 + x * (1.0 / 3.0) * (1.0 + 0.25 * x));
+}
+
+static double zipf_h(const Zipf *z, double x)
+{
+    return exp(-z->s * log(x));
+}
+
+static double zipf_hint(const Zipf *z, double x)
+{
+    double lx = log(x);
+    return zipf_helper2((1.0 - z->s) * lx) * lx;
+}
+
+static double zipf_hint_inv(const Zipf *z, double x)
+{
+    double t = x * (1.0 - z->s);
+    if (t < -1.0)
+        t = -1.0;
+    return exp(zipf_helper1(t) * x);
+}
+
+static void zipf_init(Zipf *z, long n, double s)
+{
+    z->s = s;
+    z->n = n;
+    z->h_x1 = zipf_hint(z, 1.5) - 1.0;
+    z->h_n = zipf_hint(z, (double)n + 0.5);
+    z->cut = 2.0 - zipf_hint_inv(z, zipf_hint(z, 2.5) - zipf_h(z, 2.0));
+}
+
+static long zipf_sample(const Zipf *z)
+{
+    while (1)
+    {
+        double u = z->h_n + rng_unit() * (z->h_x1 - z->h_n);
+        double x = zipf_hint_inv(z, u);
+        long k = (long)(x + 0.5);
+        if (k < 1)
+            k = 1;
+        else if (k > z->n)
+            k = z->n;
+        if ((double)k - x <= z->cut || u >= zipf_hint(z, (double)k + 0.5) - zipf_h(z, (double)k))
+            return k;
+    }
+}
+
+/* Output goes through one big buffer with hand-rolled number formatting;
+ * fprintf would cap the generator well below what the engine can take */
+#define OUT_BUF (1 << 20)
+
+static char out_buf[OUT_BUF];
+static size_t out_len;
+static FILE *out_fp;
+
+static void out_flush(void)
+{
+    if (out_len > 0 && fwrite(out_buf, 1, out_len, out_fp) != out_len)
+    {
+        /* Reader went away (e.g. "| head"): stop quietly */
+        exit(0);
+    }
+    out_len = 0;
+}
+
+static void out_str(const char *s)
+{
+    while (*s)
+        out_buf[out_len++] = *s++;
+}
+
+static void out_num(unsigned long long v)
+{
+    char tmp[24];
+    int n = 0;
+    do
+    {
+        tmp[n++] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v);
+    while (n > 0)
+        out_buf[out_len++] = tmp[--n];
+}
+
+static void out_ip(unsigned a, unsigned b, unsigned c, unsigned d)
+{
+    out_num(a);
+    out_buf[out_len++] = '.';
+    out_num(b);
+    out_buf[out_len++] = '.';
+    out_num(c);
+    out_buf[out_len++] = '.';
+    out_num(d);
+}
+
+static void out_line(long long ts, long user, const unsigned ip[4], const char *event,
+                     const char *res_prefix, long res, const char *status)
+{
+    if (OUT_BUF - out_len < 256)
+        out_flush();
+    out_num((unsigned long long)ts);
+    out_str(", ");
+    out_num((unsigned long long)user);
+    out_str(", ");
+    out_ip(ip[0], ip[1], ip[2], ip[3]);
+    out_str(", ");
+    out_str(event);
+    out_str(", ");
+    if (res_prefix)
+    {
+        out_str(res_prefix);
+        out_num((unsigned long long)res);
+    }
+    else
+    {
+        out_str("-");
+    }
+    out_str(", ");
+    out_str(status);
+    out_buf[out_len++] = '\n';
+}
+
+enum
+{
+    ATTACK_BRUTE,
+    ATTACK_CRAWL,
+    ATTACK_HOP,
+    ATTACK_COMBO
+};
+
+#define CAMPAIGN_SLOTS 8
+
+typedef struct
+{
+    int kind;
+    long user;
+    long left; /* Events still to emit; 0 = slot free */
+    long step;
+    unsigned home_ip[4];
+} Campaign;
+
+static long campaigns_started;
+
+static void campaign_start(Campaign *c, const Workload *w)
+{
+    double total = w->mix[0] + w->mix[1] + w->mix[2] + w->mix[3];
+    double pick = rng_unit() * total;
+    c->kind = ATTACK_BRUTE;
+    for (int k = 0; k < 4; k++)
+    {
+        if (pick < w->mix[k])
+        {
+            c->kind = k;
+            break;
+        }
+        pick -= w->mix[k];
+    }
+
+    long id = ++campaigns_started;
+    c->user = w->users + id; /* Attackers never collide with normal users */
+    c->left = 40 + rng_below(121);
+    c->step = 0;
+    c->home_ip[0] = 192;
+    c->home_ip[1] = 168;
+    c->home_ip[2] = (unsigned)((id >> 8) & 255);
+    c->home_ip[3] = (unsigned)(id & 255);
+}
+
+static void campaign_emit(Campaign *c, long long ts)
+{
+    unsigned ip[4];
+    long id = c->user;
+    long step = c->step++;
+    c->left--;
+
+    switch (c->kind)
+    {
+    case ATTACK_BRUTE:
+        out_line(ts, id, c->home_ip, "LOGIN", NULL, 0, "FAILED");
+        break;
+    case ATTACK_CRAWL:
+        out_line(ts, id, c->home_ip, "FILE_ACCESS", "secret_doc_", step + 1, "SUCCESS");
+        break;
+    case ATTACK_HOP:
+        ip[0] = 45;
+        ip[1] = 33;
+        ip[2] = (unsigned)((step / 250) % 250 + 1);
+        ip[3] = (unsigned)(step % 250 + 1);
+        out_line(ts, id, ip, "LOGIN", NULL, 0, "FAILED");
+        break;
+    default:
+        ip[0] = 99;
+        ip[1] = (unsigned)(step % 5 + 1);
+        ip[2] = (unsigned)(step % 10 + 1);
+        ip[3] = (unsigned)(step % 250 + 1);
+        out_line(ts, id, ip, step % 3 == 0 ? "LOGIN" : "FILE_ACCESS", "vault_", step + 1,
+                 step % 2 == 0 ? "FAILED" : "SUCCESS");
+        break;
+    }
+}
+
+/* Normal traffic: a home IP and a handful of resources per user, with the
+ * odd roaming login and failure */
+static void normal_emit(const Workload *w, const Zipf *z, long long ts)
+{
+    static const char *events[] = {"LOGIN", "FILE_ACCESS", "API_CALL", "API_CALL", "TRANSACTION"};
+    long user = w->zipf > 0.0 ? zipf_sample(z) : 1 + rng_below(w->users);
+
+    uint64_t h = (uint64_t)user * 0x9E3779B97F4A7C15ull;
+    long ip_idx = (rng_below(100) == 0) ? rng_below(w->ips) : (long)((h >> 20) % (uint64_t)w->ips);
+    unsigned ip[4] = {10, (unsigned)((ip_idx >> 16) & 255), (unsigned)((ip_idx >> 8) & 255),
+                      (unsigned)(ip_idx & 255)};
+
+    long res = 1 + (long)(((uint64_t)user * 7 + (uint64_t)rng_below(4)) % (uint64_t)w->resources);
+    const char *event = events[rng_below(5)];
+    const char *status = rng_below(50) == 0 ? "FAILED" : "SUCCESS";
+    out_line(ts, user, ip, event, "res_", res, status);
+}
+
+static int write_workload(const Workload *w)
+{
+    out_fp = strcmp(w->output, "-") == 0 ? stdout : fopen(w->output, "w");
+    if (!out_fp)
+    {
+        perror("fopen output");
+        return 1;
+    }
+
+    rng_state = w->seed ? w->seed : 1;
+    Zipf z;
+    if (w->zipf > 0.0)
+        zipf_init(&z, w->users, w->zipf);
+
+    Campaign slots[CAMPAIGN_SLOTS];
+    memset(slots, 0, sizeof(slots));
+
+    const long long base = 1708069200;
+    long long attacks = 0, late = 0;
+    out_str("# CodeShield workload — generated\n");
+
+    for (long long i = 0; i < w->events; i++)
+    {
+        long long ts = base + i / w->rate;
+        if (w->out_of_order > 0.0 && rng_unit() < w->out_of_order)
+        {
+            ts -= 1 + rng_below(w->max_lag);
+            late++;
+        }
+
+        if (w->attack_rate > 0.0 && rng_unit() < w->attack_rate)
+        {
+            Campaign *c = &slots[rng_below(CAMPAIGN_SLOTS)];
+            if (c->left == 0)
+                campaign_start(c, w);
+            campaign_emit(c, ts);
+            attacks++;
+        }
+        else
+        {
+            normal_emit(w, &z, ts);
+        }
+    }
+    out_flush();
+    if (out_fp != stdout)
+        fclose(out_fp);
+    else
+        fflush(stdout);
+
+    fprintf(stderr, "Generated %lld events (%lld attack, %lld late, %ld campaigns) over %lld s\n",
+            w->events, attacks, late, campaigns_started, w->events / w->rate + 1);
+    return 0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s               write the classic sample_logs.txt\n", prog);
+    fprintf(stderr, "       %s [options]     stream a synthetic workload\n", prog);
+    fprintf(stderr, "  -n, --events <n>        events to generate (default 1000000)\n");
+    fprintf(stderr, "  -u, --users <n>         distinct normal users (default 100000)\n");
+    fprintf(stderr, "  -i, --ips <n>           distinct normal IPs, up to 16M (default 65536)\n");
+    fprintf(stderr, "  -r, --resources <n>     distinct resources (default 100000)\n");
+    fprintf(stderr, "  -z, --zipf <s>          user skew exponent, 0 = uniform (default 0)\n");
+    fprintf(stderr, "  -a, --attack-rate <f>   fraction of attack events (default 0.001)\n");
+    fprintf(stderr, "  -m, --attack-mix <b,c,h,x>\n");
+    fprintf(stderr, "                          weights of brute force, crawler, IP hopper and\n");
+    fprintf(stderr, "                          combined campaigns (default 1,1,1,1)\n");
+    fprintf(stderr, "  -O, --out-of-order <f>  fraction of events arriving late (default 0)\n");
+    fprintf(stderr, "  -L, --max-lag <s>       most seconds a late event trails (default 3)\n");
+    fprintf(stderr, "  -R, --rate <n>          events per second of log time (default 1000)\n");
+    fprintf(stderr, "  -S, --seed <n>          random seed (default 1)\n");
+    fprintf(stderr, "  -o, --output <path>     output file, - for stdout (default -)\n");
+}
+
+int main(int argc, char **argv)
+{
+    if (argc == 1)
+        return write_sample();
+
+    static const struct option long_opts[] = {
+        {"events", required_argument, NULL, 'n'},
+        {"users", required_argument, NULL, 'u'},
+        {"ips", required_argument, NULL, 'i'},
+        {"resources", required_argument, NULL, 'r'},
+        {"zipf", required_argument, NULL, 'z'},
+        {"attack-rate", required_argument, NULL, 'a'},
+        {"attack-mix", required_argument, NULL, 'm'},
+        {"out-of-order", required_argument, NULL, 'O'},
+        {"max-lag", required_argument, NULL, 'L'},
+        {"rate", required_argument, NULL, 'R'},
+        {"seed", required_argument, NULL, 'S'},
+        {"output", required_argument, NULL, 'o'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}};
+
+    Workload w = {
+        .events = 1000000,
+        .users = 100000,
+        .ips = 65536,
+        .resources = 100000,
+        .zipf = 0.0,
+        .attack_rate = 0.001,
+        .mix = {1, 1, 1, 1},
+        .out_of_order = 0.0,
+        .max_lag = 3,
+        .rate = 1000,
+        .seed = 1,
+        .output = "-"};
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "n:u:i:r:z:a:m:O:L:R:S:o:h", long_opts, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            w.events = atoll(optarg);
+            break;
+        case 'u':
+            w.users = atol(optarg);
+            break;
+        case 'i':
+            w.ips = atol(optarg);
+            break;
+        case 'r':
+            w.resources = atol(optarg);
+            break;
+        case 'z':
+            w.zipf = atof(optarg);
+            break;
+        case 'a':
+            w.attack_rate = atof(optarg);
+            break;
+        case 'm':
+            if (sscanf(optarg, "%lf,%lf,%lf,%lf", &w.mix[0], &w.mix[1], &w.mix[2], &w.mix[3]) != 4 ||
+                w.mix[0] + w.mix[1] + w.mix[2] + w.mix[3] <= 0.0)
+            {
+                fprintf(stderr, "Invalid attack mix '%s' (expected four weights)\n", optarg);
+                return 1;
+            }
+            break;
+        case 'O':
+            w.out_of_order = atof(optarg);
+            break;
+        case 'L':
+            w.max_lag = atoi(optarg);
+            break;
+        case 'R':
+            w.rate = atol(optarg);
+            break;
+        case 'S':
+            w.seed = strtoull(optarg, NULL, 10);
+            break;
+        case 'o':
+            w.output = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    if (w.events < 0 || w.users < 1 || w.ips < 1 || w.ips > (1L << 24) || w.resources < 1 ||
+        w.zipf < 0.0 || w.attack_rate < 0.0 || w.attack_rate > 1.0 || w.out_of_order < 0.0 ||
+        w.out_of_order > 1.0 || w.max_lag < 1 || w.rate < 1)
+    {
+        fprintf(stderr, "Invalid workload parameters\n");
+        usage(argv[0]);
+        return 1;
+    }
+    return write_workload(&w);
+}
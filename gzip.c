@@ -0,0 +1,336 @@
+#include "structures.h"
+#include <zlib.h>
+
+/*
+ * Streaming gzip input.
+ *
+ * A compressed log cannot be cut into chunks before it is inflated, so each
+ * .gz input gets a reader thread that inflates it straight from the mapping
+ * into a ring of buffers while the parse workers parse the buffers filled
+ * before. Every buffer is handed out as one piece ending at a line boundary:
+ * the partial last line is carried over to the start of the next buffer,
+ * and a buffer grows when a single line does not fit. Pieces are taken and
+ * released in stream order. The ring holds `depth` buffers, which bounds
+ * memory and how far inflation runs ahead of parsing.
+ *
+ * Offsets (piece ends, resume points) are positions in the inflated stream.
+ * Concatenated members (cat a.gz b.gz) are read as one stream.
+ */
+
+#define GZIP_PIECE_BYTES (1 << 20)
+#define GZIP_INPUT_STEP (1u << 30) /* avail_in is 32-bit */
+
+typedef struct
+{
+    char *data;
+    size_t len; /* Bytes handed out: whole lines */
+    size_t fill; /* Bytes inflated into it, a partial line included */
+    size_t cap;
+    uint64_t end;
+    uint64_t inflate_ns;
+} GzipBuf;
+
+struct GzipReader
+{
+    const unsigned char *data;
+    size_t size;
+    uint64_t skip;   /* Inflated bytes to pass over first */
+    uint64_t out_at; /* Bytes inflated, over all members (reader thread) */
+
+    GzipBuf *bufs;
+    int depth;
+    long produced; /* Buffers filled by the reader thread */
+    long taken;
+    long released;
+    int done;
+    int stop;
+    const char *error;
+    uint64_t inflated;
+
+    pthread_mutex_t mu;
+    pthread_cond_t filled; /* Reader -> gzip_next */
+    pthread_cond_t space;  /* gzip_release -> reader */
+    pthread_t thread;
+};
+
+int gzip_is(const char *data, size_t size)
+{
+    return size >= 2 && (unsigned char)data[0] == 0x1f && (unsigned char)data[1] == 0x8b;
+}
+
+static void buf_reserve(GzipBuf *b, size_t n)
+{
+    if (n <= b->cap)
+        return;
+    while (b->cap < n)
+        b->cap = b->cap ? b->cap * 2 : GZIP_PIECE_BYTES;
+    b->data = (char *)realloc(b->data, b->cap);
+    if (!b->data)
+    {
+        perror("realloc gzip buffer");
+        exit(1);
+    }
+}
+
+/* Length of data[0..fill) up to and including its last newline, looking only
+ * at data[from..fill); 0 if there is none */
+static size_t last_line_end(const char *data, size_t from, size_t fill)
+{
+    for (size_t i = fill; i > from; i--)
+    {
+        if (data[i - 1] == '\n')
+            return i;
+    }
+    return 0;
+}
+
+/* Feed the next stretch of compressed input once zlib has used up the last */
+static void refill_input(GzipReader *r, z_stream *zs)
+{
+    if (zs->avail_in > 0)
+        return;
+    size_t used = (size_t)(zs->next_in - r->data);
+    size_t left = r->size - used;
+    zs->avail_in = (uInt)(left < GZIP_INPUT_STEP ? left : GZIP_INPUT_STEP);
+}
+
+/* Inflate into out[0..cap) from *fill on. Returns 1 at the end of the
+ * stream, 0 when out is full, -1 on an error (r->error set). */
+static int inflate_into(GzipReader *r, z_stream *zs, char *out, size_t cap, size_t *fill)
+{
+    while (*fill < cap)
+    {
+        refill_input(r, zs);
+        zs->next_out = (Bytef *)out + *fill;
+        zs->avail_out = (uInt)(cap - *fill);
+        int rc = inflate(zs, Z_NO_FLUSH);
+        r->out_at += cap - zs->avail_out - *fill;
+        *fill = cap - zs->avail_out;
+        if (rc == Z_STREAM_END)
+        {
+            /* Another member may follow; anything but a gzip header after
+             * the first is trailing garbage and ignored, as gzip -d does */
+            size_t used = (size_t)(zs->next_in - r->data);
+            if (!gzip_is((const char *)zs->next_in, r->size - used))
+                return 1;
+            inflateReset(zs);
+        }
+        else if (rc == Z_BUF_ERROR && zs->avail_in == 0)
+        {
+            r->error = "unexpected end of file";
+            return -1;
+        }
+        else if (rc != Z_OK && rc != Z_BUF_ERROR)
+        {
+            r->error = zs->msg ? zs->msg : "corrupt data";
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void *reader_thread(void *arg)
+{
+    GzipReader *r = (GzipReader *)arg;
+    z_stream zs = {0};
+    if (inflateInit2(&zs, 15 + 16) != Z_OK)
+    {
+        pthread_mutex_lock(&r->mu);
+        r->error = "cannot initialize zlib";
+        r->done = 1;
+        pthread_cond_broadcast(&r->filled);
+        pthread_mutex_unlock(&r->mu);
+        return NULL;
+    }
+    zs.next_in = (Bytef *)r->data;
+
+    /* Pass over what an earlier run already read; the resume point is a
+     * piece boundary, so this ends at the start of a line */
+    int status = 0;
+    if (r->skip > 0)
+    {
+        GzipBuf *b = &r->bufs[0];
+        buf_reserve(b, GZIP_PIECE_BYTES);
+        while (status == 0 && r->out_at < r->skip)
+        {
+            size_t fill = 0;
+            uint64_t left = r->skip - r->out_at;
+            status = inflate_into(r, &zs, b->data, left < b->cap ? (size_t)left : b->cap, &fill);
+        }
+        if (status == 1 && r->out_at < r->skip)
+        {
+            log_info("Compressed input is shorter than when it was checkpointed; "
+                     "reading it from the start\n");
+            inflateReset(&zs);
+            zs.next_in = (Bytef *)r->data;
+            zs.avail_in = 0;
+            r->out_at = 0;
+            status = 0;
+        }
+    }
+
+    uint64_t pos = r->out_at; /* Stream offset of the next piece */
+    pthread_mutex_lock(&r->mu);
+    r->inflated = pos;
+    pthread_mutex_unlock(&r->mu);
+    GzipBuf *prev = NULL;
+    while (status == 0)
+    {
+        pthread_mutex_lock(&r->mu);
+        while (!r->stop && r->produced - r->released >= r->depth)
+            pthread_cond_wait(&r->space, &r->mu);
+        int stop = r->stop;
+        pthread_mutex_unlock(&r->mu);
+        if (stop)
+            break;
+
+        uint64_t t0 = now_ns();
+        GzipBuf *b = &r->bufs[r->produced % r->depth];
+        buf_reserve(b, GZIP_PIECE_BYTES);
+        b->fill = 0;
+        if (prev && prev->fill > prev->len)
+        {
+            /* The partial line the previous piece left out */
+            size_t carry = prev->fill - prev->len;
+            buf_reserve(b, carry * 2);
+            memmove(b->data, prev->data + prev->len, carry);
+            b->fill = carry;
+        }
+
+        /* Fill up, then cut after the last newline; the carried-over part
+         * has none, and a line longer than the buffer makes it grow */
+        b->len = 0;
+        while (1)
+        {
+            size_t from = b->fill;
+            status = inflate_into(r, &zs, b->data, b->cap, &b->fill);
+            if (status != 0)
+                break;
+            b->len = last_line_end(b->data, from, b->fill);
+            if (b->len > 0)
+                break;
+            buf_reserve(b, b->cap * 2);
+        }
+        if (status == 1)
+            b->len = b->fill; /* The last line may lack its newline */
+        if (status < 0 || b->len == 0)
+            break;
+        pos += b->len;
+        b->end = pos;
+        b->inflate_ns = now_ns() - t0;
+        prev = b;
+
+        pthread_mutex_lock(&r->mu);
+        r->produced++;
+        r->inflated = pos;
+        pthread_cond_broadcast(&r->filled);
+        pthread_mutex_unlock(&r->mu);
+    }
+
+    inflateEnd(&zs);
+    pthread_mutex_lock(&r->mu);
+    r->done = 1;
+    pthread_cond_broadcast(&r->filled);
+    pthread_mutex_unlock(&r->mu);
+    return NULL;
+}
+
+/* Start inflating data[0..size), a gzip stream, from inflated offset `skip`
+ * on, keeping at most `depth` pieces in flight */
+GzipReader *gzip_open(const char *data, size_t size, uint64_t skip, int depth)
+{
+    GzipReader *r = (GzipReader *)calloc(1, sizeof(GzipReader));
+    if (!r)
+    {
+        perror("calloc gzip reader");
+        exit(1);
+    }
+    r->data = (const unsigned char *)data;
+    r->size = size;
+    r->skip = skip;
+    r->depth = depth < 2 ? 2 : depth;
+    r->bufs = (GzipBuf *)calloc((size_t)r->depth, sizeof(GzipBuf));
+    if (!r->bufs)
+    {
+        perror("calloc gzip buffers");
+        exit(1);
+    }
+    pthread_mutex_init(&r->mu, NULL);
+    pthread_cond_init(&r->filled, NULL);
+    pthread_cond_init(&r->space, NULL);
+    if (pthread_create(&r->thread, NULL, reader_thread, r) != 0)
+    {
+        perror("pthread_create gzip reader");
+        exit(1);
+    }
+    return r;
+}
+
+/* Take the next piece, waiting for it to be inflated. Returns 1, or 0 at
+ * the end of the stream (also after an error, see gzip_error). Its data stays
+ * valid until it is released; pieces must be released in the order taken. */
+int gzip_next(GzipReader *r, GzipPiece *out)
+{
+    pthread_mutex_lock(&r->mu);
+    while (r->taken == r->produced && !r->done)
+        pthread_cond_wait(&r->filled, &r->mu);
+    int got = r->taken < r->produced;
+    if (got)
+    {
+        GzipBuf *b = &r->bufs[r->taken % r->depth];
+        out->data = b->data;
+        out->len = b->len;
+        out->end = b->end;
+        out->inflate_ns = b->inflate_ns;
+        out->seq = r->taken++;
+    }
+    else
+    {
+        out->seq = r->taken;
+    }
+    pthread_mutex_unlock(&r->mu);
+    return got;
+}
+
+void gzip_release(GzipReader *r)
+{
+    pthread_mutex_lock(&r->mu);
+    r->released++;
+    pthread_cond_signal(&r->space);
+    pthread_mutex_unlock(&r->mu);
+}
+
+/* Why the stream ended early, or NULL if it did not */
+const char *gzip_error(GzipReader *r)
+{
+    pthread_mutex_lock(&r->mu);
+    const char *err = r->error;
+    pthread_mutex_unlock(&r->mu);
+    return err;
+}
+
+/* Inflated bytes read so far */
+uint64_t gzip_inflated(GzipReader *r)
+{
+    pthread_mutex_lock(&r->mu);
+    uint64_t n = r->inflated;
+    pthread_mutex_unlock(&r->mu);
+    return n;
+}
+
+void gzip_close(GzipReader *r)
+{
+    pthread_mutex_lock(&r->mu);
+    r->stop = 1;
+    pthread_cond_signal(&r->space);
+    pthread_mutex_unlock(&r->mu);
+    pthread_join(r->thread, NULL);
+
+    for (int i = 0; i < r->depth; i++)
+        free(r->bufs[i].data);
+    free(r->bufs);
+    pthread_mutex_destroy(&r->mu);
+    pthread_cond_destroy(&r->filled);
+    pthread_cond_destroy(&r->space);
+    free(r);
+}
@@ -7,186 +7,373 @@ unsigned int hash_user(int user_id)
     h = (h ^ (h >> 16)) * 0x85ebca6b;
     h = (h ^ (h >> 13)) * 0xc2b2ae35;
     h = h ^ (h >> 16);
-    return h % HASH_SIZE;
+    return h;
 }
 
-/* DJB2 hash for IP strings */
-unsigned int hash_ip(const char *ip)
+/* IPs are interned ids, so they get the same integer mix as users */
+unsigned int hash_ip(uint32_t ip_id)
 {
-    unsigned int hash = 5381;
-    int c;
-    while ((c = *ip++))
+    return hash_user((int)ip_id);
+}
+
+/* ─── Entity map: Robin Hood open addressing with incremental rehash ───
+ * Slots hold (key, probe distance, value). Lookups stop as soon as they meet
+ * a slot that is closer to its home than the probe is, so misses stay short
+ * even at high load. When the table passes MAP_MAX_LOAD it is not rehashed
+ * in one go: a table twice the size becomes current, the old one is kept
+ * for lookups, and every later operation moves the next MAP_MIGRATE_STEP old
+ * slots across. No single insert ever pays for a full rehash.
+ *
+ * Slots of the draining table are never shifted, only tombstoned (value set
+ * to NULL, probe distance kept), so its probe chains stay valid until the
+ * last slot has moved and it is freed. */
+
+#define MAP_MIN_SLOTS 1024
+#define MAP_MAX_LOAD 0.85
+#define MAP_MIGRATE_STEP 8
+
+static void table_alloc(MapTable *t, size_t slots)
+{
+    t->slots = (MapSlot *)calloc(slots, sizeof(MapSlot));
+    if (!t->slots)
     {
-        hash = ((hash << 5) + hash) + c;
+        perror("calloc entity map");
+        exit(1);
     }
-    return hash % HASH_SIZE;
+    t->mask = slots - 1;
+    t->count = 0;
 }
 
-/* Get or create user stats */
-EntityStats *get_or_create_user(SharedState *state, int user_id)
+static MapSlot *table_find(const MapTable *t, uint32_t key, unsigned int hash)
 {
-    unsigned int idx = hash_user(user_id);
-    EntityStats *e = state->user_map[idx];
+    size_t pos = hash & t->mask;
+    uint32_t dist = 1;
+    while (t->slots[pos].dist >= dist)
+    {
+        if (t->slots[pos].key == key && t->slots[pos].value)
+            return &t->slots[pos];
+        pos = (pos + 1) & t->mask;
+        dist++;
+    }
+    return NULL;
+}
 
-    /* Look for existing */
-    while (e)
+/* Insert a key known to be absent, displacing richer slots on the way */
+static void table_insert(MapTable *t, uint32_t key, unsigned int hash, void *value)
+{
+    MapSlot cur = {.key = key, .dist = 1, .value = value};
+    size_t pos = hash & t->mask;
+    while (t->slots[pos].dist != 0)
     {
-        if (e->user_id == user_id)
-            return e;
-        e = e->next;
+        if (t->slots[pos].dist < cur.dist)
+        {
+            MapSlot tmp = t->slots[pos];
+            t->slots[pos] = cur;
+            cur = tmp;
+        }
+        pos = (pos + 1) & t->mask;
+        cur.dist++;
     }
+    t->slots[pos] = cur;
+    t->count++;
+}
 
-    /* Create new */
-    e = (EntityStats *)calloc(1, sizeof(EntityStats));
-    if (!e)
+/* Backward-shift deletion keeps the current table free of tombstones */
+static void table_erase(MapTable *t, MapSlot *slot)
+{
+    size_t pos = (size_t)(slot - t->slots);
+    size_t next = (pos + 1) & t->mask;
+    while (t->slots[next].dist > 1)
     {
-        perror("calloc EntityStats");
-        exit(1);
+        t->slots[pos] = t->slots[next];
+        t->slots[pos].dist--;
+        pos = next;
+        next = (next + 1) & t->mask;
     }
+    memset(&t->slots[pos], 0, sizeof(MapSlot));
+    t->count--;
+}
 
-    e->user_id = user_id;
-    e->resource_cap = 8;
-    e->resources = (ResourceRef *)malloc(sizeof(ResourceRef) * e->resource_cap);
-    e->ip_cap = 4;
-    e->ip_refs = (IPRef *)malloc(sizeof(IPRef) * e->ip_cap);
+/* Move the next few slots of the draining table into the current one */
+static void map_migrate(EntityMap *m, size_t steps)
+{
+    if (!m->old.slots)
+        return;
 
-    if (!e->resources || !e->ip_refs)
+    while (steps-- > 0 && m->migrate_pos <= m->old.mask)
     {
-        perror("malloc resources/ips");
-        exit(1);
+        MapSlot *slot = &m->old.slots[m->migrate_pos++];
+        if (slot->dist != 0 && slot->value)
+        {
+            table_insert(&m->cur, slot->key, m->hash(slot->key), slot->value);
+            slot->value = NULL;
+            m->old.count--;
+        }
     }
 
-    /* Insert at head */
-    e->next = state->user_map[idx];
-    state->user_map[idx] = e;
+    if (m->migrate_pos > m->old.mask)
+    {
+        free(m->old.slots);
+        memset(&m->old, 0, sizeof(m->old));
+        m->migrate_pos = 0;
+    }
+}
 
-    return e;
+void map_init(EntityMap *m, unsigned int (*hash)(uint32_t key))
+{
+    memset(m, 0, sizeof(*m));
+    m->hash = hash;
+    table_alloc(&m->cur, MAP_MIN_SLOTS);
 }
 
-/* Get or create IP stats */
-IPStats *get_or_create_ip(SharedState *state, const char *ip)
+void map_destroy(EntityMap *m)
 {
-    unsigned int idx = hash_ip(ip);
-    IPStats *ip_stat = state->ip_map[idx];
+    free(m->cur.slots);
+    free(m->old.slots);
+    memset(m, 0, sizeof(*m));
+}
+
+void *map_get(EntityMap *m, uint32_t key)
+{
+    map_migrate(m, MAP_MIGRATE_STEP);
+
+    unsigned int h = m->hash(key);
+    MapSlot *slot = table_find(&m->cur, key, h);
+    if (!slot && m->old.slots)
+        slot = table_find(&m->old, key, h);
+    return slot ? slot->value : NULL;
+}
 
-    /* Look for existing */
-    while (ip_stat)
+void map_put(EntityMap *m, uint32_t key, void *value)
+{
+    if ((double)(m->cur.count + 1) > MAP_MAX_LOAD * (double)(m->cur.mask + 1))
     {
-        if (strcmp(ip_stat->ip_address, ip) == 0)
-            return ip_stat;
-        ip_stat = ip_stat->next;
+        /* A previous resize still draining: finish it before starting another */
+        if (m->old.slots)
+            map_migrate(m, m->old.mask + 1);
+
+        m->old = m->cur;
+        m->migrate_pos = 0;
+        table_alloc(&m->cur, (m->old.mask + 1) * 2);
+        m->resizes++;
     }
 
-    /* Create new */
-    ip_stat = (IPStats *)calloc(1, sizeof(IPStats));
-    if (!ip_stat)
+    map_migrate(m, MAP_MIGRATE_STEP);
+    table_insert(&m->cur, key, m->hash(key), value);
+}
+
+void *map_remove(EntityMap *m, uint32_t key)
+{
+    map_migrate(m, MAP_MIGRATE_STEP);
+
+    unsigned int h = m->hash(key);
+    MapSlot *slot = table_find(&m->cur, key, h);
+    if (slot)
     {
-        perror("calloc IPStats");
-        exit(1);
+        void *value = slot->value;
+        table_erase(&m->cur, slot);
+        return value;
     }
 
-    strncpy(ip_stat->ip_address, ip, 39);
-    ip_stat->ip_address[39] = '\0';
+    if (m->old.slots && (slot = table_find(&m->old, key, h)) != NULL)
+    {
+        void *value = slot->value;
+        slot->value = NULL;
+        m->old.count--;
+        return value;
+    }
+    return NULL;
+}
+
+size_t map_count(const EntityMap *m)
+{
+    return m->cur.count + m->old.count;
+}
+
+/* Iterate values: start with *cursor = 0, stop when NULL comes back. The
+ * map must not change during the walk. */
+void *map_next(const EntityMap *m, size_t *cursor)
+{
+    size_t old_slots = m->old.slots ? m->old.mask + 1 : 0;
+
+    while (*cursor < old_slots)
+    {
+        MapSlot *slot = &m->old.slots[(*cursor)++];
+        if (slot->dist != 0 && slot->value)
+            return slot->value;
+    }
+    while (*cursor - old_slots <= m->cur.mask)
+    {
+        MapSlot *slot = &m->cur.slots[(*cursor)++ - old_slots];
+        if (slot->dist != 0)
+            return slot->value;
+    }
+    return NULL;
+}
+
+unsigned int map_hash_user(uint32_t key)
+{
+    return hash_user((int)key);
+}
+
+/* Get or create user stats */
+EntityStats *get_or_create_user(Shard *shard, int user_id)
+{
+    EntityStats *e = (EntityStats *)map_get(&shard->user_map, (uint32_t)user_id);
+    if (e)
+        return e;
+
+    /* Create new from the pool. A recycled node keeps the (empty) resource
+     * and IP sets of its previous owner, including any hash table they had
+     * grown, so warmed-up slots never hit malloc. */
+    e = (EntityStats *)pool_alloc(&shard->user_pool);
+    RefSet resources = e->resources;
+    RefSet ips = e->ips;
+    memset(e, 0, sizeof(*e));
+
+    e->user_id = user_id;
+    e->resources = resources;
+    e->ips = ips;
+
+    map_put(&shard->user_map, (uint32_t)user_id, e);
+
+    return e;
+}
+
+/* Get or create IP stats */
+IPStats *get_or_create_ip(Shard *shard, uint32_t ip_id)
+{
+    IPStats *ip_stat = (IPStats *)map_get(&shard->ip_map, ip_id);
+    if (ip_stat)
+        return ip_stat;
+
+    /* Create new */
+    ip_stat = (IPStats *)pool_alloc(&shard->ip_pool);
+    memset(ip_stat, 0, sizeof(*ip_stat));
+
+    ip_stat->ip_id = ip_id;
     ip_stat->window_start = time(NULL);
 
-    /* Insert at head */
-    ip_stat->next = state->ip_map[idx];
-    state->ip_map[idx] = ip_stat;
+    map_put(&shard->ip_map, ip_id, ip_stat);
 
     return ip_stat;
 }
 
-/* Remove user if no activity */
-void remove_user_if_empty(SharedState *state, int user_id)
+/* ─── Idle entities ───
+ * An entity whose last entry leaves the window is handed back to its pool,
+ * unless it has alerted: then it stays in the map, empty, for one more
+ * window, so that a return within it does not repeat an alert at the same
+ * score. The idle queue holds one record per emptying, oldest first, and
+ * expire_idle_entities() frees the entities that are still empty a window
+ * later. A record whose entity came back, or emptied again since, finds
+ * it busy or idle for less than a window and is dropped. */
+
+static void idle_push(Shard *shard, uint32_t id, int is_ip)
 {
-    EntityStats *e = get_or_create_user(state, user_id);
-    if (e->failed_attempts == 0 && e->resource_count == 0 && e->ip_count == 0)
+    if (shard->idle_count == shard->idle_cap)
     {
-        unsigned int idx = hash_user(user_id);
-        EntityStats *prev = NULL;
-        EntityStats *cur = state->user_map[idx];
-
-        while (cur)
+        size_t cap = shard->idle_cap ? shard->idle_cap * 2 : 64;
+        IdleEntity *q = (IdleEntity *)malloc(sizeof(IdleEntity) * cap);
+        if (!q)
         {
-            if (cur == e)
-            {
-                if (prev)
-                    prev->next = cur->next;
-                else
-                    state->user_map[idx] = cur->next;
-
-                free(e->resources);
-                free(e->ip_refs);
-                free(e);
-                return;
-            }
-            prev = cur;
-            cur = cur->next;
+            perror("malloc idle queue");
+            exit(1);
         }
+        for (size_t i = 0; i < shard->idle_count; i++)
+            q[i] = shard->idle[(shard->idle_head + i) & (shard->idle_cap - 1)];
+        free(shard->idle);
+        shard->idle = q;
+        shard->idle_cap = cap;
+        shard->idle_head = 0;
     }
+    IdleEntity *rec = &shard->idle[(shard->idle_head + shard->idle_count) & (shard->idle_cap - 1)];
+    rec->id = id;
+    rec->is_ip = is_ip;
+    rec->since = shard->watermark;
+    shard->idle_count++;
 }
 
-/* Remove IP if no activity */
-void remove_ip_if_empty(SharedState *state, const char *ip)
+static void free_user(Shard *shard, EntityStats *e)
 {
-    unsigned int idx = hash_ip(ip);
-    IPStats *prev = NULL;
-    IPStats *cur = state->ip_map[idx];
+    map_remove(&shard->user_map, (uint32_t)e->user_id);
+    unlink_dirty_user(shard, e);
+    heap_remove(&shard->user_heap, &e->heap_pos);
+
+    if (e->resource_sketch)
+        pool_free(&shard->sketch_pool, e->resource_sketch);
+    if (e->ip_sketch)
+        pool_free(&shard->sketch_pool, e->ip_sketch);
 
-    while (cur)
+    /* The empty sets stay attached for the next owner */
+    pool_free(&shard->user_pool, e);
+}
+
+static void free_ip(Shard *shard, IPStats *ip)
+{
+    map_remove(&shard->ip_map, ip->ip_id);
+    unlink_dirty_ip(shard, ip);
+    heap_remove(&shard->ip_heap, &ip->heap_pos);
+    pool_free(&shard->ip_pool, ip);
+}
+
+/* Remove user if no activity */
+void remove_user_if_empty(Shard *shard, int user_id)
+{
+    EntityStats *e = (EntityStats *)map_get(&shard->user_map, (uint32_t)user_id);
+    if (!e || e->event_count != 0)
+        return;
+
+    if (e->last_alert_score != 0)
     {
-        if (strcmp(cur->ip_address, ip) == 0)
-        {
-            if (cur->failed_attempts == 0)
-            {
-                if (prev)
-                    prev->next = cur->next;
-                else
-                    state->ip_map[idx] = cur->next;
-                free(cur);
-            }
-            return;
-        }
-        prev = cur;
-        cur = cur->next;
+        e->idle_since = shard->watermark;
+        idle_push(shard, (uint32_t)user_id, 0);
+    }
+    else
+    {
+        free_user(shard, e);
     }
 }
 
-/* Free all resources */
-void free_all_resources(SharedState *state)
+/* Remove IP if no activity */
+void remove_ip_if_empty(Shard *shard, uint32_t ip_id)
 {
-    /* Free user map */
-    for (int i = 0; i < HASH_SIZE; i++)
+    IPStats *ip = (IPStats *)map_get(&shard->ip_map, ip_id);
+    if (!ip || ip->failed_attempts != 0)
+        return;
+
+    if (ip->last_alert_score != 0)
     {
-        EntityStats *e = state->user_map[i];
-        while (e)
-        {
-            EntityStats *tmp = e;
-            e = e->next;
-            free(tmp->resources);
-            free(tmp->ip_refs);
-            free(tmp);
-        }
+        ip->idle_since = shard->watermark;
+        idle_push(shard, ip_id, 1);
     }
-
-    /* Free IP map */
-    for (int i = 0; i < HASH_SIZE; i++)
+    else
     {
-        IPStats *ip = state->ip_map[i];
-        while (ip)
-        {
-            IPStats *tmp = ip;
-            ip = ip->next;
-            free(tmp);
-        }
+        free_ip(shard, ip);
     }
+}
 
-    /* Free log entries */
-    LogEntry *cur = state->head;
-    while (cur)
+/* Free the entities that have been idle for a whole window */
+void expire_idle_entities(Shard *shard, time_t now)
+{
+    while (shard->idle_count > 0)
     {
-        LogEntry *tmp = cur;
-        cur = cur->next;
-        free(tmp);
+        IdleEntity *rec = &shard->idle[shard->idle_head];
+        if (now - rec->since < WINDOW_SECONDS)
+            break;
+        shard->idle_head = (shard->idle_head + 1) & (shard->idle_cap - 1);
+        shard->idle_count--;
+
+        if (rec->is_ip)
+        {
+            IPStats *ip = (IPStats *)map_get(&shard->ip_map, rec->id);
+            if (ip && ip->failed_attempts == 0 && now - ip->idle_since >= WINDOW_SECONDS)
+                free_ip(shard, ip);
+        }
+        else
+        {
+            EntityStats *e = (EntityStats *)map_get(&shard->user_map, rec->id);
+            if (e && e->event_count == 0 && now - e->idle_since >= WINDOW_SECONDS)
+                free_user(shard, e);
+        }
     }
-}
\ No newline at end of file
+}
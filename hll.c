@@ -0,0 +1,144 @@
+#include "structures.h"
+#include <math.h>
+
+/*
+ * Sliding-window HyperLogLog for approximate distinct counts.
+ *
+ * The window is cut into HLL_SLICES slices of event time. A sketch keeps one
+ * register array per slice (plus one spare, so the slice straddling the
+ * window's trailing edge is still there) in a small ring. Adding an id only
+ * touches the register array of the id's slice; estimating takes the
+ * register-wise max over every slice that still overlaps the window. Old
+ * slices are simply overwritten, so nothing is ever removed explicitly and
+ * the memory per sketch is fixed by the precision.
+ *
+ * Because whole slices expire at once, an id can be counted for up to one
+ * slice (WINDOW_SECONDS / HLL_SLICES) longer than the exact window would.
+ *
+ * A sketch costs the same whatever it holds, so a user's set only moves to
+ * one once its exact table would be larger (see window.c). The ids added
+ * before that stay in the ref-counted set until their entries expire, and
+ * an estimate counts them in with the live slices.
+ */
+
+#define HLL_RING (HLL_SLICES + 1)
+#define HLL_SLICE_SECONDS (WINDOW_SECONDS / HLL_SLICES)
+
+/* Smallest precision whose standard error 1.04/sqrt(2^p) is within bound */
+int hll_precision_for_error(double rel_error)
+{
+    int p = HLL_MIN_PRECISION;
+    while (p < HLL_MAX_PRECISION && 1.04 / sqrt((double)(1u << p)) > rel_error)
+        p++;
+    return p;
+}
+
+double hll_error_for_precision(int precision)
+{
+    return 1.04 / sqrt((double)(1u << precision));
+}
+
+size_t hll_sketch_bytes(int precision)
+{
+    return sizeof(WindowSketch) + ((size_t)HLL_RING << precision);
+}
+
+void hll_reset(WindowSketch *sk, int precision)
+{
+    for (int i = 0; i < HLL_RING; i++)
+        sk->slice[i] = -1;
+    memset(sk->regs, 0, (size_t)HLL_RING << precision);
+}
+
+/* Hashes the string behind the id, not the id: ids depend on the order
+ * strings were first seen, and an estimate should not */
+static void hll_update(uint8_t *regs, int precision, uint32_t id)
+{
+    uint64_t h = intern_hash64(id);
+    uint32_t idx = (uint32_t)(h >> (64 - precision));
+    uint64_t rest = (h << precision) | ((uint64_t)1 << (precision - 1));
+    uint8_t rank = (uint8_t)(__builtin_clzll(rest) + 1);
+    if (rank > regs[idx])
+        regs[idx] = rank;
+}
+
+void hll_add(WindowSketch *sk, int precision, uint32_t id, time_t ts)
+{
+    int64_t slice = (int64_t)ts / HLL_SLICE_SECONDS;
+    int pos = (int)(slice % HLL_RING);
+    if (pos < 0)
+        pos += HLL_RING;
+
+    uint8_t *regs = sk->regs + ((size_t)pos << precision);
+    if (sk->slice[pos] != slice)
+    {
+        if (sk->slice[pos] > slice)
+            return; /* Slot already reused by a newer slice: too old to matter */
+        memset(regs, 0, (size_t)1 << precision);
+        sk->slice[pos] = slice;
+    }
+
+    hll_update(regs, precision, id);
+}
+
+/* Oldest slice still counted at `now`. Estimates can only change without
+ * new adds when this moves on. */
+int64_t hll_oldest_slice(time_t now)
+{
+    return ((int64_t)now - WINDOW_SECONDS) / HLL_SLICE_SECONDS;
+}
+
+/* Distinct ids in the live slices plus the members of `held`, the ids
+ * still counted exactly from before the sketch existed (NULL for none) */
+int hll_estimate(const WindowSketch *sk, int precision, time_t now, const RefSet *held)
+{
+    uint32_t m = 1u << precision;
+    int64_t oldest = hll_oldest_slice(now);
+
+    /* Register-wise max over the live slices, then the held ids on top */
+    uint8_t regs[1u << HLL_MAX_PRECISION];
+    memset(regs, 0, m);
+    for (int i = 0; i < HLL_RING; i++)
+    {
+        if (sk->slice[i] < oldest)
+            continue;
+        const uint8_t *live = sk->regs + ((size_t)i << precision);
+        for (uint32_t j = 0; j < m; j++)
+        {
+            if (live[j] > regs[j])
+                regs[j] = live[j];
+        }
+    }
+    if (held && held->mask)
+    {
+        for (uint32_t i = 0; i <= held->mask; i++)
+        {
+            if (held->table[i].ref_count != 0)
+                hll_update(regs, precision, held->table[i].id);
+        }
+    }
+    else if (held)
+    {
+        for (int i = 0; i < held->count; i++)
+            hll_update(regs, precision, held->inline_refs[i].id);
+    }
+
+    double sum = 0.0;
+    uint32_t zeros = 0;
+    for (uint32_t j = 0; j < m; j++)
+    {
+        sum += ldexp(1.0, -regs[j]);
+        if (regs[j] == 0)
+            zeros++;
+    }
+
+    double alpha = m == 16 ? 0.673 : m == 32 ? 0.697 : m == 64 ? 0.709 : 0.7213 / (1.0 + 1.079 / m);
+    double est = alpha * m * m / sum;
+
+    /* Linear counting is far more accurate while many registers are empty
+     * (and gives 0 for an empty sketch) */
+    if (est <= 2.5 * m && zeros > 0)
+        est = m * log((double)m / zeros);
+
+    return (int)(est + 0.5);
+}
@@ -1,125 +1,1149 @@
 #include "structures.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <limits.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-LogEntry *parse_log_line(const char *line)
+/* ─── Single-pass log parser ───
+ * format: timestamp, user_id, ip, event_type, resource_id, status_code
+ * Writes straight into a caller-owned entry: no allocation, no sscanf, and
+ * every byte of the line is looked at once. Spaces/tabs around fields and a
+ * trailing CR are ignored. IPs and resources come out as interned ids,
+ * event type and status as enums. */
+
+static const char *skip_blanks(const char *p, const char *end)
 {
-    LogEntry *entry = (LogEntry *)calloc(1, sizeof(LogEntry));
-    if (!entry)
+    while (p < end && (*p == ' ' || *p == '\t'))
+        p++;
+    return p;
+}
+
+/* Parse an optionally signed decimal in [min, max] up to the next comma;
+ * a value out of range fails like a malformed one */
+static int parse_number(const char **pp, const char *end, long min, long max, long *out)
+{
+    const char *p = skip_blanks(*pp, end);
+    int neg = 0;
+    if (p < end && (*p == '-' || *p == '+'))
+        neg = (*p++ == '-');
+
+    const char *digits = p;
+    unsigned long limit = neg ? 0UL - (unsigned long)min : (unsigned long)max;
+    unsigned long v = 0;
+    while (p < end && *p >= '0' && *p <= '9')
     {
-        perror("calloc LogEntry");
-        exit(1);
+        unsigned long d = (unsigned long)(*p - '0');
+        if (v > (limit - d) / 10)
+            return -1;
+        v = v * 10 + d;
+        p++;
     }
+    if (p == digits)
+        return -1;
+
+    p = skip_blanks(p, end);
+    if (p >= end || *p != ',')
+        return -1;
+
+    *out = neg ? (long)(0UL - v) : (long)v;
+    *pp = p + 1;
+    return 0;
+}
+
+/* Locate a trimmed text field. The last field runs to the end of the line,
+ * every other one must end with a comma. */
+typedef struct
+{
+    const char *s;
+    size_t len;
+} TextField;
+
+static ParseResult parse_text(const char **pp, const char *end, TextField *out, int last)
+{
+    const char *p = skip_blanks(*pp, end);
+    const char *start = p;
+    while (p < end && *p != ',')
+        p++;
+
+    if (last && p < end)
+        return PARSE_ERR_EXTRA_FIELDS;
+    if (!last && p >= end)
+        return PARSE_ERR_MISSING_FIELD;
+
+    const char *stop = p;
+    while (stop > start && (stop[-1] == ' ' || stop[-1] == '\t'))
+        stop--;
 
-    long ts;
-    /* format: timestamp, user_id, ip, event_type, resource_id, status_code */
-    int n = sscanf(line, " %ld , %d , %39[^,] , %15[^,] , %31[^,] , %15[^\n]",
-                   &ts, &entry->user_id, entry->ip_address,
-                   entry->event_type, entry->resource_id, entry->status_code);
-    if (n < 6)
+    size_t len = (size_t)(stop - start);
+    if (len == 0)
+        return PARSE_ERR_EMPTY_FIELD;
+    if (len > MAX_FIELD_LEN)
+        return PARSE_ERR_FIELD_TOO_LONG;
+
+    out->s = start;
+    out->len = len;
+    *pp = last ? p : p + 1;
+    return PARSE_OK;
+}
+
+static int field_is(const char *s, size_t len, const char *lit, size_t lit_len)
+{
+    return len == lit_len && memcmp(s, lit, len) == 0;
+}
+
+uint8_t parse_event_type(const char *s, size_t len)
+{
+    if (field_is(s, len, "LOGIN", 5))
+        return EVENT_LOGIN;
+    if (field_is(s, len, "FILE_ACCESS", 11))
+        return EVENT_FILE_ACCESS;
+    if (field_is(s, len, "API_CALL", 8))
+        return EVENT_API_CALL;
+    if (field_is(s, len, "TRANSACTION", 11))
+        return EVENT_TRANSACTION;
+    return EVENT_OTHER;
+}
+
+uint8_t parse_status_code(const char *s, size_t len)
+{
+    if (field_is(s, len, "SUCCESS", 7))
+        return STATUS_SUCCESS;
+    if (field_is(s, len, "FAILED", 6))
+        return STATUS_FAILED;
+    return STATUS_OTHER;
+}
+
+const char *event_type_str(uint8_t ev)
+{
+    switch (ev)
     {
-        free(entry);
-        return NULL;
+    case EVENT_LOGIN:
+        return "LOGIN";
+    case EVENT_FILE_ACCESS:
+        return "FILE_ACCESS";
+    case EVENT_API_CALL:
+        return "API_CALL";
+    case EVENT_TRANSACTION:
+        return "TRANSACTION";
+    default:
+        return "OTHER";
     }
+}
+
+const char *status_code_str(uint8_t st)
+{
+    switch (st)
+    {
+    case STATUS_SUCCESS:
+        return "SUCCESS";
+    case STATUS_FAILED:
+        return "FAILED";
+    default:
+        return "OTHER";
+    }
+}
+
+/* Parse one line into `entry`. Its IP and resource are interned at once
+ * when `defer` is NULL; otherwise strings not interned yet are left in
+ * `defer` (see intern_defer()) for the publishing thread. */
+ParseResult parse_log_line(const char *line, size_t len, LogEntry *entry, InternDeferred *defer)
+{
+    const char *p = line;
+    const char *end = line + len;
+
+    /* Drop the line terminator (LF or CRLF) */
+    while (end > p && (end[-1] == '\n' || end[-1] == '\r'))
+        end--;
+
+    long ts, uid;
+    if (parse_number(&p, end, LONG_MIN, LONG_MAX, &ts) != 0)
+        return PARSE_ERR_TIMESTAMP;
+    if (parse_number(&p, end, INT_MIN, INT_MAX, &uid) != 0)
+        return PARSE_ERR_USER_ID;
+
+    TextField ip, ev, res, st;
+    ParseResult r;
+    if ((r = parse_text(&p, end, &ip, 0)) != PARSE_OK ||
+        (r = parse_text(&p, end, &ev, 0)) != PARSE_OK ||
+        (r = parse_text(&p, end, &res, 0)) != PARSE_OK ||
+        (r = parse_text(&p, end, &st, 1)) != PARSE_OK)
+        return r;
+
+    /* Only well-formed lines reach the intern table */
     entry->timestamp = (time_t)ts;
+    entry->user_id = (int)uid;
+    if (defer)
+    {
+        entry->ip_id = intern_defer(defer, ip.s, ip.len);
+        entry->resource_id = intern_defer(defer, res.s, res.len);
+    }
+    else
+    {
+        entry->ip_id = intern_bytes(ip.s, ip.len);
+        entry->resource_id = intern_bytes(res.s, res.len);
+    }
+    entry->event_type = parse_event_type(ev.s, ev.len);
+    entry->status_code = parse_status_code(st.s, st.len);
+    return PARSE_OK;
+}
+
+/* Blank lines and '#' comments are skipped rather than counted as malformed */
+int is_ignorable_line(const char *line, size_t len)
+{
+    const char *p = skip_blanks(line, line + len);
+    return p == line + len || *p == '\n' || *p == '\r' || *p == '#';
+}
+
+const char *parse_result_str(ParseResult r)
+{
+    switch (r)
+    {
+    case PARSE_OK:
+        return "ok";
+    case PARSE_ERR_TIMESTAMP:
+        return "bad timestamp";
+    case PARSE_ERR_USER_ID:
+        return "bad user id";
+    case PARSE_ERR_MISSING_FIELD:
+        return "missing field";
+    case PARSE_ERR_EXTRA_FIELDS:
+        return "extra fields";
+    case PARSE_ERR_EMPTY_FIELD:
+        return "empty field";
+    case PARSE_ERR_FIELD_TOO_LONG:
+        return "field too long";
+    case PARSE_ERR_BAD_BLOCK:
+        return "corrupt archive block";
+    default:
+        return "unknown";
+    }
+}
+
+/* ─── Replay pacing ─── */
+typedef struct
+{
+    int started;
+    time_t first_event;
+    struct timespec wall_start;
+} ReplayClock;
+
+static double elapsed_since(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - start->tv_sec) +
+           (double)(now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/* How long to wait before releasing an event so that the wall clock keeps
+ * up with its position in the replay. Events that arrive late or out of
+ * order are released immediately. */
+static double pace_delay(ReplayClock *clk, double speed, time_t event_ts)
+{
+    if (speed <= 0.0)
+        return 0.0; /* max: no pacing at all */
+
+    if (!clk->started)
+    {
+        clk->started = 1;
+        clk->first_event = event_ts;
+        clock_gettime(CLOCK_MONOTONIC, &clk->wall_start);
+        return 0.0;
+    }
+
+    double due = (double)(event_ts - clk->first_event) / speed;
+    return due - elapsed_since(&clk->wall_start);
+}
+
+static void sleep_seconds(double s)
+{
+    struct timespec ts;
+    ts.tv_sec = (time_t)s;
+    ts.tv_nsec = (long)((s - (double)ts.tv_sec) * 1e9);
+    nanosleep(&ts, NULL);
+}
+
+/* ─── Test data fallback ─── */
+static void create_test_logs(const char *path)
+{
+    printf("%s not found. Creating test data...\n", path);
+    FILE *fp = fopen(path, "w");
+    if (!fp)
+    {
+        perror("fopen");
+        exit(1);
+    }
+
+    /* Generate some test logs */
+    time_t base = time(NULL) - 600; /* 10 minutes ago */
+    for (int i = 0; i < 100; i++)
+    {
+        fprintf(fp, "%ld, %d, 192.168.1.%d, %s, %s, %s\n",
+                (long)(base + i * 2),
+                (i % 5) + 100, /* users 100-104 */
+                (i % 10) + 1,
+                (i % 3 == 0) ? "LOGIN" : (i % 3 == 1) ? "FILE_ACCESS"
+                                                      : "API_CALL",
+                (i % 2 == 0) ? "res_1" : "res_2",
+                (i % 4 == 0) ? "FAILED" : "SUCCESS");
+    }
+    fclose(fp);
+}
+
+/* ─── Routing into the analyzer shards ─── */
+typedef struct
+{
+    SharedState *state;
+    ReplayClock clk;
+    int input_index;     /* Input being read, for checkpoints */
+    uint64_t input_ino;  /* Its inode */
+    uint64_t input_base; /* Offset in it of the data being parsed */
+    uint64_t input_end;  /* Bytes of it read so far, once it is done */
+} Publisher;
+
+/* Admit a parsed entry and hand it to the shards that own its user and IP.
+ * Must be called from one thread, in input order. */
+void route_log_entry(SharedState *state, const LogEntry *parsed)
+{
+    if (!admit_log_entry(state, parsed->timestamp))
+        return;
+    state->total_logs_processed++;
+    counter_add(&state->ingest_metrics.events_admitted, 1);
+
+    /* The user's shard always gets the event; a failed login also counts
+     * against the IP, which may be owned by a different shard */
+    LogEntry entry = *parsed;
+    Shard *user_shard = shard_for_user(state, entry.user_id);
+    Shard *ip_shard = is_failed_login(&entry) ? shard_for_ip(state, entry.ip_id) : NULL;
+
+    entry.route = ROUTE_USER | (ip_shard == user_shard ? ROUTE_IP : 0);
+    shard_post(user_shard, &entry);
+    if (ip_shard && ip_shard != user_shard)
+    {
+        entry.route = ROUTE_IP;
+        shard_post(ip_shard, &entry);
+    }
 
-    /* trim leading spaces from parsed strings */
+    /* Every shard evaluates at the same event-time ticks, right after the
+     * entry that moved the watermark past the next one */
+    if (state->watermark >= state->next_eval_time)
     {
-        char *fields[] = {entry->ip_address, entry->event_type,
-                          entry->resource_id, entry->status_code};
-        for (int i = 0; i < 4; i++)
+        shard_broadcast(state, ROUTE_TICK, state->watermark);
+        state->next_eval_time = (state->watermark / EVAL_INTERVAL + 1) * EVAL_INTERVAL;
+    }
+}
+
+static void publish_entry(Publisher *pub, const LogEntry *parsed)
+{
+    /* Hold the event back until its replay time (no-op in max mode); what
+     * is staged goes out first rather than waiting out the sleep */
+    double wait = pace_delay(&pub->clk, pub->state->cfg.replay_speed, parsed->timestamp);
+    if (wait > 0.0)
+    {
+        shard_flush_all(pub->state);
+        sleep_seconds(wait);
+    }
+    route_log_entry(pub->state, parsed);
+}
+
+/* ─── Chunked parallel parsing of a memory-mapped file ───
+ * The mapping is cut into ~PARSE_CHUNK_BYTES pieces at newline boundaries.
+ * Workers claim the next piece, parse it into the slot's entry array, and the
+ * ingestion thread publishes slots strictly in file order. Workers only
+ * look strings up in the intern table; the ones it lacks are interned as
+ * their slot is published, which keeps ids in input order. At most
+ * PARSE_SLOTS_PER_THREAD pieces per worker are in flight, which bounds memory
+ * no matter how large the file is. A binary archive (archive.c) is cut at
+ * its block boundaries instead and each piece is one decoded block. A gzip
+ * file is inflated by its own reader thread (gzip.c), and each piece is one
+ * buffer of whole lines it filled. */
+
+#define PARSE_CHUNK_BYTES (1 << 20)
+#define PARSE_SLOTS_PER_THREAD 2
+
+typedef struct
+{
+    LogEntry *entries;
+    int count;
+    int cap;
+    InternDeferred strings; /* Not interned yet, left to the publisher */
+    int errors[PARSE_RESULT_COUNT];
+    int lines;         /* Lines looked at, comments and blanks included */
+    int out_of_range;  /* Entries dropped by --from/--until */
+    size_t end;        /* Offset just past the piece in the file */
+    uint64_t parse_ns; /* Time the worker spent on this piece */
+    size_t inflated;     /* Text bytes of a gzip piece */
+    uint64_t inflate_ns; /* Time the gzip reader spent on it */
+    int ready;
+} ParseSlot;
+
+typedef struct
+{
+    const EngineConfig *cfg;
+    const char *data;
+    size_t size;
+    int archive;        /* Pieces are archive blocks rather than lines */
+    GzipReader *gz;     /* Pieces come inflated from here instead */
+    size_t split_pos;   /* Start of the next unclaimed piece */
+    long blocks_skipped; /* Archive blocks outside the time range */
+    long next_claim;    /* Sequence number of the next unclaimed piece */
+    long next_publish;  /* Sequence number the publisher waits for */
+    int done_splitting;
+
+    ParseSlot *slots;
+    int slot_count;
+
+    pthread_mutex_t mu;
+    pthread_cond_t slot_ready; /* Worker -> publisher */
+    pthread_cond_t slot_free;  /* Publisher -> workers */
+} ParseJob;
+
+static void slot_reserve(ParseSlot *slot, int n)
+{
+    if (n <= slot->cap)
+        return;
+    while (slot->cap < n)
+        slot->cap = slot->cap ? slot->cap * 2 : 4096;
+    slot->entries = (LogEntry *)realloc(slot->entries, sizeof(LogEntry) * slot->cap);
+    if (!slot->entries)
+    {
+        perror("realloc parse slot");
+        exit(1);
+    }
+}
+
+static void slot_clear(ParseSlot *slot)
+{
+    intern_deferred_clear(&slot->strings);
+    slot->count = 0;
+    slot->lines = 0;
+    slot->out_of_range = 0;
+    slot->inflated = 0;
+    slot->inflate_ns = 0;
+    memset(slot->errors, 0, sizeof(slot->errors));
+}
+
+static void slot_free(ParseSlot *slot)
+{
+    free(slot->entries);
+    intern_deferred_free(&slot->strings);
+}
+
+static void parse_chunk(const char *p, const char *end, ParseSlot *slot)
+{
+    while (p < end)
+    {
+        const char *nl = memchr(p, '\n', (size_t)(end - p));
+        const char *line_end = nl ? nl + 1 : end;
+        size_t len = (size_t)(line_end - p);
+        slot->lines++;
+
+        if (!is_ignorable_line(p, len))
+        {
+            slot_reserve(slot, slot->count + 1);
+            ParseResult r = parse_log_line(p, len, &slot->entries[slot->count], &slot->strings);
+            if (r == PARSE_OK)
+                slot->count++;
+            else
+                slot->errors[r]++;
+        }
+        p = line_end;
+    }
+}
+
+static void decode_block(const char *data, const ArchiveBlock *blk, ParseSlot *slot)
+{
+    slot_reserve(slot, (int)blk->count);
+    if (archive_decode_block(data, blk, slot->entries, &slot->strings) != PARSE_OK)
+    {
+        slot->errors[PARSE_ERR_BAD_BLOCK]++;
+        return;
+    }
+    slot->count = (int)blk->count;
+    slot->lines = (int)blk->count;
+}
+
+/* Drop the entries outside --from/--until, keeping the order */
+static void keep_in_range(const EngineConfig *cfg, ParseSlot *slot)
+{
+    if (!cfg->from_time && !cfg->until_time)
+        return;
+    int kept = 0;
+    for (int i = 0; i < slot->count; i++)
+    {
+        if (in_time_range(cfg, slot->entries[i].timestamp))
+            slot->entries[kept++] = slot->entries[i];
+    }
+    slot->out_of_range = slot->count - kept;
+    slot->count = kept;
+}
+
+/* Claim the next text piece: ~PARSE_CHUNK_BYTES, extended to the end of its
+ * last line. Called with the job locked. */
+static void claim_lines(ParseJob *job, size_t *begin, size_t *end)
+{
+    *begin = job->split_pos;
+    *end = job->size;
+    size_t want = job->split_pos + PARSE_CHUNK_BYTES;
+    if (want < job->size)
+    {
+        const char *nl = memchr(job->data + want, '\n', job->size - want);
+        if (nl)
+            *end = (size_t)(nl + 1 - job->data);
+    }
+    job->split_pos = *end;
+}
+
+/* Claim the next archive block that overlaps the time range, stepping over
+ * those that do not by their headers alone. Called with the job locked.
+ * Returns 0 with nothing claimed at the end of the file, -1 on a corrupt
+ * block (the rest of the file is given up). */
+static int claim_block(ParseJob *job, ArchiveBlock *blk)
+{
+    const EngineConfig *cfg = job->cfg;
+    while (job->split_pos < job->size)
+    {
+        if (archive_block_at(job->data, job->size, job->split_pos, blk) != PARSE_OK)
+        {
+            job->split_pos = job->size;
+            return -1;
+        }
+        job->split_pos = blk->end;
+        if ((cfg->from_time && blk->max_time < cfg->from_time) ||
+            (cfg->until_time && blk->min_time > cfg->until_time))
+        {
+            job->blocks_skipped++;
+            continue;
+        }
+        return 1;
+    }
+    return 0;
+}
+
+static void *parse_worker(void *arg)
+{
+    ParseJob *job = (ParseJob *)arg;
+
+    pthread_mutex_lock(&job->mu);
+    while (1)
+    {
+        while (!job->done_splitting &&
+               job->next_claim >= job->next_publish + job->slot_count)
+        {
+            pthread_cond_wait(&job->slot_free, &job->mu);
+        }
+        if (job->done_splitting)
+            break;
+
+        /* Claim the next piece */
+        long seq = job->next_claim++;
+        size_t begin = 0, end = 0;
+        ArchiveBlock blk;
+        GzipPiece piece = {0};
+        int claimed = 1;
+        if (job->gz)
         {
-            char *p = fields[i];
-            while (*p == ' ')
+            /* Wait for the inflater unlocked, so the publisher is not held
+             * up. Pieces come out in stream order, which need not be the
+             * order workers claimed in, so the piece decides the slot. */
+            pthread_mutex_unlock(&job->mu);
+            claimed = gzip_next(job->gz, &piece);
+            pthread_mutex_lock(&job->mu);
+            if (!claimed)
             {
-                memmove(p, p + 1, strlen(p));
+                job->next_claim = piece.seq;
+                job->done_splitting = 1;
+                break;
             }
-            /* trim trailing spaces/newlines */
-            size_t len = strlen(p);
-            while (len > 0 && (p[len - 1] == ' ' || p[len - 1] == '\n' || p[len - 1] == '\r'))
-                p[--len] = '\0';
+            seq = piece.seq;
         }
+        else if (job->archive)
+            claimed = claim_block(job, &blk);
+        else
+            claim_lines(job, &begin, &end);
+        if (!job->gz && job->split_pos >= job->size)
+            job->done_splitting = 1;
+
+        ParseSlot *slot = &job->slots[seq % job->slot_count];
+        slot->end = job->gz ? piece.end : job->split_pos;
+        pthread_mutex_unlock(&job->mu);
+
+        uint64_t t0 = now_ns();
+        slot_clear(slot);
+        slot->inflated = piece.len;
+        slot->inflate_ns = piece.inflate_ns;
+        if (job->gz)
+            parse_chunk(piece.data, piece.data + piece.len, slot);
+        else if (!job->archive)
+            parse_chunk(job->data + begin, job->data + end, slot);
+        else if (claimed > 0)
+            decode_block(job->data, &blk, slot);
+        else if (claimed < 0)
+            slot->errors[PARSE_ERR_BAD_BLOCK]++;
+        keep_in_range(job->cfg, slot);
+        slot->parse_ns = now_ns() - t0;
+
+        pthread_mutex_lock(&job->mu);
+        slot->ready = 1;
+        pthread_cond_broadcast(&job->slot_ready);
+    }
+    pthread_cond_broadcast(&job->slot_free);
+    pthread_cond_broadcast(&job->slot_ready);
+    pthread_mutex_unlock(&job->mu);
+    return NULL;
+}
+
+/* Publish one parsed piece and account for it. The strings the worker
+ * left are interned here, entry by entry. */
+static void publish_slot(Publisher *pub, ParseSlot *slot)
+{
+    for (int i = 0; i < slot->count; i++)
+    {
+        LogEntry *e = &slot->entries[i];
+        e->ip_id = intern_resolve(&slot->strings, e->ip_id);
+        e->resource_id = intern_resolve(&slot->strings, e->resource_id);
+        publish_entry(pub, e);
+    }
+    for (int r = 1; r < PARSE_RESULT_COUNT; r++)
+    {
+        pub->state->parse_errors[r] += slot->errors[r];
+        counter_add(&pub->state->ingest_metrics.parse_errors[r], (uint64_t)slot->errors[r]);
     }
+    hist_record(&pub->state->ingest_metrics.parse_chunk_ns, slot->parse_ns);
+    counter_add(&pub->state->ingest_metrics.lines_parsed, (uint64_t)slot->lines);
+    counter_add(&pub->state->ingest_metrics.events_out_of_range, (uint64_t)slot->out_of_range);
 
-    return entry;
+    /* A piece boundary is a clean place to resume from */
+    if (checkpoint_due(pub->state))
+        checkpoint_begin(pub->state, pub->input_index, pub->input_base + slot->end,
+                         pub->input_ino, 0);
 }
 
-void *ingestion_thread(void *arg)
+/* Parse (or decode, for an archive) one mapped file from byte `start` on
+ * `threads` workers, publishing in file order. With `gz` set, the pieces
+ * come from that reader instead of the mapping. */
+static void ingest_mapped(Publisher *pub, const char *data, size_t size, size_t start,
+                          GzipReader *gz, int threads)
 {
-    SharedState *state = (SharedState *)arg;
+    ParseJob job = {0};
+    job.cfg = &pub->state->cfg;
+    job.data = data;
+    job.size = size;
+    job.gz = gz;
+    job.archive = !gz && archive_is(data, size);
+    job.split_pos = job.archive && start < archive_first_block() ? archive_first_block() : start;
+    job.slot_count = threads * PARSE_SLOTS_PER_THREAD;
+    job.slots = (ParseSlot *)calloc((size_t)job.slot_count, sizeof(ParseSlot));
+    if (!job.slots)
+    {
+        perror("calloc parse slots");
+        exit(1);
+    }
+    pthread_mutex_init(&job.mu, NULL);
+    pthread_cond_init(&job.slot_ready, NULL);
+    pthread_cond_init(&job.slot_free, NULL);
 
-    /* Try to open the log file */
-    FILE *fp = fopen("sample_logs.txt", "r");
-    if (!fp)
+    pthread_t *workers = (pthread_t *)malloc(sizeof(pthread_t) * threads);
+    if (!workers)
+    {
+        perror("malloc parse workers");
+        exit(1);
+    }
+    for (int i = 0; i < threads; i++)
     {
-        /* If file doesn't exist, create a simple test file */
-        printf("sample_logs.txt not found. Creating test data...\n");
-        fp = fopen("sample_logs.txt", "w");
-        if (!fp)
+        if (pthread_create(&workers[i], NULL, parse_worker, &job) != 0)
         {
-            perror("fopen");
+            perror("pthread_create parse worker");
             exit(1);
         }
+    }
 
-        /* Generate some test logs */
-        time_t base = time(NULL) - 600; /* 10 minutes ago */
-        for (int i = 0; i < 100; i++)
+    pthread_mutex_lock(&job.mu);
+    while (1)
+    {
+        ParseSlot *slot = &job.slots[job.next_publish % job.slot_count];
+        if (!slot->ready)
         {
-            fprintf(fp, "%ld, %d, 192.168.1.%d, %s, %s, %s\n",
-                    (long)(base + i * 2),
-                    (i % 5) + 100, /* users 100-104 */
-                    (i % 10) + 1,
-                    (i % 3 == 0) ? "LOGIN" : (i % 3 == 1) ? "FILE_ACCESS"
-                                                          : "API_CALL",
-                    (i % 2 == 0) ? "res_1" : "res_2",
-                    (i % 4 == 0) ? "FAILED" : "SUCCESS");
+            /* About to wait for the parsers: publish what is staged first */
+            pthread_mutex_unlock(&job.mu);
+            shard_flush_all(pub->state);
+            pthread_mutex_lock(&job.mu);
         }
-        fclose(fp);
+        while (!slot->ready && job.next_publish < job.next_claim + !job.done_splitting)
+        {
+            pthread_cond_wait(&job.slot_ready, &job.mu);
+        }
+        if (!slot->ready)
+            break; /* Every claimed piece has been published */
+        pthread_mutex_unlock(&job.mu);
 
-        /* Reopen for reading */
-        fp = fopen("sample_logs.txt", "r");
-        if (!fp)
+        publish_slot(pub, slot);
+        if (job.gz)
         {
-            perror("fopen");
-            exit(1);
+            hist_record(&pub->state->ingest_metrics.inflate_ns, slot->inflate_ns);
+            counter_add(&pub->state->ingest_metrics.bytes_inflated, slot->inflated);
+            gzip_release(job.gz);
         }
+
+        pthread_mutex_lock(&job.mu);
+        slot->ready = 0;
+        job.next_publish++;
+        pthread_cond_broadcast(&job.slot_free);
     }
+    pthread_mutex_unlock(&job.mu);
 
-    char line[256];
-    while (fgets(line, sizeof(line), fp))
+    for (int i = 0; i < threads; i++)
     {
-        if (line[0] == '\n' || line[0] == '#')
-            continue;
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+    counter_add(&pub->state->ingest_metrics.blocks_skipped, (uint64_t)job.blocks_skipped);
 
-        LogEntry *entry = parse_log_line(line);
-        if (!entry)
-            continue;
+    for (int i = 0; i < job.slot_count; i++)
+    {
+        slot_free(&job.slots[i]);
+    }
+    free(job.slots);
+    pthread_mutex_destroy(&job.mu);
+    pthread_cond_destroy(&job.slot_ready);
+    pthread_cond_destroy(&job.slot_free);
+}
 
-        pthread_mutex_lock(&state->lock);
+/* Map a whole input file read-only and hand it to the parse workers,
+ * starting at byte `start` (a resume point) unless the file is no longer
+ * inode `ino`. A gzip file is inflated on the way, and `start` counts
+ * inflated bytes. */
+static int ingest_file(Publisher *pub, const char *path, size_t start, uint64_t ino)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
 
-        /* Insert at head (newest) */
-        entry->next = state->head;
-        entry->prev = NULL;
-        if (state->head)
-            state->head->prev = entry;
-        state->head = entry;
-        if (!state->tail)
-            state->tail = entry;
-        state->log_count++;
-        state->total_logs_processed++;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        fprintf(stderr, "Cannot read %s: not a regular file\n", path);
+        close(fd);
+        return -1;
+    }
+    pub->input_ino = (uint64_t)st.st_ino;
+    if (start > 0 && ino && (uint64_t)st.st_ino != ino)
+    {
+        log_info("%s was replaced since it was checkpointed; reading it from the start\n", path);
+        start = 0;
+    }
+    if (st.st_size == 0)
+    {
+        if (start > 0)
+            log_info("%s is shorter than when it was checkpointed; reading it from the start\n",
+                     path);
+        pub->input_end = 0;
+        close(fd);
+        return 0;
+    }
 
-        pthread_cond_signal(&state->cond_new_log);
-        pthread_mutex_unlock(&state->lock);
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        fprintf(stderr, "Cannot mmap %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+    int threads = pub->state->cfg.parse_threads;
 
-        /* Small delay to simulate real-time */
-        usleep(10000); /* 10 ms */
+    int rc = 0;
+    if (gzip_is((const char *)map, (size_t)st.st_size))
+    {
+        GzipReader *gz = gzip_open((const char *)map, (size_t)st.st_size, start,
+                                   threads * PARSE_SLOTS_PER_THREAD + 1);
+        ingest_mapped(pub, NULL, 0, 0, gz, threads);
+        pub->input_end = gzip_inflated(gz);
+        const char *err = gzip_error(gz);
+        if (err)
+        {
+            fprintf(stderr, "Cannot decompress %s: %s\n", path, err);
+            rc = -1;
+        }
+        gzip_close(gz);
+    }
+    else
+    {
+        if ((size_t)st.st_size < start)
+        {
+            log_info("%s is shorter than when it was checkpointed; reading it from the start\n",
+                     path);
+            start = 0;
+        }
+        if ((size_t)st.st_size > start)
+            ingest_mapped(pub, (const char *)map, (size_t)st.st_size, start, NULL, threads);
+        pub->input_end = (uint64_t)st.st_size;
     }
 
-    fclose(fp);
+    munmap(map, (size_t)st.st_size);
+    return rc;
+}
+
+/* ─── Follow mode ───
+ * With --follow the last input is read like tail -F. At its end the
+ * ingestion thread sleeps on inotify until the file grows, is truncated
+ * (its size drops below what was read: read it again from the start) or is
+ * rotated (the path names another inode: finish the old file, then read
+ * the new one from the start). A missing file is waited for. Only whole
+ * lines are read, so a line still being written is picked up once its
+ * newline is, and an offset recorded in a checkpoint is always the start of
+ * a line. A backlog of more than one chunk goes to the parse workers; a few
+ * appended lines are parsed right here. Reads use pread rather than mmap, so
+ * a truncation under our feet cannot fault. Runs until main signals
+ * stop_fd. */
+
+#define FOLLOW_READ_BYTES (16 << 20)
+
+typedef struct
+{
+    const char *path;
+    int fd; /* -1 while the path is missing */
+    uint64_t ino;
+    dev_t dev;
+    uint64_t offset; /* Bytes of it read: always the end of a line */
+    int inotify;
+    int file_watch;
+    char *buf;
+    size_t cap;
+    ParseSlot slot;
+} Follower;
+
+static int follow_open(Follower *f)
+{
+    f->fd = open(f->path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (f->fd < 0 || fstat(f->fd, &st) != 0)
+    {
+        if (f->fd >= 0)
+            close(f->fd);
+        f->fd = -1;
+        return -1;
+    }
+    f->ino = (uint64_t)st.st_ino;
+    f->dev = st.st_dev;
+    f->offset = 0;
+    f->file_watch = inotify_add_watch(f->inotify, f->path,
+                                      IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF);
+    return 0;
+}
+
+static void follow_close(Follower *f)
+{
+    if (f->fd < 0)
+        return;
+    if (f->file_watch >= 0)
+        inotify_rm_watch(f->inotify, f->file_watch);
+    close(f->fd);
+    f->fd = -1;
+}
+
+/* Read and publish every whole line past f->offset. With `final` (the file
+ * has been rotated away) an unterminated last line is taken as well. */
+static void follow_read(Publisher *pub, Follower *f, int final)
+{
+    while (f->fd >= 0)
+    {
+        ssize_t n = pread(f->fd, f->buf, f->cap, (off_t)f->offset);
+        if (n <= 0)
+            return;
+        size_t len = (size_t)n;
+        while (len > 0 && f->buf[len - 1] != '\n')
+            len--;
+        if (len == 0)
+        {
+            if ((size_t)n == f->cap)
+            {
+                /* One line longer than the buffer */
+                f->cap *= 2;
+                f->buf = (char *)realloc(f->buf, f->cap);
+                if (!f->buf)
+                {
+                    perror("realloc follow buffer");
+                    exit(1);
+                }
+                continue;
+            }
+            if (!final)
+                return;
+            len = (size_t)n;
+        }
+
+        pub->input_ino = f->ino;
+        pub->input_base = f->offset;
+        if (len > PARSE_CHUNK_BYTES)
+        {
+            ingest_mapped(pub, f->buf, len, 0, NULL, pub->state->cfg.parse_threads);
+        }
+        else
+        {
+            ParseSlot *slot = &f->slot;
+            uint64_t t0 = now_ns();
+            slot_clear(slot);
+            parse_chunk(f->buf, f->buf + len, slot);
+            keep_in_range(&pub->state->cfg, slot);
+            slot->parse_ns = now_ns() - t0;
+            slot->end = len;
+            publish_slot(pub, slot);
+        }
+        pub->input_base = 0;
+        f->offset += len;
+    }
+}
+
+/* After an inotify wake-up: read what was appended, then look for a
+ * truncation or a rotation */
+static void follow_check(Publisher *pub, Follower *f)
+{
+    struct stat st;
+    if (f->fd >= 0)
+    {
+        if (fstat(f->fd, &st) == 0 && (uint64_t)st.st_size < f->offset)
+        {
+            log_info("\n%s was truncated; reading it from the start\n", f->path);
+            f->offset = 0;
+        }
+        follow_read(pub, f, 0);
+    }
+
+    if (stat(f->path, &st) != 0 ||
+        (f->fd >= 0 && (uint64_t)st.st_ino == f->ino && st.st_dev == f->dev))
+        return;
+    if (f->fd >= 0)
+    {
+        follow_read(pub, f, 1);
+        follow_close(f);
+        log_info("\n%s was rotated; following the new file\n", f->path);
+    }
+    if (follow_open(f) == 0)
+        follow_read(pub, f, 0);
+}
+
+/* Read `path` from `start` (unless it is no longer inode `ino`) and keep
+ * reading it as it grows, until a stop is requested */
+static void follow_input(Publisher *pub, const char *path, uint64_t start, uint64_t ino)
+{
+    Follower f = {.path = path, .fd = -1, .file_watch = -1};
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s", path);
+    f.inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (f.inotify < 0 || inotify_add_watch(f.inotify, dirname(dir), IN_CREATE | IN_MOVED_TO) < 0)
+    {
+        fprintf(stderr, "Cannot watch %s: %s; reading it once\n", path, strerror(errno));
+        if (f.inotify >= 0)
+            close(f.inotify);
+        ingest_file(pub, path, (size_t)start, ino);
+        return;
+    }
+
+    struct stat st;
+    char magic[16];
+    ssize_t got = follow_open(&f) == 0 ? pread(f.fd, magic, sizeof(magic), 0) : 0;
+    if (f.fd < 0)
+    {
+        log_info("Waiting for %s to appear\n", path);
+    }
+    else if (got > 0 && (gzip_is(magic, (size_t)got) || archive_is(magic, (size_t)got)))
+    {
+        log_info("%s is compressed or an archive; reading it without following\n", path);
+        follow_close(&f);
+        close(f.inotify);
+        ingest_file(pub, path, (size_t)start, ino);
+        return;
+    }
+    else if (start > 0 && ino && f.ino != ino)
+    {
+        log_info("%s was replaced since it was checkpointed; reading it from the start\n", path);
+    }
+    else if (fstat(f.fd, &st) == 0 && (uint64_t)st.st_size < start)
+    {
+        log_info("%s is shorter than when it was checkpointed; reading it from the start\n",
+                 path);
+    }
+    else
+    {
+        f.offset = start;
+    }
+
+    f.cap = FOLLOW_READ_BYTES;
+    f.buf = (char *)malloc(f.cap);
+    if (!f.buf)
+    {
+        perror("malloc follow buffer");
+        exit(1);
+    }
+    follow_read(pub, &f, 0);
+
+    struct pollfd fds[2] = {{.fd = f.inotify, .events = POLLIN},
+                            {.fd = pub->state->stop_fd, .events = POLLIN}};
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    while (1)
+    {
+        /* Nothing staged waits for the next write */
+        shard_flush_all(pub->state);
+        if (poll(fds, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            break;
+        }
+        if (fds[1].revents)
+            break;
+        while (read(f.inotify, events, sizeof(events)) > 0)
+            ; /* Whatever happened, follow_check looks at the file itself */
+        follow_check(pub, &f);
+    }
+
+    pub->input_ino = f.ino;
+    pub->input_end = f.offset;
+    follow_close(&f);
+    close(f.inotify);
+    free(f.buf);
+    slot_free(&f.slot);
+}
+
+/* ─── Network input ───
+ * With --listen, once the files are read, the ingestion thread serves the
+ * listener (listen.c) until a stop is requested. Each wake-up's messages
+ * are parsed as one chunk. Before sleeping, whatever is staged goes out. */
+static void listen_input(Publisher *pub)
+{
+    SharedState *state = pub->state;
+    ParseSlot slot = {0};
+    const char *text;
+    long n;
+    int timeout = 0;
+    pub->input_ino = 0;
+    while ((n = listener_read(state->listener, timeout, &text)) >= 0)
+    {
+        if (n == 0)
+        {
+            /* Nothing more right now */
+            shard_flush_all(state);
+            timeout = -1;
+            continue;
+        }
+        timeout = 0;
+        uint64_t t0 = now_ns();
+        slot_clear(&slot);
+        parse_chunk(text, text + n, &slot);
+        keep_in_range(&state->cfg, &slot);
+        slot.parse_ns = now_ns() - t0;
+        slot.end = 0; /* A restart listens afresh */
+        publish_slot(pub, &slot);
+    }
+    slot_free(&slot);
+}
+
+/* ─── Merged inputs ───
+ * With --merge every input is read at once by a thread of its own (merge.c)
+ * and what is published is their merge by event time. */
+static void ingest_merged(Publisher *pub)
+{
+    MergeSet *m = merge_open(pub->state);
+    LogEntry entry;
+    int rc;
+    while ((rc = merge_next(m, &entry, 0)) != 0)
+    {
+        if (rc < 0)
+        {
+            /* About to wait for a reader: publish what is staged first */
+            shard_flush_all(pub->state);
+            if (merge_next(m, &entry, 1) == 0)
+                break;
+        }
+        publish_entry(pub, &entry);
+    }
+    merge_close(m);
+}
+
+/* Inputs in reading order, the listener last; with neither given, the
+ * bundled sample file */
+int input_total(const EngineConfig *cfg)
+{
+    if (cfg->listen_count > 0)
+        return cfg->input_count + 1;
+    return cfg->input_count > 0 ? cfg->input_count : 1;
+}
+
+const char *input_path_at(const EngineConfig *cfg, int i)
+{
+    if (i < cfg->input_count)
+        return cfg->input_paths[i];
+    return cfg->listen_count > 0 ? cfg->listen_specs[0] : DEFAULT_INPUT;
+}
+
+void *ingestion_thread(void *arg)
+{
+    SharedState *state = (SharedState *)arg;
+    Publisher pub = {.state = state};
+
+    /* No inputs given: fall back to the bundled sample file */
+    if (state->cfg.input_count == 0 && state->cfg.listen_count == 0 &&
+        access(DEFAULT_INPUT, F_OK) != 0)
+        create_test_logs(DEFAULT_INPUT);
+
+    int total = input_total(&state->cfg);
+    if (state->cfg.merge)
+    {
+        ingest_merged(&pub);
+    }
+    else
+    {
+        /* After a restore, pick up where the checkpoint left off */
+        for (int i = state->resume_index; i < total; i++)
+        {
+            const char *path = input_path_at(&state->cfg, i);
+            uint64_t start = i == state->resume_index ? state->resume_offset : 0;
+            uint64_t ino = i == state->resume_index ? state->resume_ino : 0;
+            pub.input_index = i;
+            pub.input_end = 0;
+            if (state->cfg.listen_count && i == state->cfg.input_count)
+                listen_input(&pub);
+            else if (state->cfg.follow && i == total - 1)
+                follow_input(&pub, path, start, ino);
+            else
+                ingest_file(&pub, path, (size_t)start, ino);
+        }
+    }
 
-    pthread_mutex_lock(&state->lock);
     state->ingestion_done = 1;
-    pthread_cond_signal(&state->cond_new_log);
-    pthread_mutex_unlock(&state->lock);
+    if (state->checkpoint.running)
+    {
+        /* The last checkpoint is taken after the final evaluation, at the
+         * end of the last input, so a restart only reads what is appended */
+        checkpoint_wait(state);
+        checkpoint_begin(state, total - 1, pub.input_end, pub.input_ino, ROUTE_STOP);
+    }
+    else
+    {
+        shard_broadcast(state, ROUTE_STOP, state->watermark);
+        shard_flush_all(state);
+    }
 
-    printf("\nIngestion complete. %d logs loaded.\n", state->total_logs_processed);
+    log_info("\nIngestion complete. %d logs loaded.\n", state->total_logs_processed);
+    for (int r = 1; r < PARSE_RESULT_COUNT; r++)
+    {
+        if (state->parse_errors[r] > 0)
+            log_info("  Skipped %d malformed lines: %s\n",
+                   state->parse_errors[r], parse_result_str((ParseResult)r));
+    }
+    unsigned long long out_of_range = atomic_load(&state->ingest_metrics.events_out_of_range);
+    unsigned long long unread = atomic_load(&state->ingest_metrics.blocks_skipped);
+    if (out_of_range > 0 || unread > 0)
+        log_info("  Skipped %llu events outside the time range (%llu archive blocks unread)\n",
+                 out_of_range, unread);
     return NULL;
-}
\ No newline at end of file
+}
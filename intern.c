@@ -0,0 +1,374 @@
+#include "structures.h"
+#include <stdatomic.h>
+
+/*
+ * Global string interning table. IPs and resource names are mapped to dense
+ * 32-bit ids once, at parse time, so the window and the stats only ever
+ * compare integers. Ids are never recycled; the strings live until
+ * intern_destroy() at shutdown.
+ *
+ * Ids are handed out in input order, so they are the same from run to run
+ * whatever the thread timing: a parse worker only looks strings up, and
+ * what it does not find goes into an InternDeferred list that the thread
+ * publishing the entries resolves, in order (intern_resolve()). Lookups and
+ * inserts still run concurrently, so the table is split into stripes by
+ * hash, each with its own lock, open-addressing index and string arena.
+ * Reverse lookups (id -> string) go through a two-level page directory whose
+ * pages never move, so intern_str() needs no lock. Each string is stored
+ * after a 64-bit hash of its bytes (intern_hash64()), for the consumers
+ * that need a hash independent of the id. Pages and strings are
+ * published with release stores, so intern_peek() can also read ids that
+ * another thread has just handed out.
+ */
+
+#define INTERN_STRIPES 64
+#define INTERN_PAGE_BITS 12
+#define INTERN_PAGE_SIZE (1u << INTERN_PAGE_BITS)
+#define INTERN_MAX_PAGES (1u << 16) /* 2^28 distinct strings */
+#define INTERN_ARENA_CHUNK (64 * 1024)
+
+typedef struct
+{
+    uint32_t hash;
+    uint32_t len;
+    uint32_t id;
+    const char *str;
+} InternSlot;
+
+typedef struct InternChunk
+{
+    struct InternChunk *next;
+    size_t used;
+    size_t cap;
+    char data[];
+} InternChunk;
+
+typedef struct
+{
+    pthread_mutex_t lock;
+    InternSlot *slots; /* str == NULL marks an empty slot */
+    uint32_t cap;      /* Power of two */
+    uint32_t count;
+    InternChunk *arena;
+} InternStripe;
+
+static InternStripe stripes[INTERN_STRIPES];
+static _Atomic(_Atomic(const char *) *) pages[INTERN_MAX_PAGES];
+static pthread_mutex_t page_lock = PTHREAD_MUTEX_INITIALIZER;
+static atomic_uint next_id;
+
+/* FNV-1a; stripes use the low bits, slots the high ones */
+static uint32_t intern_hash(const char *s, size_t len)
+{
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; i++)
+    {
+        h ^= (unsigned char)s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/* FNV-1a 64 with a splitmix64 finish, so every output bit depends on
+ * every input byte */
+static uint64_t string_hash64(const char *s, size_t len)
+{
+    uint64_t z = 14695981039346656037ull;
+    for (size_t i = 0; i < len; i++)
+    {
+        z ^= (unsigned char)s[i];
+        z *= 1099511628211ull;
+    }
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+/* Copy the string into the arena behind its 64-bit hash */
+static const char *arena_copy(InternStripe *st, const char *s, size_t len)
+{
+    InternChunk *c = st->arena;
+    size_t need = sizeof(uint64_t) + len + 1;
+    size_t at = c ? (c->used + sizeof(uint64_t) - 1) & ~(sizeof(uint64_t) - 1) : 0;
+    if (!c || at > c->cap || c->cap - at < need)
+    {
+        size_t cap = need > INTERN_ARENA_CHUNK ? need : INTERN_ARENA_CHUNK;
+        c = (InternChunk *)malloc(sizeof(InternChunk) + cap);
+        if (!c)
+        {
+            perror("malloc intern arena");
+            exit(1);
+        }
+        c->next = st->arena;
+        c->used = 0;
+        c->cap = cap;
+        st->arena = c;
+        at = 0;
+    }
+
+    uint64_t h = string_hash64(s, len);
+    memcpy(c->data + at, &h, sizeof(h));
+    char *dst = c->data + at + sizeof(uint64_t);
+    memcpy(dst, s, len);
+    dst[len] = '\0';
+    c->used = at + need;
+    return dst;
+}
+
+static void stripe_grow(InternStripe *st)
+{
+    uint32_t new_cap = st->cap ? st->cap * 2 : 256;
+    InternSlot *slots = (InternSlot *)calloc(new_cap, sizeof(InternSlot));
+    if (!slots)
+    {
+        perror("calloc intern stripe");
+        exit(1);
+    }
+
+    for (uint32_t i = 0; i < st->cap; i++)
+    {
+        if (!st->slots[i].str)
+            continue;
+        uint32_t pos = (st->slots[i].hash >> 6) & (new_cap - 1);
+        while (slots[pos].str)
+            pos = (pos + 1) & (new_cap - 1);
+        slots[pos] = st->slots[i];
+    }
+    free(st->slots);
+    st->slots = slots;
+    st->cap = new_cap;
+}
+
+static void publish_string(uint32_t id, const char *str)
+{
+    uint32_t page = id >> INTERN_PAGE_BITS;
+    if (page >= INTERN_MAX_PAGES)
+    {
+        fprintf(stderr, "Intern table full (%u strings)\n", id);
+        exit(1);
+    }
+
+    _Atomic(const char *) *slots = atomic_load_explicit(&pages[page], memory_order_acquire);
+    if (!slots)
+    {
+        pthread_mutex_lock(&page_lock);
+        slots = atomic_load_explicit(&pages[page], memory_order_relaxed);
+        if (!slots)
+        {
+            slots = (_Atomic(const char *) *)calloc(INTERN_PAGE_SIZE, sizeof(*slots));
+            if (!slots)
+            {
+                perror("calloc intern page");
+                exit(1);
+            }
+            atomic_store_explicit(&pages[page], slots, memory_order_release);
+        }
+        pthread_mutex_unlock(&page_lock);
+    }
+    atomic_store_explicit(&slots[id & (INTERN_PAGE_SIZE - 1)], str, memory_order_release);
+}
+
+void intern_init(void)
+{
+    for (int i = 0; i < INTERN_STRIPES; i++)
+    {
+        memset(&stripes[i], 0, sizeof(InternStripe));
+        pthread_mutex_init(&stripes[i].lock, NULL);
+    }
+    atomic_store(&next_id, 0);
+
+    /* "-" (no resource) is always id 0 == RESOURCE_NONE */
+    intern_bytes("-", 1);
+}
+
+/* Slot of the string in the stripe, or the empty slot where it goes.
+ * Called with the stripe locked. */
+static InternSlot *stripe_find(InternStripe *st, uint32_t h, const char *s, size_t len)
+{
+    uint32_t pos = (h >> 6) & (st->cap - 1);
+    while (st->slots[pos].str)
+    {
+        InternSlot *slot = &st->slots[pos];
+        if (slot->hash == h && slot->len == len && memcmp(slot->str, s, len) == 0)
+            return slot;
+        pos = (pos + 1) & (st->cap - 1);
+    }
+    return &st->slots[pos];
+}
+
+static uint32_t intern_hashed(const char *s, size_t len, uint32_t h)
+{
+    InternStripe *st = &stripes[h & (INTERN_STRIPES - 1)];
+
+    pthread_mutex_lock(&st->lock);
+
+    if (st->count * 4 >= st->cap * 3)
+        stripe_grow(st);
+
+    InternSlot *slot = stripe_find(st, h, s, len);
+    if (!slot->str)
+    {
+        uint32_t id = atomic_fetch_add(&next_id, 1);
+        const char *copy = arena_copy(st, s, len);
+        publish_string(id, copy);
+
+        slot->hash = h;
+        slot->len = (uint32_t)len;
+        slot->id = id;
+        slot->str = copy;
+        st->count++;
+    }
+    uint32_t id = slot->id;
+
+    pthread_mutex_unlock(&st->lock);
+    return id;
+}
+
+uint32_t intern_bytes(const char *s, size_t len)
+{
+    return intern_hashed(s, len, intern_hash(s, len));
+}
+
+/* ─── Deferred interning ─── */
+
+static void deferred_grow(InternDeferred *d)
+{
+    uint32_t cap = d->cap ? d->cap * 2 : 64;
+    d->strs = (DeferredStr *)realloc(d->strs, sizeof(DeferredStr) * cap);
+    uint32_t *index = (uint32_t *)calloc((size_t)cap * 2, sizeof(uint32_t));
+    if (!d->strs || !index)
+    {
+        perror("realloc intern deferred");
+        exit(1);
+    }
+    for (uint32_t i = 0; i < d->count; i++)
+    {
+        uint32_t pos = d->strs[i].hash & (cap * 2 - 1);
+        while (index[pos])
+            pos = (pos + 1) & (cap * 2 - 1);
+        index[pos] = i + 1;
+    }
+    free(d->index);
+    d->index = index;
+    d->cap = cap;
+}
+
+/* Id of the string if it is interned already, else INTERN_PENDING | its
+ * index in `d`, where each distinct string is kept once. The bytes are not
+ * copied: they must stay put until the list is resolved or cleared. */
+uint32_t intern_defer(InternDeferred *d, const char *s, size_t len)
+{
+    uint32_t h = intern_hash(s, len);
+    InternStripe *st = &stripes[h & (INTERN_STRIPES - 1)];
+
+    pthread_mutex_lock(&st->lock);
+    InternSlot *slot = st->cap ? stripe_find(st, h, s, len) : NULL;
+    uint32_t id = slot && slot->str ? slot->id : INTERN_PENDING;
+    pthread_mutex_unlock(&st->lock);
+    if (id != INTERN_PENDING)
+        return id;
+
+    if (d->count == d->cap)
+        deferred_grow(d);
+    uint32_t mask = d->cap * 2 - 1;
+    uint32_t pos = h & mask;
+    while (d->index[pos])
+    {
+        DeferredStr *ds = &d->strs[d->index[pos] - 1];
+        if (ds->hash == h && ds->len == len && memcmp(ds->str, s, len) == 0)
+            return INTERN_PENDING | (d->index[pos] - 1);
+        pos = (pos + 1) & mask;
+    }
+    DeferredStr *ds = &d->strs[d->count];
+    ds->str = s;
+    ds->len = (uint32_t)len;
+    ds->hash = h;
+    ds->id = INTERN_PENDING;
+    d->index[pos] = ++d->count;
+    return INTERN_PENDING | (d->count - 1);
+}
+
+/* The id behind what intern_defer() returned, interning the string on
+ * first use. Called in input order, this is what gives new strings their
+ * ids. */
+uint32_t intern_resolve(InternDeferred *d, uint32_t ref)
+{
+    if (!(ref & INTERN_PENDING))
+        return ref;
+    DeferredStr *ds = &d->strs[ref & ~INTERN_PENDING];
+    if (ds->id == INTERN_PENDING)
+        ds->id = intern_hashed(ds->str, ds->len, ds->hash);
+    return ds->id;
+}
+
+void intern_deferred_clear(InternDeferred *d)
+{
+    if (d->count)
+        memset(d->index, 0, sizeof(uint32_t) * d->cap * 2);
+    d->count = 0;
+}
+
+void intern_deferred_free(InternDeferred *d)
+{
+    free(d->strs);
+    free(d->index);
+    memset(d, 0, sizeof(*d));
+}
+
+const char *intern_str(uint32_t id)
+{
+    _Atomic(const char *) *page = atomic_load_explicit(&pages[id >> INTERN_PAGE_BITS],
+                                                       memory_order_acquire);
+    return page ? atomic_load_explicit(&page[id & (INTERN_PAGE_SIZE - 1)], memory_order_acquire)
+                : "?";
+}
+
+/* Like intern_str(), but NULL for an id that is handed out and not yet
+ * published by the thread interning it */
+const char *intern_peek(uint32_t id)
+{
+    _Atomic(const char *) *page = atomic_load_explicit(&pages[id >> INTERN_PAGE_BITS],
+                                                       memory_order_acquire);
+    return page ? atomic_load_explicit(&page[id & (INTERN_PAGE_SIZE - 1)], memory_order_acquire)
+                : NULL;
+}
+
+/* 64-bit hash of the string's bytes: the same for the same string in every
+ * run, whatever id it got */
+uint64_t intern_hash64(uint32_t id)
+{
+    const char *str = intern_peek(id);
+    uint64_t h = 0;
+    if (str)
+        memcpy(&h, str - sizeof(uint64_t), sizeof(h));
+    return h;
+}
+
+uint32_t intern_count(void)
+{
+    return atomic_load(&next_id);
+}
+
+void intern_destroy(void)
+{
+    for (int i = 0; i < INTERN_STRIPES; i++)
+    {
+        InternStripe *st = &stripes[i];
+        InternChunk *c = st->arena;
+        while (c)
+        {
+            InternChunk *tmp = c;
+            c = c->next;
+            free(tmp);
+        }
+        free(st->slots);
+        pthread_mutex_destroy(&st->lock);
+        memset(st, 0, sizeof(*st));
+    }
+
+    for (uint32_t p = 0; p < INTERN_MAX_PAGES && atomic_load(&pages[p]); p++)
+    {
+        free((void *)atomic_load(&pages[p]));
+        atomic_store(&pages[p], NULL);
+    }
+}
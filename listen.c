@@ -0,0 +1,610 @@
+#define _GNU_SOURCE /* accept4, recvmmsg */
+#include "structures.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+/*
+ * Network input (--listen).
+ *
+ * One epoll loop, run by the ingestion thread, serves every listening
+ * socket and connection: TCP or Unix stream connections and UDP or Unix
+ * datagram sockets. Sockets are level-triggered and each gets at most one
+ * read per wake-up, so a busy sender cannot starve the others. A stream
+ * connection keeps its own buffer, holding whatever partial message its last
+ * read ended in.
+ *
+ * A stream carries messages either one per line or, as syslog over TCP
+ * does, octet-counted ("<len> <message>", RFC 6587); a datagram holds one
+ * or more lines. A message is a log line as in a file, or an RFC 5424
+ * syslog message whose MSG part is one: the header and structured data are
+ * stripped. Everything received in one wake-up comes out of listener_read
+ * as one run of newline-terminated lines, which ingestion parses and
+ * publishes like a chunk of a file.
+ */
+
+#define LISTEN_CONN_BYTES (64 << 10)  /* Initial buffer of a stream connection */
+#define LISTEN_LINE_MAX (1 << 20)     /* Longer messages are dropped */
+#define LISTEN_DGRAM_BYTES 65536      /* Largest datagram */
+#define LISTEN_DGRAM_BATCH 32         /* Datagrams taken per recvmmsg */
+#define LISTEN_OUT_BYTES (4 << 20)    /* Text gathered before listener_read returns */
+#define LISTEN_EVENTS 256
+#define LISTEN_RCVBUF (8 << 20)       /* Asked for on datagram sockets */
+
+typedef enum
+{
+    ROLE_STOP = 0,   /* The stop pipe */
+    ROLE_ACCEPT,     /* Listening stream socket */
+    ROLE_DGRAM,      /* Bound datagram socket */
+    ROLE_CONN        /* Accepted stream connection */
+} SocketRole;
+
+/* Registered with epoll; a Conn starts with one */
+typedef struct
+{
+    int fd;
+    SocketRole role;
+    char name[128]; /* As given to --listen */
+    char unix_path[sizeof(((struct sockaddr_un *)0)->sun_path)]; /* Removed on close */
+} Endpoint;
+
+typedef struct Conn
+{
+    Endpoint ep;
+    char *buf;
+    size_t len;
+    size_t cap;
+    int discarding; /* Dropping the rest of an overlong line */
+    size_t skip;    /* Bytes of an overlong counted frame still to drop */
+    struct Conn *prev, *next;
+} Conn;
+
+struct Listener
+{
+    int epfd;
+    Endpoint stop;
+    Endpoint *endpoints;
+    int endpoint_count;
+    Conn *conns;
+    ListenMetrics *metrics;
+    int stopping;
+
+    char *out; /* Lines gathered for the caller */
+    size_t out_len;
+    size_t out_cap;
+
+    char *dgrams; /* LISTEN_DGRAM_BATCH buffers for recvmmsg */
+    struct mmsghdr msgs[LISTEN_DGRAM_BATCH];
+    struct iovec iovs[LISTEN_DGRAM_BATCH];
+    struct epoll_event events[LISTEN_EVENTS];
+};
+
+/* ─── Messages ─── */
+
+static void out_append(Listener *l, const char *p, size_t len)
+{
+    if (l->out_len + len + 1 > l->out_cap)
+    {
+        while (l->out_len + len + 1 > l->out_cap)
+            l->out_cap = l->out_cap ? l->out_cap * 2 : LISTEN_OUT_BYTES;
+        l->out = (char *)realloc(l->out, l->out_cap);
+        if (!l->out)
+        {
+            perror("realloc listener buffer");
+            exit(1);
+        }
+    }
+    memcpy(l->out + l->out_len, p, len);
+    l->out_len += len;
+    l->out[l->out_len++] = '\n';
+}
+
+static const char *skip_token(const char *p, const char *end)
+{
+    const char *start = p;
+    while (p < end && *p != ' ')
+        p++;
+    return p > start && p < end ? p + 1 : NULL;
+}
+
+/* Narrow an RFC 5424 message down to its MSG part:
+ *   <PRI>VERSION TIMESTAMP HOSTNAME APP-NAME PROCID MSGID SD [MSG]
+ * SD is "-" or one or more [id param="value" ...] elements, in which "]"
+ * only appears escaped. Returns 0 if it is not a valid header. */
+static int syslog_body(const char **pp, size_t *plen)
+{
+    const char *p = *pp + 1, *end = *pp + *plen;
+    const char *digits = p;
+    while (p < end && *p >= '0' && *p <= '9' && p - digits < 3)
+        p++;
+    if (p == digits || p >= end || *p++ != '>')
+        return 0;
+    digits = p;
+    while (p < end && *p >= '0' && *p <= '9')
+        p++;
+    if (p == digits || p >= end || *p++ != ' ')
+        return 0;
+    for (int i = 0; i < 5 && p; i++)
+        p = skip_token(p, end); /* TIMESTAMP, HOSTNAME, APP-NAME, PROCID, MSGID */
+    if (!p || p >= end)
+        return 0; /* SD is required, if only as "-" */
+
+    if (*p == '-')
+    {
+        p++;
+    }
+    else
+    {
+        while (p < end && *p == '[')
+        {
+            p++;
+            while (p < end && *p != ']')
+                p += *p == '\\' ? 2 : 1;
+            if (p >= end)
+                return 0;
+            p++;
+        }
+    }
+    if (p < end && *p != ' ')
+        return 0;
+    if (p < end)
+        p++; /* The space before MSG */
+    if (end - p >= 3 && memcmp(p, "\xEF\xBB\xBF", 3) == 0)
+        p += 3; /* UTF-8 BOM */
+
+    *pp = p;
+    *plen = (size_t)(end - p);
+    return 1;
+}
+
+static void add_message(Listener *l, const char *p, size_t len)
+{
+    while (len > 0 && (p[len - 1] == '\n' || p[len - 1] == '\r'))
+        len--;
+    if (len == 0)
+        return;
+    counter_add(&l->metrics->messages, 1);
+    if (p[0] == '<')
+    {
+        /* Left as it is otherwise, for the parser to reject and count */
+        if (syslog_body(&p, &len))
+            counter_add(&l->metrics->syslog_messages, 1);
+        else
+            counter_add(&l->metrics->syslog_invalid, 1);
+    }
+    out_append(l, p, len);
+}
+
+/* Every line of a datagram is a message, the last one with or without its
+ * newline */
+static void add_datagram(Listener *l, const char *p, size_t len)
+{
+    const char *end = p + len;
+    while (p < end)
+    {
+        const char *nl = memchr(p, '\n', (size_t)(end - p));
+        const char *line_end = nl ? nl : end;
+        add_message(l, p, (size_t)(line_end - p));
+        p = line_end + 1;
+    }
+}
+
+/* Whether p starts an octet-counted frame ("<len> <"): 1 with its header
+ * and message length set, 0 if it does not, -1 if too little has arrived
+ * to tell. A log line starts with digits too, but then a comma. */
+static int counted_frame(const char *p, size_t avail, size_t *header, size_t *len)
+{
+    size_t i = 0, v = 0;
+    if (p[0] < '1' || p[0] > '9')
+        return 0;
+    while (i < avail && p[i] >= '0' && p[i] <= '9' && i < 10)
+        v = v * 10 + (size_t)(p[i++] - '0');
+    if (i == avail)
+        return -1;
+    if (p[i] != ' ')
+        return 0;
+    if (i + 1 == avail)
+        return -1;
+    if (p[i + 1] != '<')
+        return 0;
+    *header = i + 1;
+    *len = v;
+    return 1;
+}
+
+/* Take every complete message out of a connection's buffer; with
+ * `closing`, an unterminated last line as well */
+static void take_frames(Listener *l, Conn *c, int closing)
+{
+    size_t pos = 0;
+    while (pos < c->len)
+    {
+        const char *p = c->buf + pos;
+        size_t avail = c->len - pos;
+        if (c->skip > 0)
+        {
+            size_t n = c->skip < avail ? c->skip : avail;
+            c->skip -= n;
+            pos += n;
+            continue;
+        }
+        const char *nl;
+        if (c->discarding)
+        {
+            nl = memchr(p, '\n', avail);
+            c->discarding = !nl;
+            pos = nl ? (size_t)(nl + 1 - c->buf) : c->len;
+            continue;
+        }
+
+        size_t header, len;
+        int counted = counted_frame(p, avail, &header, &len);
+        if (counted > 0)
+        {
+            if (len > LISTEN_LINE_MAX)
+            {
+                counter_add(&l->metrics->oversized, 1);
+                c->skip = header + len;
+                continue;
+            }
+            if (header + len > avail)
+                break;
+            add_message(l, p + header, len);
+            pos += header + len;
+            continue;
+        }
+        if (counted < 0 && !closing)
+            break;
+        nl = memchr(p, '\n', avail);
+        if (!nl)
+        {
+            if (closing)
+            {
+                add_message(l, p, avail);
+                pos = c->len;
+            }
+            break;
+        }
+        add_message(l, p, (size_t)(nl - p));
+        pos = (size_t)(nl + 1 - c->buf);
+    }
+
+    c->len -= pos;
+    memmove(c->buf, c->buf + pos, c->len);
+    if (c->len < c->cap)
+        return;
+
+    /* Full of one message: grow for it, or give up on it */
+    if (c->cap < LISTEN_LINE_MAX + 16)
+    {
+        c->cap = c->cap * 2 < LISTEN_LINE_MAX + 16 ? c->cap * 2 : LISTEN_LINE_MAX + 16;
+        c->buf = (char *)realloc(c->buf, c->cap);
+        if (!c->buf)
+        {
+            perror("realloc connection buffer");
+            exit(1);
+        }
+        return;
+    }
+    counter_add(&l->metrics->oversized, 1);
+    c->len = 0;
+    c->discarding = 1;
+}
+
+/* ─── Sockets ─── */
+
+static void watch(Listener *l, Endpoint *ep)
+{
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = ep};
+    if (epoll_ctl(l->epfd, EPOLL_CTL_ADD, ep->fd, &ev) != 0)
+    {
+        perror("epoll_ctl");
+        exit(1);
+    }
+}
+
+static void conn_close(Listener *l, Conn *c)
+{
+    take_frames(l, c, 1);
+    epoll_ctl(l->epfd, EPOLL_CTL_DEL, c->ep.fd, NULL);
+    close(c->ep.fd);
+    if (c->prev)
+        c->prev->next = c->next;
+    else
+        l->conns = c->next;
+    if (c->next)
+        c->next->prev = c->prev;
+    atomic_store_explicit(&l->metrics->connections_open,
+                          atomic_load_explicit(&l->metrics->connections_open,
+                                               memory_order_relaxed) - 1,
+                          memory_order_relaxed);
+    free(c->buf);
+    free(c);
+}
+
+static void accept_all(Listener *l, Endpoint *ep)
+{
+    int fd;
+    while ((fd = accept4(ep->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+    {
+        Conn *c = (Conn *)calloc(1, sizeof(Conn));
+        if (!c)
+        {
+            perror("calloc connection");
+            exit(1);
+        }
+        c->ep.fd = fd;
+        c->ep.role = ROLE_CONN;
+        c->cap = LISTEN_CONN_BYTES;
+        c->buf = (char *)malloc(c->cap);
+        if (!c->buf)
+        {
+            perror("malloc connection buffer");
+            exit(1);
+        }
+        c->next = l->conns;
+        if (l->conns)
+            l->conns->prev = c;
+        l->conns = c;
+        watch(l, &c->ep);
+        counter_add(&l->metrics->connections_accepted, 1);
+        counter_add(&l->metrics->connections_open, 1);
+    }
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED)
+        fprintf(stderr, "accept on %s: %s\n", ep->name, strerror(errno));
+}
+
+static void read_conn(Listener *l, Conn *c)
+{
+    ssize_t n = read(c->ep.fd, c->buf + c->len, c->cap - c->len);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+        return;
+    if (n <= 0)
+    {
+        conn_close(l, c);
+        return;
+    }
+    counter_add(&l->metrics->bytes_received, (uint64_t)n);
+    c->len += (size_t)n;
+    take_frames(l, c, 0);
+}
+
+/* Drain the socket while whole batches come back, so a burst of small
+ * datagrams is handed on in one piece rather than 32 at a time */
+static void read_dgrams(Listener *l, Endpoint *ep)
+{
+    int n;
+    do
+    {
+        for (int i = 0; i < LISTEN_DGRAM_BATCH; i++)
+        {
+            l->iovs[i].iov_base = l->dgrams + (size_t)i * LISTEN_DGRAM_BYTES;
+            l->iovs[i].iov_len = LISTEN_DGRAM_BYTES;
+            memset(&l->msgs[i].msg_hdr, 0, sizeof(l->msgs[i].msg_hdr));
+            l->msgs[i].msg_hdr.msg_iov = &l->iovs[i];
+            l->msgs[i].msg_hdr.msg_iovlen = 1;
+        }
+        n = recvmmsg(ep->fd, l->msgs, LISTEN_DGRAM_BATCH, MSG_DONTWAIT, NULL);
+        for (int i = 0; i < n; i++)
+        {
+            counter_add(&l->metrics->datagrams, 1);
+            counter_add(&l->metrics->bytes_received, l->msgs[i].msg_len);
+            add_datagram(l, (const char *)l->iovs[i].iov_base, l->msgs[i].msg_len);
+        }
+    } while (n == LISTEN_DGRAM_BATCH && l->out_len < LISTEN_OUT_BYTES);
+}
+
+/* Parse "[tcp:|udp:][addr:]port", "unix:path" or "unixgram:path" and bind
+ * it; a bare port means both TCP and UDP. Returns the number of endpoints
+ * opened, -1 on an error (reported). */
+static int open_spec(Listener *l, const char *spec)
+{
+    const char *rest = spec;
+    int want_stream = 1, want_dgram = 1, unix_type = 0;
+    if (strncmp(spec, "tcp:", 4) == 0)
+        want_dgram = 0, rest = spec + 4;
+    else if (strncmp(spec, "udp:", 4) == 0)
+        want_stream = 0, rest = spec + 4;
+    else if (strncmp(spec, "unix:", 5) == 0)
+        unix_type = SOCK_STREAM, rest = spec + 5;
+    else if (strncmp(spec, "unixgram:", 9) == 0)
+        unix_type = SOCK_DGRAM, rest = spec + 9;
+
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    memset(&addr, 0, sizeof(addr));
+    if (unix_type)
+    {
+        struct sockaddr_un *un = (struct sockaddr_un *)&addr;
+        if (*rest == '\0' || strlen(rest) >= sizeof(un->sun_path))
+        {
+            fprintf(stderr, "Invalid socket path in --listen %s\n", spec);
+            return -1;
+        }
+        un->sun_family = AF_UNIX;
+        strcpy(un->sun_path, rest);
+        addr_len = sizeof(*un);
+        want_stream = unix_type == SOCK_STREAM;
+        want_dgram = !want_stream;
+
+        /* A socket left behind by an earlier run is in the way */
+        struct stat st;
+        if (stat(rest, &st) == 0 && S_ISSOCK(st.st_mode))
+            unlink(rest);
+    }
+    else
+    {
+        struct sockaddr_in *in = (struct sockaddr_in *)&addr;
+        char host[64] = "127.0.0.1";
+        const char *colon = strrchr(rest, ':');
+        if (colon)
+        {
+            snprintf(host, sizeof(host), "%.*s", (int)(colon - rest), rest);
+            rest = colon + 1;
+        }
+        char *end;
+        long port = strtol(rest, &end, 10);
+        in->sin_family = AF_INET;
+        in->sin_port = htons((uint16_t)port);
+        if (*rest == '\0' || *end != '\0' || port < 0 || port > 65535 ||
+            inet_pton(AF_INET, host, &in->sin_addr) != 1)
+        {
+            fprintf(stderr, "Invalid address in --listen %s\n", spec);
+            return -1;
+        }
+        addr_len = sizeof(*in);
+    }
+
+    int opened = 0;
+    for (int stream = 1; stream >= 0; stream--)
+    {
+        if (stream ? !want_stream : !want_dgram)
+            continue;
+        int fd = socket(addr.ss_family, (stream ? SOCK_STREAM : SOCK_DGRAM) | SOCK_NONBLOCK |
+                                            SOCK_CLOEXEC, 0);
+        int one = 1, rcvbuf = LISTEN_RCVBUF;
+        if (fd >= 0 && addr.ss_family == AF_INET)
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (fd >= 0 && !stream)
+            setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+        if (fd < 0 || bind(fd, (struct sockaddr *)&addr, addr_len) != 0 ||
+            (stream && listen(fd, SOMAXCONN) != 0))
+        {
+            fprintf(stderr, "Cannot listen on %s (%s): %s\n", spec, stream ? "stream" : "datagram",
+                    strerror(errno));
+            if (fd >= 0)
+                close(fd);
+            return -1;
+        }
+
+        Endpoint *ep = &l->endpoints[l->endpoint_count++];
+        ep->fd = fd;
+        ep->role = stream ? ROLE_ACCEPT : ROLE_DGRAM;
+        snprintf(ep->name, sizeof(ep->name), "%s", spec);
+        if (unix_type)
+        {
+            /* Length-checked above and NUL-padded by the memset */
+            memcpy(ep->unix_path, ((struct sockaddr_un *)&addr)->sun_path,
+                   sizeof(ep->unix_path));
+            log_info("Listening on %s\n", ep->unix_path);
+        }
+        else
+        {
+            /* Port 0 picks one: say which */
+            struct sockaddr_in bound;
+            socklen_t bound_len = sizeof(bound);
+            char host[INET_ADDRSTRLEN] = "?";
+            getsockname(fd, (struct sockaddr *)&bound, &bound_len);
+            inet_ntop(AF_INET, &bound.sin_addr, host, sizeof(host));
+            log_info("Listening on %s %s:%d\n", stream ? "tcp" : "udp", host,
+                     ntohs(bound.sin_port));
+        }
+        opened++;
+    }
+    return opened;
+}
+
+/* Bind every --listen address; NULL if any of them fails (reported).
+ * listener_read gives up once `stop_fd` is readable. */
+Listener *listener_open(const EngineConfig *cfg, int stop_fd, ListenMetrics *metrics)
+{
+    Listener *l = (Listener *)calloc(1, sizeof(Listener));
+    if (!l)
+    {
+        perror("calloc listener");
+        exit(1);
+    }
+    l->metrics = metrics;
+    l->endpoints = (Endpoint *)calloc((size_t)cfg->listen_count * 2, sizeof(Endpoint));
+    l->dgrams = (char *)malloc((size_t)LISTEN_DGRAM_BATCH * LISTEN_DGRAM_BYTES);
+    l->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (!l->endpoints || !l->dgrams || l->epfd < 0)
+    {
+        perror("listener");
+        exit(1);
+    }
+    for (int i = 0; i < cfg->listen_count; i++)
+    {
+        if (open_spec(l, cfg->listen_specs[i]) < 0)
+        {
+            listener_close(l);
+            return NULL;
+        }
+    }
+    for (int i = 0; i < l->endpoint_count; i++)
+        watch(l, &l->endpoints[i]);
+    l->stop.fd = stop_fd;
+    l->stop.role = ROLE_STOP;
+    watch(l, &l->stop);
+    return l;
+}
+
+/* Wait up to timeout_ms (-1 = as long as it takes) for input, and gather
+ * the messages that arrived as newline-terminated lines in *text (valid
+ * until the next call). Returns their length, 0 if nothing came in time,
+ * or -1 once a stop is requested and nothing is left. */
+long listener_read(Listener *l, int timeout_ms, const char **text)
+{
+    l->out_len = 0;
+    *text = l->out;
+    if (l->stopping)
+        return -1; /* What came in with the stop was handed out already */
+    int n = epoll_wait(l->epfd, l->events, LISTEN_EVENTS, timeout_ms);
+    if (n < 0)
+    {
+        if (errno != EINTR)
+            perror("epoll_wait");
+        return 0;
+    }
+
+    for (int i = 0; i < n && l->out_len < LISTEN_OUT_BYTES; i++)
+    {
+        /* Sockets left over stay ready and are reported again */
+        Endpoint *ep = (Endpoint *)l->events[i].data.ptr;
+        switch (ep->role)
+        {
+        case ROLE_STOP:
+            l->stopping = 1;
+            break;
+        case ROLE_ACCEPT:
+            accept_all(l, ep);
+            break;
+        case ROLE_DGRAM:
+            read_dgrams(l, ep);
+            break;
+        case ROLE_CONN:
+            read_conn(l, (Conn *)ep);
+            break;
+        }
+    }
+    *text = l->out;
+    return l->stopping && l->out_len == 0 ? -1 : (long)l->out_len;
+}
+
+void listener_close(Listener *l)
+{
+    while (l->conns)
+    {
+        Conn *c = l->conns;
+        l->conns = c->next;
+        close(c->ep.fd);
+        free(c->buf);
+        free(c);
+    }
+    for (int i = 0; i < l->endpoint_count; i++)
+    {
+        close(l->endpoints[i].fd);
+        if (l->endpoints[i].unix_path[0])
+            unlink(l->endpoints[i].unix_path);
+    }
+    close(l->epfd);
+    free(l->endpoints);
+    free(l->dgrams);
+    free(l->out);
+    free(l);
+}
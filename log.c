@@ -0,0 +1,128 @@
+#include "structures.h"
+#include <stdarg.h>
+
+/*
+ * Asynchronous leveled console logger.
+ *
+ * log_info/log_debug are macros that test log_level before evaluating their
+ * arguments, so a disabled level costs one predictable branch. An enabled
+ * record is formatted by the calling thread into a fixed-size slot and
+ * pushed into an MPSC ring (ring.c); a background thread drains the ring
+ * into stdout and flushes once the ring is empty, so analyzers never wait
+ * on the terminal. The log thread naps (1 ms, backing off to 16 ms) rather
+ * than sleeping on the ring's condition variable, so a busy logger does
+ * not cost a futex wake per record.
+ *
+ * A full ring makes the logging thread wait: nothing asked for is lost, and
+ * the ring only absorbs bursts. One record may hold several lines; it is
+ * written in one piece, so a multi-line message is never interleaved with
+ * another thread's output.
+ */
+
+#define LOG_RING_CAP 2048
+#define LOG_BATCH 32
+#define LOG_STOP (-1) /* len of the record that stops the log thread */
+#define LOG_IDLE_MIN_US 1000  /* First nap once the ring is empty */
+#define LOG_IDLE_MAX_US 16000 /* Longest nap while nothing is logged */
+
+typedef struct
+{
+    int len;
+    char text[LOG_RECORD_MAX];
+} LogRecord;
+
+int log_level = LOG_LEVEL_INFO;
+
+static MpscRing log_ring;
+static pthread_t log_tid;
+static int log_running;
+
+static void *log_thread(void *arg)
+{
+    (void)arg;
+    LogRecord *batch = (LogRecord *)malloc(sizeof(LogRecord) * LOG_BATCH);
+    if (!batch)
+    {
+        perror("malloc log batch");
+        exit(1);
+    }
+
+    int stopped = 0;
+    long idle_us = LOG_IDLE_MIN_US;
+    while (!stopped)
+    {
+        size_t n = mpsc_try_pop_batch(&log_ring, batch, LOG_BATCH);
+        if (n == 0)
+        {
+            fflush(stdout);
+            usleep((useconds_t)idle_us);
+            if (idle_us < LOG_IDLE_MAX_US)
+                idle_us *= 2;
+            continue;
+        }
+        idle_us = LOG_IDLE_MIN_US;
+
+        for (size_t i = 0; i < n; i++)
+        {
+            if (batch[i].len == LOG_STOP)
+                stopped = 1;
+            else
+                fwrite(batch[i].text, 1, (size_t)batch[i].len, stdout);
+        }
+    }
+
+    fflush(stdout);
+    free(batch);
+    return NULL;
+}
+
+/* Start the log thread; with LOG_LEVEL_OFF no thread is started at all */
+void log_start(LogLevel level)
+{
+    log_level = level;
+    if (level == LOG_LEVEL_OFF)
+        return;
+
+    mpsc_init(&log_ring, sizeof(LogRecord), LOG_RING_CAP);
+    if (pthread_create(&log_tid, NULL, log_thread, NULL) != 0)
+    {
+        perror("pthread_create log");
+        exit(1);
+    }
+    log_running = 1;
+}
+
+/* Write out every record logged so far and stop the log thread. Later
+ * records are printed synchronously. */
+void log_stop(void)
+{
+    if (!log_running)
+        return;
+
+    LogRecord stop = {.len = LOG_STOP};
+    mpsc_push(&log_ring, &stop);
+    pthread_join(log_tid, NULL);
+    mpsc_destroy(&log_ring);
+    log_running = 0;
+}
+
+/* Format one record; called through log_info/log_debug only */
+void log_write(const char *fmt, ...)
+{
+    LogRecord rec;
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(rec.text, sizeof(rec.text), fmt, ap);
+    va_end(ap);
+    if (len < 0)
+        return;
+    rec.len = len < LOG_RECORD_MAX ? len : LOG_RECORD_MAX - 1;
+
+    if (!log_running)
+    {
+        fwrite(rec.text, 1, (size_t)rec.len, stdout);
+        return;
+    }
+
+    mpsc_push(&log_ring, &rec);
+}
@@ -1,4 +1,82 @@
 #include "structures.h"
+#include <dirent.h>
+#include <errno.h>
+#include <getopt.h>
+#include <glob.h>
+#include <signal.h>
+#include <sys/stat.h>
+
+static void print_latency_row(const char *name, const HistSnapshot *s)
+{
+    if (s->count == 0)
+        return;
+    double p50 = snap_quantile(s, 0.5) / 1e3, p99 = snap_quantile(s, 0.99) / 1e3;
+    printf("│ %-9s %10.1f %10.1f %11.1f │\n", name, p50, p99, (double)s->max / 1e3);
+}
+
+/* Rates over the whole run and stage latencies merged over shards */
+static void print_metrics_summary(SharedState *state)
+{
+    double secs = (double)(now_ns() - state->start_ns) / 1e9;
+    unsigned long long events = atomic_load(&state->ingest_metrics.events_admitted);
+    unsigned long long lines = atomic_load(&state->ingest_metrics.lines_parsed);
+    unsigned long long expired = 0;
+
+    HistSnapshot fold = {0}, eval = {0}, parse = {0}, inflate = {0}, handoff = {0}, latency = {0},
+                 commit = {0};
+    for (int s = 0; s < state->cfg.shard_count; s++)
+    {
+        ShardMetrics *m = &state->shards[s].metrics;
+        expired += atomic_load(&m->entries_expired);
+        hist_snapshot(&fold, &m->fold_ns);
+        hist_snapshot(&eval, &m->eval_ns);
+    }
+    hist_snapshot(&parse, &state->ingest_metrics.parse_chunk_ns);
+    hist_snapshot(&inflate, &state->ingest_metrics.inflate_ns);
+    hist_snapshot(&handoff, &state->ingest_metrics.handoff_ns);
+    hist_snapshot(&latency, &state->alert_metrics.latency_ns);
+    hist_snapshot(&commit, &state->alert_metrics.commit_ns);
+
+    printf("├─────────────────────────────────────────────┤\n");
+    printf("│         PIPELINE METRICS                    │\n");
+    printf("├─────────────────────────────────────────────┤\n");
+    printf("│ Run time (s):         %-21.2f │\n", secs);
+    printf("│ Lines parsed/s:       %-21.0f │\n", secs > 0 ? lines / secs : 0.0);
+    printf("│ Events ingested/s:    %-21.0f │\n", secs > 0 ? events / secs : 0.0);
+    printf("│ Entries expired:      %-21llu │\n", expired);
+    printf("│ Stage (us)       p50        p99         max │\n");
+    print_latency_row("inflate", &inflate);
+    print_latency_row("parse", &parse);
+    print_latency_row("handoff", &handoff);
+    print_latency_row("fold", &fold);
+    print_latency_row("evaluate", &eval);
+    print_latency_row("alert", &latency);
+    print_latency_row("log write", &commit);
+}
+
+/* Per-source rows for --merge: read rate and how long the merge waited on
+ * each reader (the slowest source stalls everyone) */
+#define DASHBOARD_SOURCES 10
+
+static void print_sources(SharedState *state)
+{
+    if (state->source_count == 0)
+        return;
+    printf("├─────────────────────────────────────────────┤\n");
+    printf("│ Source             events    events/s stall │\n");
+    for (int i = 0; i < state->source_count && i < DASHBOARD_SOURCES; i++)
+    {
+        SourceStats *st = &state->sources[i];
+        const char *name = strrchr(st->path, '/');
+        name = name ? name + 1 : st->path;
+        printf("│ %-14.14s %10llu %11.0f %4.1fs │\n", name,
+               (unsigned long long)atomic_load(&st->events_merged), source_rate(state, i),
+               (double)atomic_load(&st->stall_ns) / 1e9);
+    }
+    if (state->source_count > DASHBOARD_SOURCES)
+        printf("│ ... and %-4d more sources                   │\n",
+               state->source_count - DASHBOARD_SOURCES);
+}
 
 void print_dashboard(SharedState *state)
 {
@@ -7,85 +85,740 @@ void print_dashboard(SharedState *state)
     printf("│         FINAL ANALYSIS DASHBOARD            │\n");
     printf("├─────────────────────────────────────────────┤\n");
     printf("│ Total logs processed: %-21d │\n", state->total_logs_processed);
-    printf("│ Alerts generated:     %-21d │\n", state->total_alerts_generated);
+    printf("│ Alerts generated:     %-21d │\n", atomic_load(&state->total_alerts_generated));
+    if (atomic_load(&state->alerts_spilled) > 0)
+        printf("│ Alerts spilled:       %-21ld │\n", atomic_load(&state->alerts_spilled));
+    if (atomic_load(&state->alerts_dropped) > 0)
+        printf("│ Alerts dropped:       %-21ld │\n", atomic_load(&state->alerts_dropped));
+    printf("│ Alerts logged:        %-21ld │\n", state->alert_sink.written);
+    printf("│ Log writes:           %-21ld │\n", state->alert_sink.commits);
+    if (state->alert_sink.rotations > 0)
+        printf("│ Log rotations:        %-21ld │\n", state->alert_sink.rotations);
+    if (state->cfg.checkpoint_path)
+        printf("│ Checkpoints written:  %-21ld │\n", atomic_load(&state->checkpoint.written));
+    if (state->cfg.listen_count)
+    {
+        printf("│ Connections accepted: %-21llu │\n",
+               (unsigned long long)atomic_load(&state->listen_metrics.connections_accepted));
+        printf("│ Messages received:    %-21llu │\n",
+               (unsigned long long)atomic_load(&state->listen_metrics.messages));
+    }
     printf("│ Active entities:       ");
 
-    int active_users = 0, active_ips = 0;
-    for (int i = 0; i < HASH_SIZE; i++)
+    int active_users = 0, active_ips = 0, tracked_users = 0;
+    size_t user_bytes = 0;
+    size_t cursor;
+    EntityStats *u;
+    for (int s = 0; s < state->cfg.shard_count; s++)
     {
-        EntityStats *u = state->user_map[i];
-        while (u)
+        Shard *shard = &state->shards[s];
+        cursor = 0;
+        while ((u = (EntityStats *)map_next(&shard->user_map, &cursor)) != NULL)
         {
             if (u->current_score > 0)
                 active_users++;
-            u = u->next;
+            tracked_users++;
+            user_bytes += entity_memory_bytes(shard, u);
         }
-        IPStats *ip = state->ip_map[i];
-        while (ip)
+        cursor = 0;
+        IPStats *ip;
+        while ((ip = (IPStats *)map_next(&shard->ip_map, &cursor)) != NULL)
         {
             if (ip->failed_attempts > 0)
                 active_ips++;
-            ip = ip->next;
         }
     }
     printf("%-21d │\n", active_users + active_ips);
+
+    char mode[32];
+    if (state->cfg.approx_error > 0.0)
+        snprintf(mode, sizeof(mode), "HLL p=%d +/-%.1f%%", state->cfg.hll_precision,
+                 100.0 * hll_error_for_precision(state->cfg.hll_precision));
+    else
+        snprintf(mode, sizeof(mode), "exact");
+    printf("│ Distinct counting:    %-21s │\n", mode);
+    printf("│ Memory per user (B):  %-21zu │\n",
+           tracked_users ? user_bytes / tracked_users : (size_t)0);
     printf("├─────────────────────────────────────────────┤\n");
     printf("│         TOP SUSPICIOUS ENTITIES             │\n");
     printf("├─────────────────────────────────────────────┤\n");
 
-    /* Collect top 5 users by score */
-    typedef struct
+    /* Leaders merged from the shards' boards: O(shards * K), no map scan */
+    int k = state->cfg.top_k, n_users, n_ips;
+    TopEntry *top_users = (TopEntry *)malloc(sizeof(TopEntry) * (size_t)k);
+    TopEntry *top_ips = (TopEntry *)malloc(sizeof(TopEntry) * (size_t)k);
+    if (!top_users || !top_ips)
     {
-        int user_id;
-        int score;
-        int severity;
-    } ScoreEntry;
+        perror("malloc top entities");
+        exit(1);
+    }
+    topk_collect(state, top_users, &n_users, top_ips, &n_ips);
 
-    ScoreEntry top_users[5] = {0};
+    for (int i = 0; i < n_users + n_ips; i++)
+    {
+        const TopEntry *t = i < n_users ? &top_users[i] : &top_ips[i - n_users];
+        int severity = severity_from_score(t->score);
+        const char *color = severity >= 3 ? "\033[1;31m" : severity >= 2 ? "\033[31m"
+                                                      : severity >= 1   ? "\033[33m"
+                                                                        : "\033[0m";
+        if (i < n_users)
+            printf("│ %sUser %-6d Score: %-4d [%-12s\033[1;36m │\n",
+                   color, (int)t->id, t->score, severity_str(severity));
+        else
+            printf("│ %sIP %-15s Score: %-4d [%-4.4s]\033[1;36m │\n",
+                   color, intern_str(t->id), t->score, severity_str(severity));
+    }
+    free(top_users);
+    free(top_ips);
 
-    for (int i = 0; i < HASH_SIZE; i++)
+    printf("├─────────────────────────────────────────────┤\n");
+    /* Totals over all shards; high water is the sum of per-shard peaks */
+    printf("│ Pool      in use/slots    occ.  high water  │\n");
+    size_t w_count = 0, w_cap = 0, w_high = 0;
+    long in_use[2] = {0}, capacity[2] = {0}, high_water[2] = {0};
+    for (int s = 0; s < state->cfg.shard_count; s++)
     {
-        EntityStats *u = state->user_map[i];
-        while (u)
+        Shard *shard = &state->shards[s];
+        w_count += window_count(&shard->window);
+        w_cap += shard->window.cap;
+        w_high += shard->window.high_water;
+
+        const ObjectPool *pools[] = {&shard->user_pool, &shard->ip_pool};
+        for (int i = 0; i < 2; i++)
         {
-            int score = u->current_score;
-            if (score > 0)
-            {
-                for (int j = 0; j < 5; j++)
-                {
-                    if (score > top_users[j].score)
-                    {
-                        /* Shift down */
-                        for (int k = 4; k > j; k--)
-                        {
-                            top_users[k] = top_users[k - 1];
-                        }
-                        top_users[j].user_id = u->user_id;
-                        top_users[j].score = score;
-                        top_users[j].severity = severity_from_score(score);
-                        break;
-                    }
-                }
-            }
-            u = u->next;
+            in_use[i] += pools[i]->in_use;
+            capacity[i] += pools[i]->capacity;
+            high_water[i] += pools[i]->high_water;
         }
     }
-
-    for (int i = 0; i < 5 && top_users[i].score > 0; i++)
+    printf("│ window    %7zu/%-7zu        hw %-7zu │\n", w_count, w_cap, w_high);
+    const char *pool_names[] = {"users", "ips"};
+    for (int i = 0; i < 2; i++)
     {
-        const char *color = top_users[i].severity >= 3 ? "\033[1;31m" : top_users[i].severity >= 2 ? "\033[31m"
-                                                                    : top_users[i].severity >= 1   ? "\033[33m"
-                                                                                                   : "\033[0m";
-        printf("│ %sUser %-6d Score: %-4d [%-12s\033[1;36m │\n",
-               color, top_users[i].user_id, top_users[i].score,
-               severity_str(top_users[i].severity));
+        double occ = capacity[i] ? 100.0 * in_use[i] / capacity[i] : 0.0;
+        printf("│ %-9s %7ld/%-7ld %5.1f%% hw %-7ld │\n",
+               pool_names[i], in_use[i], capacity[i], occ, high_water[i]);
     }
+    printf("│ Analyzer shards:      %-21d │\n", state->cfg.shard_count);
 
+    print_sources(state);
+    print_metrics_summary(state);
     printf("└─────────────────────────────────────────────┘\033[0m\n\n");
 }
 
-int main(void)
+static void print_usage(const char *prog)
+{
+    printf("Usage: %s [options] [logfile|dir|glob ...]\n", prog);
+    printf("  Reads %s when no log files are given; a directory or\n", DEFAULT_INPUT);
+    printf("  quoted glob stands for the files in it, in name order.\n");
+    printf("  -p, --pace <mode>   replay pacing: max (default), realtime, or a\n");
+    printf("                      speed-up factor such as 1x, 10x, 2.5x\n");
+    printf("  -l, --lateness <s>  seconds an event may trail the newest event\n");
+    printf("                      and still be counted (default %d)\n", DEFAULT_LATENESS);
+    printf("  -j, --parse-threads <n>\n");
+    printf("                      threads parsing each input file (default: CPUs)\n");
+    printf("  -a, --approx-distinct <err>\n");
+    printf("                      count distinct resources/IPs with sliding\n");
+    printf("                      HyperLogLog sketches at this relative error\n");
+    printf("                      (e.g. 0.05) instead of exact sets\n");
+    printf("  -s, --shards <n>    analyzer threads, each owning a slice of the\n");
+    printf("                      users and IPs (default: CPUs)\n");
+    printf("  -b, --alert-backpressure <mode>\n");
+    printf("                      when the alert queue is full: block (default),\n");
+    printf("                      spill (to a temporary file) or drop (counted)\n");
+    printf("  -B, --batch-size <n>\n");
+    printf("                      entries ingestion hands to a shard at once\n");
+    printf("                      (default %d; smaller = lower latency)\n", DEFAULT_BATCH_SIZE);
+    printf("  -F, --flush-ms <ms> longest an entry waits for its batch to fill\n");
+    printf("                      (default %d)\n", DEFAULT_FLUSH_MS);
+    printf("  -v, --log-level <level>\n");
+    printf("                      console output: off, info (alerts; default)\n");
+    printf("                      or debug (every evaluation and entity scored)\n");
+    printf("  -k, --top-k <n>     suspicious users and IPs listed in the\n");
+    printf("                      dashboard and metrics (default %d)\n", DEFAULT_TOP_K);
+    printf("  -o, --alert-log <path>\n");
+    printf("                      alert log file (default %s)\n", DEFAULT_ALERT_LOG);
+    printf("  -f, --alert-format <fmt>\n");
+    printf("                      text (default) or json (one object per line)\n");
+    printf("  -m, --alert-min-severity <0..3>\n");
+    printf("                      lowest severity written to the log (default 3)\n");
+    printf("      --alert-commit-ms <ms>\n");
+    printf("                      longest a logged alert is buffered (default %d)\n",
+           DEFAULT_ALERT_COMMIT_MS);
+    printf("      --alert-fsync <policy>\n");
+    printf("                      none (default), commit (every write) or rotate\n");
+    printf("      --alert-rotate-mb <n>\n");
+    printf("                      rotate the log to <path>.<n> past n MiB\n");
+    printf("      --alert-rotate-secs <s>\n");
+    printf("                      rotate the log after s seconds\n");
+    printf("      --metrics-file <path>\n");
+    printf("                      write Prometheus metrics to this file\n");
+    printf("      --metrics-port <port>\n");
+    printf("                      serve Prometheus metrics on 127.0.0.1:port\n");
+    printf("      --metrics-interval <ms>\n");
+    printf("                      how often metrics are refreshed (default %d)\n",
+           DEFAULT_METRICS_INTERVAL_MS);
+    printf("      --checkpoint <path>\n");
+    printf("                      restore the window and alert state from this\n");
+    printf("                      file at startup if it exists, resuming the\n");
+    printf("                      input where it stopped, and save them to it\n");
+    printf("                      periodically and at the end of input\n");
+    printf("      --checkpoint-secs <s>\n");
+    printf("                      seconds between checkpoints (default %d)\n",
+           DEFAULT_CHECKPOINT_SECS);
+    printf("      --from <ts>     replay only events at or after this Unix time\n");
+    printf("      --until <ts>    replay only events at or before this Unix time\n");
+    printf("                      (archive blocks outside the range are skipped)\n");
+    printf("      --follow        keep reading the last log file as it grows,\n");
+    printf("                      across rotation and truncation, until\n");
+    printf("                      SIGINT or SIGTERM\n");
+    printf("      --merge         read all log files at once, one thread each,\n");
+    printf("                      and analyze them merged in event-time order\n");
+    printf("      --listen <addr> after the log files, take log lines and RFC 5424\n");
+    printf("                      syslog messages on addr until SIGINT or SIGTERM:\n");
+    printf("                      [tcp:|udp:][ip:]port (both when bare, default\n");
+    printf("                      ip 127.0.0.1), unix:path or unixgram:path;\n");
+    printf("                      may be repeated\n");
+    printf("      --archive <path>\n");
+    printf("                      convert the log files into a binary archive at\n");
+    printf("                      path instead of analyzing them; archives are\n");
+    printf("                      read like any log file, only much faster\n");
+    printf("  -h, --help          show this help\n");
+}
+
+/* Parse "max", "realtime" or "<factor>[x]" into a replay speed (0 = max) */
+static int parse_pace(const char *arg, double *speed)
+{
+    if (strcmp(arg, "max") == 0)
+    {
+        *speed = 0.0;
+        return 0;
+    }
+    if (strcmp(arg, "realtime") == 0)
+    {
+        *speed = 1.0;
+        return 0;
+    }
+
+    char *end;
+    double v = strtod(arg, &end);
+    if (end == arg || v <= 0.0 || (*end != '\0' && strcmp(end, "x") != 0))
+        return -1;
+    *speed = v;
+    return 0;
+}
+
+/* Long-only options */
+enum
+{
+    OPT_ALERT_COMMIT_MS = 256,
+    OPT_ALERT_FSYNC,
+    OPT_ALERT_ROTATE_MB,
+    OPT_ALERT_ROTATE_SECS,
+    OPT_METRICS_FILE,
+    OPT_METRICS_PORT,
+    OPT_METRICS_INTERVAL,
+    OPT_CHECKPOINT,
+    OPT_CHECKPOINT_SECS,
+    OPT_FROM,
+    OPT_UNTIL,
+    OPT_FOLLOW,
+    OPT_MERGE,
+    OPT_LISTEN,
+    OPT_ARCHIVE
+};
+
+/* ─── Input list ───
+ * A directory stands for the regular files in it, a pattern that names no
+ * file for the files it matches (glob(3)), each in name order. */
+static void add_input(EngineConfig *cfg, int *cap, const char *path)
+{
+    if (cfg->input_count == *cap)
+    {
+        *cap = *cap ? *cap * 2 : 16;
+        cfg->input_paths = (char **)realloc(cfg->input_paths, sizeof(char *) * (size_t)*cap);
+        if (!cfg->input_paths)
+        {
+            perror("realloc input list");
+            exit(1);
+        }
+    }
+    cfg->input_paths[cfg->input_count] = strdup(path);
+    if (!cfg->input_paths[cfg->input_count])
+    {
+        perror("strdup input path");
+        exit(1);
+    }
+    cfg->input_count++;
+}
+
+static int compare_names(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+static int add_directory(EngineConfig *cfg, int *cap, const char *dir)
+{
+    DIR *d = opendir(dir);
+    if (!d)
+    {
+        fprintf(stderr, "Cannot open %s: %s\n", dir, strerror(errno));
+        return -1;
+    }
+    int first = cfg->input_count;
+    struct dirent *de;
+    char path[4096];
+    while ((de = readdir(d)) != NULL)
+    {
+        struct stat st;
+        if (de->d_name[0] == '.')
+            continue;
+        snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+        if (stat(path, &st) == 0 && S_ISREG(st.st_mode))
+            add_input(cfg, cap, path);
+    }
+    closedir(d);
+    if (cfg->input_count == first)
+    {
+        fprintf(stderr, "No log files in %s\n", dir);
+        return -1;
+    }
+    qsort(cfg->input_paths + first, (size_t)(cfg->input_count - first), sizeof(char *),
+          compare_names);
+    return 0;
+}
+
+static int expand_inputs(EngineConfig *cfg, char **args, int n)
+{
+    int cap = 0;
+    cfg->input_paths = NULL;
+    cfg->input_count = 0;
+    for (int i = 0; i < n; i++)
+    {
+        struct stat st;
+        if (stat(args[i], &st) == 0)
+        {
+            if (S_ISDIR(st.st_mode))
+            {
+                if (add_directory(cfg, &cap, args[i]) != 0)
+                    return -1;
+            }
+            else
+            {
+                add_input(cfg, &cap, args[i]);
+            }
+        }
+        else if (strpbrk(args[i], "*?["))
+        {
+            glob_t g;
+            if (glob(args[i], 0, NULL, &g) != 0)
+            {
+                fprintf(stderr, "No files match %s\n", args[i]);
+                return -1;
+            }
+            for (size_t k = 0; k < g.gl_pathc; k++)
+                add_input(cfg, &cap, g.gl_pathv[k]);
+            globfree(&g);
+        }
+        else
+        {
+            add_input(cfg, &cap, args[i]); /* Reported when it is opened */
+        }
+    }
+    return 0;
+}
+
+static void free_inputs(EngineConfig *cfg)
+{
+    for (int i = 0; i < cfg->input_count; i++)
+        free(cfg->input_paths[i]);
+    free(cfg->input_paths);
+}
+
+/* Parse a Unix timestamp for --from/--until */
+static int parse_time(const char *arg, time_t *out)
 {
+    char *end;
+    long long v = strtoll(arg, &end, 10);
+    if (end == arg || *end != '\0' || v <= 0)
+        return -1;
+    *out = (time_t)v;
+    return 0;
+}
+
+static int parse_args(int argc, char **argv, EngineConfig *cfg)
+{
+    static const struct option long_opts[] = {
+        {"pace", required_argument, NULL, 'p'},
+        {"lateness", required_argument, NULL, 'l'},
+        {"parse-threads", required_argument, NULL, 'j'},
+        {"approx-distinct", required_argument, NULL, 'a'},
+        {"shards", required_argument, NULL, 's'},
+        {"alert-backpressure", required_argument, NULL, 'b'},
+        {"batch-size", required_argument, NULL, 'B'},
+        {"flush-ms", required_argument, NULL, 'F'},
+        {"log-level", required_argument, NULL, 'v'},
+        {"top-k", required_argument, NULL, 'k'},
+        {"alert-log", required_argument, NULL, 'o'},
+        {"metrics-file", required_argument, NULL, OPT_METRICS_FILE},
+        {"metrics-port", required_argument, NULL, OPT_METRICS_PORT},
+        {"metrics-interval", required_argument, NULL, OPT_METRICS_INTERVAL},
+        {"alert-format", required_argument, NULL, 'f'},
+        {"alert-min-severity", required_argument, NULL, 'm'},
+        {"alert-commit-ms", required_argument, NULL, OPT_ALERT_COMMIT_MS},
+        {"alert-fsync", required_argument, NULL, OPT_ALERT_FSYNC},
+        {"alert-rotate-mb", required_argument, NULL, OPT_ALERT_ROTATE_MB},
+        {"alert-rotate-secs", required_argument, NULL, OPT_ALERT_ROTATE_SECS},
+        {"checkpoint", required_argument, NULL, OPT_CHECKPOINT},
+        {"checkpoint-secs", required_argument, NULL, OPT_CHECKPOINT_SECS},
+        {"from", required_argument, NULL, OPT_FROM},
+        {"until", required_argument, NULL, OPT_UNTIL},
+        {"follow", no_argument, NULL, OPT_FOLLOW},
+        {"merge", no_argument, NULL, OPT_MERGE},
+        {"listen", required_argument, NULL, OPT_LISTEN},
+        {"archive", required_argument, NULL, OPT_ARCHIVE},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0}};
+
+    cfg->replay_speed = 0.0;
+    cfg->allowed_lateness = DEFAULT_LATENESS;
+    cfg->approx_error = 0.0;
+    cfg->alert_backpressure = BACKPRESSURE_BLOCK;
+    cfg->batch_size = DEFAULT_BATCH_SIZE;
+    cfg->flush_ms = DEFAULT_FLUSH_MS;
+    cfg->log_level = LOG_LEVEL_INFO;
+    cfg->top_k = DEFAULT_TOP_K;
+    cfg->checkpoint_path = NULL;
+    cfg->checkpoint_secs = DEFAULT_CHECKPOINT_SECS;
+    cfg->alert_append = 0;
+    cfg->from_time = 0;
+    cfg->until_time = 0;
+    cfg->follow = 0;
+    cfg->merge = 0;
+    cfg->listen_count = 0;
+    cfg->archive_path = NULL;
+    cfg->alert_path = DEFAULT_ALERT_LOG;
+    cfg->alert_format = ALERT_FORMAT_TEXT;
+    cfg->alert_min_severity = 3;
+    cfg->alert_commit_ms = DEFAULT_ALERT_COMMIT_MS;
+    cfg->alert_fsync = ALERT_FSYNC_NONE;
+    cfg->alert_rotate_bytes = 0;
+    cfg->alert_rotate_secs = 0;
+    cfg->metrics_path = NULL;
+    cfg->metrics_port = 0;
+    cfg->metrics_interval_ms = DEFAULT_METRICS_INTERVAL_MS;
+    cfg->hll_precision = HLL_MIN_PRECISION;
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    cfg->parse_threads = cpus < 1 ? 1 : cpus > 8 ? 8 : (int)cpus;
+    cfg->shard_count = cfg->parse_threads;
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "p:l:j:a:s:b:B:F:v:k:o:f:m:h", long_opts, NULL)) != -1)
+    {
+        switch (opt)
+        {
+        case 'p':
+            if (parse_pace(optarg, &cfg->replay_speed) != 0)
+            {
+                fprintf(stderr, "Invalid pace '%s'\n", optarg);
+                return -1;
+            }
+            break;
+        case 'l':
+            cfg->allowed_lateness = atoi(optarg);
+            if (cfg->allowed_lateness < 0)
+            {
+                fprintf(stderr, "Invalid lateness '%s'\n", optarg);
+                return -1;
+            }
+            break;
+        case 'j':
+            cfg->parse_threads = atoi(optarg);
+            if (cfg->parse_threads < 1 || cfg->parse_threads > MAX_PARSE_THREADS)
+            {
+                fprintf(stderr, "Invalid parse thread count '%s'\n", optarg);
+                return -1;
+            }
+            break;
+        case 'a':
+            cfg->approx_error = atof(optarg);
+            if (cfg->approx_error <= 0.0 || cfg->approx_error >= 1.0)
+            {
+                fprintf(stderr, "Invalid error bound '%s' (expected 0 < err < 1)\n", optarg);
+                return -1;
+            }
+            cfg->hll_precision = hll_precision_for_error(cfg->approx_error);
+            break;
+        case 's':
+            cfg->shard_count = atoi(optarg);
+            if (cfg->shard_count < 1 || cfg->shard_count > MAX_SHARDS)
+            {
+                fprintf(stderr, "Invalid shard count '%s'\n", optarg);
+                return -1;
+            }
+            break;
+        case 'b':
+            if (strcmp(optarg, "block") == 0)
+                cfg->alert_backpressure = BACKPRESSURE_BLOCK;
+            else if (strcmp(optarg, "spill") == 0)
+                cfg->alert_backpressure = BACKPRESSURE_SPILL;
+            else if (strcmp(optarg, "drop") == 0)
+                cfg->alert_backpressure = BACKPRESSURE_DROP;
+            else
+            {
+                fprintf(stderr, "Invalid backpressure mode '%s'\n", optarg);
+                return -1;
+            }
+            break;
+        case 'B':
+            cfg->batch_size = atoi(optarg);
+            if (cfg->batch_size < 1 || cfg->batch_size > SHARD_INBOX_CAP)
+            {
+                fprintf(stderr, "Invalid batch size '%s' (1..%d)\n", optarg, SHARD_INBOX_CAP);
+                return -1;
+            }
+            break;
+        case 'F':
+            cfg->flush_ms = atoi(optarg);
+            if (cfg->flush_ms < 0)
+            {
+                fprintf(stderr, "Invalid flush deadline '%s'\n", optarg);
+                return -1;
+            }
+            break;
+        case 'v':
+            if (strcmp(optarg, "off") == 0)
+                cfg->log_level = LOG_LEVEL_OFF;
+            else if (strcmp(optarg, "info") == 0)
+                cfg->log_level = LOG_LEVEL_INFO;
+            else if (strcmp(optarg, "debug") == 0)
+                cfg->log_level = LOG_LEVEL_DEBUG;
+            else
+            {
+                fprintf(stderr, "Invalid log level '%s'\n", optarg);
+                return -1;
+            }
+            break;
+        case 'k':
+            cfg->top_k = atoi(optarg);
+            if (cfg->top_k < 1 || cfg->top_k > 1000)
+            {
+                fprintf(stderr, "Invalid top-k '%s' (1..1000)\n", optarg);
+                return -1;
+            }
+            break;
+        case 'o':
+            cfg->alert_path = optarg;
+            break;
+        case 'f':
+            if (strcmp(optarg, "text") == 0)
+                cfg->alert_format = ALERT_FORMAT_TEXT;
+            else if (strcmp(optarg, "json") == 0)
+                cfg->alert_format = ALERT_FORMAT_JSON;
+            else
+            {
+                fprintf(stderr, "Invalid alert format '%s'\n", optarg);
+                return -1;
+            }
+            break;
+        case 'm':
+            cfg->alert_min_severity = atoi(optarg);
+            if (cfg->alert_min_severity < 0 || cfg->alert_min_severity > 3)
+            {
+                fprintf(stderr, "Invalid minimum severity '%s' (0..3)\n", optarg);
+                return -1;
+            }
+            break;
+        case OPT_ALERT_COMMIT_MS:
+            cfg->alert_commit_ms = atoi(optarg);
+            if (cfg->alert_commit_ms < 0)
+            {
+                fprintf(stderr, "Invalid commit interval '%s'\n", optarg);
+                return -1;
+            }
+            break;
+        case OPT_ALERT_FSYNC:
+            if (strcmp(optarg, "none") == 0)
+                cfg->alert_fsync = ALERT_FSYNC_NONE;
+            else if (strcmp(optarg, "commit") == 0)
+                cfg->alert_fsync = ALERT_FSYNC_COMMIT;
+            else if (strcmp(optarg, "rotate") == 0)
+                cfg->alert_fsync = ALERT_FSYNC_ROTATE;
+            else
+            {
+                fprintf(stderr, "Invalid fsync policy '%s'\n", optarg);
+                return -1;
+            }
+            break;
+        case OPT_ALERT_ROTATE_MB:
+            cfg->alert_rotate_bytes = atol(optarg) * 1024 * 1024;
+            if (cfg->alert_rotate_bytes < 0)
+            {
+                fprintf(stderr, "Invalid rotation size '%s'\n", optarg);
+                return -1;
+            }
+            break;
+        case OPT_ALERT_ROTATE_SECS:
+            cfg->alert_rotate_secs = atoi(optarg);
+            if (cfg->alert_rotate_secs < 0)
+            {
+                fprintf(stderr, "Invalid rotation interval '%s'\n", optarg);
+                return -1;
+            }
+            break;
+        case OPT_METRICS_FILE:
+            cfg->metrics_path = optarg;
+            break;
+        case OPT_METRICS_PORT:
+            cfg->metrics_port = atoi(optarg);
+            if (cfg->metrics_port < 1 || cfg->metrics_port > 65535)
+            {
+                fprintf(stderr, "Invalid metrics port '%s'\n", optarg);
+                return -1;
+            }
+            break;
+        case OPT_METRICS_INTERVAL:
+            cfg->metrics_interval_ms = atoi(optarg);
+            if (cfg->metrics_interval_ms < 1)
+            {
+                fprintf(stderr, "Invalid metrics interval '%s'\n", optarg);
+                return -1;
+            }
+            break;
+        case OPT_CHECKPOINT:
+            cfg->checkpoint_path = optarg;
+            break;
+        case OPT_CHECKPOINT_SECS:
+            cfg->checkpoint_secs = atoi(optarg);
+            if (cfg->checkpoint_secs < 1)
+            {
+                fprintf(stderr, "Invalid checkpoint interval '%s'\n", optarg);
+                return -1;
+            }
+            break;
+        case OPT_FROM:
+        case OPT_UNTIL:
+            if (parse_time(optarg, opt == OPT_FROM ? &cfg->from_time : &cfg->until_time) != 0)
+            {
+                fprintf(stderr, "Invalid time '%s' (expected Unix seconds)\n", optarg);
+                return -1;
+            }
+            break;
+        case OPT_FOLLOW:
+            cfg->follow = 1;
+            break;
+        case OPT_MERGE:
+            cfg->merge = 1;
+            break;
+        case OPT_LISTEN:
+            if (cfg->listen_count == MAX_LISTENERS)
+            {
+                fprintf(stderr, "At most %d --listen addresses\n", MAX_LISTENERS);
+                return -1;
+            }
+            cfg->listen_specs[cfg->listen_count++] = optarg;
+            break;
+        case OPT_ARCHIVE:
+            cfg->archive_path = optarg;
+            break;
+        case 'h':
+            print_usage(argv[0]);
+            exit(0);
+        default:
+            print_usage(argv[0]);
+            return -1;
+        }
+    }
+
+    if (expand_inputs(cfg, argv + optind, argc - optind) != 0)
+        return -1;
+    if (cfg->from_time && cfg->until_time && cfg->from_time > cfg->until_time)
+    {
+        fprintf(stderr, "--from is after --until\n");
+        return -1;
+    }
+    /* A merged read has no single position to resume or follow from */
+    if (cfg->merge && (cfg->checkpoint_path || cfg->follow || cfg->listen_count))
+    {
+        fprintf(stderr, "--merge cannot be combined with %s\n",
+                cfg->follow ? "--follow" : cfg->listen_count ? "--listen" : "--checkpoint");
+        return -1;
+    }
+    /* Both would read until stopped */
+    if (cfg->listen_count && (cfg->follow || cfg->archive_path))
+    {
+        fprintf(stderr, "--listen cannot be combined with %s\n",
+                cfg->follow ? "--follow" : "--archive");
+        return -1;
+    }
+    return 0;
+}
+
+/* --follow and --listen never reach the end of their input. SIGINT/SIGTERM end the run as
+ * if it had, through a pipe the ingestion thread polls; a second one kills. */
+static int stop_pipe_w = -1;
+
+static void on_stop_signal(int sig)
+{
+    (void)sig;
+    char c = 1;
+    if (write(stop_pipe_w, &c, 1) < 0)
+        _exit(1);
+}
+
+static void catch_stop_signals(SharedState *state)
+{
+    int fds[2];
+    if (pipe(fds) != 0)
+    {
+        perror("pipe");
+        exit(1);
+    }
+    state->stop_fd = fds[0];
+    stop_pipe_w = fds[1];
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_stop_signal;
+    sa.sa_flags = SA_RESETHAND | SA_RESTART;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+}
+
+/* Everything main sets up before the threads start, in any state of
+ * completion */
+static void free_state(SharedState *state)
+{
+    free_all_resources(state);
+    intern_destroy();
+    if (state->listener)
+        listener_close(state->listener);
+    if (state->stop_fd >= 0)
+    {
+        close(state->stop_fd);
+        close(stop_pipe_w);
+    }
+    free(state->sources);
+    free(state);
+}
+
+int main(int argc, char **argv)
+{
+    EngineConfig cfg;
+    if (parse_args(argc, argv, &cfg) != 0)
+        return 1;
+
+    /* Conversion only: no engine, no dashboard */
+    if (cfg.archive_path)
+    {
+        intern_init();
+        int rc = archive_convert(&cfg);
+        intern_destroy();
+        free_inputs(&cfg);
+        return rc == 0 ? 0 : 1;
+    }
+
     /* Clear screen */
     printf("\033[2J\033[H");
 
@@ -102,19 +835,38 @@ int main(void)
         perror("calloc SharedState");
         return 1;
     }
+    state->cfg = cfg;
+    state->start_ns = now_ns();
+    state->stop_fd = -1;
+    if (cfg.follow || cfg.listen_count)
+        catch_stop_signals(state);
+    if (cfg.merge)
+        merge_stats_init(state);
+    intern_init();
+    init_shards(state);
+    log_start(cfg.log_level);
+    if (cfg.listen_count)
+    {
+        state->listener = listener_open(&cfg, state->stop_fd, &state->listen_metrics);
+        if (!state->listener)
+        {
+            log_stop();
+            free_state(state);
+            free_inputs(&cfg);
+            return 1;
+        }
+    }
 
-    pthread_mutex_init(&state->lock, NULL);
-    pthread_mutex_init(&state->ip_lock, NULL);
-    pthread_cond_init(&state->cond_new_log, NULL);
-    pthread_cond_init(&state->cond_alert, NULL);
-
-    /* Clear alert log */
-    FILE *fp = fopen("alert_log.txt", "w");
-    if (fp)
-        fclose(fp);
+    /* A restored run carries on the alert log instead of starting afresh */
+    if (checkpoint_restore(state) > 0)
+        state->cfg.alert_append = 1;
+    init_alerts(state);
+    atomic_init(&state->shards_running, cfg.shard_count);
+    metrics_start(state);
+    checkpoint_start(state);
 
     /* Create threads */
-    pthread_t t_ingest, t_analyze, t_alert;
+    pthread_t t_ingest, t_alert;
 
     printf("Starting threads...\n");
 
@@ -124,10 +876,14 @@ int main(void)
         return 1;
     }
 
-    if (pthread_create(&t_analyze, NULL, analyzer_thread, state) != 0)
+    for (int i = 0; i < cfg.shard_count; i++)
     {
-        perror("pthread_create analyzer");
-        return 1;
+        if (pthread_create(&state->shards[i].thread, NULL, analyzer_thread,
+                           &state->shards[i]) != 0)
+        {
+            perror("pthread_create analyzer");
+            return 1;
+        }
     }
 
     if (pthread_create(&t_alert, NULL, alert_thread, state) != 0)
@@ -136,39 +892,44 @@ int main(void)
         return 1;
     }
 
-    /* Progress indicator */
+    /* Progress indicator; polled often enough that a short run is not
+     * rounded up to whole seconds */
     int last_count = 0;
-    while (!state->ingestion_done || state->head != NULL)
+    while (!state->analyzer_done)
     {
-        sleep(1);
-        if (state->log_count > last_count)
+        usleep(100000);
+        int ingested = (int)atomic_load_explicit(&state->ingest_metrics.events_admitted,
+                                                 memory_order_relaxed);
+        if (ingested > last_count)
         {
-            printf("\rProcessing logs: %d", state->log_count);
-            fflush(stdout);
-            last_count = state->log_count;
+            log_info("\rProcessing logs: %d", ingested);
+            last_count = ingested;
         }
     }
 
-    printf("\n\nIngestion complete. Waiting for analysis to finish...\n");
+    log_info("\n\nAnalysis complete. Waiting for alerts to drain...\n");
 
     /* Wait for threads */
     pthread_join(t_ingest, NULL);
-    pthread_join(t_analyze, NULL);
+    for (int i = 0; i < cfg.shard_count; i++)
+    {
+        pthread_join(state->shards[i].thread, NULL);
+    }
     pthread_join(t_alert, NULL);
+    checkpoint_stop(state); /* The final checkpoint is on disk */
+    log_stop(); /* Everything logged is on screen before the dashboard */
+    metrics_stop(state); /* Final export covers the whole run */
 
     /* Print final dashboard */
     print_dashboard(state);
 
     /* Cleanup */
-    free_all_resources(state);
-    pthread_mutex_destroy(&state->lock);
-    pthread_mutex_destroy(&state->ip_lock);
-    pthread_cond_destroy(&state->cond_new_log);
-    pthread_cond_destroy(&state->cond_alert);
-    free(state);
+    free_alerts(state);
+    free_state(state);
+    free_inputs(&cfg);
 
     printf("\n✅ All resources freed. Clean exit.\n");
-    printf("📝 Check alert_log.txt for critical alerts.\n\n");
+    printf("📝 Check %s for logged alerts.\n\n", cfg.alert_path);
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,523 @@
+#include "structures.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * Multi-source ingestion (--merge).
+ *
+ * Every input is a source with its own reader thread, which maps the file,
+ * parses it (inflating a gzip file, decoding an archive) and pushes the
+ * entries into a bounded SPSC ring; a full ring holds the reader back, so
+ * a fast source cannot run away from a slow one. The ingestion thread takes
+ * the k-way merge of the rings through a min-heap keyed by each source's
+ * next timestamp, ties going to the earlier input, so the shards see one
+ * stream in event-time order whatever the thread timing. Each source is
+ * assumed to be in time order itself; whatever is not is left to the
+ * lateness rules, as in a single file.
+ *
+ * Readers only look strings up in the intern table. One it lacks goes
+ * through a second ring, as a length byte and the bytes, and the entry
+ * carries INTERN_PENDING in its place; the merger interns it as it takes
+ * the entry, so ids follow the merged order, not the reader timing.
+ *
+ * A reader ends its stream with a ROUTE_STOP entry. Its counters
+ * (SourceStats) have one writer each: the reader or the merger. What the
+ * readers count is carried over into the global IngestMetrics by the merger
+ * as it takes their batches.
+ */
+
+#define MERGE_SOURCE_BUFFER 8192 /* Entries a reader may run ahead of the merge */
+#define MERGE_BATCH 512          /* Entries moved through a ring at once */
+#define MERGE_READ_BYTES (1 << 20) /* Text parsed between counter updates */
+#define MERGE_NAME_BYTES (1 << 16) /* Strings a reader may pass on ahead of the merge */
+
+typedef struct
+{
+    SharedState *state;
+    SourceStats *stats;
+    SpscRing ring;
+    SpscRing names; /* Bytes: strings for the merger to intern, in entry order */
+    pthread_t thread;
+
+    /* Reader-private: entries not yet pushed */
+    LogEntry staged[MERGE_BATCH];
+    size_t staged_count;
+    InternDeferred strings; /* Of the text or block being read */
+
+    /* Merger-private: the batch being merged */
+    LogEntry batch[MERGE_BATCH];
+    size_t pos, count;
+    int index; /* Input order, breaks timestamp ties */
+    int ended;
+
+    /* Reader counts already carried over into IngestMetrics */
+    uint64_t seen_lines, seen_out_of_range, seen_skipped, seen_inflated;
+    uint64_t seen_errors[PARSE_RESULT_COUNT];
+} Source;
+
+struct MergeSet
+{
+    SharedState *state;
+    Source *sources;
+    int count;
+    Source **heap; /* Sources with a batch in hand, by next timestamp */
+    int heap_count;
+    Source **pending; /* Sources whose batch ran out, to refill first */
+    int pending_count;
+};
+
+/* ─── Reader side ─── */
+
+static void stage_push(Source *src)
+{
+    spsc_push_batch(&src->ring, src->staged, src->staged_count);
+    src->staged_count = 0;
+}
+
+/* Pass a string the intern table lacked on to the merger */
+static void stage_name(Source *src, uint32_t *field)
+{
+    if (!(*field & INTERN_PENDING))
+        return;
+    const DeferredStr *ds = &src->strings.strs[*field & ~INTERN_PENDING];
+    uint8_t rec[1 + MAX_FIELD_LEN];
+    rec[0] = (uint8_t)ds->len;
+    memcpy(rec + 1, ds->str, ds->len);
+    spsc_push_batch(&src->names, rec, 1 + ds->len);
+    *field = INTERN_PENDING;
+}
+
+static void stage_entry(Source *src, const LogEntry *e)
+{
+    SourceStats *st = src->stats;
+    if (!in_time_range(&src->state->cfg, e->timestamp))
+    {
+        counter_add(&st->out_of_range, 1);
+        return;
+    }
+    /* Strings of staged entries cannot reach the merger, so never wait for
+     * room in the names ring while holding any */
+    if (MERGE_NAME_BYTES - spsc_depth(&src->names) < 2 * (1 + MAX_FIELD_LEN) &&
+        src->staged_count > 0)
+        stage_push(src);
+    LogEntry *s = &src->staged[src->staged_count++];
+    *s = *e;
+    stage_name(src, &s->ip_id);
+    stage_name(src, &s->resource_id);
+    counter_add(&st->events_read, 1);
+    if ((uint64_t)e->timestamp > atomic_load_explicit(&st->newest, memory_order_relaxed))
+        atomic_store_explicit(&st->newest, (uint64_t)e->timestamp, memory_order_relaxed);
+    if (src->staged_count == MERGE_BATCH)
+        stage_push(src);
+}
+
+static void read_lines(Source *src, const char *p, const char *end)
+{
+    SourceStats *st = src->stats;
+    uint64_t lines = 0;
+    const char *start = p;
+    intern_deferred_clear(&src->strings);
+    while (p < end)
+    {
+        const char *nl = memchr(p, '\n', (size_t)(end - p));
+        const char *line_end = nl ? nl + 1 : end;
+        size_t len = (size_t)(line_end - p);
+        lines++;
+
+        if (!is_ignorable_line(p, len))
+        {
+            LogEntry e = {0};
+            ParseResult r = parse_log_line(p, len, &e, &src->strings);
+            if (r == PARSE_OK)
+                stage_entry(src, &e);
+            else
+                counter_add(&st->parse_errors[r], 1);
+        }
+        p = line_end;
+    }
+    counter_add(&st->lines, lines);
+    counter_add(&st->bytes_read, (uint64_t)(end - start));
+}
+
+/* Plain text, in MERGE_READ_BYTES stretches cut at line ends */
+static void read_text(Source *src, const char *data, size_t size)
+{
+    size_t pos = 0;
+    while (pos < size)
+    {
+        size_t end = size;
+        if (size - pos > MERGE_READ_BYTES)
+        {
+            const char *nl = memchr(data + pos + MERGE_READ_BYTES, '\n',
+                                    size - pos - MERGE_READ_BYTES);
+            if (nl)
+                end = (size_t)(nl + 1 - data);
+        }
+        read_lines(src, data + pos, data + end);
+        pos = end;
+    }
+}
+
+static void read_gzip(Source *src, const char *data, size_t size)
+{
+    GzipReader *gz = gzip_open(data, size, 0, 2);
+    GzipPiece piece;
+    while (gzip_next(gz, &piece))
+    {
+        read_lines(src, piece.data, piece.data + piece.len);
+        counter_add(&src->stats->inflated, piece.len);
+        gzip_release(gz);
+    }
+    const char *err = gzip_error(gz);
+    if (err)
+        fprintf(stderr, "Cannot decompress %s: %s\n", src->stats->path, err);
+    gzip_close(gz);
+}
+
+/* Archive blocks outside --from/--until are stepped over unread */
+static void read_archive(Source *src, const char *data, size_t size)
+{
+    const EngineConfig *cfg = &src->state->cfg;
+    SourceStats *st = src->stats;
+    LogEntry *entries = (LogEntry *)malloc(sizeof(LogEntry) * ARCHIVE_BLOCK_EVENTS);
+    if (!entries)
+    {
+        perror("malloc archive block");
+        exit(1);
+    }
+    size_t pos = archive_first_block();
+    while (pos < size)
+    {
+        ArchiveBlock blk;
+        intern_deferred_clear(&src->strings);
+        if (archive_block_at(data, size, pos, &blk) != PARSE_OK ||
+            archive_decode_block(data, &blk, entries, &src->strings) != PARSE_OK)
+        {
+            counter_add(&st->parse_errors[PARSE_ERR_BAD_BLOCK], 1);
+            break;
+        }
+        pos = blk.end;
+        counter_add(&st->bytes_read, blk.end - blk.start);
+        if ((cfg->from_time && blk.max_time < cfg->from_time) ||
+            (cfg->until_time && blk.min_time > cfg->until_time))
+        {
+            counter_add(&st->blocks_skipped, 1);
+            continue;
+        }
+        for (uint32_t i = 0; i < blk.count; i++)
+            stage_entry(src, &entries[i]);
+        counter_add(&st->lines, blk.count);
+    }
+    free(entries);
+}
+
+static void read_source(Source *src)
+{
+    const char *path = src->stats->path;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Cannot open %s: %s\n", path, strerror(errno));
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode))
+    {
+        fprintf(stderr, "Cannot read %s: not a regular file\n", path);
+        close(fd);
+        return;
+    }
+    if (st.st_size == 0)
+    {
+        close(fd);
+        return;
+    }
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        fprintf(stderr, "Cannot mmap %s: %s\n", path, strerror(errno));
+        return;
+    }
+    madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+    const char *data = (const char *)map;
+    size_t size = (size_t)st.st_size;
+    if (gzip_is(data, size))
+        read_gzip(src, data, size);
+    else if (archive_is(data, size))
+        read_archive(src, data, size);
+    else
+        read_text(src, data, size);
+    munmap(map, size);
+}
+
+static void *reader_thread(void *arg)
+{
+    Source *src = (Source *)arg;
+    atomic_store(&src->stats->start_ns, now_ns());
+    read_source(src);
+
+    LogEntry stop = {0};
+    stop.route = ROUTE_STOP;
+    src->staged[src->staged_count++] = stop;
+    stage_push(src);
+    atomic_store(&src->stats->end_ns, now_ns());
+    return NULL;
+}
+
+/* ─── Merger side ─── */
+
+/* Move what the reader counted since last time into the global counters */
+static void carry_over(SharedState *state, Source *src)
+{
+    IngestMetrics *im = &state->ingest_metrics;
+    SourceStats *st = src->stats;
+    uint64_t v;
+
+    v = atomic_load_explicit(&st->lines, memory_order_relaxed);
+    counter_add(&im->lines_parsed, v - src->seen_lines);
+    src->seen_lines = v;
+    v = atomic_load_explicit(&st->out_of_range, memory_order_relaxed);
+    counter_add(&im->events_out_of_range, v - src->seen_out_of_range);
+    src->seen_out_of_range = v;
+    v = atomic_load_explicit(&st->blocks_skipped, memory_order_relaxed);
+    counter_add(&im->blocks_skipped, v - src->seen_skipped);
+    src->seen_skipped = v;
+    v = atomic_load_explicit(&st->inflated, memory_order_relaxed);
+    counter_add(&im->bytes_inflated, v - src->seen_inflated);
+    src->seen_inflated = v;
+    for (int r = 1; r < PARSE_RESULT_COUNT; r++)
+    {
+        v = atomic_load_explicit(&st->parse_errors[r], memory_order_relaxed);
+        state->parse_errors[r] += (int)(v - src->seen_errors[r]);
+        counter_add(&im->parse_errors[r], v - src->seen_errors[r]);
+        src->seen_errors[r] = v;
+    }
+}
+
+/* Take the source's next batch, waiting for its reader. Returns 0 once
+ * its stream has ended. */
+static int source_fill(MergeSet *m, Source *src)
+{
+    SourceStats *st = src->stats;
+    counter_add(&st->events_merged, src->count);
+    src->pos = src->count = 0;
+    if (src->ended)
+        return 0;
+
+    if (spsc_depth(&src->ring) == 0)
+    {
+        uint64_t t0 = now_ns();
+        src->count = spsc_pop_batch(&src->ring, src->batch, MERGE_BATCH);
+        counter_add(&st->stall_ns, now_ns() - t0);
+    }
+    else
+    {
+        src->count = spsc_pop_batch(&src->ring, src->batch, MERGE_BATCH);
+    }
+    if (src->batch[src->count - 1].route & ROUTE_STOP)
+    {
+        /* Nothing can follow the end marker */
+        src->ended = 1;
+        src->count--;
+    }
+    atomic_store_explicit(&st->buffered, spsc_depth(&src->ring), memory_order_relaxed);
+    carry_over(m->state, src);
+    return src->count > 0;
+}
+
+/* Intern the next string the reader passed on */
+static uint32_t take_name(Source *src)
+{
+    uint8_t len;
+    char buf[MAX_FIELD_LEN];
+    spsc_pop_batch(&src->names, &len, 1);
+    for (size_t got = 0; got < len;)
+        got += spsc_pop_batch(&src->names, buf + got, len - got);
+    return intern_bytes(buf, len);
+}
+
+static int source_before(const Source *a, const Source *b)
+{
+    time_t ta = a->batch[a->pos].timestamp, tb = b->batch[b->pos].timestamp;
+    return ta < tb || (ta == tb && a->index < b->index);
+}
+
+static void heap_sift_up(MergeSet *m, int i)
+{
+    Source *src = m->heap[i];
+    while (i > 0)
+    {
+        int parent = (i - 1) / 2;
+        if (!source_before(src, m->heap[parent]))
+            break;
+        m->heap[i] = m->heap[parent];
+        i = parent;
+    }
+    m->heap[i] = src;
+}
+
+static void heap_sift_down(MergeSet *m, int i)
+{
+    Source *src = m->heap[i];
+    while (1)
+    {
+        int child = 2 * i + 1;
+        if (child >= m->heap_count)
+            break;
+        if (child + 1 < m->heap_count && source_before(m->heap[child + 1], m->heap[child]))
+            child++;
+        if (!source_before(m->heap[child], src))
+            break;
+        m->heap[i] = m->heap[child];
+        i = child;
+    }
+    m->heap[i] = src;
+}
+
+/* Start a reader for every input */
+MergeSet *merge_open(SharedState *state)
+{
+    MergeSet *m = (MergeSet *)calloc(1, sizeof(MergeSet));
+    if (!m)
+    {
+        perror("calloc merge set");
+        exit(1);
+    }
+    m->state = state;
+    m->count = state->source_count;
+    m->sources = (Source *)calloc((size_t)m->count, sizeof(Source));
+    m->heap = (Source **)malloc(sizeof(Source *) * (size_t)m->count);
+    m->pending = (Source **)malloc(sizeof(Source *) * (size_t)m->count);
+    if (!m->sources || !m->heap || !m->pending)
+    {
+        perror("malloc merge sources");
+        exit(1);
+    }
+
+    for (int i = 0; i < m->count; i++)
+    {
+        Source *src = &m->sources[i];
+        src->state = state;
+        src->stats = &state->sources[i];
+        src->index = i;
+        spsc_init(&src->ring, sizeof(LogEntry), MERGE_SOURCE_BUFFER);
+        spsc_init(&src->names, 1, MERGE_NAME_BYTES);
+        if (pthread_create(&src->thread, NULL, reader_thread, src) != 0)
+        {
+            perror("pthread_create source reader");
+            exit(1);
+        }
+    }
+    /* Refilled in reverse so the first input's reader is waited on first */
+    for (int i = m->count - 1; i >= 0; i--)
+        m->pending[m->pending_count++] = &m->sources[i];
+    return m;
+}
+
+/* Next entry of the merged stream. Returns 1, 0 at the end of every
+ * source, or -1 without waiting when the next entry depends on a reader
+ * that has not caught up (only when `wait` is 0). */
+int merge_next(MergeSet *m, LogEntry *out, int wait)
+{
+    while (m->pending_count > 0)
+    {
+        Source *src = m->pending[m->pending_count - 1];
+        if (!wait && !src->ended && spsc_depth(&src->ring) == 0)
+            return -1;
+        m->pending_count--;
+        if (source_fill(m, src))
+        {
+            m->heap[m->heap_count++] = src;
+            heap_sift_up(m, m->heap_count - 1);
+        }
+    }
+    if (m->heap_count == 0)
+        return 0;
+
+    Source *top = m->heap[0];
+    *out = top->batch[top->pos++];
+    if (out->ip_id & INTERN_PENDING)
+        out->ip_id = take_name(top);
+    if (out->resource_id & INTERN_PENDING)
+        out->resource_id = take_name(top);
+    if (top->pos < top->count)
+    {
+        heap_sift_down(m, 0);
+    }
+    else
+    {
+        /* Its order is unknown until the next batch comes in */
+        m->heap[0] = m->heap[--m->heap_count];
+        if (m->heap_count > 0)
+            heap_sift_down(m, 0);
+        m->pending[m->pending_count++] = top;
+    }
+    return 1;
+}
+
+void merge_close(MergeSet *m)
+{
+    for (int i = 0; i < m->count; i++)
+    {
+        Source *src = &m->sources[i];
+        pthread_join(src->thread, NULL);
+        carry_over(m->state, src);
+        spsc_destroy(&src->ring);
+        spsc_destroy(&src->names);
+        intern_deferred_free(&src->strings);
+    }
+    free(m->sources);
+    free(m->heap);
+    free(m->pending);
+    free(m);
+}
+
+/* Per-source counters for --merge, one per input; owned by the state so
+ * they outlive the merge for the final dashboard and metrics export */
+void merge_stats_init(SharedState *state)
+{
+    int n = input_total(&state->cfg);
+    state->sources = (SourceStats *)calloc((size_t)n, sizeof(SourceStats));
+    if (!state->sources)
+    {
+        perror("calloc source stats");
+        exit(1);
+    }
+    state->source_count = n;
+    for (int i = 0; i < n; i++)
+        state->sources[i].path = input_path_at(&state->cfg, i);
+}
+
+/* Event time a source trails the source furthest ahead by, as read; 0 once
+ * it is finished */
+double source_lag_seconds(const SharedState *state, int i)
+{
+    SourceStats *st = &state->sources[i];
+    if (atomic_load(&st->end_ns))
+        return 0.0;
+    uint64_t front = 0;
+    for (int s = 0; s < state->source_count; s++)
+    {
+        uint64_t t = atomic_load_explicit(&state->sources[s].newest, memory_order_relaxed);
+        if (t > front)
+            front = t;
+    }
+    uint64_t own = atomic_load_explicit(&st->newest, memory_order_relaxed);
+    return own && front > own ? (double)(front - own) : 0.0;
+}
+
+/* Events read per second of the reader's running time */
+double source_rate(const SharedState *state, int i)
+{
+    SourceStats *st = &state->sources[i];
+    uint64_t start = atomic_load(&st->start_ns), end = atomic_load(&st->end_ns);
+    if (!start)
+        return 0.0;
+    double secs = (double)((end ? end : now_ns()) - start) / 1e9;
+    uint64_t events = atomic_load_explicit(&st->events_read, memory_order_relaxed);
+    return secs > 0 ? (double)events / secs : 0.0;
+}
@@ -0,0 +1,533 @@
+#include "structures.h"
+#include <errno.h>
+#include <poll.h>
+#include <stddef.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+/*
+ * Pipeline metrics.
+ *
+ * Every counter and histogram has exactly one writer: ingestion owns
+ * IngestMetrics, each shard its ShardMetrics, the alert thread
+ * AlertMetrics. Writers update with relaxed loads and stores (no atomic
+ * read-modify-write, no lock); readers (the exporter, the dashboard) see
+ * a slightly stale but never torn value.
+ *
+ * Latencies go into log-linear histograms in the style of HDR histograms:
+ * each power of two is split into 2^HIST_SUB_BITS buckets, so any
+ * recorded value is known to within 1/16 (6.25%) from 1 ns up to 2^64 ns,
+ * in a fixed 976 buckets.
+ *
+ * With --metrics-file and/or --metrics-port, a metrics thread renders the
+ * Prometheus text exposition format every --metrics-interval ms. It
+ * replaces the file atomically (write + rename) and serves the latest
+ * rendering to any HTTP GET on 127.0.0.1:<port>.
+ */
+
+uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* ─── Histograms ─── */
+
+#define HIST_SUB (1u << HIST_SUB_BITS)
+
+static int hist_index(uint64_t v)
+{
+    if (v < HIST_SUB)
+        return (int)v;
+    int e = 63 - __builtin_clzll(v); /* >= HIST_SUB_BITS */
+    return (e - HIST_SUB_BITS + 1) * (int)HIST_SUB +
+           (int)((v >> (e - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+/* Middle of a bucket's range, used as its value for quantiles */
+static double hist_value(int idx)
+{
+    if (idx < (int)HIST_SUB)
+        return (double)idx;
+    int e = idx / (int)HIST_SUB + HIST_SUB_BITS - 1;
+    uint64_t width = 1ull << (e - HIST_SUB_BITS);
+    uint64_t low = (uint64_t)(HIST_SUB + idx % HIST_SUB) << (e - HIST_SUB_BITS);
+    return (double)low + (double)(width - 1) / 2.0;
+}
+
+static void counter_store(atomic_ullong *c, uint64_t v)
+{
+    atomic_store_explicit(c, v, memory_order_relaxed);
+}
+
+static uint64_t counter_get(atomic_ullong *c)
+{
+    return atomic_load_explicit(c, memory_order_relaxed);
+}
+
+/* Owner thread only */
+void hist_record(LatencyHist *h, uint64_t ns)
+{
+    atomic_ullong *b = &h->buckets[hist_index(ns)];
+    counter_store(b, counter_get(b) + 1);
+    counter_store(&h->count, counter_get(&h->count) + 1);
+    counter_store(&h->sum, counter_get(&h->sum) + ns);
+    if (ns > counter_get(&h->max))
+        counter_store(&h->max, ns);
+}
+
+/* Add a live histogram into a snapshot (several shards merge into one) */
+void hist_snapshot(HistSnapshot *out, LatencyHist *h)
+{
+    for (int i = 0; i < HIST_BUCKETS; i++)
+        out->buckets[i] += counter_get(&h->buckets[i]);
+    out->count += counter_get(&h->count);
+    out->sum += counter_get(&h->sum);
+    uint64_t max = counter_get(&h->max);
+    if (max > out->max)
+        out->max = max;
+}
+
+/* Value at quantile q (0..1), in ns; 0 for an empty histogram */
+double snap_quantile(const HistSnapshot *s, double q)
+{
+    if (s->count == 0)
+        return 0.0;
+    uint64_t rank = (uint64_t)(q * (double)(s->count - 1)) + 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++)
+    {
+        seen += s->buckets[i];
+        if (seen >= rank)
+        {
+            double v = hist_value(i);
+            return v > (double)s->max ? (double)s->max : v;
+        }
+    }
+    return (double)s->max;
+}
+
+/* ─── Prometheus exposition ─── */
+
+static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+
+static void write_summary(FILE *f, const char *name, const char *labels, const HistSnapshot *s)
+{
+    const char *sep = labels[0] ? "," : "";
+    for (size_t i = 0; i < sizeof(quantiles) / sizeof(quantiles[0]); i++)
+        fprintf(f, "%s{%s%squantile=\"%g\"} %.9f\n", name, labels, sep, quantiles[i],
+                snap_quantile(s, quantiles[i]) / 1e9);
+    fprintf(f, "%s_sum%s%s%s %.9f\n", name, labels[0] ? "{" : "", labels, labels[0] ? "}" : "",
+            (double)s->sum / 1e9);
+    fprintf(f, "%s_count%s%s%s %llu\n", name, labels[0] ? "{" : "", labels, labels[0] ? "}" : "",
+            (unsigned long long)s->count);
+}
+
+static void write_header(FILE *f, const char *name, const char *type, const char *help)
+{
+    fprintf(f, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+/* Current leaders, from the shards' top-K boards */
+static void write_top(FILE *f, SharedState *state)
+{
+    int k = state->cfg.top_k, n_users, n_ips;
+    TopEntry *users = (TopEntry *)malloc(sizeof(TopEntry) * (size_t)k);
+    TopEntry *ips = (TopEntry *)malloc(sizeof(TopEntry) * (size_t)k);
+    if (!users || !ips)
+    {
+        perror("malloc metrics top-k");
+        exit(1);
+    }
+    topk_collect(state, users, &n_users, ips, &n_ips);
+
+    write_header(f, "codeshield_top_user_score", "gauge", "Score of the most suspicious users");
+    for (int i = 0; i < n_users; i++)
+        fprintf(f, "codeshield_top_user_score{rank=\"%d\",user=\"%d\"} %d\n", i + 1,
+                (int)users[i].id, users[i].score);
+    write_header(f, "codeshield_top_ip_score", "gauge", "Score of the most suspicious IPs");
+    for (int i = 0; i < n_ips; i++)
+        fprintf(f, "codeshield_top_ip_score{rank=\"%d\",ip=\"%s\"} %d\n", i + 1,
+                intern_str(ips[i].id), ips[i].score);
+
+    free(users);
+    free(ips);
+}
+
+static void write_hist(FILE *f, const char *name, const char *help, LatencyHist *h)
+{
+    HistSnapshot s = {0};
+    hist_snapshot(&s, h);
+    write_header(f, name, "summary", help);
+    write_summary(f, name, "", &s);
+}
+
+/* One series per shard, labelled shard="<id>" */
+static void write_shard_hist(FILE *f, SharedState *state, const char *name, const char *help,
+                             size_t offset)
+{
+    write_header(f, name, "summary", help);
+    for (int i = 0; i < state->cfg.shard_count; i++)
+    {
+        HistSnapshot s = {0};
+        hist_snapshot(&s, (LatencyHist *)((char *)&state->shards[i].metrics + offset));
+        char labels[32];
+        snprintf(labels, sizeof(labels), "shard=\"%d\"", i);
+        write_summary(f, name, labels, &s);
+    }
+}
+
+static void write_shard_counter(FILE *f, SharedState *state, const char *name, const char *type,
+                                const char *help, size_t offset)
+{
+    write_header(f, name, type, help);
+    for (int i = 0; i < state->cfg.shard_count; i++)
+    {
+        atomic_ullong *c = (atomic_ullong *)((char *)&state->shards[i].metrics + offset);
+        fprintf(f, "%s{shard=\"%d\"} %llu\n", name, i, (unsigned long long)counter_get(c));
+    }
+}
+
+/* One series per --merge source, labelled source="<path>" */
+static void write_source_label(FILE *f, const char *name, const char *path)
+{
+    fprintf(f, "%s{source=\"", name);
+    for (const char *p = path; *p; p++)
+    {
+        if (*p == '"' || *p == '\\')
+            fputc('\\', f);
+        fputc(*p, f);
+    }
+    fputs("\"} ", f);
+}
+
+static void write_source_counter(FILE *f, SharedState *state, const char *name,
+                                 const char *type, const char *help, size_t offset)
+{
+    write_header(f, name, type, help);
+    for (int i = 0; i < state->source_count; i++)
+    {
+        atomic_ullong *c = (atomic_ullong *)((char *)&state->sources[i] + offset);
+        write_source_label(f, name, state->sources[i].path);
+        fprintf(f, "%llu\n", (unsigned long long)counter_get(c));
+    }
+}
+
+static void write_sources(FILE *f, SharedState *state)
+{
+    write_source_counter(f, state, "codeshield_source_events_total", "counter",
+                         "Events read from the source", offsetof(SourceStats, events_read));
+    write_source_counter(f, state, "codeshield_source_bytes_total", "counter",
+                         "Bytes read from the source (inflated for gzip)",
+                         offsetof(SourceStats, bytes_read));
+    write_source_counter(f, state, "codeshield_source_buffered", "gauge",
+                         "Entries read from the source and waiting to be merged",
+                         offsetof(SourceStats, buffered));
+
+    write_header(f, "codeshield_source_lag_seconds", "gauge",
+                 "Event time the source's reader trails the one furthest ahead by");
+    for (int i = 0; i < state->source_count; i++)
+    {
+        write_source_label(f, "codeshield_source_lag_seconds", state->sources[i].path);
+        fprintf(f, "%.0f\n", source_lag_seconds(state, i));
+    }
+    write_header(f, "codeshield_source_stall_seconds_total", "counter",
+                 "Time the merge spent waiting for the source's reader");
+    for (int i = 0; i < state->source_count; i++)
+    {
+        write_source_label(f, "codeshield_source_stall_seconds_total", state->sources[i].path);
+        fprintf(f, "%.9f\n", (double)counter_get(&state->sources[i].stall_ns) / 1e9);
+    }
+}
+
+static void write_counter(FILE *f, const char *name, const char *type, const char *help,
+                          unsigned long long v)
+{
+    write_header(f, name, type, help);
+    fprintf(f, "%s %llu\n", name, v);
+}
+
+/* Render every metric; the caller frees *out */
+size_t metrics_render(SharedState *state, char **out)
+{
+    size_t len = 0;
+    FILE *f = open_memstream(out, &len);
+    if (!f)
+    {
+        perror("open_memstream metrics");
+        exit(1);
+    }
+
+    IngestMetrics *in = &state->ingest_metrics;
+    write_counter(f, "codeshield_uptime_seconds", "gauge", "Seconds since the engine started",
+                  (unsigned long long)((now_ns() - state->start_ns) / 1000000000ull));
+    write_counter(f, "codeshield_lines_parsed_total", "counter", "Input lines parsed",
+                  counter_get(&in->lines_parsed));
+    write_counter(f, "codeshield_events_ingested_total", "counter",
+                  "Events admitted and routed to shards", counter_get(&in->events_admitted));
+    write_counter(f, "codeshield_events_late_total", "counter",
+                  "Events dropped for arriving behind the window", counter_get(&in->events_late));
+    write_counter(f, "codeshield_events_out_of_range_total", "counter",
+                  "Events outside --from/--until", counter_get(&in->events_out_of_range));
+    write_counter(f, "codeshield_archive_blocks_skipped_total", "counter",
+                  "Archive blocks outside --from/--until, never decoded",
+                  counter_get(&in->blocks_skipped));
+    write_counter(f, "codeshield_bytes_inflated_total", "counter",
+                  "Text bytes read out of gzip inputs", counter_get(&in->bytes_inflated));
+    write_header(f, "codeshield_parse_errors_total", "counter", "Malformed lines by reason");
+    for (int r = 1; r < PARSE_RESULT_COUNT; r++)
+        fprintf(f, "codeshield_parse_errors_total{reason=\"%s\"} %llu\n",
+                parse_result_str((ParseResult)r),
+                (unsigned long long)counter_get(&in->parse_errors[r]));
+    write_hist(f, "codeshield_parse_chunk_seconds", "Time to parse one input chunk",
+               &in->parse_chunk_ns);
+    write_hist(f, "codeshield_inflate_seconds", "Time to inflate one piece of a gzip input",
+               &in->inflate_ns);
+    write_hist(f, "codeshield_handoff_wait_seconds",
+               "Time ingestion spent publishing one batch to a shard inbox", &in->handoff_ns);
+    if (state->source_count > 0)
+        write_sources(f, state);
+    if (state->cfg.listen_count > 0)
+    {
+        ListenMetrics *lm = &state->listen_metrics;
+        write_counter(f, "codeshield_listen_connections_accepted_total", "counter",
+                      "Stream connections accepted", counter_get(&lm->connections_accepted));
+        write_counter(f, "codeshield_listen_connections", "gauge", "Stream connections open",
+                      counter_get(&lm->connections_open));
+        write_counter(f, "codeshield_listen_bytes_total", "counter",
+                      "Bytes received on the listening sockets", counter_get(&lm->bytes_received));
+        write_counter(f, "codeshield_listen_datagrams_total", "counter", "Datagrams received",
+                      counter_get(&lm->datagrams));
+        write_counter(f, "codeshield_listen_messages_total", "counter",
+                      "Messages received, syslog or plain lines", counter_get(&lm->messages));
+        write_counter(f, "codeshield_listen_syslog_messages_total", "counter",
+                      "RFC 5424 messages whose header was stripped",
+                      counter_get(&lm->syslog_messages));
+        write_counter(f, "codeshield_listen_syslog_invalid_total", "counter",
+                      "Messages starting with '<' without a valid RFC 5424 header",
+                      counter_get(&lm->syslog_invalid));
+        write_counter(f, "codeshield_listen_oversized_total", "counter",
+                      "Messages over the length limit, dropped", counter_get(&lm->oversized));
+    }
+
+    write_shard_counter(f, state, "codeshield_shard_events_applied_total", "counter",
+                        "Events folded into the shard's window",
+                        offsetof(ShardMetrics, events_applied));
+    write_shard_counter(f, state, "codeshield_shard_entries_expired_total", "counter",
+                        "Entries expired out of the shard's window",
+                        offsetof(ShardMetrics, entries_expired));
+    write_shard_counter(f, state, "codeshield_shard_evaluations_total", "counter",
+                        "Evaluation ticks run", offsetof(ShardMetrics, evaluations));
+    write_shard_counter(f, state, "codeshield_shard_entities_scored_total", "counter",
+                        "Users and IPs rescored", offsetof(ShardMetrics, entities_scored));
+    write_shard_counter(f, state, "codeshield_shard_alerts_total", "counter",
+                        "Alerts raised", offsetof(ShardMetrics, alerts));
+    write_shard_counter(f, state, "codeshield_shard_window_entries", "gauge",
+                        "Entries inside the shard's window",
+                        offsetof(ShardMetrics, window_entries));
+    write_header(f, "codeshield_shard_inbox_depth", "gauge", "Entries queued for the shard");
+    for (int i = 0; i < state->cfg.shard_count; i++)
+        fprintf(f, "codeshield_shard_inbox_depth{shard=\"%d\"} %zu\n", i,
+                spsc_depth(&state->shards[i].inbox));
+    write_shard_hist(f, state, "codeshield_shard_fold_seconds",
+                     "Time to fold one run of events into the window",
+                     offsetof(ShardMetrics, fold_ns));
+    write_shard_hist(f, state, "codeshield_shard_eval_seconds", "Time of one evaluation tick",
+                     offsetof(ShardMetrics, eval_ns));
+
+    AlertMetrics *am = &state->alert_metrics;
+    write_counter(f, "codeshield_alert_queue_depth", "gauge",
+                  "Alerts queued for the alert thread", mpsc_depth(&state->alert_ring));
+    write_counter(f, "codeshield_alerts_emitted_total", "counter",
+                  "Alerts printed and logged by the alert thread", counter_get(&am->emitted));
+    write_counter(f, "codeshield_alerts_spilled_total", "counter",
+                  "Alerts spilled to disk under backpressure",
+                  (unsigned long long)atomic_load(&state->alerts_spilled));
+    write_counter(f, "codeshield_alerts_dropped_total", "counter",
+                  "Alerts dropped under backpressure",
+                  (unsigned long long)atomic_load(&state->alerts_dropped));
+    write_hist(f, "codeshield_alert_latency_seconds",
+               "From ingestion sending the evaluation tick to the alert being emitted",
+               &am->latency_ns);
+    write_hist(f, "codeshield_alert_commit_seconds", "Time of one alert log group commit",
+               &am->commit_ns);
+
+    if (state->cfg.checkpoint_path)
+    {
+        Checkpointer *ck = &state->checkpoint;
+        write_counter(f, "codeshield_checkpoints_written_total", "counter",
+                      "Checkpoints written", (unsigned long long)atomic_load(&ck->written));
+        write_counter(f, "codeshield_checkpoints_failed_total", "counter",
+                      "Checkpoints that could not be written",
+                      (unsigned long long)atomic_load(&ck->failed));
+        write_counter(f, "codeshield_checkpoint_bytes", "gauge", "Size of the last checkpoint",
+                      atomic_load(&ck->last_bytes));
+        /* Each shard records its own pauses; exported as one series */
+        HistSnapshot pause = {0};
+        for (int i = 0; i < state->cfg.shard_count; i++)
+            hist_snapshot(&pause, &state->shards[i].metrics.pause_ns);
+        write_header(f, "codeshield_checkpoint_pause_seconds", "summary",
+                     "Time a shard spends copying out its part of a checkpoint");
+        write_summary(f, "codeshield_checkpoint_pause_seconds", "", &pause);
+        write_hist(f, "codeshield_checkpoint_seconds",
+                   "From the checkpoint marker to the file renamed into place", &ck->total_ns);
+    }
+    write_top(f, state);
+
+    fclose(f);
+    return len;
+}
+
+/* ─── Exporter thread ─── */
+
+static void export_file(SharedState *state, const char *text, size_t len)
+{
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", state->cfg.metrics_path);
+    FILE *f = fopen(tmp, "w");
+    if (!f)
+    {
+        perror("fopen metrics file");
+        return;
+    }
+    fwrite(text, 1, len, f);
+    if (fclose(f) != 0 || rename(tmp, state->cfg.metrics_path) != 0)
+        perror("write metrics file");
+}
+
+static int listen_local(int port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        perror("socket metrics");
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons((uint16_t)port);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 16) != 0)
+    {
+        perror("bind metrics port");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Answer one scrape with the latest rendering. Whatever the request says,
+ * the reply is the metrics page. */
+static void serve_client(int listen_fd, const char *text, size_t len)
+{
+    int fd = accept(listen_fd, NULL, NULL);
+    if (fd < 0)
+        return;
+
+    /* Wait briefly for the request so the client sees its reply after
+     * sending it, not before */
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    char req[2048];
+    if (poll(&pfd, 1, 200) > 0)
+    {
+        ssize_t r = read(fd, req, sizeof(req));
+        (void)r;
+    }
+
+    char head[160];
+    int hlen = snprintf(head, sizeof(head),
+                        "HTTP/1.0 200 OK\r\n"
+                        "Content-Type: text/plain; version=0.0.4\r\n"
+                        "Content-Length: %zu\r\n"
+                        "Connection: close\r\n\r\n",
+                        len);
+    const char *parts[2] = {head, text};
+    size_t sizes[2] = {(size_t)hlen, len};
+    for (int i = 0; i < 2; i++)
+    {
+        size_t off = 0;
+        while (off < sizes[i])
+        {
+            ssize_t n = send(fd, parts[i] + off, sizes[i] - off, MSG_NOSIGNAL);
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0)
+                break;
+            off += (size_t)n;
+        }
+    }
+    close(fd);
+}
+
+static void *metrics_thread(void *arg)
+{
+    SharedState *state = (SharedState *)arg;
+    char *text = NULL;
+    size_t len = 0;
+    uint64_t next = 0;
+
+    while (1)
+    {
+        int stopping = atomic_load(&state->metrics_stop);
+        uint64_t now = now_ns();
+        if (now >= next || stopping)
+        {
+            free(text);
+            len = metrics_render(state, &text);
+            if (state->cfg.metrics_path)
+                export_file(state, text, len);
+            next = now + (uint64_t)state->cfg.metrics_interval_ms * 1000000ull;
+        }
+        if (stopping)
+            break;
+
+        /* Sleep until the next export, waking early for scrapes; the stop
+         * flag is looked at least every 100 ms */
+        int wait_ms = (int)((next - now) / 1000000ull);
+        if (wait_ms > 100)
+            wait_ms = 100;
+        struct pollfd pfd = {.fd = state->metrics_listen_fd, .events = POLLIN};
+        if (poll(&pfd, state->metrics_listen_fd >= 0 ? 1 : 0, wait_ms) > 0)
+            serve_client(state->metrics_listen_fd, text, len);
+    }
+
+    free(text);
+    return NULL;
+}
+
+/* Start the exporter if a metrics file or port was asked for */
+void metrics_start(SharedState *state)
+{
+    state->metrics_listen_fd = -1;
+    atomic_init(&state->metrics_stop, 0);
+    state->metrics_running = 0;
+    if (!state->cfg.metrics_path && state->cfg.metrics_port == 0)
+        return;
+
+    if (state->cfg.metrics_port > 0)
+        state->metrics_listen_fd = listen_local(state->cfg.metrics_port);
+
+    if (pthread_create(&state->metrics_thread, NULL, metrics_thread, state) != 0)
+    {
+        perror("pthread_create metrics");
+        exit(1);
+    }
+    state->metrics_running = 1;
+}
+
+/* Final export, then stop serving */
+void metrics_stop(SharedState *state)
+{
+    if (!state->metrics_running)
+        return;
+    atomic_store(&state->metrics_stop, 1);
+    pthread_join(state->metrics_thread, NULL);
+    if (state->metrics_listen_fd >= 0)
+        close(state->metrics_listen_fd);
+    state->metrics_listen_fd = -1;
+    state->metrics_running = 0;
+}
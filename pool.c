@@ -0,0 +1,118 @@
+#include "structures.h"
+#include <stddef.h>
+
+/*
+ * Fixed-size object pools. Objects are carved out of large slabs and recycled
+ * through an intrusive free list, so once the pools have grown to the
+ * steady-state working set, allocating and releasing log entries and entity
+ * stats never touches malloc/free. Slabs are only returned at shutdown.
+ *
+ * While an object sits on the free list its first pointer-sized bytes hold
+ * the free-list link; everything after that is left untouched.
+ */
+
+typedef struct PoolSlab
+{
+    struct PoolSlab *next;
+    long slot_count;
+    /* objects follow, aligned to max_align_t */
+} PoolSlab;
+
+#define SLAB_HEADER_SIZE \
+    ((sizeof(PoolSlab) + _Alignof(max_align_t) - 1) & ~(_Alignof(max_align_t) - 1))
+
+static char *slab_objects(PoolSlab *slab)
+{
+    return (char *)slab + SLAB_HEADER_SIZE;
+}
+
+void pool_init(ObjectPool *pool, const char *name, size_t obj_size, int objs_per_slab)
+{
+    memset(pool, 0, sizeof(*pool));
+    pool->name = name;
+
+    /* Room for the free-list link, and keep every slot aligned */
+    size_t align = _Alignof(max_align_t);
+    if (obj_size < sizeof(void *))
+        obj_size = sizeof(void *);
+    pool->obj_size = (obj_size + align - 1) & ~(align - 1);
+    pool->objs_per_slab = objs_per_slab;
+}
+
+static void pool_grow(ObjectPool *pool)
+{
+    /* calloc so never-used slots read as zero (NULL pointers, 0 counts) */
+    PoolSlab *slab = (PoolSlab *)calloc(1, SLAB_HEADER_SIZE +
+                                               pool->obj_size * pool->objs_per_slab);
+    if (!slab)
+    {
+        perror("calloc pool slab");
+        exit(1);
+    }
+    slab->slot_count = pool->objs_per_slab;
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+    pool->slab_count++;
+    pool->capacity += pool->objs_per_slab;
+
+    /* Thread the new slots onto the free list, lowest address first */
+    char *objs = slab_objects(slab);
+    for (int i = pool->objs_per_slab - 1; i >= 0; i--)
+    {
+        void *obj = objs + (size_t)i * pool->obj_size;
+        *(void **)obj = pool->free_list;
+        pool->free_list = obj;
+    }
+}
+
+/* Returns an object whose contents are whatever was left by its last user
+ * (zero if the slot is fresh); callers initialize what they need. */
+void *pool_alloc(ObjectPool *pool)
+{
+    if (!pool->free_list)
+        pool_grow(pool);
+
+    void *obj = pool->free_list;
+    pool->free_list = *(void **)obj;
+    *(void **)obj = NULL;
+
+    pool->in_use++;
+    if (pool->in_use > pool->high_water)
+        pool->high_water = pool->in_use;
+    return obj;
+}
+
+void pool_free(ObjectPool *pool, void *obj)
+{
+    *(void **)obj = pool->free_list;
+    pool->free_list = obj;
+    pool->in_use--;
+}
+
+/* Visit every slot ever carved out of the pool, live or free */
+void pool_foreach_slot(ObjectPool *pool, void (*fn)(void *obj))
+{
+    for (PoolSlab *slab = pool->slabs; slab; slab = slab->next)
+    {
+        char *objs = slab_objects(slab);
+        for (long i = 0; i < slab->slot_count; i++)
+        {
+            fn(objs + (size_t)i * pool->obj_size);
+        }
+    }
+}
+
+void pool_destroy(ObjectPool *pool)
+{
+    PoolSlab *slab = pool->slabs;
+    while (slab)
+    {
+        PoolSlab *tmp = slab;
+        slab = slab->next;
+        free(tmp);
+    }
+    pool->slabs = NULL;
+    pool->free_list = NULL;
+    pool->capacity = 0;
+    pool->in_use = 0;
+}
@@ -0,0 +1,187 @@
+#include "structures.h"
+
+/*
+ * Ref-counted id sets for per-user distinct resources and IPs.
+ *
+ * Most users touch a handful of resources from one or two IPs, so the first
+ * REFSET_INLINE members live inside the set itself and are found by a short
+ * scan. Past that the set is promoted to an open-addressing table (linear
+ * probing, backward-shift deletion, no tombstones), so a crawler touching
+ * thousands of resources still pays O(1) per add and remove.
+ *
+ * A slot is empty when its ref_count is 0; present members always hold at
+ * least one reference.
+ */
+
+#define REFSET_MIN_TABLE 16
+#define REFSET_KEEP_TABLE 64 /* Larger tables are released when the set empties */
+
+static inline uint32_t refset_hash(uint32_t id)
+{
+    id ^= id >> 16;
+    id *= 0x7feb352d;
+    id ^= id >> 15;
+    id *= 0x846ca68b;
+    id ^= id >> 16;
+    return id;
+}
+
+static void table_insert(SetRef *table, uint32_t mask, SetRef ref)
+{
+    uint32_t pos = refset_hash(ref.id) & mask;
+    while (table[pos].ref_count != 0)
+        pos = (pos + 1) & mask;
+    table[pos] = ref;
+}
+
+static void table_resize(RefSet *s, uint32_t slots)
+{
+    SetRef *table = (SetRef *)calloc(slots, sizeof(SetRef));
+    if (!table)
+    {
+        perror("calloc refset table");
+        exit(1);
+    }
+
+    if (s->mask)
+    {
+        for (uint32_t i = 0; i <= s->mask; i++)
+        {
+            if (s->table[i].ref_count != 0)
+                table_insert(table, slots - 1, s->table[i]);
+        }
+        free(s->table);
+    }
+    else
+    {
+        /* Promotion from the inline array */
+        for (int i = 0; i < s->count; i++)
+        {
+            table_insert(table, slots - 1, s->inline_refs[i]);
+        }
+    }
+
+    s->table = table;
+    s->mask = slots - 1;
+}
+
+/* Take a reference on id; returns 1 if it was not a member before */
+int refset_add(RefSet *s, uint32_t id)
+{
+    if (!s->mask)
+    {
+        for (int i = 0; i < s->count; i++)
+        {
+            if (s->inline_refs[i].id == id)
+            {
+                s->inline_refs[i].ref_count++;
+                return 0;
+            }
+        }
+        if (s->count < REFSET_INLINE)
+        {
+            s->inline_refs[s->count].id = id;
+            s->inline_refs[s->count].ref_count = 1;
+            s->count++;
+            return 1;
+        }
+        table_resize(s, REFSET_MIN_TABLE);
+    }
+
+    uint32_t pos = refset_hash(id) & s->mask;
+    while (s->table[pos].ref_count != 0)
+    {
+        if (s->table[pos].id == id)
+        {
+            s->table[pos].ref_count++;
+            return 0;
+        }
+        pos = (pos + 1) & s->mask;
+    }
+
+    /* Keep the load factor under 3/4 so probe runs stay short */
+    if ((uint32_t)(s->count + 1) * 4 > (s->mask + 1) * 3)
+    {
+        table_resize(s, (s->mask + 1) * 2);
+        pos = refset_hash(id) & s->mask;
+        while (s->table[pos].ref_count != 0)
+            pos = (pos + 1) & s->mask;
+    }
+
+    s->table[pos].id = id;
+    s->table[pos].ref_count = 1;
+    s->count++;
+    return 1;
+}
+
+/* Drop a reference on id; returns 1 if that was its last one */
+int refset_remove(RefSet *s, uint32_t id)
+{
+    if (!s->mask)
+    {
+        for (int i = 0; i < s->count; i++)
+        {
+            if (s->inline_refs[i].id == id)
+            {
+                if (--s->inline_refs[i].ref_count > 0)
+                    return 0;
+                s->inline_refs[i] = s->inline_refs[--s->count];
+                return 1;
+            }
+        }
+        return 0;
+    }
+
+    uint32_t pos = refset_hash(id) & s->mask;
+    while (s->table[pos].ref_count != 0 && s->table[pos].id != id)
+        pos = (pos + 1) & s->mask;
+    if (s->table[pos].ref_count == 0)
+        return 0;
+    if (--s->table[pos].ref_count > 0)
+        return 0;
+
+    /* Backward-shift the rest of the probe run into the hole */
+    uint32_t hole = pos;
+    uint32_t next = (pos + 1) & s->mask;
+    while (s->table[next].ref_count != 0)
+    {
+        uint32_t home = refset_hash(s->table[next].id) & s->mask;
+        if (((next - home) & s->mask) >= ((next - hole) & s->mask))
+        {
+            s->table[hole] = s->table[next];
+            hole = next;
+        }
+        next = (next + 1) & s->mask;
+    }
+    s->table[hole].ref_count = 0;
+    s->count--;
+
+    /* A crawler's big table is not worth keeping once it has drained */
+    if (s->count == 0 && s->mask + 1 > REFSET_KEEP_TABLE)
+        refset_free(s);
+    return 1;
+}
+
+/* Heap bytes the set would hold after taking one more member */
+size_t refset_grown_bytes(const RefSet *s)
+{
+    if (!s->mask)
+        return s->count < REFSET_INLINE ? 0 : REFSET_MIN_TABLE * sizeof(SetRef);
+    uint32_t slots = s->mask + 1;
+    if ((uint32_t)(s->count + 1) * 4 > slots * 3)
+        slots *= 2;
+    return (size_t)slots * sizeof(SetRef);
+}
+
+/* Heap bytes held beyond the set struct itself */
+size_t refset_heap_bytes(const RefSet *s)
+{
+    return s->mask ? (size_t)(s->mask + 1) * sizeof(SetRef) : 0;
+}
+
+void refset_free(RefSet *s)
+{
+    if (s->mask)
+        free(s->table);
+    memset(s, 0, sizeof(*s));
+}
@@ -0,0 +1,365 @@
+#include "structures.h"
+#include <stddef.h>
+
+/*
+ * Bounded lock-free rings for the handoffs between pipeline stages.
+ *
+ * SpscRing: one producer, one consumer (ingestion -> analyzer shard). Head
+ * and tail live on their own cache lines; each side also caches the other
+ * side's index, so a push or pop only reads the shared counter when the
+ * cached one says the ring looks full or empty.
+ *
+ * MpscRing: many producers, one consumer (analyzer shards -> alert thread).
+ * A bounded sequence-numbered ring: every cell carries a sequence number
+ * that tells producers whether it is free for position `pos` and tells the
+ * consumer whether it holds a published element. Producers claim positions
+ * with one CAS on the enqueue counter.
+ *
+ * Neither ring takes a lock while data flows. A side that finds nothing to
+ * do spins briefly and then sleeps on a RingSignal; the other side only
+ * touches the signal's mutex when somebody is registered as waiting, so
+ * the mutex and condvar stay off the fast path.
+ */
+
+#define RING_SPIN 64 /* Re-checks before a waiter goes to sleep */
+
+static void signal_init(RingSignal *sig)
+{
+    pthread_mutex_init(&sig->mu, NULL);
+    pthread_cond_init(&sig->cond, NULL);
+    atomic_init(&sig->waiters, 0);
+}
+
+static void signal_destroy(RingSignal *sig)
+{
+    pthread_mutex_destroy(&sig->mu);
+    pthread_cond_destroy(&sig->cond);
+}
+
+/* Block until ready(arg) holds. The waiter registers before its final
+ * check and the waker publishes before checking for waiters, with a full
+ * fence on both sides, so one of them always sees the other. */
+static void signal_wait(RingSignal *sig, int (*ready)(void *arg), void *arg)
+{
+    for (int i = 0; i < RING_SPIN; i++)
+    {
+        if (ready(arg))
+            return;
+    }
+
+    pthread_mutex_lock(&sig->mu);
+    atomic_fetch_add(&sig->waiters, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+    while (!ready(arg))
+    {
+        pthread_cond_wait(&sig->cond, &sig->mu);
+    }
+    atomic_fetch_sub(&sig->waiters, 1);
+    pthread_mutex_unlock(&sig->mu);
+}
+
+static void signal_wake(RingSignal *sig)
+{
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(&sig->waiters, memory_order_relaxed) == 0)
+        return;
+
+    pthread_mutex_lock(&sig->mu);
+    pthread_cond_broadcast(&sig->cond);
+    pthread_mutex_unlock(&sig->mu);
+}
+
+static size_t round_pow2(size_t n)
+{
+    size_t cap = 1;
+    while (cap < n)
+        cap <<= 1;
+    return cap;
+}
+
+/* ─── SPSC ring ─── */
+
+void spsc_init(SpscRing *r, size_t elem_size, size_t min_cap)
+{
+    memset(r, 0, sizeof(*r));
+    size_t cap = round_pow2(min_cap);
+    r->slots = (char *)malloc(elem_size * cap);
+    if (!r->slots)
+    {
+        perror("malloc spsc ring");
+        exit(1);
+    }
+    r->elem_size = elem_size;
+    r->mask = cap - 1;
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+    signal_init(&r->not_empty);
+    signal_init(&r->not_full);
+}
+
+void spsc_destroy(SpscRing *r)
+{
+    free(r->slots);
+    signal_destroy(&r->not_empty);
+    signal_destroy(&r->not_full);
+    r->slots = NULL;
+}
+
+/* Copy n elements into the ring starting at index pos, wrapping once */
+static void spsc_copy_in(SpscRing *r, size_t pos, const void *items, size_t n)
+{
+    size_t at = pos & r->mask;
+    size_t first = n < r->mask + 1 - at ? n : r->mask + 1 - at;
+    memcpy(r->slots + at * r->elem_size, items, first * r->elem_size);
+    if (first < n)
+        memcpy(r->slots, (const char *)items + first * r->elem_size,
+               (n - first) * r->elem_size);
+}
+
+static void spsc_copy_out(SpscRing *r, size_t pos, void *out, size_t n)
+{
+    size_t at = pos & r->mask;
+    size_t first = n < r->mask + 1 - at ? n : r->mask + 1 - at;
+    memcpy(out, r->slots + at * r->elem_size, first * r->elem_size);
+    if (first < n)
+        memcpy((char *)out + first * r->elem_size, r->slots,
+               (n - first) * r->elem_size);
+}
+
+/* Producer: free slots, refreshing the cached head only when needed */
+static size_t spsc_space(SpscRing *r)
+{
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    size_t cap = r->mask + 1;
+    if (tail - r->head_cache == cap)
+        r->head_cache = atomic_load_explicit(&r->head, memory_order_acquire);
+    return cap - (tail - r->head_cache);
+}
+
+static int spsc_has_space(void *arg)
+{
+    SpscRing *r = (SpscRing *)arg;
+    return (r->mask + 1) - (atomic_load_explicit(&r->tail, memory_order_relaxed) -
+                            atomic_load_explicit(&r->head, memory_order_acquire)) > 0;
+}
+
+static int spsc_has_data(void *arg)
+{
+    SpscRing *r = (SpscRing *)arg;
+    return atomic_load_explicit(&r->tail, memory_order_acquire) !=
+           atomic_load_explicit(&r->head, memory_order_relaxed);
+}
+
+int spsc_try_push(SpscRing *r, const void *item)
+{
+    if (spsc_space(r) == 0)
+        return 0;
+
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    spsc_copy_in(r, tail, item, 1);
+    atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+    signal_wake(&r->not_empty);
+    return 1;
+}
+
+/* Push n elements, waiting for room as needed; the consumer is woken once
+ * per stretch copied in, not once per element */
+void spsc_push_batch(SpscRing *r, const void *items, size_t n)
+{
+    const char *p = (const char *)items;
+    while (n > 0)
+    {
+        size_t room = spsc_space(r);
+        if (room == 0)
+        {
+            signal_wait(&r->not_full, spsc_has_space, r);
+            continue;
+        }
+
+        size_t k = n < room ? n : room;
+        size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+        spsc_copy_in(r, tail, p, k);
+        atomic_store_explicit(&r->tail, tail + k, memory_order_release);
+        signal_wake(&r->not_empty);
+
+        p += k * r->elem_size;
+        n -= k;
+    }
+}
+
+void spsc_push(SpscRing *r, const void *item)
+{
+    spsc_push_batch(r, item, 1);
+}
+
+/* Consumer: wait for at least one element, then take up to max in one go */
+size_t spsc_pop_batch(SpscRing *r, void *out, size_t max)
+{
+    size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    if (r->tail_cache == head)
+    {
+        r->tail_cache = atomic_load_explicit(&r->tail, memory_order_acquire);
+        if (r->tail_cache == head)
+        {
+            signal_wait(&r->not_empty, spsc_has_data, r);
+            r->tail_cache = atomic_load_explicit(&r->tail, memory_order_acquire);
+        }
+    }
+
+    size_t n = r->tail_cache - head;
+    if (n > max)
+        n = max;
+    spsc_copy_out(r, head, out, n);
+    atomic_store_explicit(&r->head, head + n, memory_order_release);
+    signal_wake(&r->not_full);
+    return n;
+}
+
+/* ─── MPSC ring ─── */
+
+typedef struct
+{
+    atomic_size_t seq;
+    /* element bytes follow */
+} MpscCell;
+
+static MpscCell *mpsc_cell(const MpscRing *r, size_t pos)
+{
+    return (MpscCell *)(r->cells + (pos & r->mask) * r->cell_size);
+}
+
+static void *cell_data(MpscCell *c)
+{
+    return (char *)c + sizeof(MpscCell);
+}
+
+void mpsc_init(MpscRing *r, size_t elem_size, size_t min_cap)
+{
+    memset(r, 0, sizeof(*r));
+    size_t cap = round_pow2(min_cap);
+    size_t align = _Alignof(max_align_t);
+    r->cell_size = (sizeof(MpscCell) + elem_size + align - 1) & ~(align - 1);
+    r->cells = (char *)malloc(r->cell_size * cap);
+    if (!r->cells)
+    {
+        perror("malloc mpsc ring");
+        exit(1);
+    }
+    r->elem_size = elem_size;
+    r->mask = cap - 1;
+    for (size_t i = 0; i < cap; i++)
+        atomic_init(&mpsc_cell(r, i)->seq, i);
+    atomic_init(&r->enqueue_pos, 0);
+    atomic_init(&r->dequeue_pos, 0);
+    signal_init(&r->not_empty);
+    signal_init(&r->not_full);
+}
+
+void mpsc_destroy(MpscRing *r)
+{
+    free(r->cells);
+    signal_destroy(&r->not_empty);
+    signal_destroy(&r->not_full);
+    r->cells = NULL;
+}
+
+int mpsc_try_push(MpscRing *r, const void *item)
+{
+    size_t pos = atomic_load_explicit(&r->enqueue_pos, memory_order_relaxed);
+    MpscCell *cell;
+    while (1)
+    {
+        cell = mpsc_cell(r, pos);
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+        if (diff == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&r->enqueue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed,
+                                                      memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0)
+        {
+            return 0; /* Full: the cell still holds an element a lap behind */
+        }
+        else
+        {
+            pos = atomic_load_explicit(&r->enqueue_pos, memory_order_relaxed);
+        }
+    }
+
+    memcpy(cell_data(cell), item, r->elem_size);
+    atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+    signal_wake(&r->not_empty);
+    return 1;
+}
+
+static int mpsc_has_space(void *arg)
+{
+    MpscRing *r = (MpscRing *)arg;
+    size_t pos = atomic_load_explicit(&r->enqueue_pos, memory_order_relaxed);
+    return atomic_load_explicit(&mpsc_cell(r, pos)->seq, memory_order_acquire) >= pos;
+}
+
+static int mpsc_has_data(void *arg)
+{
+    MpscRing *r = (MpscRing *)arg;
+    size_t pos = atomic_load_explicit(&r->dequeue_pos, memory_order_relaxed);
+    return atomic_load_explicit(&mpsc_cell(r, pos)->seq, memory_order_acquire) == pos + 1;
+}
+
+void mpsc_push(MpscRing *r, const void *item)
+{
+    while (!mpsc_try_push(r, item))
+    {
+        signal_wait(&r->not_full, mpsc_has_space, r);
+    }
+}
+
+/* Single consumer: take up to max published elements without waiting */
+size_t mpsc_try_pop_batch(MpscRing *r, void *out, size_t max)
+{
+    size_t n = 0;
+    while (n < max)
+    {
+        size_t pos = atomic_load_explicit(&r->dequeue_pos, memory_order_relaxed);
+        MpscCell *cell = mpsc_cell(r, pos);
+        if (atomic_load_explicit(&cell->seq, memory_order_acquire) != pos + 1)
+            break;
+
+        memcpy((char *)out + n * r->elem_size, cell_data(cell), r->elem_size);
+        atomic_store_explicit(&cell->seq, pos + r->mask + 1, memory_order_release);
+        atomic_store_explicit(&r->dequeue_pos, pos + 1, memory_order_relaxed);
+        n++;
+    }
+    if (n > 0)
+        signal_wake(&r->not_full);
+    return n;
+}
+
+/* Single consumer: wait for at least one element, then take up to max */
+size_t mpsc_pop_batch(MpscRing *r, void *out, size_t max)
+{
+    size_t n;
+    while ((n = mpsc_try_pop_batch(r, out, max)) == 0)
+    {
+        signal_wait(&r->not_empty, mpsc_has_data, r);
+    }
+    return n;
+}
+
+/* Approximate number of queued elements, for metrics; any thread */
+size_t spsc_depth(SpscRing *r)
+{
+    size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    return tail > head ? tail - head : 0;
+}
+
+size_t mpsc_depth(MpscRing *r)
+{
+    size_t deq = atomic_load_explicit(&r->dequeue_pos, memory_order_relaxed);
+    size_t enq = atomic_load_explicit(&r->enqueue_pos, memory_order_relaxed);
+    return enq > deq ? enq - deq : 0;
+}
@@ -16,7 +16,7 @@ int compute_user_score(EntityStats *e)
     return compute_score(e);
 }
 
-void evaluate_entity(SharedState *state, EntityStats *e, const char *ip)
+void evaluate_entity(Shard *shard, EntityStats *e, const char *ip)
 {
     int score = compute_score(e);
     int sev = severity_from_score(score);
@@ -35,11 +35,12 @@ void evaluate_entity(SharedState *state, EntityStats *e, const char *ip)
             item.ip_address[39] = '\0';
             item.score = score;
             item.severity = sev;
-            item.timestamp = time(NULL);
+            item.timestamp = shard->watermark;
+            item.tick_ns = shard->metrics.tick_ns;
 
-            push_alert(state, item);
+            push_alert(shard->state, item);
             e->last_alert_score = score;
-            e->last_alert_time = time(NULL);
+            e->last_alert_time = shard->watermark;
         }
     }
 }
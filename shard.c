@@ -0,0 +1,251 @@
+#include "structures.h"
+
+/*
+ * Analyzer shards. Users are partitioned by hash_user and IPs by hash_ip, and
+ * each shard owns its entities outright: its window, pools and maps are only
+ * ever touched by its own worker thread, so folding entries in, expiring them
+ * and scoring needs no lock at all. An IP's failed-login count lives in the
+ * IP's shard only, so the global view of an IP is the one its owner holds.
+ *
+ * Ingestion routes every admitted entry to the user's shard and, for failed
+ * logins, to the IP's shard as well (one copy with both ROUTE_ flags when
+ * they coincide). Evaluation ticks and the final stop are broadcast to every
+ * shard as control entries in the same queues, so each shard sees them in
+ * order with the events that preceded them.
+ *
+ * The inbox is the only shared part: a lock-free SPSC ring (ring.c) that
+ * ingestion pushes into and the worker drains up to SHARD_BATCH_MAX entries
+ * at a time. A full inbox makes ingestion wait, which throttles it to the
+ * slowest shard instead of dropping events.
+ *
+ * Ingestion does not push entry by entry: shard_post stages entries per
+ * shard and publishes a shard's batch with one ring push once it reaches
+ * cfg.batch_size, or once the oldest staged entry has waited cfg.flush_ms.
+ * Control entries are staged like events, so they stay in order.
+ */
+
+/* The maps index slots with the low bits of the same hashes, so pick the
+ * shard from the high bits; otherwise every key in a shard would share its
+ * low bits and crowd into a fraction of the map's home slots. */
+static int shard_index(unsigned int hash, int shard_count)
+{
+    return (int)(((uint64_t)hash * (uint64_t)shard_count) >> 32);
+}
+
+Shard *shard_for_user(SharedState *state, int user_id)
+{
+    return &state->shards[shard_index(hash_user(user_id), state->cfg.shard_count)];
+}
+
+Shard *shard_for_ip(SharedState *state, uint32_t ip_id)
+{
+    return &state->shards[shard_index(hash_ip(ip_id), state->cfg.shard_count)];
+}
+
+/* Slab sizes are a trade-off between malloc calls while warming up and
+ * memory held by a mostly idle engine */
+void init_shards(SharedState *state)
+{
+    int n = state->cfg.shard_count;
+    state->shards = (Shard *)calloc((size_t)n, sizeof(Shard));
+    if (!state->shards)
+    {
+        perror("calloc shards");
+        exit(1);
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        Shard *s = &state->shards[i];
+        s->id = i;
+        s->state = state;
+        s->sketch_epoch = INT64_MIN;
+
+        window_init(&s->window, 4096);
+        map_init(&s->user_map, map_hash_user);
+        map_init(&s->ip_map, hash_ip);
+
+        pool_init(&s->user_pool, "users", sizeof(EntityStats), 256);
+        pool_init(&s->ip_pool, "ips", sizeof(IPStats), 256);
+        pool_init(&s->sketch_pool, "sketches",
+                  hll_sketch_bytes(state->cfg.hll_precision), 256);
+
+        topk_init(s, state->cfg.top_k);
+
+        spsc_init(&s->inbox, sizeof(LogEntry), SHARD_INBOX_CAP);
+        s->staged = (LogEntry *)malloc(sizeof(LogEntry) * state->cfg.batch_size);
+        s->batch = (LogEntry *)malloc(sizeof(LogEntry) * SHARD_BATCH_MAX);
+        if (!s->batch || !s->staged)
+        {
+            perror("malloc shard batch");
+            exit(1);
+        }
+    }
+}
+
+/* Publish a shard's staged entries, waiting while its inbox is full */
+static void shard_flush(Shard *shard)
+{
+    if (shard->staged_count == 0)
+        return;
+
+    uint64_t t0 = now_ns();
+    spsc_push_batch(&shard->inbox, shard->staged, shard->staged_count);
+    hist_record(&shard->state->ingest_metrics.handoff_ns, now_ns() - t0);
+    shard->state->staged_total -= shard->staged_count;
+    shard->staged_count = 0;
+}
+
+void shard_flush_all(SharedState *state)
+{
+    for (int i = 0; i < state->cfg.shard_count; i++)
+    {
+        shard_flush(&state->shards[i]);
+    }
+}
+
+static double ms_since(const struct timespec *t)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)(now.tv_sec - t->tv_sec) * 1e3 +
+           (double)(now.tv_nsec - t->tv_nsec) / 1e6;
+}
+
+/* Publish everything if the oldest staged entry has waited flush_ms */
+void shard_flush_due(SharedState *state)
+{
+    state->posts_since_check = 0;
+    if (state->staged_total > 0 && ms_since(&state->staged_since) >= state->cfg.flush_ms)
+        shard_flush_all(state);
+}
+
+/* Stage one entry for a shard (ingestion thread only) */
+void shard_post(Shard *shard, const LogEntry *entry)
+{
+    SharedState *state = shard->state;
+
+    if (state->staged_total++ == 0)
+        clock_gettime(CLOCK_MONOTONIC, &state->staged_since);
+
+    shard->staged[shard->staged_count++] = *entry;
+    if (shard->staged_count == (size_t)state->cfg.batch_size)
+        shard_flush(shard);
+
+    /* Reading the clock per entry would cost more than the handoff saves;
+     * a quiet shard's partial batch is looked at every 256 posts, and
+     * callers flush before they go idle */
+    if (++state->posts_since_check == 256)
+        shard_flush_due(state);
+}
+
+/* Queue a control entry (ROUTE_TICK / ROUTE_STOP) for every shard */
+void shard_broadcast(SharedState *state, uint8_t route, time_t timestamp)
+{
+    LogEntry ctl = {.timestamp = timestamp, .route = route};
+    ctl.sent_ns = now_ns(); /* Start of the alert latency measurement */
+    for (int i = 0; i < state->cfg.shard_count; i++)
+    {
+        shard_post(&state->shards[i], &ctl);
+    }
+}
+
+/* Worker side: wait for entries and move up to SHARD_BATCH_MAX of them into
+ * shard->batch. Returns the number of entries taken. */
+size_t shard_take(Shard *shard)
+{
+    shard->batch_count = spsc_pop_batch(&shard->inbox, shard->batch, SHARD_BATCH_MAX);
+    return shard->batch_count;
+}
+
+/* ─── Dirty lists ───
+ * add_log_to_stats/remove_log_from_stats put every entity they touch on its
+ * shard's dirty list, and run_evaluation rescores only those, so a tick
+ * costs time proportional to activity rather than to the number of tracked
+ * entities. The lists are doubly linked so an entity that empties out can
+ * leave in O(1) before its node goes back to the pool. */
+
+void mark_user_dirty(Shard *shard, EntityStats *user)
+{
+    if (user->dirty)
+        return;
+    user->dirty = 1;
+    user->dirty_prev = NULL;
+    user->dirty_next = shard->dirty_users;
+    if (shard->dirty_users)
+        shard->dirty_users->dirty_prev = user;
+    shard->dirty_users = user;
+}
+
+void mark_ip_dirty(Shard *shard, IPStats *ip)
+{
+    if (ip->dirty)
+        return;
+    ip->dirty = 1;
+    ip->dirty_prev = NULL;
+    ip->dirty_next = shard->dirty_ips;
+    if (shard->dirty_ips)
+        shard->dirty_ips->dirty_prev = ip;
+    shard->dirty_ips = ip;
+}
+
+void unlink_dirty_user(Shard *shard, EntityStats *user)
+{
+    if (!user->dirty)
+        return;
+    if (user->dirty_prev)
+        user->dirty_prev->dirty_next = user->dirty_next;
+    else
+        shard->dirty_users = user->dirty_next;
+    if (user->dirty_next)
+        user->dirty_next->dirty_prev = user->dirty_prev;
+    user->dirty = 0;
+}
+
+void unlink_dirty_ip(Shard *shard, IPStats *ip)
+{
+    if (!ip->dirty)
+        return;
+    if (ip->dirty_prev)
+        ip->dirty_prev->dirty_next = ip->dirty_next;
+    else
+        shard->dirty_ips = ip->dirty_next;
+    if (ip->dirty_next)
+        ip->dirty_next->dirty_prev = ip->dirty_prev;
+    ip->dirty = 0;
+}
+
+static void free_entity_sets(void *obj)
+{
+    EntityStats *e = (EntityStats *)obj;
+    refset_free(&e->resources);
+    refset_free(&e->ips);
+}
+
+/* Free all resources. Every map value lives in a pool slab, so tearing down
+ * the pools releases the entities in one go. */
+void free_all_resources(SharedState *state)
+{
+    for (int i = 0; i < state->cfg.shard_count; i++)
+    {
+        Shard *s = &state->shards[i];
+
+        pool_foreach_slot(&s->user_pool, free_entity_sets);
+
+        pool_destroy(&s->user_pool);
+        pool_destroy(&s->ip_pool);
+        pool_destroy(&s->sketch_pool);
+
+        map_destroy(&s->user_map);
+        map_destroy(&s->ip_map);
+        window_free(&s->window);
+        topk_free(s);
+        free(s->idle);
+
+        spsc_destroy(&s->inbox);
+        free(s->batch);
+        free(s->staged);
+    }
+    free(state->shards);
+    state->shards = NULL;
+}
@@ -0,0 +1,246 @@
+#include "structures.h"
+#include <errno.h>
+#include <fcntl.h>
+
+/*
+ * Alert log writer, owned by the alert thread.
+ *
+ * The log file stays open for the whole run. It is started afresh unless
+ * cfg.alert_append is set (a run resuming from a checkpoint). Formatted alerts collect in a
+ * buffer that goes out with one write() (a group commit) once it is nearly
+ * full, once its oldest alert has waited cfg.alert_commit_ms, or once the
+ * alert thread runs out of work. With ALERT_FSYNC_COMMIT every commit is
+ * also fsync'ed, so a crash loses at most the alerts still buffered.
+ *
+ * After a commit the file is rotated if it has reached alert_rotate_bytes or
+ * has been open for alert_rotate_secs: it is renamed to "<path>.<n>" with the
+ * next unused n, and a fresh file is started. Because size is only checked
+ * at commit time, a rotated file can overshoot the limit by one buffer.
+ */
+
+#define SINK_BUF_SIZE (64 * 1024)
+#define SINK_LINE_MAX 512 /* Longest formatted alert, JSON escapes included */
+
+static double sink_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int sink_open_file(AlertSink *s, int truncate)
+{
+    s->fd = open(s->cfg->alert_path, O_WRONLY | O_CREAT | O_APPEND | (truncate ? O_TRUNC : 0),
+                 0644);
+    if (s->fd < 0)
+    {
+        perror("open alert log");
+        return -1;
+    }
+    s->file_bytes = truncate ? 0 : (long)lseek(s->fd, 0, SEEK_END);
+    s->opened_at = sink_now();
+    return 0;
+}
+
+/* Rotated names continue after whatever an earlier run left behind */
+static void sink_find_next_rotation(AlertSink *s)
+{
+    char path[4096];
+    s->next_rotation = 1;
+    while (1)
+    {
+        snprintf(path, sizeof(path), "%s.%d", s->cfg->alert_path, s->next_rotation);
+        if (access(path, F_OK) != 0)
+            break;
+        s->next_rotation++;
+    }
+}
+
+void sink_open(AlertSink *s, const EngineConfig *cfg)
+{
+    memset(s, 0, sizeof(*s));
+    s->cfg = cfg;
+    s->fd = -1;
+    s->buf = (char *)malloc(SINK_BUF_SIZE);
+    if (!s->buf)
+    {
+        perror("malloc alert sink");
+        exit(1);
+    }
+    s->cached_sec = (time_t)-1;
+    if (cfg->alert_rotate_bytes > 0 || cfg->alert_rotate_secs > 0)
+        sink_find_next_rotation(s);
+    sink_open_file(s, !cfg->alert_append);
+}
+
+static void sink_rotate(AlertSink *s)
+{
+    char rotated[4096];
+    snprintf(rotated, sizeof(rotated), "%s.%d", s->cfg->alert_path, s->next_rotation++);
+
+    if (s->cfg->alert_fsync != ALERT_FSYNC_NONE)
+        fsync(s->fd);
+    close(s->fd);
+    s->fd = -1;
+    if (rename(s->cfg->alert_path, rotated) != 0)
+        perror("rename alert log");
+    else
+        s->rotations++;
+    sink_open_file(s, 1);
+}
+
+/* Write the buffer out in one go (retrying short writes), then apply the
+ * fsync and rotation policies */
+void sink_commit(AlertSink *s)
+{
+    if (s->len == 0)
+        return;
+
+    uint64_t t0 = now_ns();
+    size_t off = 0;
+    while (s->fd >= 0 && off < s->len)
+    {
+        ssize_t n = write(s->fd, s->buf + off, s->len - off);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (s->write_errors++ == 0)
+                perror("write alert log");
+            break;
+        }
+        off += (size_t)n;
+    }
+    s->file_bytes += (long)off;
+    s->len = 0;
+    s->pending = 0;
+    s->commits++;
+
+    if (s->fd < 0)
+        return;
+    if (s->cfg->alert_fsync == ALERT_FSYNC_COMMIT)
+        fsync(s->fd);
+    if (s->commit_hist)
+        hist_record(s->commit_hist, now_ns() - t0);
+
+    if ((s->cfg->alert_rotate_bytes > 0 && s->file_bytes >= s->cfg->alert_rotate_bytes) ||
+        (s->cfg->alert_rotate_secs > 0 &&
+         sink_now() - s->opened_at >= s->cfg->alert_rotate_secs))
+        sink_rotate(s);
+}
+
+/* Commit if the oldest buffered alert has waited alert_commit_ms */
+void sink_commit_due(AlertSink *s)
+{
+    if (s->pending > 0 && (sink_now() - s->first_pending) * 1e3 >= s->cfg->alert_commit_ms)
+        sink_commit(s);
+}
+
+/* Alerts arrive in timestamp order per shard, so consecutive alerts mostly
+ * share a second; format the time only when it changes */
+static void sink_format_time(AlertSink *s, time_t t)
+{
+    if (t == s->cached_sec)
+        return;
+
+    struct tm tm_info;
+    if (s->cfg->alert_format == ALERT_FORMAT_JSON)
+    {
+        gmtime_r(&t, &tm_info);
+        strftime(s->cached_time, sizeof(s->cached_time), "%Y-%m-%dT%H:%M:%SZ", &tm_info);
+    }
+    else
+    {
+        localtime_r(&t, &tm_info);
+        strftime(s->cached_time, sizeof(s->cached_time), "%Y-%m-%d %H:%M:%S", &tm_info);
+    }
+    s->cached_sec = t;
+}
+
+/* Copy a JSON string body, escaping quotes, backslashes and control bytes */
+static size_t json_escape(char *out, const char *in)
+{
+    static const char hex[] = "0123456789abcdef";
+    size_t n = 0;
+    for (; *in; in++)
+    {
+        unsigned char c = (unsigned char)*in;
+        if (c == '"' || c == '\\')
+        {
+            out[n++] = '\\';
+            out[n++] = (char)c;
+        }
+        else if (c < 0x20)
+        {
+            memcpy(out + n, "\\u00", 4);
+            out[n + 4] = hex[c >> 4];
+            out[n + 5] = hex[c & 15];
+            n += 6;
+        }
+        else
+        {
+            out[n++] = (char)c;
+        }
+    }
+    return n;
+}
+
+static size_t format_text(AlertSink *s, char *out, const AlertItem *a)
+{
+    int n = sprintf(out, "[%s] ", s->cached_time);
+    if (a->user_id != -1)
+        n += sprintf(out + n, "User: %d | ", a->user_id);
+    n += sprintf(out + n, "IP: %s | Score: %d | Severity: %s\n",
+                 a->ip_address, a->score, severity_str(a->severity));
+    return (size_t)n;
+}
+
+static size_t format_json(AlertSink *s, char *out, const AlertItem *a)
+{
+    int n = sprintf(out, "{\"time\":\"%s\",\"ts\":%lld,", s->cached_time, (long long)a->timestamp);
+    if (a->user_id != -1)
+        n += sprintf(out + n, "\"user\":%d,", a->user_id);
+    else
+        n += sprintf(out + n, "\"user\":null,");
+
+    size_t len = (size_t)n;
+    memcpy(out + len, "\"ip\":\"", 6);
+    len += 6;
+    len += json_escape(out + len, a->ip_address);
+    len += (size_t)sprintf(out + len, "\",\"score\":%d,\"severity\":%d,\"level\":\"%s\"}\n",
+                           a->score, a->severity, severity_str(a->severity));
+    return len;
+}
+
+/* Buffer one alert if it meets alert_min_severity */
+void sink_write(AlertSink *s, const AlertItem *a)
+{
+    if (a->severity < s->cfg->alert_min_severity)
+        return;
+
+    if (SINK_BUF_SIZE - s->len < SINK_LINE_MAX)
+        sink_commit(s);
+    if (s->pending++ == 0)
+        s->first_pending = sink_now();
+
+    sink_format_time(s, a->timestamp);
+    if (s->cfg->alert_format == ALERT_FORMAT_JSON)
+        s->len += format_json(s, s->buf + s->len, a);
+    else
+        s->len += format_text(s, s->buf + s->len, a);
+    s->written++;
+}
+
+void sink_close(AlertSink *s)
+{
+    sink_commit(s);
+    if (s->fd >= 0)
+    {
+        if (s->cfg->alert_fsync != ALERT_FSYNC_NONE)
+            fsync(s->fd);
+        close(s->fd);
+    }
+    s->fd = -1;
+    free(s->buf);
+    s->buf = NULL;
+}
@@ -3,47 +3,226 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <string.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <time.h>
 #include <unistd.h>
 
 /* ─── Constants ─── */
 #define WINDOW_SECONDS 300
-#define HASH_SIZE 2048 /* Larger for better distribution */
 #define ALERT_QUEUE_CAP 1024
+#define EVAL_INTERVAL 2     /* Seconds of event time between evaluations */
+#define DEFAULT_LATENESS 5  /* Seconds an event may trail the newest one */
+#define DEFAULT_INPUT "sample_logs.txt"
+#define MAX_PARSE_THREADS 64
+#define MAX_SHARDS 64
+#define MAX_LISTENERS 8 /* --listen options */
+#define SHARD_INBOX_CAP 16384 /* Entries queued per shard before ingestion waits */
+#define SHARD_BATCH_MAX 4096  /* Entries a shard takes from its inbox at once */
+#define DEFAULT_BATCH_SIZE 1024 /* Entries ingestion stages per shard before publishing */
+#define DEFAULT_FLUSH_MS 5      /* Longest a staged entry waits to be published */
+#define DEFAULT_ALERT_LOG "alert_log.txt"
+#define DEFAULT_ALERT_COMMIT_MS 100 /* Longest a logged alert waits to be written */
+#define DEFAULT_METRICS_INTERVAL_MS 1000
+#define DEFAULT_CHECKPOINT_SECS 30
+#define ARCHIVE_BLOCK_EVENTS 65536 /* Most events in one archive block */
+#define ARCHIVE_BLOCK_SECONDS 3600 /* Most event time one archive block spans */
 
 /* Thresholds from problem statement */
 #define THRESH_FAILED_IP 5
 #define THRESH_RESOURCES 10
 #define THRESH_IPS 3
 
-/* ─── Log Entry (doubly-linked list) ─── */
+/* ─── Event types and status codes (parsed into enums) ─── */
+typedef enum
+{
+    EVENT_OTHER = 0,
+    EVENT_LOGIN,
+    EVENT_FILE_ACCESS,
+    EVENT_API_CALL,
+    EVENT_TRANSACTION
+} EventType;
+
+typedef enum
+{
+    STATUS_OTHER = 0,
+    STATUS_SUCCESS,
+    STATUS_FAILED
+} StatusCode;
+
+#define RESOURCE_NONE 0 /* Interned id of "-" */
+#define MAX_FIELD_LEN 255
+
+/* What a queued entry means to the shard receiving it (LogEntry.route) */
+#define ROUTE_USER 0x01 /* Counts toward the user's stats (user owned here) */
+#define ROUTE_IP 0x02   /* Counts toward the IP's failed logins (IP owned here) */
+#define ROUTE_TICK 0x04 /* Not an event: watermark advanced to timestamp, evaluate */
+#define ROUTE_STOP 0x08 /* Not an event: input exhausted, final evaluation */
+#define ROUTE_CHECKPOINT 0x10 /* Not an event: hand a copy of the shard's state to
+                               * the checkpoint writer (after evaluating, when
+                               * combined with ROUTE_STOP) */
+
+/* ─── Log Entry (one slot of the window ring, 24 bytes) ───
+ * IPs and resources are interned ids (see intern.c) */
 typedef struct LogEntry
 {
     time_t timestamp;
-    int user_id;
-    char ip_address[40];
-    char event_type[16];
-    char resource_id[32];
-    char status_code[16];
-    struct LogEntry *prev;
-    struct LogEntry *next;
+    union
+    {
+        struct
+        {
+            int user_id;
+            uint32_t ip_id;
+        };
+        uint64_t sent_ns; /* Control entries: now_ns() when ingestion sent them */
+    };
+    uint32_t resource_id;
+    uint8_t event_type;  /* EventType */
+    uint8_t status_code; /* StatusCode */
+    uint8_t route;       /* ROUTE_* flags, set when ingestion hands it to a shard */
 } LogEntry;
 
-/* ─── Resource reference counting ─── */
+/* ─── Strings a parse worker left to the publishing thread (intern.c) ───
+ * An entry field holding INTERN_PENDING | i refers to strs[i] until
+ * intern_resolve() turns it into an id, in input order */
+#define INTERN_PENDING 0x80000000u /* Above every id (the table stops at 2^28) */
+
+typedef struct
+{
+    const char *str; /* Not a copy: points into the input */
+    uint32_t len;
+    uint32_t hash;
+    uint32_t id; /* INTERN_PENDING until resolved */
+} DeferredStr;
+
+typedef struct
+{
+    DeferredStr *strs;
+    uint32_t *index; /* 2 * cap slots of strs index + 1, 0 when empty */
+    uint32_t count;
+    uint32_t cap;
+} InternDeferred;
+
+static inline int is_failed_login(const LogEntry *entry)
+{
+    return entry->event_type == EVENT_LOGIN && entry->status_code == STATUS_FAILED;
+}
+
+/* ─── Sliding window: growable ring of entries in arrival order ─── */
+typedef struct
+{
+    LogEntry *slots;
+    size_t cap;        /* Power of two */
+    size_t begin;      /* Oldest entry (indices grow monotonically) */
+    size_t applied;    /* Entries before this index are in the stats */
+    size_t end;        /* One past the newest entry */
+    size_t high_water; /* Peak number of entries held */
+} LogWindow;
+
+static inline LogEntry *window_at(const LogWindow *w, size_t idx)
+{
+    return &w->slots[idx & (w->cap - 1)];
+}
+
+static inline size_t window_count(const LogWindow *w)
+{
+    return w->end - w->begin;
+}
+
+/* ─── Parser outcome (also indexes SharedState.parse_errors) ─── */
+typedef enum
+{
+    PARSE_OK = 0,
+    PARSE_ERR_TIMESTAMP,
+    PARSE_ERR_USER_ID,
+    PARSE_ERR_MISSING_FIELD,
+    PARSE_ERR_EXTRA_FIELDS,
+    PARSE_ERR_EMPTY_FIELD,
+    PARSE_ERR_FIELD_TOO_LONG, /* Longer than MAX_FIELD_LEN */
+    PARSE_ERR_BAD_BLOCK,      /* Archive block that fails to decode */
+    PARSE_RESULT_COUNT
+} ParseResult;
+
+/* ─── One block of a binary archive (see archive.c) ─── */
 typedef struct
 {
-    char name[32];
-    int ref_count;
-} ResourceRef;
+    uint32_t count; /* Events */
+    time_t min_time, max_time;
+    size_t start, end; /* Byte range of the block, header included */
+} ArchiveBlock;
+
+/* ─── Streaming gzip input (see gzip.c) ─── */
+typedef struct GzipReader GzipReader;
 
-/* ─── IP reference counting ─── */
 typedef struct
 {
-    char ip[40];
-    int ref_count;
-} IPRef;
+    const char *data; /* Whole lines */
+    size_t len;
+    uint64_t end;        /* Offset just past it in the inflated stream */
+    uint64_t inflate_ns; /* Time the reader spent inflating it */
+    long seq;            /* Pieces taken before it */
+} GzipPiece;
+
+/* ─── Network input (see listen.c) ─── */
+typedef struct Listener Listener;
+
+/* ─── Multi-source ingestion (see merge.c) ─── */
+typedef struct MergeSet MergeSet;
+
+/* One input read by its own thread under --merge. Written by the reader
+ * unless marked otherwise, read by anyone. */
+typedef struct
+{
+    const char *path;
+    atomic_ullong bytes_read; /* Text (inflated for gzip) or archive bytes */
+    atomic_ullong inflated;
+    atomic_ullong lines;
+    atomic_ullong events_read; /* Parsed and in the time range */
+    atomic_ullong out_of_range;
+    atomic_ullong blocks_skipped;
+    atomic_ullong parse_errors[PARSE_RESULT_COUNT];
+    atomic_ullong newest;   /* Newest event time read */
+    atomic_ullong start_ns; /* Reader started; 0 = not yet */
+    atomic_ullong end_ns;   /* Reader finished; 0 = still reading */
+    atomic_ullong events_merged; /* Merger: passed on to the shards */
+    atomic_ullong stall_ns;      /* Merger: time spent waiting for this reader */
+    atomic_ullong buffered;      /* Merger: entries queued behind the merge (gauge) */
+} SourceStats;
+
+/* ─── Ref-counted id set (see refset.c) ───
+ * Up to REFSET_INLINE members live inline; larger sets are promoted to an
+ * open-addressing table. Used for a user's distinct resources and IPs. */
+#define REFSET_INLINE 4
+
+typedef struct
+{
+    uint32_t id;
+    int ref_count; /* 0 marks an empty table slot */
+} SetRef;
+
+typedef struct
+{
+    int count;     /* Distinct members */
+    uint32_t mask; /* Table slots - 1, or 0 while inline */
+    union
+    {
+        SetRef inline_refs[REFSET_INLINE];
+        SetRef *table;
+    };
+} RefSet;
+
+/* ─── Sliding-window HyperLogLog sketch (see hll.c) ─── */
+#define HLL_SLICES 6 /* Event-time slices per window */
+#define HLL_MIN_PRECISION 4
+#define HLL_MAX_PRECISION 16
+
+typedef struct
+{
+    int64_t slice[HLL_SLICES + 1]; /* Slice held by each ring position, -1 if none */
+    uint8_t regs[];                /* (HLL_SLICES + 1) << precision registers */
+} WindowSketch;
 
 /* ─── Per-user statistics ─── */
 typedef struct EntityStats
@@ -51,36 +230,58 @@ typedef struct EntityStats
     int user_id;
     int failed_attempts;
 
-    /* Resource tracking with ref counting */
-    ResourceRef *resources;
-    int resource_count;
-    int resource_cap;
+    int event_count; /* Entries of this user currently in the window */
+
+    /* Distinct resources and IPs in the window, with ref counting. In
+     * approximate mode a set that outgrows a sketch gets one: new ids go
+     * there and the set only drains. */
+    RefSet resources;
+    RefSet ips;
 
-    /* IP tracking with ref counting */
-    IPRef *ip_refs;
+    /* Sketches of the same (approximate mode, large sets only) */
+    WindowSketch *resource_sketch;
+    WindowSketch *ip_sketch;
+
+    /* Distinct counts the scorer works from: kept in step with the sets,
+     * and re-estimated before each evaluation once a sketch is in use */
+    int resource_count;
     int ip_count;
-    int ip_cap;
+    uint32_t last_ip_id; /* IP of the newest event, labels alerts */
 
     /* Score tracking */
     int current_score;
     int last_alert_score;
     time_t last_alert_time;
+    time_t idle_since; /* Watermark when it last emptied (see hashmap.c) */
+    int heap_pos; /* Slot in the shard's user_heap + 1; 0 = not a suspect */
 
-    struct EntityStats *next; /* For hash chaining */
+    /* Shard's list of users changed since the last evaluation */
+    int dirty;
+    struct EntityStats *dirty_prev;
+    struct EntityStats *dirty_next;
 } EntityStats;
 
 /* ─── Per-IP statistics ─── */
 typedef struct IPStats
 {
-    char ip_address[40];
+    uint32_t ip_id;
     int failed_attempts;
     time_t window_start;
+    int current_score;
     int last_alert_score;
     time_t last_alert_time;
-    struct IPStats *next;
+    time_t idle_since; /* Watermark when it last emptied (see hashmap.c) */
+    int heap_pos; /* Slot in the shard's ip_heap + 1; 0 = not a suspect */
+
+    /* Shard's list of IPs changed since the last evaluation */
+    int dirty;
+    struct IPStats *dirty_prev;
+    struct IPStats *dirty_next;
 } IPStats;
 
 /* ─── Alert item ─── */
+#define ALERT_STOP (-1) /* severity of the item that ends the alert stream */
+
 typedef struct
 {
     int user_id;
@@ -88,40 +289,509 @@ typedef struct
     int score;
     int severity; /* 0=normal 1=suspicious 2=high 3=critical */
     time_t timestamp;
+    uint64_t tick_ns; /* sent_ns of the tick whose evaluation raised it */
 } AlertItem;
 
-/* ─── Central shared state ─── */
+/* ─── Entity map: Robin Hood open addressing, incremental rehash (hashmap.c) ─── */
+typedef struct
+{
+    uint32_t key;
+    uint32_t dist; /* Probe distance + 1; 0 marks an empty slot */
+    void *value;   /* NULL in a draining table marks a moved/removed slot */
+} MapSlot;
+
+typedef struct
+{
+    MapSlot *slots;
+    size_t mask; /* Slot count - 1 (power of two) */
+    size_t count;
+} MapTable;
+
+typedef struct
+{
+    MapTable cur;       /* Receives every insert */
+    MapTable old;       /* Table being drained after a resize (slots == NULL if none) */
+    size_t migrate_pos; /* Next old slot to move */
+    long resizes;
+    unsigned int (*hash)(uint32_t key);
+} EntityMap;
+
+/* ─── Fixed-size object pool (slabs + free list, see pool.c) ─── */
+typedef struct
+{
+    const char *name;
+    size_t obj_size;
+    int objs_per_slab;
+    void *free_list;
+    struct PoolSlab *slabs;
+    long slab_count;
+    long capacity;   /* Slots across all slabs */
+    long in_use;
+    long high_water; /* Peak of in_use */
+} ObjectPool;
+
+/* ─── Bounded lock-free rings between pipeline stages (see ring.c) ─── */
+typedef struct
+{
+    pthread_mutex_t mu; /* Only taken by sleepers and whoever wakes them */
+    pthread_cond_t cond;
+    atomic_int waiters;
+} RingSignal;
+
+typedef struct
+{
+    char *slots;
+    size_t elem_size;
+    size_t mask; /* Capacity - 1 (power of two) */
+
+    _Alignas(64) atomic_size_t head; /* Consumer's next index */
+    size_t tail_cache;               /* Consumer's last view of tail */
+
+    _Alignas(64) atomic_size_t tail; /* Producer's next index */
+    size_t head_cache;               /* Producer's last view of head */
+
+    _Alignas(64) RingSignal not_empty;
+    RingSignal not_full;
+} SpscRing;
+
 typedef struct
 {
-    /* Log storage */
-    LogEntry *head;
-    LogEntry *tail;
-    int log_count;
+    char *cells; /* Sequence number + element, cell_size apart */
+    size_t cell_size;
+    size_t elem_size;
+    size_t mask;
+
+    _Alignas(64) atomic_size_t enqueue_pos; /* Shared by the producers */
+    _Alignas(64) atomic_size_t dequeue_pos; /* Written by the consumer only */
 
-    /* Hash maps */
-    EntityStats *user_map[HASH_SIZE];
-    IPStats *ip_map[HASH_SIZE];
+    _Alignas(64) RingSignal not_empty;
+    RingSignal not_full;
+} MpscRing;
 
-    /* Alert queue */
-    AlertItem alert_queue[ALERT_QUEUE_CAP];
-    int aq_head;
-    int aq_tail;
-    int aq_count;
+/* What push_alert does when the alert ring is full */
+typedef enum
+{
+    BACKPRESSURE_BLOCK = 0, /* Wait for the alert thread to make room */
+    BACKPRESSURE_SPILL,     /* Append to a spill file the alert thread drains */
+    BACKPRESSURE_DROP       /* Discard and count in alerts_dropped */
+} Backpressure;
+
+/* Console log verbosity (see log.c) */
+typedef enum
+{
+    LOG_LEVEL_OFF = 0,
+    LOG_LEVEL_INFO, /* Alerts and progress */
+    LOG_LEVEL_DEBUG /* Every evaluation and every entity scored */
+} LogLevel;
 
-    /* Synchronization */
+/* Alert log line format (see sink.c) */
+typedef enum
+{
+    ALERT_FORMAT_TEXT = 0, /* "[time] User: .. | IP: .. | Score: .. | Severity: .." */
+    ALERT_FORMAT_JSON      /* One JSON object per line */
+} AlertFormat;
+
+/* When the alert log is fsync'ed */
+typedef enum
+{
+    ALERT_FSYNC_NONE = 0, /* Leave it to the kernel */
+    ALERT_FSYNC_COMMIT,   /* After every group commit */
+    ALERT_FSYNC_ROTATE    /* Only before a file is rotated or closed */
+} AlertFsync;
+
+/* ─── Metrics (see metrics.c): one writer per struct, relaxed atomics ─── */
+#define HIST_SUB_BITS 4
+#define HIST_BUCKETS 976 /* 2^HIST_SUB_BITS buckets per power of two up to 2^64 */
+
+typedef struct
+{
+    atomic_ullong buckets[HIST_BUCKETS];
+    atomic_ullong count;
+    atomic_ullong sum; /* ns */
+    atomic_ullong max;
+} LatencyHist;
+
+typedef struct
+{
+    uint64_t buckets[HIST_BUCKETS];
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+} HistSnapshot;
+
+typedef struct
+{
+    atomic_ullong lines_parsed;
+    atomic_ullong events_admitted;
+    atomic_ullong events_late;
+    atomic_ullong events_out_of_range; /* Outside --from/--until */
+    atomic_ullong blocks_skipped;      /* Archive blocks outside it, never decoded */
+    atomic_ullong parse_errors[PARSE_RESULT_COUNT];
+    atomic_ullong bytes_inflated;      /* Text read out of gzip inputs */
+    LatencyHist parse_chunk_ns; /* Parse of one chunk, recorded on publish */
+    LatencyHist inflate_ns;     /* Inflating one gzip piece, recorded on publish */
+    LatencyHist handoff_ns;     /* Publishing one batch into a shard inbox */
+} IngestMetrics;
+
+/* Network input, written by the ingestion thread (see listen.c) */
+typedef struct
+{
+    atomic_ullong connections_accepted;
+    atomic_ullong connections_open; /* Gauge */
+    atomic_ullong bytes_received;
+    atomic_ullong datagrams;
+    atomic_ullong messages;
+    atomic_ullong syslog_messages; /* RFC 5424 headers stripped */
+    atomic_ullong syslog_invalid;  /* Started with "<" but had no valid header */
+    atomic_ullong oversized;       /* Longer than the line limit, dropped */
+} ListenMetrics;
+
+typedef struct
+{
+    atomic_ullong events_applied;
+    atomic_ullong entries_expired;
+    atomic_ullong evaluations;
+    atomic_ullong entities_scored;
+    atomic_ullong alerts;
+    atomic_ullong window_entries; /* Gauge */
+    LatencyHist fold_ns;          /* Folding one run of events into the window */
+    LatencyHist eval_ns;          /* One run_evaluation */
+    LatencyHist pause_ns;         /* Copying out the shard's part of a checkpoint */
+    uint64_t tick_ns;             /* sent_ns of the tick being evaluated */
+} ShardMetrics;
+
+typedef struct
+{
+    atomic_ullong emitted;
+    LatencyHist latency_ns; /* Tick sent by ingestion -> alert emitted */
+    LatencyHist commit_ns;  /* One alert log group commit */
+} AlertMetrics;
+
+/* Single-writer counter bump: no read-modify-write needed */
+static inline void counter_add(atomic_ullong *c, uint64_t v)
+{
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + v,
+                          memory_order_relaxed);
+}
+
+/* ─── Runtime configuration (filled from argv in main.c) ─── */
+typedef struct
+{
+    /* Replay pacing: 0 = as fast as possible, 1.0 = event-time real time,
+     * 10.0 = ten times faster than the timestamps in the log */
+    double replay_speed;
+
+    /* How far (seconds) an event may lag the newest event seen and still be
+     * accepted; the watermark trails the newest timestamp by this much */
+    int allowed_lateness;
+
+    /* Input files, ingested in the order given (DEFAULT_INPUT if none);
+     * directories and globs are expanded to the files in them, sorted */
+    char **input_paths;
+    int input_count;
+    int parse_threads; /* Workers parsing chunks of each mapped file */
+    int follow;        /* Keep reading the last input as it grows, until stopped */
+    int merge;         /* Read every input at once and merge them by event time */
+
+    /* Addresses to take log lines and syslog messages on once the input
+     * files are read, until stopped: [tcp:|udp:][addr:]port, unix:path or
+     * unixgram:path. The listener counts as one more input, the last. */
+    const char *listen_specs[MAX_LISTENERS];
+    int listen_count;
+
+    /* Event-time range to replay, inclusive (0 = unbounded). Archive blocks
+     * entirely outside it are skipped unread. */
+    time_t from_time;
+    time_t until_time;
+
+    /* Convert the inputs into a binary archive here instead of analyzing */
+    const char *archive_path;
+
+    /* Distinct resource/IP counting: 0 = exact ref-counted sets, otherwise
+     * sliding HyperLogLog sketches with this target relative error */
+    double approx_error;
+    int hll_precision; /* Derived from approx_error */
+
+    int shard_count; /* Analyzer workers, each owning a slice of the entities */
+    Backpressure alert_backpressure;
+
+    /* Ingestion publishes to each shard in batches of up to batch_size
+     * entries; a partial batch goes out once its oldest entry has waited
+     * flush_ms. Larger batches cost fewer handoffs, smaller ones less
+     * latency. */
+    int batch_size;
+    int flush_ms;
+
+    /* Alert log: alerts of at least alert_min_severity are buffered and
+     * written out together once alert_commit_ms has passed (or the buffer
+     * fills); the file is rotated past alert_rotate_bytes or
+     * alert_rotate_secs (0 = never) */
+    const char *alert_path;
+    AlertFormat alert_format;
+    int alert_min_severity;
+    int alert_commit_ms;
+    AlertFsync alert_fsync;
+    long alert_rotate_bytes;
+    int alert_rotate_secs;
+    int alert_append; /* Keep the log's contents (set when resuming) */
+
+    LogLevel log_level;
+
+    int top_k; /* Suspicious users and IPs listed by the dashboard */
+
+    /* Checkpoints: the window and alert dedup state are saved to
+     * checkpoint_path every checkpoint_secs and once more at the end of
+     * input, and restored from it at startup (NULL = off) */
+    const char *checkpoint_path;
+    int checkpoint_secs;
+
+    /* Prometheus exposition: written to metrics_path and/or served on
+     * 127.0.0.1:metrics_port every metrics_interval_ms (neither = off) */
+    const char *metrics_path;
+    int metrics_port;
+    int metrics_interval_ms;
+} EngineConfig;
+
+/* Whether an event time is inside --from/--until */
+static inline int in_time_range(const EngineConfig *cfg, time_t t)
+{
+    return (!cfg->from_time || t >= cfg->from_time) && (!cfg->until_time || t <= cfg->until_time);
+}
+
+/* ─── Buffered alert log writer (see sink.c), alert thread only ─── */
+typedef struct
+{
+    const EngineConfig *cfg;
+    int fd;
+    char *buf;
+    size_t len;
+    long pending;         /* Alerts in buf */
+    double first_pending; /* Monotonic time the oldest of them was buffered */
+    long file_bytes;      /* Size of the current file */
+    double opened_at;
+    int next_rotation;    /* Suffix for the next rotated file */
+
+    time_t cached_sec; /* Timestamp cached_time was formatted from */
+    char cached_time[32];
+
+    long written; /* Alerts written */
+    long commits;
+    long rotations;
+    long write_errors;
+    LatencyHist *commit_hist; /* Optional: timing of each commit */
+} AlertSink;
+
+/* ─── Top-K suspicious entities (see topk.c) ─── */
+#define TOPK_MIN_SCORE 11 /* Suspicious and up; lower scores are not ranked */
+#define DEFAULT_TOP_K 5
+
+typedef struct
+{
+    int score;
+    uint32_t id; /* User id, or interned IP id */
+    int *pos;    /* The entity's heap_pos, kept at index + 1 */
+} HeapItem;
+
+typedef struct
+{
+    HeapItem *items; /* Max-heap by score, ties to the lower id */
+    int count;
+    int cap;
+    long changes; /* Bumped on every change */
+} ScoreHeap;
+
+typedef struct
+{
+    int score;
+    uint32_t id;
+} TopEntry;
+
+/* A shard's best top_k users and IPs as of its last evaluation; written by
+ * the shard, read by anyone under the lock */
+typedef struct
+{
     pthread_mutex_t lock;
-    pthread_mutex_t ip_lock;
-    pthread_cond_t cond_new_log;
-    pthread_cond_t cond_alert;
+    TopEntry *users;
+    TopEntry *ips;
+    int user_count;
+    int ip_count;
+    long published; /* Heap changes already on the board (shard only) */
+    int *frontier;  /* Scratch for walking a heap (shard only) */
+} TopKBoard;
+
+/* ─── Checkpoints (see checkpoint.c) ─── */
+typedef struct
+{
+    uint32_t id; /* User id, or interned IP id */
+    int32_t last_alert_score;
+    int64_t last_alert_time;
+} DedupRecord;
+
+/* One shard's part of a checkpoint, copied out by the shard's worker */
+typedef struct
+{
+    int64_t watermark;
+    int64_t sketch_epoch;
+    LogEntry *entries; /* The window, oldest first */
+    size_t entry_count;
+    DedupRecord *users; /* Entities that have alerted */
+    size_t user_count;
+    DedupRecord *ips;
+    size_t ip_count;
+} CheckpointSection;
+
+typedef struct
+{
+    /* Ingestion's side of the cut, filled in when the marker is sent */
+    int input_index;
+    uint64_t input_offset; /* Resume here: the first byte not yet read */
+    uint64_t input_ino;    /* Inode of that input, to notice it was replaced */
+    int64_t watermark;
+    int64_t next_eval_time;
+    int64_t admit_max_time;
+    uint32_t intern_count; /* Every id in the cut is below this */
+    uint64_t started_ns;   /* When the marker went out */
+
+    CheckpointSection *sections; /* One per shard */
+    atomic_int pending;          /* Shards yet to hand in their section */
+    atomic_int in_flight;        /* A marker is out and its file not yet written */
+
+    pthread_t thread; /* Writer */
+    int running;
+    int stop;
+    pthread_mutex_t mu;
+    pthread_cond_t cond; /* Last section in, file written, or stop */
+
+    atomic_long written;
+    atomic_long failed;
+    atomic_ullong last_bytes;
+    LatencyHist total_ns; /* Marker sent -> file renamed into place */
+} Checkpointer;
+
+struct SharedState;
+
+/* An emptied entity kept for its alert state (see hashmap.c) */
+typedef struct
+{
+    uint32_t id; /* User id, or interned IP id */
+    int is_ip;
+    time_t since; /* Shard watermark when it emptied */
+} IdleEntity;
+
+/* ─── Analyzer shard (see shard.c) ───
+ * Users are partitioned by hash_user and IPs by hash_ip. A shard's window,
+ * pools and maps are touched only by its own worker thread; the inbox is
+ * the one part shared with ingestion. */
+typedef struct Shard
+{
+    int id;
+    struct SharedState *state;
+
+    /* Entries routed here, in arrival order */
+    LogWindow window;
+    time_t watermark; /* Event-time clock, advanced by entries and ticks */
+
+    ObjectPool user_pool;
+    ObjectPool ip_pool;
+    ObjectPool sketch_pool; /* WindowSketch, sized from cfg.hll_precision */
+
+    /* Entity maps (keyed by user id / interned IP id) */
+    EntityMap user_map;
+    EntityMap ip_map;
+
+    /* Entities whose stats changed since the last evaluation; only these
+     * are rescored (see mark_user_dirty) */
+    EntityStats *dirty_users;
+    IPStats *dirty_ips;
+    int64_t sketch_epoch; /* hll_oldest_slice at the last full user sweep */
+
+    /* Emptied entities kept for their alert state, oldest first: a ring of
+     * idle_cap (a power of two) records */
+    IdleEntity *idle;
+    size_t idle_head;
+    size_t idle_count;
+    size_t idle_cap;
+
+    /* Suspects ranked by current score, and the leaders published from
+     * them after each evaluation */
+    ScoreHeap user_heap;
+    ScoreHeap ip_heap;
+    TopKBoard board;
+
+    int alerts_generated;
+    ShardMetrics metrics;
+    pthread_t thread;
+
+    /* Inbox: ingestion pushes, the worker drains it in batches */
+    SpscRing inbox;
+    LogEntry *staged; /* Ingestion-private: entries not yet pushed */
+    size_t staged_count;
+    LogEntry *batch; /* Worker-private: the last batch taken */
+    size_t batch_count;
+} Shard;
+
+/* ─── Central shared state ─── */
+typedef struct SharedState
+{
+    EngineConfig cfg;
+
+    /* Analyzer shards (cfg.shard_count of them) */
+    Shard *shards;
+
+    /* Ingestion's event-time clock (driven by log timestamps, never by
+     * time(NULL)); shards receive it through ROUTE_TICK entries */
+    time_t watermark;
+    time_t next_eval_time;
+    time_t admit_max_time; /* Newest timestamp seen by admit_log_entry */
+    int late_events_dropped;
+
+    /* Ingestion's staging across all shards (see shard_post) */
+    size_t staged_total;
+    struct timespec staged_since; /* When staging last went from empty to non-empty */
+    int posts_since_check;        /* Posts since the flush deadline was checked */
+
+    /* Alerts from every shard to the alert thread */
+    MpscRing alert_ring;
+    pthread_mutex_t spill_lock; /* Guards the spill file (slow path only) */
+    FILE *alert_spill;
+    long spill_pending;          /* Alerts in the spill file, not yet drained */
+    atomic_long alerts_spilled;  /* Total ever spilled */
+    atomic_long alerts_dropped;  /* Lost under BACKPRESSURE_DROP */
+    AlertSink alert_sink;
+    AlertMetrics alert_metrics;
 
     /* Control flags */
     int ingestion_done;
-    int analyzer_done;
+    int stop_fd; /* Readable once a stop is requested (--follow), else -1 */
+    atomic_int shards_running; /* Analyzer workers not yet stopped */
+    atomic_int analyzer_done;  /* Polled by main for progress */
 
     /* Performance metrics */
     int total_logs_processed;
-    int total_alerts_generated;
-    double avg_processing_time;
+    atomic_int total_alerts_generated; /* Summed by each shard as it stops */
+    int parse_errors[PARSE_RESULT_COUNT]; /* Malformed lines by reason */
+    IngestMetrics ingest_metrics;
+    uint64_t start_ns;
+
+    /* Checkpoints, and where ingestion resumes after a restore */
+    Checkpointer checkpoint;
+    int resume_index;
+    uint64_t resume_offset;
+    uint64_t resume_ino;
+
+    /* Network input (--listen), opened by main */
+    Listener *listener;
+    ListenMetrics listen_metrics;
+
+    /* --merge: one per input (see merge.c) */
+    SourceStats *sources;
+    int source_count;
+
+    /* Metrics exporter (see metrics.c) */
+    pthread_t metrics_thread;
+    int metrics_running;
+    int metrics_listen_fd;
+    atomic_int metrics_stop;
 } SharedState;
 
 /* ─── Severity helpers ─── */
@@ -155,34 +825,215 @@ static inline const char *severity_str(int sev)
 /*             FUNCTION PROTOTYPES                    */
 /* ================================================== */
 
+/* intern.c */
+void intern_init(void);
+uint32_t intern_bytes(const char *s, size_t len);
+uint32_t intern_defer(InternDeferred *d, const char *s, size_t len);
+uint32_t intern_resolve(InternDeferred *d, uint32_t ref);
+void intern_deferred_clear(InternDeferred *d);
+void intern_deferred_free(InternDeferred *d);
+const char *intern_str(uint32_t id);
+const char *intern_peek(uint32_t id);
+uint64_t intern_hash64(uint32_t id);
+uint32_t intern_count(void);
+void intern_destroy(void);
+
+/* refset.c */
+int refset_add(RefSet *s, uint32_t id);
+int refset_remove(RefSet *s, uint32_t id);
+size_t refset_heap_bytes(const RefSet *s);
+size_t refset_grown_bytes(const RefSet *s);
+void refset_free(RefSet *s);
+
+/* hll.c */
+int hll_precision_for_error(double rel_error);
+double hll_error_for_precision(int precision);
+size_t hll_sketch_bytes(int precision);
+void hll_reset(WindowSketch *sk, int precision);
+void hll_add(WindowSketch *sk, int precision, uint32_t id, time_t ts);
+int hll_estimate(const WindowSketch *sk, int precision, time_t now, const RefSet *held);
+int64_t hll_oldest_slice(time_t now);
+
+/* pool.c */
+void pool_init(ObjectPool *pool, const char *name, size_t obj_size, int objs_per_slab);
+void *pool_alloc(ObjectPool *pool);
+void pool_free(ObjectPool *pool, void *obj);
+void pool_foreach_slot(ObjectPool *pool, void (*fn)(void *obj));
+void pool_destroy(ObjectPool *pool);
+
 /* hashmap.c */
 unsigned int hash_user(int user_id);
-unsigned int hash_ip(const char *ip);
-EntityStats *get_or_create_user(SharedState *state, int user_id);
-IPStats *get_or_create_ip(SharedState *state, const char *ip);
-void remove_user_if_empty(SharedState *state, int user_id);
-void remove_ip_if_empty(SharedState *state, const char *ip);
+unsigned int hash_ip(uint32_t ip_id);
+unsigned int map_hash_user(uint32_t key);
+void map_init(EntityMap *m, unsigned int (*hash)(uint32_t key));
+void map_destroy(EntityMap *m);
+void *map_get(EntityMap *m, uint32_t key);
+void map_put(EntityMap *m, uint32_t key, void *value);
+void *map_remove(EntityMap *m, uint32_t key);
+size_t map_count(const EntityMap *m);
+void *map_next(const EntityMap *m, size_t *cursor);
+EntityStats *get_or_create_user(Shard *shard, int user_id);
+IPStats *get_or_create_ip(Shard *shard, uint32_t ip_id);
+void remove_user_if_empty(Shard *shard, int user_id);
+void remove_ip_if_empty(Shard *shard, uint32_t ip_id);
+void expire_idle_entities(Shard *shard, time_t now);
+
+/* shard.c */
+void init_shards(SharedState *state);
+Shard *shard_for_user(SharedState *state, int user_id);
+Shard *shard_for_ip(SharedState *state, uint32_t ip_id);
+void shard_post(Shard *shard, const LogEntry *entry);
+void shard_broadcast(SharedState *state, uint8_t route, time_t timestamp);
+void shard_flush_all(SharedState *state);
+void shard_flush_due(SharedState *state);
+size_t shard_take(Shard *shard);
+void mark_user_dirty(Shard *shard, EntityStats *user);
+void mark_ip_dirty(Shard *shard, IPStats *ip);
+void unlink_dirty_user(Shard *shard, EntityStats *user);
+void unlink_dirty_ip(Shard *shard, IPStats *ip);
 void free_all_resources(SharedState *state);
 
 /* scorer.c */
 int compute_score(EntityStats *e); /* ADD THIS - needed by analyzer.c */
 int compute_ip_score(IPStats *ip);
 int compute_user_score(EntityStats *e); /* For compatibility */
-void evaluate_entity(SharedState *state, EntityStats *e, const char *ip);
-void evaluate_ip(SharedState *state, IPStats *ip);
+void evaluate_entity(Shard *shard, EntityStats *e, const char *ip);
+void evaluate_ip(Shard *shard, IPStats *ip);
+
+/* ring.c */
+void spsc_init(SpscRing *r, size_t elem_size, size_t min_cap);
+void spsc_destroy(SpscRing *r);
+int spsc_try_push(SpscRing *r, const void *item);
+void spsc_push(SpscRing *r, const void *item);
+void spsc_push_batch(SpscRing *r, const void *items, size_t n);
+size_t spsc_pop_batch(SpscRing *r, void *out, size_t max);
+void mpsc_init(MpscRing *r, size_t elem_size, size_t min_cap);
+void mpsc_destroy(MpscRing *r);
+int mpsc_try_push(MpscRing *r, const void *item);
+void mpsc_push(MpscRing *r, const void *item);
+size_t mpsc_try_pop_batch(MpscRing *r, void *out, size_t max);
+size_t mpsc_pop_batch(MpscRing *r, void *out, size_t max);
+size_t spsc_depth(SpscRing *r);
+size_t mpsc_depth(MpscRing *r);
 
 /* alert.c */
+void init_alerts(SharedState *state);
 void push_alert(SharedState *state, AlertItem item);
+void finish_alerts(SharedState *state);
+void free_alerts(SharedState *state);
 void *alert_thread(void *arg);
 
+/* log.c: the arguments are only evaluated when the level is enabled */
+#define LOG_RECORD_MAX 1024 /* Longest record, several lines allowed */
+extern int log_level;
+#define log_info(...)                    \
+    do                                   \
+    {                                    \
+        if (log_level >= LOG_LEVEL_INFO) \
+            log_write(__VA_ARGS__);      \
+    } while (0)
+#define log_debug(...)                    \
+    do                                    \
+    {                                     \
+        if (log_level >= LOG_LEVEL_DEBUG) \
+            log_write(__VA_ARGS__);       \
+    } while (0)
+void log_start(LogLevel level);
+void log_stop(void);
+void log_write(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+/* metrics.c */
+uint64_t now_ns(void);
+void hist_record(LatencyHist *h, uint64_t ns);
+void hist_snapshot(HistSnapshot *out, LatencyHist *h);
+double snap_quantile(const HistSnapshot *s, double q);
+size_t metrics_render(SharedState *state, char **out);
+void metrics_start(SharedState *state);
+void metrics_stop(SharedState *state);
+
+/* sink.c */
+void sink_open(AlertSink *s, const EngineConfig *cfg);
+void sink_write(AlertSink *s, const AlertItem *a);
+void sink_commit(AlertSink *s);
+void sink_commit_due(AlertSink *s);
+void sink_close(AlertSink *s);
+
+/* topk.c */
+void heap_init(ScoreHeap *h);
+void heap_free(ScoreHeap *h);
+void heap_update(ScoreHeap *h, int *pos, uint32_t id, int score);
+void heap_remove(ScoreHeap *h, int *pos);
+void topk_init(Shard *shard, int k);
+void topk_free(Shard *shard);
+void topk_publish(Shard *shard);
+void topk_collect(SharedState *state, TopEntry *users, int *n_users, TopEntry *ips, int *n_ips);
+
+/* archive.c */
+int archive_is(const char *data, size_t size);
+size_t archive_first_block(void);
+ParseResult archive_block_at(const char *data, size_t size, size_t pos, ArchiveBlock *blk);
+ParseResult archive_decode_block(const char *data, const ArchiveBlock *blk, LogEntry *out,
+                                 InternDeferred *defer);
+int archive_convert(const EngineConfig *cfg);
+
+/* gzip.c */
+int gzip_is(const char *data, size_t size);
+GzipReader *gzip_open(const char *data, size_t size, uint64_t skip, int depth);
+int gzip_next(GzipReader *r, GzipPiece *out);
+void gzip_release(GzipReader *r);
+const char *gzip_error(GzipReader *r);
+uint64_t gzip_inflated(GzipReader *r);
+void gzip_close(GzipReader *r);
+
+/* listen.c */
+Listener *listener_open(const EngineConfig *cfg, int stop_fd, ListenMetrics *metrics);
+long listener_read(Listener *l, int timeout_ms, const char **text);
+void listener_close(Listener *l);
+
+/* merge.c */
+MergeSet *merge_open(SharedState *state);
+int merge_next(MergeSet *m, LogEntry *out, int wait);
+void merge_close(MergeSet *m);
+void merge_stats_init(SharedState *state);
+double source_lag_seconds(const SharedState *state, int i);
+double source_rate(const SharedState *state, int i);
+
+/* checkpoint.c */
+int checkpoint_restore(SharedState *state);
+void checkpoint_start(SharedState *state);
+int checkpoint_due(SharedState *state);
+void checkpoint_begin(SharedState *state, int input_index, uint64_t offset, uint64_t input_ino,
+                      uint8_t route);
+void checkpoint_shard(Shard *shard);
+void checkpoint_wait(SharedState *state);
+void checkpoint_stop(SharedState *state);
+
 /* ingestion.c */
-LogEntry *parse_log_line(const char *line);
+ParseResult parse_log_line(const char *line, size_t len, LogEntry *entry, InternDeferred *defer);
+int is_ignorable_line(const char *line, size_t len);
+const char *parse_result_str(ParseResult r);
+uint8_t parse_event_type(const char *s, size_t len);
+uint8_t parse_status_code(const char *s, size_t len);
+const char *event_type_str(uint8_t ev);
+const char *status_code_str(uint8_t st);
+void route_log_entry(SharedState *state, const LogEntry *parsed);
+int input_total(const EngineConfig *cfg);
+const char *input_path_at(const EngineConfig *cfg, int i);
 void *ingestion_thread(void *arg);
 
 /* window.c */
-void add_log_to_stats(SharedState *state, LogEntry *entry);
-void remove_log_from_stats(SharedState *state, LogEntry *entry);
-void expire_old_logs(SharedState *state, time_t now);
+void add_log_to_stats(Shard *shard, LogEntry *entry);
+void remove_log_from_stats(Shard *shard, LogEntry *entry);
+void refresh_distinct_counts(Shard *shard, EntityStats *user);
+size_t entity_memory_bytes(const Shard *shard, const EntityStats *user);
+void window_init(LogWindow *w, size_t initial_cap);
+void window_free(LogWindow *w);
+LogEntry *window_push(LogWindow *w);
+void window_push_batch(LogWindow *w, const LogEntry *entries, size_t n);
+void expire_old_logs(Shard *shard, time_t now);
+int admit_log_entry(SharedState *state, time_t event_time);
+void advance_watermark(Shard *shard, time_t watermark);
+void apply_pending_logs(Shard *shard);
 
 /* analyzer.c */
 void *analyzer_thread(void *arg);
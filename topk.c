@@ -0,0 +1,285 @@
+#include "structures.h"
+
+/*
+ * Top suspicious entities, kept up to date as scores change.
+ *
+ * Each shard keeps one indexed max-heap of its users and one of its IPs.
+ * Only entities scoring at least TOPK_MIN_SCORE (suspicious and up) are in
+ * a heap, so its size follows the number of suspects, not the number of
+ * entities. Every heap item points back at its entity's heap_pos (index + 1,
+ * 0 = not in the heap), so a score change or a removal finds its item
+ * directly and costs O(log n) on the shard's own thread.
+ *
+ * After a tick that changed a heap the shard copies its best cfg.top_k
+ * users and IPs onto its board, under the board's lock. The heap is walked
+ * best-first from the root with a small frontier heap, so this is
+ * O(K log K) however many suspects there are. Readers (the dashboard, the
+ * metrics exporter) merge the boards of all shards: O(shards * K) per
+ * frame, with no map scan.
+ */
+
+/* ─── Indexed max-heap ─── */
+
+/* Ties go to the lower id, so the order does not depend on history */
+static int ranks_before(int score_a, uint32_t id_a, int score_b, uint32_t id_b)
+{
+    return score_a > score_b || (score_a == score_b && id_a < id_b);
+}
+
+static int item_before(const HeapItem *a, const HeapItem *b)
+{
+    return ranks_before(a->score, a->id, b->score, b->id);
+}
+
+static void heap_place(ScoreHeap *h, int i, HeapItem item)
+{
+    h->items[i] = item;
+    *item.pos = i + 1;
+}
+
+static void sift_up(ScoreHeap *h, int i)
+{
+    HeapItem item = h->items[i];
+    while (i > 0)
+    {
+        int parent = (i - 1) / 2;
+        if (!item_before(&item, &h->items[parent]))
+            break;
+        heap_place(h, i, h->items[parent]);
+        i = parent;
+    }
+    heap_place(h, i, item);
+}
+
+static void sift_down(ScoreHeap *h, int i)
+{
+    HeapItem item = h->items[i];
+    while (1)
+    {
+        int child = 2 * i + 1;
+        if (child >= h->count)
+            break;
+        if (child + 1 < h->count && item_before(&h->items[child + 1], &h->items[child]))
+            child++;
+        if (!item_before(&h->items[child], &item))
+            break;
+        heap_place(h, i, h->items[child]);
+        i = child;
+    }
+    heap_place(h, i, item);
+}
+
+void heap_init(ScoreHeap *h)
+{
+    memset(h, 0, sizeof(*h));
+}
+
+void heap_free(ScoreHeap *h)
+{
+    free(h->items);
+    memset(h, 0, sizeof(*h));
+}
+
+/* Take an entity out of the heap if it is in it */
+void heap_remove(ScoreHeap *h, int *pos)
+{
+    if (*pos == 0)
+        return;
+
+    int i = *pos - 1;
+    *pos = 0;
+    h->count--;
+    h->changes++;
+    if (i == h->count)
+        return;
+
+    h->items[i] = h->items[h->count];
+    *h->items[i].pos = i + 1;
+    if (i > 0 && item_before(&h->items[i], &h->items[(i - 1) / 2]))
+        sift_up(h, i);
+    else
+        sift_down(h, i);
+}
+
+/* Record an entity's new score: scores under TOPK_MIN_SCORE leave the heap */
+void heap_update(ScoreHeap *h, int *pos, uint32_t id, int score)
+{
+    if (score < TOPK_MIN_SCORE)
+    {
+        heap_remove(h, pos);
+        return;
+    }
+
+    if (*pos != 0)
+    {
+        HeapItem *item = &h->items[*pos - 1];
+        if (item->score == score)
+            return;
+        int up = score > item->score;
+        item->score = score;
+        h->changes++;
+        if (up)
+            sift_up(h, *pos - 1);
+        else
+            sift_down(h, *pos - 1);
+        return;
+    }
+
+    if (h->count == h->cap)
+    {
+        int cap = h->cap ? h->cap * 2 : 64;
+        HeapItem *items = (HeapItem *)realloc(h->items, sizeof(HeapItem) * (size_t)cap);
+        if (!items)
+        {
+            perror("realloc score heap");
+            exit(1);
+        }
+        h->items = items;
+        h->cap = cap;
+    }
+    h->items[h->count] = (HeapItem){.score = score, .id = id, .pos = pos};
+    h->count++;
+    h->changes++;
+    sift_up(h, h->count - 1);
+}
+
+/* Copy the best k items into out, best first, without touching the heap.
+ * The frontier holds indexes of heap items whose parents are already out;
+ * it never grows past k + 1. */
+static int heap_top(const ScoreHeap *h, TopEntry *out, int k, int *frontier)
+{
+    int n = 0, fcount = 0;
+    if (h->count > 0 && k > 0)
+        frontier[fcount++] = 0;
+
+    while (fcount > 0 && n < k)
+    {
+        /* Pop the best frontier index (the frontier is itself a heap) */
+        int best = frontier[0];
+        int last = frontier[--fcount];
+        int i = 0;
+        while (1)
+        {
+            int child = 2 * i + 1;
+            if (child >= fcount)
+                break;
+            if (child + 1 < fcount &&
+                item_before(&h->items[frontier[child + 1]], &h->items[frontier[child]]))
+                child++;
+            if (!item_before(&h->items[frontier[child]], &h->items[last]))
+                break;
+            frontier[i] = frontier[child];
+            i = child;
+        }
+        if (fcount > 0)
+            frontier[i] = last;
+
+        out[n].id = h->items[best].id;
+        out[n].score = h->items[best].score;
+        n++;
+
+        for (int c = 2 * best + 1; c <= 2 * best + 2 && c < h->count; c++)
+        {
+            int j = fcount++;
+            while (j > 0 && item_before(&h->items[c], &h->items[frontier[(j - 1) / 2]]))
+            {
+                frontier[j] = frontier[(j - 1) / 2];
+                j = (j - 1) / 2;
+            }
+            frontier[j] = c;
+        }
+    }
+    return n;
+}
+
+/* ─── Per-shard boards ─── */
+
+void topk_init(Shard *shard, int k)
+{
+    heap_init(&shard->user_heap);
+    heap_init(&shard->ip_heap);
+
+    TopKBoard *b = &shard->board;
+    pthread_mutex_init(&b->lock, NULL);
+    b->users = (TopEntry *)calloc((size_t)k, sizeof(TopEntry));
+    b->ips = (TopEntry *)calloc((size_t)k, sizeof(TopEntry));
+    b->frontier = (int *)malloc(sizeof(int) * (size_t)(k + 2));
+    if (!b->users || !b->ips || !b->frontier)
+    {
+        perror("malloc top-k board");
+        exit(1);
+    }
+    b->published = -1;
+}
+
+void topk_free(Shard *shard)
+{
+    heap_free(&shard->user_heap);
+    heap_free(&shard->ip_heap);
+
+    TopKBoard *b = &shard->board;
+    pthread_mutex_destroy(&b->lock);
+    free(b->users);
+    free(b->ips);
+    free(b->frontier);
+}
+
+/* Copy the shard's leaders onto its board if either heap changed since the
+ * last time; called by the shard's worker after each evaluation */
+void topk_publish(Shard *shard)
+{
+    TopKBoard *b = &shard->board;
+    long changes = shard->user_heap.changes + shard->ip_heap.changes;
+    if (changes == b->published)
+        return;
+
+    int k = shard->state->cfg.top_k;
+    pthread_mutex_lock(&b->lock);
+    b->user_count = heap_top(&shard->user_heap, b->users, k, b->frontier);
+    b->ip_count = heap_top(&shard->ip_heap, b->ips, k, b->frontier);
+    pthread_mutex_unlock(&b->lock);
+    b->published = changes;
+}
+
+/* Insert a board's sorted entries into the running best-k list */
+static void merge_board(TopEntry *dst, int *n, int k, const TopEntry *src, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (*n == k)
+        {
+            if (!ranks_before(src[i].score, src[i].id, dst[k - 1].score, dst[k - 1].id))
+                break; /* Sorted: nothing later on this board makes the cut */
+        }
+        else
+        {
+            (*n)++;
+        }
+
+        int j = *n - 1;
+        while (j > 0 && ranks_before(src[i].score, src[i].id, dst[j - 1].score, dst[j - 1].id))
+        {
+            dst[j] = dst[j - 1];
+            j--;
+        }
+        dst[j] = src[i];
+    }
+}
+
+/* Merge the boards of all shards into the best cfg.top_k users and IPs,
+ * best first. Safe to call from any thread while the shards run. */
+void topk_collect(SharedState *state, TopEntry *users, int *n_users, TopEntry *ips, int *n_ips)
+{
+    int k = state->cfg.top_k;
+    *n_users = 0;
+    *n_ips = 0;
+
+    for (int s = 0; s < state->cfg.shard_count; s++)
+    {
+        TopKBoard *b = &state->shards[s].board;
+        pthread_mutex_lock(&b->lock);
+        merge_board(users, n_users, k, b->users, b->user_count);
+        merge_board(ips, n_ips, k, b->ips, b->ip_count);
+        pthread_mutex_unlock(&b->lock);
+    }
+}
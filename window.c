@@ -1,173 +1,288 @@
 #include "structures.h"
 
-/* Add log to statistics (O(1) with ref counting) */
-void add_log_to_stats(SharedState *state, LogEntry *entry)
+static WindowSketch *new_sketch(Shard *shard)
 {
-    /* Update user stats */
-    EntityStats *user = get_or_create_user(state, entry->user_id);
+    WindowSketch *sk = (WindowSketch *)pool_alloc(&shard->sketch_pool);
+    hll_reset(sk, shard->state->cfg.hll_precision);
+    return sk;
+}
 
-    /* Track failed logins */
-    if (strcmp(entry->status_code, "FAILED") == 0 &&
-        strcmp(entry->event_type, "LOGIN") == 0)
+/* Count id into one of a user's distinct sets. Sets stay exact until their
+ * table would have to grow past the size of a sketch (approximate mode
+ * only); from then on new ids go to a sketch and the set keeps only the ids
+ * it already had, which leave as their entries expire. */
+static void distinct_add(Shard *shard, RefSet *set, WindowSketch **sketch, int *count,
+                         uint32_t id, time_t ts)
+{
+    const EngineConfig *cfg = &shard->state->cfg;
+    if (!*sketch && cfg->approx_error > 0.0 &&
+        refset_grown_bytes(set) > shard->sketch_pool.obj_size)
+        *sketch = new_sketch(shard);
+
+    if (*sketch)
     {
-        user->failed_attempts++;
+        hll_add(*sketch, cfg->hll_precision, id, ts);
+        return;
     }
+    refset_add(set, id);
+    *count = set->count;
+}
+
+/* Entries leave in arrival order, so while the set still holds an id its
+ * references are the first to go; later removals of it find nothing */
+static void distinct_remove(RefSet *set, const WindowSketch *sketch, int *count, uint32_t id)
+{
+    refset_remove(set, id);
+    if (!sketch)
+        *count = set->count;
+}
 
-    /* Track resources with ref counting */
-    if (strcmp(entry->resource_id, "-") != 0)
+/* Add log to statistics (O(1) amortized: ids only, hashed ref-counted sets).
+ * Only the parts this shard owns are counted: the user half for ROUTE_USER,
+ * the failed-login IP half for ROUTE_IP. */
+void add_log_to_stats(Shard *shard, LogEntry *entry)
+{
+    /* Update IP stats for failed logins */
+    if (entry->route & ROUTE_IP)
     {
-        int found = 0;
-        for (int i = 0; i < user->resource_count; i++)
-        {
-            if (strcmp(user->resources[i].name, entry->resource_id) == 0)
-            {
-                user->resources[i].ref_count++;
-                found = 1;
-                break;
-            }
-        }
-        if (!found)
-        {
-            if (user->resource_count >= user->resource_cap)
-            {
-                user->resource_cap *= 2;
-                user->resources = (ResourceRef *)realloc(user->resources,
-                                                         sizeof(ResourceRef) * user->resource_cap);
-            }
-            strncpy(user->resources[user->resource_count].name, entry->resource_id, 31);
-            user->resources[user->resource_count].ref_count = 1;
-            user->resource_count++;
-        }
+        IPStats *ip_stat = get_or_create_ip(shard, entry->ip_id);
+        ip_stat->failed_attempts++;
+        ip_stat->window_start = entry->timestamp;
+        mark_ip_dirty(shard, ip_stat);
     }
 
-    /* Track IPs with ref counting */
-    int ip_found = 0;
-    for (int i = 0; i < user->ip_count; i++)
+    if (!(entry->route & ROUTE_USER))
+        return;
+
+    /* Update user stats */
+    EntityStats *user = get_or_create_user(shard, entry->user_id);
+    mark_user_dirty(shard, user);
+
+    /* Track failed logins */
+    if (is_failed_login(entry))
     {
-        if (strcmp(user->ip_refs[i].ip, entry->ip_address) == 0)
-        {
-            user->ip_refs[i].ref_count++;
-            ip_found = 1;
-            break;
-        }
+        user->failed_attempts++;
     }
-    if (!ip_found)
+
+    user->event_count++;
+    user->last_ip_id = entry->ip_id;
+
+    if (entry->resource_id != RESOURCE_NONE)
+        distinct_add(shard, &user->resources, &user->resource_sketch, &user->resource_count,
+                     entry->resource_id, entry->timestamp);
+    distinct_add(shard, &user->ips, &user->ip_sketch, &user->ip_count, entry->ip_id,
+                 entry->timestamp);
+}
+
+/* Remove log from statistics (O(1) amortized) */
+void remove_log_from_stats(Shard *shard, LogEntry *entry)
+{
+    /* Update IP stats */
+    if (entry->route & ROUTE_IP)
     {
-        if (user->ip_count >= user->ip_cap)
+        IPStats *ip_stat = (IPStats *)map_get(&shard->ip_map, entry->ip_id);
+        if (ip_stat)
         {
-            user->ip_cap *= 2;
-            user->ip_refs = (IPRef *)realloc(user->ip_refs,
-                                             sizeof(IPRef) * user->ip_cap);
+            if (ip_stat->failed_attempts > 0)
+                ip_stat->failed_attempts--;
+            mark_ip_dirty(shard, ip_stat);
+            if (ip_stat->failed_attempts == 0)
+                remove_ip_if_empty(shard, entry->ip_id);
         }
-        strncpy(user->ip_refs[user->ip_count].ip, entry->ip_address, 39);
-        user->ip_refs[user->ip_count].ref_count = 1;
-        user->ip_count++;
     }
 
-    /* Update IP stats for failed logins */
-    if (strcmp(entry->event_type, "LOGIN") == 0 &&
-        strcmp(entry->status_code, "FAILED") == 0)
+    if (!(entry->route & ROUTE_USER))
+        return;
+
+    EntityStats *user = get_or_create_user(shard, entry->user_id);
+    mark_user_dirty(shard, user);
+
+    /* Update failed logins */
+    if (is_failed_login(entry))
     {
-        pthread_mutex_lock(&state->ip_lock);
-        IPStats *ip_stat = get_or_create_ip(state, entry->ip_address);
-        ip_stat->failed_attempts++;
-        ip_stat->window_start = entry->timestamp;
-        pthread_mutex_unlock(&state->ip_lock);
+        if (user->failed_attempts > 0)
+            user->failed_attempts--;
     }
+
+    user->event_count--;
+
+    if (entry->resource_id != RESOURCE_NONE)
+        distinct_remove(&user->resources, user->resource_sketch, &user->resource_count,
+                        entry->resource_id);
+    distinct_remove(&user->ips, user->ip_sketch, &user->ip_count, entry->ip_id);
+
+    /* Hand the node back to the pool once nothing of the user is left */
+    if (user->event_count == 0)
+        remove_user_if_empty(shard, entry->user_id);
 }
 
-/* Remove log from statistics (O(1) with ref counting) */
-void remove_log_from_stats(SharedState *state, LogEntry *entry)
+/* Re-estimate the distinct counts held in sketches at the current
+ * watermark; counts still kept by the sets are always current already */
+void refresh_distinct_counts(Shard *shard, EntityStats *user)
 {
-    EntityStats *user = get_or_create_user(state, entry->user_id);
+    int p = shard->state->cfg.hll_precision;
+    if (user->resource_sketch)
+        user->resource_count =
+            hll_estimate(user->resource_sketch, p, shard->watermark, &user->resources);
+    if (user->ip_sketch)
+        user->ip_count = hll_estimate(user->ip_sketch, p, shard->watermark, &user->ips);
+}
 
-    /* Update failed logins */
-    if (strcmp(entry->status_code, "FAILED") == 0 &&
-        strcmp(entry->event_type, "LOGIN") == 0)
+/* Bytes one user costs: the node plus whatever its sets or sketches hold */
+size_t entity_memory_bytes(const Shard *shard, const EntityStats *user)
+{
+    size_t bytes = sizeof(EntityStats);
+    bytes += refset_heap_bytes(&user->resources) + refset_heap_bytes(&user->ips);
+    if (user->resource_sketch)
+        bytes += shard->sketch_pool.obj_size;
+    if (user->ip_sketch)
+        bytes += shard->sketch_pool.obj_size;
+    return bytes;
+}
+
+/* ─── Ring storage ───
+ * Entries sit contiguously in arrival order. Indices grow monotonically and
+ * are masked by the power-of-two capacity, so [begin, applied) is the part
+ * already folded into the stats and [applied, end) is waiting for the
+ * analyzer. The ring doubles when full and never shrinks. */
+
+void window_init(LogWindow *w, size_t initial_cap)
+{
+    size_t cap = 1;
+    while (cap < initial_cap)
+        cap <<= 1;
+
+    memset(w, 0, sizeof(*w));
+    w->slots = (LogEntry *)malloc(sizeof(LogEntry) * cap);
+    if (!w->slots)
     {
-        if (user->failed_attempts > 0)
-            user->failed_attempts--;
+        perror("malloc window");
+        exit(1);
     }
+    w->cap = cap;
+}
+
+void window_free(LogWindow *w)
+{
+    free(w->slots);
+    memset(w, 0, sizeof(*w));
+}
 
-    /* Update resources with ref counting */
-    if (strcmp(entry->resource_id, "-") != 0)
+static void window_grow(LogWindow *w)
+{
+    size_t new_cap = w->cap * 2;
+    LogEntry *slots = (LogEntry *)malloc(sizeof(LogEntry) * new_cap);
+    if (!slots)
     {
-        for (int i = 0; i < user->resource_count; i++)
-        {
-            if (strcmp(user->resources[i].name, entry->resource_id) == 0)
-            {
-                user->resources[i].ref_count--;
-                if (user->resources[i].ref_count == 0)
-                {
-                    /* Remove by shifting */
-                    memmove(&user->resources[i], &user->resources[i + 1],
-                            (user->resource_count - i - 1) * sizeof(ResourceRef));
-                    user->resource_count--;
-                }
-                break;
-            }
-        }
+        perror("malloc window");
+        exit(1);
     }
 
-    /* Update IPs with ref counting */
-    for (int i = 0; i < user->ip_count; i++)
+    /* Re-home each live index under the wider mask */
+    for (size_t i = w->begin; i != w->end; i++)
     {
-        if (strcmp(user->ip_refs[i].ip, entry->ip_address) == 0)
-        {
-            user->ip_refs[i].ref_count--;
-            if (user->ip_refs[i].ref_count == 0)
-            {
-                memmove(&user->ip_refs[i], &user->ip_refs[i + 1],
-                        (user->ip_count - i - 1) * sizeof(IPRef));
-                user->ip_count--;
-            }
-            break;
-        }
+        slots[i & (new_cap - 1)] = w->slots[i & (w->cap - 1)];
     }
+    free(w->slots);
+    w->slots = slots;
+    w->cap = new_cap;
+}
 
-    /* Update IP stats */
-    if (strcmp(entry->event_type, "LOGIN") == 0 &&
-        strcmp(entry->status_code, "FAILED") == 0)
+/* Reserve the slot after the newest entry and return it for filling */
+LogEntry *window_push(LogWindow *w)
+{
+    if (w->end - w->begin == w->cap)
+        window_grow(w);
+
+    LogEntry *slot = window_at(w, w->end);
+    w->end++;
+    if (w->end - w->begin > w->high_water)
+        w->high_water = w->end - w->begin;
+    return slot;
+}
+
+/* Append n entries after the newest one, growing at most once */
+void window_push_batch(LogWindow *w, const LogEntry *entries, size_t n)
+{
+    while (w->end - w->begin + n > w->cap)
+        window_grow(w);
+
+    size_t at = w->end & (w->cap - 1);
+    size_t first = n < w->cap - at ? n : w->cap - at;
+    memcpy(&w->slots[at], entries, first * sizeof(LogEntry));
+    memcpy(w->slots, entries + first, (n - first) * sizeof(LogEntry));
+
+    w->end += n;
+    if (w->end - w->begin > w->high_water)
+        w->high_water = w->end - w->begin;
+}
+
+/* Expire old logs (O(1) per expiry, a sequential walk from the oldest slot).
+ * Only entries already folded into the stats are eligible; `now` is the
+ * event-time watermark. */
+void expire_old_logs(Shard *shard, time_t now)
+{
+    LogWindow *w = &shard->window;
+    size_t begin = w->begin;
+    while (w->begin != w->applied &&
+           (now - window_at(w, w->begin)->timestamp) > WINDOW_SECONDS)
     {
-        pthread_mutex_lock(&state->ip_lock);
-        unsigned int idx = hash_ip(entry->ip_address);
-        IPStats *ip_stat = state->ip_map[idx];
-        while (ip_stat)
-        {
-            if (strcmp(ip_stat->ip_address, entry->ip_address) == 0)
-            {
-                if (ip_stat->failed_attempts > 0)
-                    ip_stat->failed_attempts--;
-                break;
-            }
-            ip_stat = ip_stat->next;
-        }
-        pthread_mutex_unlock(&state->ip_lock);
+        remove_log_from_stats(shard, window_at(w, w->begin));
+        w->begin++;
     }
+    if (w->begin != begin)
+        counter_add(&shard->metrics.entries_expired, w->begin - begin);
+    expire_idle_entities(shard, now);
 }
 
-/* Expire old logs (O(1) per expiry) */
-void expire_old_logs(SharedState *state, time_t now)
+/* Admission check run by ingestion before an entry is routed to a shard.
+ * Ingestion sees every entry in order, so it owns the global watermark:
+ * it trails the newest timestamp by the allowed lateness and never moves
+ * backwards. Anything already older than the window is dropped here. */
+int admit_log_entry(SharedState *state, time_t event_time)
 {
-    while (state->tail && (now - state->tail->timestamp) > WINDOW_SECONDS)
+    if (event_time > state->admit_max_time)
     {
-        LogEntry *old = state->tail;
+        state->admit_max_time = event_time;
+        time_t wm = event_time - state->cfg.allowed_lateness;
+        if (wm > state->watermark)
+            state->watermark = wm;
+    }
 
-        /* Remove from stats */
-        remove_log_from_stats(state, old);
+    if (state->watermark - event_time > WINDOW_SECONDS)
+    {
+        state->late_events_dropped++;
+        counter_add(&state->ingest_metrics.events_late, 1);
+        return 0;
+    }
+    return 1;
+}
 
-        /* Unlink from list */
-        state->tail = old->prev;
-        if (state->tail)
-        {
-            state->tail->next = NULL;
-        }
-        else
-        {
-            state->head = NULL;
-        }
+/* Move a shard's clock forward. A shard only sees its own entries, so
+ * between ticks its watermark may trail the global one; ticks carry the
+ * global value before every evaluation. */
+void advance_watermark(Shard *shard, time_t watermark)
+{
+    if (watermark > shard->watermark)
+        shard->watermark = watermark;
+}
 
-        state->log_count--;
-        free(old);
+/* Fold every pending entry into the stats in one pass, in arrival order.
+ * Expiry still runs after each entry, so entities empty out and are
+ * recycled exactly as they would be one entry at a time. */
+void apply_pending_logs(Shard *shard)
+{
+    LogWindow *w = &shard->window;
+    time_t lateness = shard->state->cfg.allowed_lateness;
+
+    while (w->applied != w->end)
+    {
+        LogEntry *entry = window_at(w, w->applied);
+
+        advance_watermark(shard, entry->timestamp - lateness);
+        add_log_to_stats(shard, entry);
+        w->applied++;
+
+        expire_old_logs(shard, shard->watermark);
     }
-}
\ No newline at end of file
+}